@@ -17,13 +17,12 @@ public:
         Object_Graphics_T(s_graphicsParameters),
         m_angleDeg(0)
     {
-        for (uint32_t i = 0; i < 3; ++i)
-            *static_cast<ConstantBufferData*>(m_graphicsParameters->m_constantArrays[0]->data(i, m_constantArrayIndicies[0])) =
-            {
-                center,
-                mrn::float3(color.r / 255.0f, color.g / 255.0f, color.b / 255.0f),
-                0
-            };
+        *static_cast<ConstantBufferData*>(m_graphicsParameters->m_constantArrays[0]->data(m_constantArrayIndicies[0])) =
+        {
+            center,
+            mrn::float3(color.r / 255.0f, color.g / 255.0f, color.b / 255.0f),
+            0
+        };
     }
 
     mrn::bRemove tick(float delta, uint32_t frameIndex)
@@ -33,7 +32,7 @@ public:
         if (m_angleDeg > 360.0f)
             m_angleDeg -= 360.0f;
 
-        static_cast<ConstantBufferData*>(m_graphicsParameters->m_constantArrays[0]->data(frameIndex, m_constantArrayIndicies[0]))->angleRad = mrn::degToRad(m_angleDeg);
+        static_cast<ConstantBufferData*>(m_graphicsParameters->m_constantArrays[0]->data(m_constantArrayIndicies[0]))->angleRad = mrn::degToRad(m_angleDeg);
 
         return false;
     }
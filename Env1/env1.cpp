@@ -1,6 +1,12 @@
 #include <moraine.h>
 #include "Spiral.h"
 
+// Spawns 10k additional spirals before the main loop, the growth of the constant array is logged. Combine with ENV1_HEADLESS for the frame rate
+#define ENV1_SPAWN_BENCHMARK 0
+
+// Renders 600 frames without a window, saves every 100th and logs the frame rate
+#define ENV1_HEADLESS 0
+
 int main()
 {
     mrn::ApplicationDesc desc;
@@ -8,6 +14,8 @@ int main()
     desc.logfilePath                = L"C:\\dev\\Moraine\\log.html";
     desc.graphics.enableValidation  = true;
     desc.graphics.applicationName   = desc.applicationName;
+    desc.graphics.framesInFlight    = 2;
+    desc.graphics.pipelineCachePath = L"C:\\dev\\Moraine\\pipelines.cache";
     desc.window.width               = 1600;
     desc.window.height              = 800;
     desc.window.maximized           = false;
@@ -16,6 +24,13 @@ int main()
     desc.window.minimized           = false;
     desc.window.title               = L"Env1 (Moraine)";
 
+#if ENV1_HEADLESS
+    desc.graphics.headless          = true;
+    desc.graphics.headlessWidth     = desc.window.width;
+    desc.graphics.headlessHeight    = desc.window.height;
+    desc.headlessFrameCount         = 600;
+#endif
+
     mrn::Application app = mrn::createApplication(desc);
 
     mrn::Shader shader = app->createShader(L"C:\\dev\\Moraine\\Env1\\spiral\\spiral.json");
@@ -37,13 +52,13 @@ int main()
         { { -0.3f, -0.3f }, { 0.0f, 0.0f } }
     } };
 
-    mrn::VertexBuffer vertexBuffer = app->createVertexBuffer(verticies.size() * sizeof(Vertex), verticies.data(), false, 0);
+    mrn::VertexBuffer vertexBuffer = app->createVertexBuffer(verticies.size() * sizeof(Vertex), verticies.data(), false, 0, sizeof(Vertex));
 
     std::array<uint16_t, 6> indicies { 0, 1, 2, 2, 3, 0 };
 
     mrn::IndexBuffer indexBuffer = app->createIndexBuffer(indicies.size(), indicies.data());
 
-    mrn::ConstantArray constantArray = app->createConstantArray(sizeof(Spiral::ConstantBufferData), 10, true);
+    mrn::ConstantArray constantArray = app->createConstantArray(sizeof(Spiral::ConstantBufferData), 10, true, mrn::CONSTANT_ARRAY_TRACK_CHANGES | mrn::CONSTANT_ARRAY_COMPACT);
 
     mrn::ConstantSet constantSet = mrn::createConstantSet(shader, 0, { { texture, 0 }, { constantArray, 1 } });
 
@@ -70,9 +85,20 @@ int main()
 
     layer->add(std::make_unique<mrn::GraphicsString_T>(L"Hello World", font, 100, 50, 50, 0));
 
+#if ENV1_SPAWN_BENCHMARK
+    for (uint32_t i = 0; i < 10000; ++i)
+        layer->add(std::make_unique<Spiral>(mrn::float2((i % 100) / 50.0f - 1.0f, (i / 100) / 50.0f - 1.0f), mrn::WHITE));
+#endif
+
     app->addLayer(layer);
 
-    app->t_updateCommandBuffers();
+#if ENV1_HEADLESS
+    app->setFrameCallback([](const mrn::FrameCapture& frame)
+    {
+        if (frame.frameNumber % 100 == 0)
+            mrn::saveFrame(frame, mrn::sprintf(L"C:\\dev\\Moraine\\frame%llu.ppm", frame.frameNumber));
+    });
+#endif
 
     app->run();
 
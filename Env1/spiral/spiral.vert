@@ -6,21 +6,23 @@ layout(location = 1) out vec3 oColor;
 
 layout(location = 0) in vec2 iPos;
 layout(location = 1) in vec2 iTex;
+layout(location = 2) in uint iSlot; // Offset of this instance's element in vec4s
 
-layout(binding = 1) uniform ConstantBuffer
+// Spiral::ConstantBufferData: vec2 pos, vec3 color, float angle, each in its own vec4
+layout(std430, binding = 1) readonly buffer ConstantArray
 {
-    vec2 pos;
-    vec3 color;
-    vec4 angle;
-} cb;
+    vec4 elements[];
+} ca;
 
 void main()
 {
-    float angle = cb.angle.x;
+    vec2 pos = ca.elements[iSlot].xy;
+    vec3 color = ca.elements[iSlot + 1].xyz;
+    float angle = ca.elements[iSlot + 2].x;
 
     mat2 rotation = mat2(cos(angle), -sin(angle), sin(angle), cos(angle));
 
-	gl_Position = vec4(vec2(0.5, 1.0) * (rotation * iPos) + cb.pos, 0.0, 1.0);
+	gl_Position = vec4(vec2(0.5, 1.0) * (rotation * iPos) + pos, 0.0, 1.0);
 	oTexpoint = iTex;
-	oColor = cb.color;
+	oColor = color;
 }
\ No newline at end of file
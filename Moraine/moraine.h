@@ -2,6 +2,8 @@
 
 #include "mrn_core.h"
 #include "mrn_math.h"
+#include "mrn_meshopt.h"
+#include "mrn_culling.h"
 #include "mrn_application.h"
 #include "mrn_object_graphics.h"
 #include "mrn_layer.h"
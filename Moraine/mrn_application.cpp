@@ -3,19 +3,20 @@
 
 #include "mrn_renderer.h"
 
-// temp
-#include "mrn_gfxcontext_vk.h"
-
 namespace moraine
 {
     class Application_I : public Application_T
     {
     public:
 
-        Application_I(const ApplicationDesc& desc)
+        Application_I(const ApplicationDesc& desc) :
+            m_headlessFrameCount(desc.headlessFrameCount)
         {
             m_logfile = createLogfile(desc.logfilePath, desc.applicationName);
-            m_window = createWindow(desc.window, m_logfile);
+
+            if (not desc.graphics.headless)
+                m_window = createWindow(desc.window, m_logfile);
+
             m_gfxContext = createGraphicsContext(desc.graphics, m_logfile, m_window);
             m_renderer = createRenderer(m_gfxContext, &m_layerStack);
         }
@@ -30,11 +31,15 @@ namespace moraine
             Time lastTime = Time::now();
             float delta = 0.0f;
 
-            while (m_window->tick(0.0f))
+            uint32_t frameCount = 0;
+
+            while (m_window ? m_window->tick(0.0f) : frameCount++ < m_headlessFrameCount)
             {
                 Time currentTime = Time::now();
                 delta = Time::duration(lastTime, currentTime).getMillisecondsF();
                 lastTime = currentTime;
+
+                // Submits a frame and returns the frame index of the next one, the layers simulate it while the GPU renders
                 uint32_t frameIndex = m_renderer->tick(delta);
 
                 for (const auto& a : m_layerStack)
@@ -47,14 +52,24 @@ namespace moraine
             return moraine::createShader(shader, m_gfxContext);
         }
 
+        Shader createShaderAsync(Stringr shader, ShaderReadyCallback readyCallback, Shader fallback) override
+        {
+            return moraine::createShaderAsync(shader, m_gfxContext, readyCallback, fallback);
+        }
+
         Texture createTexture(Stringr texture) override
         {
             return moraine::createTexture(m_gfxContext, texture);
         }
 
-        VertexBuffer createVertexBuffer(size_t size, void* data, bool frequentUpdate, size_t reservedSize) override
+        VertexBuffer createVertexBuffer(size_t size, void* data, bool frequentUpdate, size_t reservedSize, size_t vertexStride) override
+        {
+            return moraine::createVertexBuffer(m_gfxContext, size, data, frequentUpdate, reservedSize, vertexStride);
+        }
+
+        VertexBuffer createVertexBuffer(const void* vertices, size_t vertexCount, size_t vertexSize, std::initializer_list<VertexAttributeQuantization> attributes, QuantizedVertices* out_layout) override
         {
-            return moraine::createVertexBuffer(m_gfxContext, size, data, frequentUpdate, reservedSize);
+            return moraine::createVertexBuffer(m_gfxContext, vertices, vertexCount, vertexSize, attributes, out_layout);
         }
 
         IndexBuffer createIndexBuffer(size_t indexCount, uint16_t* indexData) override
@@ -72,9 +87,14 @@ namespace moraine
             return moraine::createConstantBuffer(m_gfxContext, size, updateEveryFrame);
         }
 
-        ConstantArray createConstantArray(size_t elementSize, uint32_t initialElementCount, bool updateEveryFrame) override
+        StorageBuffer createStorageBuffer(size_t size, bool updateEveryFrame) override
+        {
+            return moraine::createStorageBuffer(m_gfxContext, size, updateEveryFrame);
+        }
+
+        ConstantArray createConstantArray(size_t elementSize, uint32_t initialElementCount, bool updateEveryFrame, uint32_t arrayFlags) override
         {
-            return moraine::createConstantArray(m_gfxContext, elementSize, initialElementCount, updateEveryFrame);
+            return moraine::createConstantArray(m_gfxContext, elementSize, initialElementCount, updateEveryFrame, arrayFlags);
         }
 
         Font createFont(Stringr ttfFile, uint32_t maxPixelHeight) override
@@ -87,9 +107,9 @@ namespace moraine
             m_layerStack.push_back(layer);
         }
 
-        void t_updateCommandBuffers() override
+        void setFrameCallback(FrameCallback callback) override
         {
-            std::static_pointer_cast<GraphicsContext_IVulkan>(m_gfxContext)->addAsyncTask(nullptr, nullptr);
+            m_renderer->setFrameCallback(std::move(callback));
         }
 
 
@@ -97,6 +117,7 @@ namespace moraine
         Window m_window;
         GraphicsContext m_gfxContext;
         Renderer m_renderer;
+        uint32_t m_headlessFrameCount;
 
         std::list<Layer> m_layerStack;
     };
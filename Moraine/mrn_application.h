@@ -7,6 +7,7 @@
 #include "mrn_buffer.h"
 #include "mrn_layer.h"
 #include "mrn_gfxstring.h"
+#include "mrn_renderer.h"
 
 namespace moraine
 {
@@ -16,6 +17,7 @@ namespace moraine
         String logfilePath;
         WindowDesc window;
         GraphicsContextDesc graphics;
+        uint32_t headlessFrameCount = 0; // Frames run() renders if graphics.headless is set, no window is created then
     };
 
     class Application_T
@@ -27,17 +29,20 @@ namespace moraine
         virtual void run() = 0;
 
         virtual Shader createShader(Stringr shader) = 0;
+        virtual Shader createShaderAsync(Stringr shader, ShaderReadyCallback readyCallback = nullptr, Shader fallback = nullptr) = 0; // See moraine::createShaderAsync()
         virtual Texture createTexture(Stringr texture) = 0;
-        virtual VertexBuffer createVertexBuffer(size_t size, void* data, bool frequentUpdate, size_t reservedSize) = 0;
+        virtual VertexBuffer createVertexBuffer(size_t size, void* data, bool frequentUpdate, size_t reservedSize, size_t vertexStride = 0) = 0;
+        virtual VertexBuffer createVertexBuffer(const void* vertices, size_t vertexCount, size_t vertexSize, std::initializer_list<VertexAttributeQuantization> attributes, QuantizedVertices* out_layout = nullptr) = 0;
         virtual IndexBuffer createIndexBuffer(size_t indexCount, uint16_t* indexData) = 0;
         virtual IndexBuffer createIndexBuffer(size_t indexCount, uint32_t* indexData) = 0;
         virtual ConstantBuffer createConstantBuffer(size_t size, bool updateEveryFrame) = 0;
-        virtual ConstantArray createConstantArray(size_t elementSize, uint32_t initialElementCount, bool updateEveryFrame) = 0;
+        virtual StorageBuffer createStorageBuffer(size_t size, bool updateEveryFrame) = 0;
+        virtual ConstantArray createConstantArray(size_t elementSize, uint32_t initialElementCount, bool updateEveryFrame, uint32_t arrayFlags = 0) = 0;
         virtual Font createFont(Stringr ttfFile, uint32_t maxPixelHeight) = 0;
 
         virtual void addLayer(Layer layer) = 0;
 
-        virtual void t_updateCommandBuffers() = 0;
+        virtual void setFrameCallback(FrameCallback callback) = 0; // See Renderer_T::setFrameCallback()
     };
 
     typedef std::shared_ptr<Application_T> Application;
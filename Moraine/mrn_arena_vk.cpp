@@ -0,0 +1,135 @@
+#include "mrn_core.h"
+#include "mrn_arena_vk.h"
+
+moraine::BufferArena_IVulkan::BufferArena_IVulkan(GraphicsContext_IVulkan* context, VkBufferUsageFlags usage, uint32_t chunkOrder) :
+    m_context(context), // Raw pointer, the context owns the arena
+    m_usage(usage | VK_BUFFER_USAGE_TRANSFER_DST_BIT),
+    m_chunkOrder(chunkOrder),
+    m_frameCounter(0)
+{
+    createChunk(m_chunkOrder);
+
+    m_context->m_flushableResources.push_back(this);
+}
+
+moraine::BufferArena_IVulkan::~BufferArena_IVulkan()
+{
+    m_context->m_flushableResources.erase(std::find(m_context->m_flushableResources.begin(), m_context->m_flushableResources.end(), this));
+
+    for (auto& a : m_chunks)
+        vmaDestroyBuffer(m_context->m_allocator, a->buffer, a->allocation);
+}
+
+moraine::BufferArena_IVulkan::Chunk& moraine::BufferArena_IVulkan::createChunk(uint32_t order)
+{
+    auto chunk = std::make_unique<Chunk>();
+    chunk->order = order;
+    chunk->freeBlocks.resize(order + 1);
+    chunk->freeBlocks[order].insert(0);
+
+    m_context->createVulkanBuffer(static_cast<size_t>(1) << order, m_usage, VMA_MEMORY_USAGE_GPU_ONLY, &chunk->buffer, &chunk->allocation, nullptr);
+
+    if (not m_chunks.empty())
+        m_context->getLogfile()->print(YELLOW, sprintf(L"Buffer arena chunk %d created (%d KiB)", static_cast<uint32_t>(m_chunks.size()), (1u << order) / 1024), MRN_DEBUG_INFO);
+
+    m_chunks.push_back(std::move(chunk));
+    return *m_chunks.back();
+}
+
+bool moraine::BufferArena_IVulkan::allocFromChunk(Chunk& chunk, uint32_t order, VkDeviceSize* out_offset)
+{
+    if (order > chunk.order)
+        return false;
+
+    // Smallest free block that fits, larger blocks are split in halves down to the requested order
+    uint32_t blockOrder = order;
+
+    while (blockOrder <= chunk.order and chunk.freeBlocks[blockOrder].empty())
+        ++blockOrder;
+
+    if (blockOrder > chunk.order)
+        return false;
+
+    VkDeviceSize offset = *chunk.freeBlocks[blockOrder].begin();
+    chunk.freeBlocks[blockOrder].erase(chunk.freeBlocks[blockOrder].begin());
+
+    while (blockOrder > order)
+    {
+        --blockOrder;
+        chunk.freeBlocks[blockOrder].insert(offset + (static_cast<VkDeviceSize>(1) << blockOrder)); // upper half stays free
+    }
+
+    *out_offset = offset;
+    return true;
+}
+
+moraine::ArenaAllocation moraine::BufferArena_IVulkan::alloc(VkDeviceSize size, VkDeviceSize alignment)
+{
+    alignment = max<VkDeviceSize>(alignment, 1);
+    bool powerOfTwo = (alignment & (alignment - 1)) == 0;
+
+    // Blocks are aligned to their size, other alignments need room to move the data to the next multiple
+    VkDeviceSize blockSize = powerOfTwo ? max(size, alignment) : size + alignment - 1;
+
+    ArenaAllocation allocation;
+    allocation.order = s_minOrder;
+
+    while ((static_cast<VkDeviceSize>(1) << allocation.order) < blockSize)
+        ++allocation.order;
+
+    bool found = false;
+
+    for (uint32_t i = 0; i < m_chunks.size() and not found; ++i)
+        if (allocFromChunk(*m_chunks[i], allocation.order, &allocation.blockOffset))
+        {
+            allocation.chunk = static_cast<uint32_t>(i);
+            found = true;
+        }
+
+    if (not found)
+    {
+        allocation.chunk = static_cast<uint32_t>(m_chunks.size());
+        allocFromChunk(createChunk(max(m_chunkOrder, allocation.order)), allocation.order, &allocation.blockOffset);
+    }
+
+    allocation.offset = (allocation.blockOffset + alignment - 1) / alignment * alignment;
+    return allocation;
+}
+
+void moraine::BufferArena_IVulkan::free(const ArenaAllocation& allocation)
+{
+    m_pendingFrees.emplace_back(m_frameCounter + m_context->m_framesInFlight, allocation);
+}
+
+void moraine::BufferArena_IVulkan::release(const ArenaAllocation& allocation)
+{
+    Chunk& chunk = *m_chunks[allocation.chunk];
+    VkDeviceSize offset = allocation.blockOffset;
+    uint32_t order = allocation.order;
+
+    // Merge with the free buddy as long as there is one
+    while (order < chunk.order)
+    {
+        auto buddy = chunk.freeBlocks[order].find(offset ^ (static_cast<VkDeviceSize>(1) << order));
+
+        if (buddy == chunk.freeBlocks[order].end())
+            break;
+
+        offset = min(offset, *buddy);
+        chunk.freeBlocks[order].erase(buddy);
+        ++order;
+    }
+
+    chunk.freeBlocks[order].insert(offset);
+}
+
+void moraine::BufferArena_IVulkan::flushFrame(uint32_t frameIndex)
+{
+    ++m_frameCounter;
+
+    while (not m_pendingFrees.empty() and m_pendingFrees.front().first <= m_frameCounter)
+    {
+        release(m_pendingFrees.front().second);
+        m_pendingFrees.pop_front();
+    }
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include "mrn_gfxcontext_vk.h"
+
+#include <set>
+#include <deque>
+
+namespace moraine
+{
+    struct ArenaAllocation
+    {
+        uint32_t        chunk;
+        VkDeviceSize    blockOffset;    // Offset of the buddy block inside its chunk
+        uint32_t        order;          // The buddy block is (1 << order) bytes large
+        VkDeviceSize    offset;         // Offset of the data inside its chunk, aligned as requested
+    };
+
+    // Device local buffers that vertex and index data is sub-allocated from with a buddy allocator, so the
+    // renderer binds a chunk once and selects meshes with vertexOffset and firstIndex instead of rebinding
+    class BufferArena_IVulkan : public FlushableResource_IVulkan
+    {
+    public:
+
+        BufferArena_IVulkan(GraphicsContext_IVulkan* context, VkBufferUsageFlags usage, uint32_t chunkOrder);
+        ~BufferArena_IVulkan() override;
+
+        ArenaAllocation alloc(VkDeviceSize size, VkDeviceSize alignment); // Alignment doesn't have to be a power of two, e.g. a vertex stride
+        void free(const ArenaAllocation& allocation); // The block is reused once frames that might still read it have finished
+
+        VkBuffer getBuffer(uint32_t chunk) const { return m_chunks[chunk]->buffer; }
+
+        void flushFrame(uint32_t frameIndex) override; // Returns blocks freed a swapchain length ago to the allocator
+
+    private:
+
+        struct Chunk
+        {
+            VkBuffer                                buffer;
+            VmaAllocation                           allocation;
+            uint32_t                                order; // The chunk is (1 << order) bytes large
+            std::vector<std::set<VkDeviceSize>>     freeBlocks; // Free block offsets per order, lowest offsets are handed out first
+        };
+
+        Chunk& createChunk(uint32_t order);
+        bool allocFromChunk(Chunk& chunk, uint32_t order, VkDeviceSize* out_offset);
+        void release(const ArenaAllocation& allocation);
+
+        static constexpr uint32_t s_minOrder = 8; // 256 byte blocks
+
+        GraphicsContext_IVulkan*                            m_context;
+        VkBufferUsageFlags                                  m_usage;
+        uint32_t                                            m_chunkOrder;
+        std::vector<std::unique_ptr<Chunk>>                 m_chunks;
+
+        uint64_t                                            m_frameCounter;
+        std::deque<std::pair<uint64_t, ArenaAllocation>>    m_pendingFrees; // first: frame counter value after which the block can be reused
+    };
+}
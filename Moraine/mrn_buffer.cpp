@@ -4,18 +4,42 @@
 
 #include "mrn_buffer_vk.h"
 
-moraine::StagingStack moraine::createStagingStack(GraphicsContext context, size_t sizeInBytes)
+moraine::StagingRing moraine::createStagingRing(GraphicsContext context, size_t blockSize)
 {
-    return std::make_shared<StagingStack_IVulkan>(context, sizeInBytes);
+    return std::make_shared<StagingRing_IVulkan>(context, blockSize);
 }
 
-moraine::VertexBuffer moraine::createVertexBuffer(GraphicsContext context, size_t size, void* data, bool frequentUpdate, size_t reservedSize)
+moraine::VertexBuffer moraine::createVertexBuffer(GraphicsContext context, size_t size, void* data, bool frequentUpdate, size_t reservedSize, size_t vertexStride)
 {
-    return std::make_shared<VertexBuffer_IVulkan>(context, size, data, frequentUpdate, reservedSize);
+    return std::make_shared<VertexBuffer_IVulkan>(context, size, data, frequentUpdate, reservedSize, vertexStride);
+}
+
+moraine::VertexBuffer moraine::createVertexBuffer(GraphicsContext context, const void* vertices, size_t vertexCount, size_t vertexSize, 
+                                                  std::initializer_list<VertexAttributeQuantization> attributes, QuantizedVertices* out_layout)
+{
+    QuantizedVertices quantized = quantizeVertices(vertices, vertexCount, vertexSize, attributes);
+
+    VertexBuffer buffer = std::make_shared<VertexBuffer_IVulkan>(context, quantized.data.size(), quantized.data.data(), false, 0, quantized.stride);
+
+    if (out_layout)
+    {
+        quantized.data.clear(); // the layout is all the caller needs
+        quantized.data.shrink_to_fit();
+        *out_layout = std::move(quantized);
+    }
+
+    return buffer;
 }
 
 moraine::IndexBuffer moraine::createIndexBuffer(GraphicsContext context, size_t indexCount, uint32_t* indexData)
 {
+    // Narrow to 16 bit indicies if every index fits, halves the index bandwidth
+    if (std::all_of(indexData, indexData + indexCount, [](uint32_t index) { return index < UINT16_MAX; }))
+    {
+        std::vector<uint16_t> narrowIndicies(indexData, indexData + indexCount);
+        return std::make_shared<IndexBuffer_IVulkan>(context, indexCount, narrowIndicies.data());
+    }
+
     return std::make_shared<IndexBuffer_IVulkan>(context, indexCount, indexData);
 }
 
@@ -29,7 +53,12 @@ moraine::ConstantBuffer moraine::createConstantBuffer(GraphicsContext context, s
     return std::make_shared<ConstantBuffer_IVulkan>(context, size, updateEveryFrame);
 }
 
-moraine::ConstantArray moraine::createConstantArray(GraphicsContext context, size_t elementSize, uint32_t initialElementCount, bool updateEveryFrame)
+moraine::StorageBuffer moraine::createStorageBuffer(GraphicsContext context, size_t size, bool updateEveryFrame)
+{
+    return std::make_shared<StorageBuffer_IVulkan>(context, size, updateEveryFrame);
+}
+
+moraine::ConstantArray moraine::createConstantArray(GraphicsContext context, size_t elementSize, uint32_t initialElementCount, bool updateEveryFrame, uint32_t arrayFlags)
 {
-    return std::make_shared<ConstantArray_IVulkan>(context, elementSize, initialElementCount, updateEveryFrame);
+    return std::make_shared<ConstantArray_IVulkan>(context, elementSize, initialElementCount, updateEveryFrame, arrayFlags);
 }
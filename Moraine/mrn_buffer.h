@@ -1,27 +1,37 @@
 #pragma once
 
 #include "mrn_constset.h"
+#include "mrn_meshopt.h"
 
 namespace moraine
 {
     MRN_DECLARE_HANDLE(GraphicsContext)
 
-    typedef void* StagingStackMarker;
+    typedef uint64_t UploadTicket; // Position on the upload timeline, 0 if a resource didn't upload anything
 
-    class StagingStack_T
+    struct StagingAllocation
+    {
+        void*   data;   // Host pointer, valid until the upload batch it was allocated in has been consumed by the GPU
+        void*   block;  // Staging block the allocation lives in
+        size_t  offset; // Offset of the allocation inside its block
+    };
+
+    class StagingRing_T
     {
     public:
 
-        virtual ~StagingStack_T() = default;
+        virtual ~StagingRing_T() = default;
 
-        virtual StagingStackMarker createMarker() = 0;
-        virtual void* alloc(size_t size, size_t alignment = alignof(void*)) = 0;
-        virtual void free(StagingStackMarker m = 0) = 0;
+        // Allocates staging memory for the current upload batch, it is reclaimed once the GPU has consumed that batch
+        virtual StagingAllocation alloc(size_t size, size_t alignment = alignof(void*)) = 0;
+
+        virtual bool isUploadComplete(UploadTicket ticket) = 0;
+        virtual void waitForUpload(UploadTicket ticket) = 0; // Submits the pending batch if the ticket belongs to it
     };
 
-    typedef std::shared_ptr<StagingStack_T> StagingStack;
+    typedef std::shared_ptr<StagingRing_T> StagingRing;
 
-    MRN_API StagingStack createStagingStack(GraphicsContext context, size_t sizeInBytes);
+    MRN_API StagingRing createStagingRing(GraphicsContext context, size_t blockSize);
 
     class VertexBuffer_T
     {
@@ -30,8 +40,17 @@ namespace moraine
         virtual ~VertexBuffer_T() = default;
 
         size_t size() const { return m_usedSize; }
+        size_t capacity() const { return m_reservedSize; }
+
+        virtual void* data() = 0; // Marks the whole used range as changed
+
+        // Only for frequently updated buffers. Writes go to a CPU copy and reach the GPU when the frame is submitted,
+        // so ranges a frame in flight reads are never overwritten. Growing past the capacity reallocates the buffer
+        virtual void write(size_t offset, const void* data, size_t size) = 0;
+        virtual void append(const void* data, size_t size) = 0;
+        virtual void resize(size_t size) = 0;
 
-        virtual void* data() = 0;
+        virtual UploadTicket getUploadTicket() const = 0;
 
     protected:
 
@@ -41,18 +60,25 @@ namespace moraine
 
     typedef std::shared_ptr<VertexBuffer_T> VertexBuffer;
 
-    MRN_API VertexBuffer createVertexBuffer(GraphicsContext context, size_t size, void* data, bool frequentUpdate, size_t reservedSize = 0);
+    // Static vertex buffers share large device buffers, with the vertex stride they are placed so the renderer doesn't have to rebind them per draw
+    MRN_API VertexBuffer createVertexBuffer(GraphicsContext context, size_t size, void* data, bool frequentUpdate, size_t reservedSize = 0, size_t vertexStride = 0);
+
+    // Creates a static vertex buffer with quantized attributes, out_layout receives the offsets, types and bounds for the shader config
+    MRN_API VertexBuffer createVertexBuffer(GraphicsContext context, const void* vertices, size_t vertexCount, size_t vertexSize, 
+                                            std::initializer_list<VertexAttributeQuantization> attributes, QuantizedVertices* out_layout = nullptr);
 
     class IndexBuffer_T
     {
     public:
 
         virtual ~IndexBuffer_T() = default;
+
+        virtual UploadTicket getUploadTicket() const = 0;
     };
 
     typedef std::shared_ptr<IndexBuffer_T> IndexBuffer;
 
-    MRN_API IndexBuffer createIndexBuffer(GraphicsContext context, size_t indexCount, uint32_t* indexData);
+    MRN_API IndexBuffer createIndexBuffer(GraphicsContext context, size_t indexCount, uint32_t* indexData); // Stored as uint16_t if all indicies fit
     MRN_API IndexBuffer createIndexBuffer(GraphicsContext context, size_t indexCount, uint16_t* indexData);
 
     class ConstantBuffer_T : public ConstantResource_T
@@ -72,6 +98,37 @@ namespace moraine
 
     MRN_API ConstantBuffer createConstantBuffer(GraphicsContext context, size_t size, bool updateEveryFrame);
 
+    // Large per object data that shaders index themselves, e.g. with gl_InstanceIndex, so many objects can be drawn with one bind and draw
+    class StorageBuffer_T : public ConstantResource_T
+    {
+    public:
+
+        StorageBuffer_T() :
+            ConstantResource_T(CONSTANT_RESOURCE_TYPE_STORAGE_BUFFER)
+        { }
+
+        virtual ~StorageBuffer_T() = default;
+
+        virtual void* data(uint32_t frameIndex) = 0;
+        virtual size_t size() const = 0;
+    };
+
+    typedef std::shared_ptr<StorageBuffer_T> StorageBuffer;
+
+    MRN_API StorageBuffer createStorageBuffer(GraphicsContext context, size_t size, bool updateEveryFrame);
+
+    enum ConstantArrayFlags
+    {
+        // Elements are written once into a CPU copy through data(elementIndex), only changed elements
+        // are copied into the frame's GPU copy before it is submitted
+        CONSTANT_ARRAY_TRACK_CHANGES = 0b01,
+
+        // Elements stay densely packed, removeElement() moves the last element into the gap. Element indicies
+        // are generational handles that stay valid while the element moves, bound offsets are updated automatically.
+        // Requires CONSTANT_ARRAY_TRACK_CHANGES, moved elements reach the GPU copies of frames in flight when those frames are submitted next
+        CONSTANT_ARRAY_COMPACT = 0b10
+    };
+
     class ConstantArray_T : public ConstantResource_T
     {
     public:
@@ -86,9 +143,16 @@ namespace moraine
         virtual void removeElement(uint32_t element) = 0;
 
         virtual void* data(uint32_t frameIndex, uint32_t elementIndex) = 0;
+
+        // Returns the CPU copy of the element and marks it changed, requires CONSTANT_ARRAY_TRACK_CHANGES
+        virtual void* data(uint32_t elementIndex) = 0;
+
+        // Index of the element's page in the bindless table's storage buffer array and the element's position in that page, UINT32_MAX unless the
+        // context was created with GraphicsContextDesc::bindless. Elements of compacting arrays can move to another page when elements are removed
+        virtual uint32_t getBindlessIndex(uint32_t elementIndex, uint32_t* out_slot = nullptr) const = 0;
     };
 
     typedef std::shared_ptr<ConstantArray_T> ConstantArray;
 
-    MRN_API ConstantArray createConstantArray(GraphicsContext context, size_t elementSize, uint32_t initialElementCount, bool updateEveryFrame);
+    MRN_API ConstantArray createConstantArray(GraphicsContext context, size_t elementSize, uint32_t initialElementCount, bool updateEveryFrame, uint32_t arrayFlags = 0);
 }
\ No newline at end of file
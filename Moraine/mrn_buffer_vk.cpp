@@ -1,10 +1,16 @@
 #include "mrn_core.h"
 #include "mrn_buffer_vk.h"
+#include "mrn_descriptors_vk.h"
 
 
-moraine::Buffer_IVulkan::Buffer_IVulkan(GraphicsContext context, size_t size, void* data, VkBufferUsageFlags usage, bool useVram, bool keepMapped) :
+moraine::Buffer_IVulkan::Buffer_IVulkan(GraphicsContext context, size_t size, void* data, VkBufferUsageFlags usage, bool useVram, bool keepMapped,
+                                        BufferArena_IVulkan* arena, VkDeviceSize alignment) :
     m_context(std::static_pointer_cast<GraphicsContext_IVulkan>(context)),
-    m_data(nullptr)
+    m_allocation(VK_NULL_HANDLE),
+    m_offset(0),
+    m_arena(useVram ? arena : nullptr),
+    m_data(nullptr),
+    m_uploadTicket(0)
 {
     VkBufferCreateInfo bufferInfo;
     bufferInfo.sType                        = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
@@ -36,68 +42,175 @@ moraine::Buffer_IVulkan::Buffer_IVulkan(GraphicsContext context, size_t size, vo
     }
     else
     {
-        VkBuffer stagingBuffer;
-        VmaAllocation stagingAllocation;
-        void* stagingMemory;
-
-        m_context->createVulkanBuffer(size, usage | VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VMA_MEMORY_USAGE_CPU_ONLY,
-                                      &stagingBuffer, &stagingAllocation, &stagingMemory);
-
         assert(m_context->getLogfile(), data != nullptr, L"Invalid API Usage: Data for VRAM buffers must be provided!", MRN_DEBUG_INFO);
-        memcpy_s(stagingMemory, size, data, size);
-
-        m_context->createVulkanBuffer(size, usage | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_MEMORY_USAGE_GPU_ONLY,
-                                      &m_buffer, &m_allocation, nullptr);
 
-        m_context->dispatchTask(m_context->m_transferQueue, [size, this, stagingBuffer](VkCommandBuffer buffer)
+        if (m_arena)
         {
-            VkBufferCopy copy;
-            copy.srcOffset = 0;
-            copy.dstOffset = 0;
-            copy.size      = size;
-
-            vkCmdCopyBuffer(buffer, stagingBuffer, m_buffer, 1, &copy);
-        });
+            m_arenaAllocation = m_arena->alloc(size, alignment);
+            m_buffer = m_arena->getBuffer(m_arenaAllocation.chunk);
+            m_offset = m_arenaAllocation.offset;
+        }
+        else
+            m_context->createVulkanBuffer(size, usage | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_MEMORY_USAGE_GPU_ONLY,
+                                          &m_buffer, &m_allocation, nullptr);
 
-        vmaDestroyBuffer(m_context->m_allocator, stagingBuffer, stagingAllocation);
+        // The copy is batched with all other uploads of this frame and submitted to the transfer queue
+        m_uploadTicket = std::static_pointer_cast<StagingRing_IVulkan>(m_context->m_stagingRing)->uploadBuffer(m_buffer, m_offset, data, size);
     }
 }
 
 moraine::Buffer_IVulkan::~Buffer_IVulkan()
 {
-    vmaDestroyBuffer(m_context->m_allocator, m_buffer, m_allocation);
+    // The copy of a pending upload is recorded with the buffer's handle when the batch is submitted
+    auto stagingRing = std::static_pointer_cast<StagingRing_IVulkan>(m_context->m_stagingRing);
+
+    if (not stagingRing->isUploadComplete(m_uploadTicket))
+        stagingRing->waitForUpload(m_uploadTicket);
+
+    if (m_arena)
+        m_arena->free(m_arenaAllocation);
+    else
+        vmaDestroyBuffer(m_context->m_allocator, m_buffer, m_allocation);
 }
 
-moraine::VertexBuffer_IVulkan::VertexBuffer_IVulkan(GraphicsContext context, size_t size, void* data, bool frequentUpdate, size_t reservedSize) :
-    Buffer_IVulkan(context, max(size, reservedSize), data, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, not frequentUpdate, frequentUpdate)
+moraine::VertexBuffer_IVulkan::VertexBuffer_IVulkan(GraphicsContext context, size_t size, void* data, bool frequentUpdate, size_t reservedSize, size_t vertexStride) :
+    Buffer_IVulkan(context, 
+                   frequentUpdate ? max(size, reservedSize) * std::static_pointer_cast<GraphicsContext_IVulkan>(context)->m_framesInFlight : max(size, reservedSize), 
+                   frequentUpdate ? nullptr : data, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, not frequentUpdate, frequentUpdate,
+                   std::static_pointer_cast<GraphicsContext_IVulkan>(context)->m_vertexArena.get(), vertexStride != 0 ? vertexStride : 4),
+    m_vertexStride(vertexStride),
+    m_dynamic(frequentUpdate),
+    m_frameCounter(0)
 {
     m_usedSize = size;
     m_reservedSize = max(size, reservedSize);
+
+    if (m_dynamic)
+    {
+        m_shadow.resize(m_reservedSize);
+        m_changedRanges.resize(m_context->m_framesInFlight, std::pair<size_t, size_t>(SIZE_MAX, 0));
+
+        if (data != nullptr)
+        {
+            memcpy_s(m_shadow.data(), m_reservedSize, data, size);
+            markChanged(0, size);
+        }
+
+        m_context->m_flushableResources.push_back(this);
+    }
 }
 
 moraine::VertexBuffer_IVulkan::~VertexBuffer_IVulkan()
 {
+    if (m_dynamic)
+        m_context->m_flushableResources.erase(std::find(m_context->m_flushableResources.begin(), m_context->m_flushableResources.end(), this));
+
+    for (auto& a : m_retiredBuffers)
+        vmaDestroyBuffer(m_context->m_allocator, a.buffer, a.allocation);
 }
 
 void moraine::VertexBuffer_IVulkan::bind(VkCommandBuffer buffer, uint32_t binding, size_t offset)
 {
-    vkCmdBindVertexBuffers(buffer, binding, 1, &m_buffer, &offset);
+    VkDeviceSize bufferOffset = m_offset + offset;
+    vkCmdBindVertexBuffers(buffer, binding, 1, &m_buffer, &bufferOffset);
 }
 
 void* moraine::VertexBuffer_IVulkan::data()
 {
-    assert(m_context->getLogfile(), m_data, L"Vertex Buffer not host visible!", MRN_DEBUG_INFO);
-    return m_data;
+    assert(m_context->getLogfile(), m_dynamic, L"Vertex Buffer not host visible!", MRN_DEBUG_INFO);
+
+    markChanged(0, m_usedSize);
+    return m_shadow.data();
+}
+
+void moraine::VertexBuffer_IVulkan::write(size_t offset, const void* data, size_t size)
+{
+    assert(m_context->getLogfile(), m_dynamic, L"Vertex Buffer not host visible!", MRN_DEBUG_INFO);
+    assert(m_context->getLogfile(), offset + size <= m_usedSize, L"Wrong API Usage: Vertex Buffer write exceeds its size, resize() it first!", MRN_DEBUG_INFO);
+
+    memcpy_s(m_shadow.data() + offset, m_reservedSize - offset, data, size);
+    markChanged(offset, offset + size);
+}
+
+void moraine::VertexBuffer_IVulkan::append(const void* data, size_t size)
+{
+    size_t offset = m_usedSize;
+    resize(m_usedSize + size);
+    write(offset, data, size);
+}
+
+void moraine::VertexBuffer_IVulkan::resize(size_t size)
+{
+    assert(m_context->getLogfile(), m_dynamic, L"Vertex Buffer not host visible!", MRN_DEBUG_INFO);
+
+    if (size > m_reservedSize)
+        grow(size);
+
+    // Objects whose draws depend on the size mark their layer changed themselves
+    m_usedSize = size;
+}
+
+void moraine::VertexBuffer_IVulkan::markChanged(size_t begin, size_t end)
+{
+    for (auto& a : m_changedRanges)
+    {
+        a.first = min(a.first, begin);
+        a.second = max(a.second, end);
+    }
+}
+
+void moraine::VertexBuffer_IVulkan::grow(size_t requiredSize)
+{
+    // The old buffer is orphaned: frames in flight keep reading it, new frames use the larger buffer
+    m_retiredBuffers.push_back({ m_frameCounter + m_context->m_framesInFlight, m_buffer, m_allocation });
+
+    m_reservedSize = max(requiredSize, m_reservedSize * 2);
+    m_shadow.resize(m_reservedSize);
+
+    m_context->createVulkanBuffer(m_reservedSize * m_context->m_framesInFlight, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU,
+                                  &m_buffer, &m_allocation, &m_data);
+
+    // Every copy of the new buffer is filled, command buffers have to bind the new buffer
+    markChanged(0, m_usedSize);
+    m_context->invalidateCommandBuffers();
+}
+
+void moraine::VertexBuffer_IVulkan::flushFrame(uint32_t frameIndex)
+{
+    ++m_frameCounter;
+
+    for (auto a = m_retiredBuffers.begin(); a != m_retiredBuffers.end();)
+        if (a->frame <= m_frameCounter)
+        {
+            vmaDestroyBuffer(m_context->m_allocator, a->buffer, a->allocation);
+            a = m_retiredBuffers.erase(a);
+        }
+        else
+            ++a;
+
+    auto& range = m_changedRanges[frameIndex];
+
+    if (range.first < range.second)
+    {
+        size_t size = min(range.second, m_usedSize) - min(range.first, m_usedSize);
+
+        if (size > 0)
+            memcpy_s(static_cast<uint8_t*>(m_data) + m_reservedSize * frameIndex + range.first, m_reservedSize - range.first, m_shadow.data() + range.first, size);
+    }
+
+    range = std::pair<size_t, size_t>(SIZE_MAX, 0);
 }
 
 moraine::IndexBuffer_IVulkan::IndexBuffer_IVulkan(GraphicsContext context, size_t indexCount, uint32_t* indexData) :
-    Buffer_IVulkan(context, indexCount * sizeof(uint32_t), indexData, VK_BUFFER_USAGE_INDEX_BUFFER_BIT, true, false),
+    Buffer_IVulkan(context, indexCount * sizeof(uint32_t), indexData, VK_BUFFER_USAGE_INDEX_BUFFER_BIT, true, false,
+                   std::static_pointer_cast<GraphicsContext_IVulkan>(context)->m_indexArena.get(), sizeof(uint32_t)),
     m_32bitIndicies(true)
 {
 }
 
 moraine::IndexBuffer_IVulkan::IndexBuffer_IVulkan(GraphicsContext context, size_t indexCount, uint16_t* indexData) :
-    Buffer_IVulkan(context, indexCount * sizeof(uint16_t), indexData, VK_BUFFER_USAGE_INDEX_BUFFER_BIT, true, false),
+    Buffer_IVulkan(context, indexCount * sizeof(uint16_t), indexData, VK_BUFFER_USAGE_INDEX_BUFFER_BIT, true, false,
+                   std::static_pointer_cast<GraphicsContext_IVulkan>(context)->m_indexArena.get(), sizeof(uint16_t)),
     m_32bitIndicies(false)
 {
 }
@@ -108,14 +221,14 @@ moraine::IndexBuffer_IVulkan::~IndexBuffer_IVulkan()
 
 void moraine::IndexBuffer_IVulkan::bind(VkCommandBuffer buffer)
 {
-    vkCmdBindIndexBuffer(buffer, m_buffer, 0, m_32bitIndicies ? VK_INDEX_TYPE_UINT32 : VK_INDEX_TYPE_UINT16);
+    vkCmdBindIndexBuffer(buffer, m_buffer, m_offset, getIndexType());
 }
 
 moraine::ConstantBuffer_IVulkan::ConstantBuffer_IVulkan(GraphicsContext context, size_t size, bool updateEveryFrame) :
     Buffer_IVulkan(context, 
                    updateEveryFrame ? 
                        getAlignedSize(size, std::static_pointer_cast<GraphicsContext_IVulkan>(context)->m_physicalDevice.deviceProperties.limits.minUniformBufferOffsetAlignment) * 
-                           std::static_pointer_cast<GraphicsContext_IVulkan>(context)->m_swapchainImages.size() :
+                           std::static_pointer_cast<GraphicsContext_IVulkan>(context)->m_framesInFlight :
                        size, 
                    nullptr, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, false, true),
     m_elementSize(size),
@@ -132,166 +245,627 @@ void* moraine::ConstantBuffer_IVulkan::data(uint32_t frameIndex)
     return static_cast<uint8_t*>(m_data) + frameIndex * m_elementAlignedSize;
 }
 
-moraine::ConstantArray_IVulkan::ConstantArray_IVulkan(GraphicsContext context, size_t elementSize, uint32_t initialElementCount, bool updateEveryFrame) :
-    Buffer_IVulkan(context,
-                   getAlignedSize(elementSize, std::static_pointer_cast<GraphicsContext_IVulkan>(context)->m_physicalDevice.deviceProperties.limits.minUniformBufferOffsetAlignment) *
-                       initialElementCount *
-                       (updateEveryFrame ? std::static_pointer_cast<GraphicsContext_IVulkan>(context)->m_swapchainImages.size() : 1),
-                   nullptr, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT, false, true),
-    m_reservedElementCount(initialElementCount),
-    m_elementAlignedSize(getAlignedSize(elementSize, std::static_pointer_cast<GraphicsContext_IVulkan>(context)->m_physicalDevice.deviceProperties.limits.minUniformBufferOffsetAlignment)),
+moraine::StorageBuffer_IVulkan::StorageBuffer_IVulkan(GraphicsContext context, size_t size, bool updateEveryFrame) :
+    Buffer_IVulkan(context, 
+                   updateEveryFrame ? 
+                       getAlignedSize(size, std::static_pointer_cast<GraphicsContext_IVulkan>(context)->m_physicalDevice.deviceProperties.limits.minStorageBufferOffsetAlignment) * 
+                           std::static_pointer_cast<GraphicsContext_IVulkan>(context)->m_framesInFlight :
+                       size, 
+                   nullptr, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, false, true),
+    m_elementSize(size),
+    m_elementAlignedSize(updateEveryFrame ? getAlignedSize(size, std::static_pointer_cast<GraphicsContext_IVulkan>(context)->m_physicalDevice.deviceProperties.limits.minStorageBufferOffsetAlignment) : 0)
+{
+    assert(m_context->getLogfile(), size <= m_context->m_physicalDevice.deviceProperties.limits.maxStorageBufferRange, L"Storage buffer exceeds maxStorageBufferRange!", MRN_DEBUG_INFO);
+}
+
+moraine::StorageBuffer_IVulkan::~StorageBuffer_IVulkan()
+{
+}
+
+void* moraine::StorageBuffer_IVulkan::data(uint32_t frameIndex)
+{
+    return static_cast<uint8_t*>(m_data) + frameIndex * m_elementAlignedSize;
+}
+
+moraine::ConstantArray_IVulkan::ConstantArray_IVulkan(GraphicsContext context, size_t elementSize, uint32_t initialElementCount, bool updateEveryFrame, uint32_t arrayFlags) :
+    m_context(std::static_pointer_cast<GraphicsContext_IVulkan>(context)),
+    m_pageShift(0),
+    m_elementAlignedSize(getAlignedSize(elementSize, max<VkDeviceSize>(std::static_pointer_cast<GraphicsContext_IVulkan>(context)->m_physicalDevice.deviceProperties.limits.minUniformBufferOffsetAlignment, 16))), // Instance slots count in 16 bytes
     m_perFrameData(updateEveryFrame),
-    m_elementCount(0),
-    m_head(m_data)
+    m_trackChanges(arrayFlags & CONSTANT_ARRAY_TRACK_CHANGES),
+    m_compact(arrayFlags & CONSTANT_ARRAY_COMPACT),
+    m_elementCount(0)
 {
-    for (uint32_t i = 0; i < m_reservedElementCount - 1; ++i)
-        *reinterpret_cast<void**>(static_cast<uint8_t*>(m_data) + m_elementAlignedSize * i) = static_cast<uint8_t*>(m_data) + m_elementAlignedSize * (i + 1); // set i-th element to the address of the next element
+    // Without a CPU copy a move would be written into GPU copies that frames in flight are reading
+    assert(m_context->getLogfile(), not m_compact or m_trackChanges, L"Wrong API Usage: CONSTANT_ARRAY_COMPACT requires CONSTANT_ARRAY_TRACK_CHANGES!", MRN_DEBUG_INFO);
+
+    // The page size is the initial element count rounded up to a power of two
+    while ((1u << m_pageShift) < max(initialElementCount, s_minPageElementCount))
+        ++m_pageShift;
+
+    if (m_trackChanges)
+    {
+        m_dirtyPages.resize(getCopyCount());
+        m_context->m_flushableResources.push_back(this);
+    }
 
-    *reinterpret_cast<void**>(static_cast<uint8_t*>(m_data) + m_elementAlignedSize * (m_reservedElementCount - 1)) = nullptr; // set last element to nullptr
+    addPage();
 }
 
 moraine::ConstantArray_IVulkan::~ConstantArray_IVulkan()
 {
+    if (m_trackChanges)
+        m_context->m_flushableResources.erase(std::find(m_context->m_flushableResources.begin(), m_context->m_flushableResources.end(), this));
+
+    for (auto& a : m_pages)
+    {
+        if (a.bindlessIndex != UINT32_MAX)
+            m_context->m_bindlessTable->removeBuffer(a.bindlessIndex);
+
+        vmaDestroyBuffer(m_context->m_allocator, a.buffer, a.allocation);
+    }
 }
 
-uint32_t moraine::ConstantArray_IVulkan::addElement()
+void moraine::ConstantArray_IVulkan::addPage()
 {
-    uint32_t index = static_cast<uint32_t>((reinterpret_cast<size_t>(m_head) - reinterpret_cast<size_t>(m_data)) / m_elementAlignedSize);
+    uint32_t page = static_cast<uint32_t>(m_pages.size());
+    uint32_t pageElementCount = 1u << m_pageShift;
+
+    Time start = Time::now();
 
-    m_head = *reinterpret_cast<void**>(m_head);
+    Page p;
+    void* data;
+    m_context->createVulkanBuffer(m_elementAlignedSize * pageElementCount * getCopyCount(),
+                                  VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU, &p.buffer, &p.allocation, &data);
+    p.data = static_cast<uint8_t*>(data);
+    p.dirtyCopies = 0;
+    p.bindlessIndex = UINT32_MAX;
 
-    if (not m_head)
+    if (m_context->m_bindlessTable)
+    {
+        VkDeviceSize pageSize = m_elementAlignedSize * pageElementCount;
+        p.bindlessIndex = m_context->m_bindlessTable->addBuffer(p.buffer, pageSize, m_perFrameData ? pageSize : 0);
+    }
+
+    if (m_trackChanges)
+    {
+        p.shadow.resize(m_elementAlignedSize * pageElementCount);
+        p.dirty.resize(static_cast<size_t>(getDirtyWordCount()) * getCopyCount());
+    }
+
+    m_pages.push_back(std::move(p));
+
+    // Free list is a stack, push in reverse so the lowest slot is handed out first. Compacting arrays hand out the next dense index instead
+    if (not m_compact)
+        for (uint32_t i = pageElementCount; i > 0; --i)
+            m_freeElements.push_back((page << m_pageShift) | (i - 1));
+
+    // Existing pages and their descriptors stay untouched, bound sets only get descriptors for the new page
+    for (auto& a : m_constantSetBindings)
+        a.first->addPage(page);
+
+    if (page > 0)
+        m_context->getLogfile()->print(GREY, sprintf(L"Constant array grew to %u pages of %u elements (%.3f ms)", page + 1, pageElementCount,
+                                                     Time::duration(start, Time::now()).getMillisecondsF()), MRN_DEBUG_INFO);
+}
+
+uint32_t moraine::ConstantArray_IVulkan::getBindlessIndex(uint32_t elementIndex, uint32_t* out_slot) const
+{
+    uint32_t element = resolve(elementIndex);
+
+    if (out_slot)
+        *out_slot = getSlot(element);
+
+    return m_pages[getPage(element)].bindlessIndex;
+}
+
+uint32_t moraine::ConstantArray_IVulkan::addElement()
+{
+    if (m_compact)
     {
-        VkBufferCreateInfo bufferInfo;
-        bufferInfo.sType                        = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-        bufferInfo.pNext                        = nullptr;
-        bufferInfo.flags                        = 0;
-        bufferInfo.size                         = m_elementAlignedSize * m_reservedElementCount * 2 * (m_perFrameData ? m_context->m_swapchainImages.size() : 1);
-        bufferInfo.usage                        = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
-        bufferInfo.sharingMode                  = VK_SHARING_MODE_EXCLUSIVE;
-        bufferInfo.queueFamilyIndexCount        = 0;
-        bufferInfo.pQueueFamilyIndices          = nullptr;
-
-        VmaAllocationCreateInfo allocationInfo = { };
-        allocationInfo.usage                    = VMA_MEMORY_USAGE_CPU_TO_GPU;
-        allocationInfo.flags                    = VMA_ALLOCATION_CREATE_MAPPED_BIT;
-
-        VmaAllocationInfo allocInfo;
-        VkBuffer buffer;
-        VmaAllocation allocation;
-
-        assert_vulkan(m_context->getLogfile(), vmaCreateBuffer(m_context->m_allocator, &bufferInfo, &allocationInfo, &buffer, &allocation, &allocInfo), L"", MRN_DEBUG_INFO);
-
-        if (m_perFrameData)
+        if (m_elementCount == getPageCount() << m_pageShift)
+            addPage();
+
+        uint32_t handle;
+
+        if (m_freeHandles.empty())
         {
-            for (size_t i = 0; i < m_context->m_swapchainImages.size(); ++i)
-                memcpy_s(static_cast<uint8_t*>(allocInfo.pMappedData) + m_elementAlignedSize * m_reservedElementCount * 2 * i,
-                         m_elementAlignedSize* m_reservedElementCount * 2,
-                         static_cast<uint8_t*>(m_data) + m_elementAlignedSize * m_reservedElementCount * i,
-                         m_elementAlignedSize* m_reservedElementCount);
+            handle = static_cast<uint32_t>(m_handleElements.size());
+            assert(m_context->getLogfile(), handle < s_handleIndexMask, L"Too many elements in compacting constant array!", MRN_DEBUG_INFO);
+
+            m_handleElements.push_back(0);
+            m_handleGenerations.push_back(0);
         }
         else
         {
-            memcpy_s(allocInfo.pMappedData, m_elementAlignedSize * m_reservedElementCount * 2, m_data, m_elementAlignedSize * m_reservedElementCount);
+            handle = m_freeHandles.back();
+            m_freeHandles.pop_back();
         }
 
-        std::swap(m_buffer, buffer);
-        std::swap(m_allocation, allocation);
-        std::swap(m_data, allocInfo.pMappedData);
+        uint32_t element = m_elementCount++;
+        m_handleElements[handle] = element;
+        m_elementHandles.push_back(handle);
 
-        m_reservedElementCount *= 2;
+        return static_cast<uint32_t>(m_handleGenerations[handle]) << s_handleIndexBits | handle;
+    }
 
-        for (uint32_t i = index; i < m_reservedElementCount - 1; ++i)
-            *reinterpret_cast<void**>(static_cast<uint8_t*>(m_data) + m_elementAlignedSize * i) = static_cast<uint8_t*>(m_data) + m_elementAlignedSize * (i + 1); // set i-th element to the address of the next element
+    if (m_freeElements.empty())
+        addPage();
 
-        *reinterpret_cast<void**>(static_cast<uint8_t*>(m_data) + m_elementAlignedSize * (m_reservedElementCount - 1)) = nullptr; // set last element to nullptr
+    uint32_t index = m_freeElements.back();
+    m_freeElements.pop_back();
+    return index;
+}
 
-        m_head = static_cast<uint8_t*>(m_data) + (index + 1) * m_elementAlignedSize;
-        // static_cast<uint8_t*>(m_data) + elementIndex * m_elementAlignedSize
+void moraine::ConstantArray_IVulkan::removeElement(uint32_t element)
+{
+    if (not m_compact)
+    {
+        m_freeElements.push_back(element);
+        return;
+    }
 
-        m_context->addAsyncTask(
-            [this](uint32_t frameIndex)
-            {
-                for (auto& a : m_constantSetBindings)
-                    a.first->updateDescriptorSet(std::make_pair(this, a.second), frameIndex);
-            },
-            [this, buffer, allocation]()
-            {
-                vmaDestroyBuffer(m_context->m_allocator, buffer, allocation);
-            });
+    uint32_t removed = resolve(element);
+    uint32_t last = --m_elementCount;
 
-        /*
-        
-        Create new buffer with twice the size
+    // Swap and pop: the last element fills the gap, its handle is redirected to the new position
+    if (removed != last)
+    {
+        moveElement(last, removed);
 
-        if m_perFrameData
-            for all frames
-                copy to new buffer
-        else
-            copy to new buffer
+        m_elementHandles[removed] = m_elementHandles[last];
+        m_handleElements[m_elementHandles[removed]] = removed;
 
-        swap buffers
+        // Command buffers contain the old dynamic offset of the moved element
+        m_context->invalidateCommandBuffers();
+    }
 
-        update descriptor sets // wait until all are completed
+    m_elementHandles.pop_back();
 
-        delete old buffer
-        */
+    uint32_t handle = element & s_handleIndexMask;
+    ++m_handleGenerations[handle];
+    m_freeHandles.push_back(handle);
+}
 
-    }
+uint32_t moraine::ConstantArray_IVulkan::resolve(uint32_t element) const
+{
+    if (not m_compact)
+        return element;
 
-    return index;
+    uint32_t handle = element & s_handleIndexMask;
+
+    assert(m_context->getLogfile(), handle < m_handleGenerations.size() and m_handleGenerations[handle] == static_cast<uint8_t>(element >> s_handleIndexBits),
+           L"Wrong API Usage: Constant array handle was removed!", MRN_DEBUG_INFO);
+
+    return m_handleElements[handle];
 }
 
-void moraine::ConstantArray_IVulkan::removeElement(uint32_t element)
+uint8_t* moraine::ConstantArray_IVulkan::getElementData(uint32_t copy, uint32_t elementIndex)
+{
+    return m_pages[getPage(elementIndex)].data + m_elementAlignedSize * ((static_cast<size_t>(copy) << m_pageShift) + getSlot(elementIndex));
+}
+
+uint8_t* moraine::ConstantArray_IVulkan::markChanged(uint32_t elementIndex)
 {
-    auto el = reinterpret_cast<void**>(static_cast<uint8_t*>(m_data) + m_elementAlignedSize * element);
+    uint32_t pageIndex = getPage(elementIndex);
+    uint32_t slot = getSlot(elementIndex);
+    Page& page = m_pages[pageIndex];
+
+    // The element has to reach every GPU copy, each copy is brought up to date when its frame is submitted next
+    uint32_t wordCount = getDirtyWordCount();
+    for (uint32_t copy = 0; copy < m_dirtyPages.size(); ++copy)
+    {
+        page.dirty[copy * wordCount + slot / 64] |= 1ull << (slot % 64);
+
+        if (not (page.dirtyCopies & 1u << copy))
+        {
+            page.dirtyCopies |= 1u << copy;
+            m_dirtyPages[copy].push_back(pageIndex);
+        }
+    }
+
+    return page.shadow.data() + m_elementAlignedSize * slot;
+}
 
-    *el = m_head;
-    m_head = el;
+void moraine::ConstantArray_IVulkan::moveElement(uint32_t from, uint32_t to)
+{
+    // Only the CPU copy is written, each GPU copy receives the element when its frame is flushed
+    memcpy_s(markChanged(to), m_elementAlignedSize, m_pages[getPage(from)].shadow.data() + m_elementAlignedSize * getSlot(from), m_elementAlignedSize);
 }
 
 void* moraine::ConstantArray_IVulkan::data(uint32_t frameIndex, uint32_t elementIndex)
 {
-    if (m_perFrameData)
-        return static_cast<uint8_t*>(m_data) +  m_elementAlignedSize * (frameIndex * m_reservedElementCount + elementIndex);
-    else
-        return static_cast<uint8_t*>(m_data) + elementIndex * m_elementAlignedSize;
+    return getElementData(m_perFrameData ? frameIndex : 0, resolve(elementIndex));
+}
+
+void* moraine::ConstantArray_IVulkan::data(uint32_t elementIndex)
+{
+    assert(m_context->getLogfile(), m_trackChanges, L"Wrong API Usage: ConstantArray::data(elementIndex) requires CONSTANT_ARRAY_TRACK_CHANGES", MRN_DEBUG_INFO);
+
+    return markChanged(resolve(elementIndex));
+}
+
+void moraine::ConstantArray_IVulkan::flushFrame(uint32_t frameIndex)
+{
+    uint32_t copy = m_perFrameData ? frameIndex : 0;
+    uint32_t wordCount = getDirtyWordCount();
+
+    for (uint32_t pageIndex : m_dirtyPages[copy])
+    {
+        Page& page = m_pages[pageIndex];
+        uint64_t* dirty = page.dirty.data() + static_cast<size_t>(copy) * wordCount;
+        uint8_t* destination = page.data + (m_elementAlignedSize << m_pageShift) * copy;
+
+        // Consecutive changed slots are copied with a single memcpy, runs may continue across words
+        uint32_t runStart = UINT32_MAX;
+
+        for (uint32_t word = 0; word <= wordCount; ++word)
+        {
+            uint64_t bits = word < wordCount ? dirty[word] : 0;
+
+            for (uint32_t bit = 0; bit < 64; ++bit)
+            {
+                if (runStart == UINT32_MAX and bits == 0)
+                    break; // nothing left in this word
+
+                uint32_t slot = word * 64 + bit;
+                bool isDirty = bits & 1ull << bit;
+
+                if (isDirty and runStart == UINT32_MAX)
+                    runStart = slot;
+                else if (not isDirty and runStart != UINT32_MAX)
+                {
+                    size_t offset = m_elementAlignedSize * runStart;
+                    size_t size = m_elementAlignedSize * (slot - runStart);
+                    memcpy_s(destination + offset, size, page.shadow.data() + offset, size);
+                    runStart = UINT32_MAX;
+                }
+
+                bits &= ~(1ull << bit);
+            }
+
+            if (word < wordCount)
+                dirty[word] = 0;
+        }
+
+        page.dirtyCopies &= ~(1u << copy);
+    }
+
+    m_dirtyPages[copy].clear();
 }
 
 
 
 
-moraine::StagingStack_IVulkan::StagingStack_IVulkan(GraphicsContext context, size_t size)
-    : Buffer_IVulkan(context, size, nullptr, VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, false, true),
-    m_head(m_data),
-    m_end(static_cast<uint8_t*>(m_data) + size)
+moraine::StagingRing_IVulkan::StagingRing_IVulkan(GraphicsContext context, size_t blockSize) :
+    m_context(static_cast<GraphicsContext_IVulkan*>(context.get())), // Raw pointer, the context owns the ring
+    m_blockSize(blockSize),
+    m_currentBlock(0),
+    m_nextTicket(1),
+    m_submittedTicket(0),
+    m_batchUsed(false)
 {
+    VkSemaphoreTypeCreateInfoKHR vstci;
+    vstci.sType                     = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO_KHR;
+    vstci.pNext                     = nullptr;
+    vstci.semaphoreType             = VK_SEMAPHORE_TYPE_TIMELINE_KHR;
+    vstci.initialValue              = 0;
+
+    VkSemaphoreCreateInfo vsci;
+    vsci.sType                      = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+    vsci.pNext                      = &vstci;
+    vsci.flags                      = 0;
+
+    assert_vulkan(m_context->getLogfile(), vkCreateSemaphore(m_context->m_device, &vsci, nullptr, &m_semaphore), L"vkCreateSemaphore() failed", MRN_DEBUG_INFO);
+
+    createBlock(blockSize);
 }
 
-moraine::StagingStack_IVulkan::~StagingStack_IVulkan()
+moraine::StagingRing_IVulkan::~StagingRing_IVulkan()
 {
+    waitForUpload(m_submittedTicket);
+
+    for (auto& a : m_commandBuffers)
+        vkFreeCommandBuffers(m_context->m_device, m_context->m_mainThreadCommandPools[m_context->m_transferQueue.queueFamilyIndex], 1, &a.first);
+
+    vkDestroySemaphore(m_context->m_device, m_semaphore, nullptr);
+
+    for (auto& a : m_blocks)
+        vmaDestroyBuffer(m_context->m_allocator, a->buffer, a->allocation);
 }
 
-moraine::StagingStackMarker moraine::StagingStack_IVulkan::createMarker()
+moraine::StagingRing_IVulkan::Block& moraine::StagingRing_IVulkan::createBlock(size_t size)
 {
-    return m_head; // Return current position of head
+    auto block = std::make_unique<Block>();
+    block->size             = size;
+    block->head             = 0;
+    block->tail             = 0;
+    block->lastUsedTicket   = m_nextTicket;
+
+    void* data;
+    m_context->createVulkanBuffer(size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VMA_MEMORY_USAGE_CPU_ONLY,
+                                  &block->buffer, &block->allocation, &data);
+    block->data = static_cast<uint8_t*>(data);
+
+    m_blocks.push_back(std::move(block));
+    return *m_blocks.back();
 }
 
-void* moraine::StagingStack_IVulkan::alloc(size_t size, size_t alignment)
+bool moraine::StagingRing_IVulkan::allocFromBlock(Block& block, size_t size, size_t alignment, size_t* out_offset)
 {
-    void* head = m_head = getAlignedPointer(m_head, alignment); // Align head and copy it
-    m_head = static_cast<uint8_t*>(m_head) + size; // Move head by size
+    if (block.regions.empty())
+        block.head = block.tail = 0; // Nothing in flight, start over at the beginning of the block
+
+    size_t offset = getAlignedSize(block.head, alignment);
+
+    if (block.head >= block.tail)
+    {
+        // Free space: [head, size) and [0, tail)
+        if (offset + size > block.size)
+        {
+            if (size >= block.tail) // Wrapping around would run into the tail (strict, head == tail means empty)
+                return false;
 
-    if (m_head >= m_end) // Stack overflow
-        throw std::exception("Stack overflow");
+            offset = 0;
+        }
+    }
+    else if (offset + size >= block.tail) // Free space: [head, tail)
+        return false;
 
-    return head; // Return copied head
+    block.head = offset + size;
+    block.lastUsedTicket = m_nextTicket;
+
+    // Regions of the same batch are merged, the region end is what reclaim() moves the tail to
+    if (not block.regions.empty() and block.regions.back().first == m_nextTicket)
+        block.regions.back().second = block.head;
+    else
+        block.regions.emplace_back(m_nextTicket, block.head);
+
+    m_batchUsed = true;
+
+    *out_offset = offset;
+    return true;
 }
 
-void moraine::StagingStack_IVulkan::free(StagingStackMarker m)
+moraine::StagingAllocation moraine::StagingRing_IVulkan::alloc(size_t size, size_t alignment)
 {
-    if (m > m_data and m < m_end)
-        m_head = m; // Set head back to marker
+    size_t offset;
+
+    // Try the current block first, then every other block, only then chain a new one
+    for (int attempt = 0; attempt < 2; ++attempt)
+    {
+        for (size_t i = 0; i < m_blocks.size(); ++i)
+        {
+            size_t index = (m_currentBlock + i) % m_blocks.size();
+            Block& block = *m_blocks[index];
+
+            if (block.size >= size and allocFromBlock(block, size, alignment, &offset))
+            {
+                m_currentBlock = index;
+                return { block.data + offset, &block, offset };
+            }
+        }
+
+        reclaim(); // Batches may have completed since the last frame
+    }
+
+    Block& block = createBlock(max(m_blockSize, getAlignedSize(size, alignment)));
+    m_currentBlock = m_blocks.size() - 1;
+
+    m_context->getLogfile()->print(YELLOW, sprintf(L"Staging Ring: allocated additional %.2f MB block (%llu blocks in use)",
+                                                   block.size / (1024.0f * 1024.0f), static_cast<unsigned long long>(m_blocks.size())), MRN_DEBUG_INFO);
+
+    allocFromBlock(block, size, alignment, &offset);
+    return { block.data + offset, &block, offset };
+}
+
+bool moraine::StagingRing_IVulkan::isUploadComplete(UploadTicket ticket)
+{
+    return ticket <= m_submittedTicket and getCompletedTicket() >= ticket;
+}
+
+void moraine::StagingRing_IVulkan::waitForUpload(UploadTicket ticket)
+{
+    if (ticket == 0)
+        return;
+
+    if (ticket > m_submittedTicket)
+        submitUploads();
+
+    VkSemaphoreWaitInfoKHR vswi;
+    vswi.sType                      = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO_KHR;
+    vswi.pNext                      = nullptr;
+    vswi.flags                      = 0;
+    vswi.semaphoreCount             = 1;
+    vswi.pSemaphores                = &m_semaphore;
+    vswi.pValues                    = &ticket;
+
+    assert_vulkan(m_context->getLogfile(), m_context->m_vkWaitSemaphoresKHR(m_context->m_device, &vswi, UINT64_MAX), L"vkWaitSemaphoresKHR() failed", MRN_DEBUG_INFO);
+}
+
+VkBuffer moraine::StagingRing_IVulkan::getBuffer(const StagingAllocation& allocation) const
+{
+    return static_cast<const Block*>(allocation.block)->buffer;
+}
+
+moraine::UploadTicket moraine::StagingRing_IVulkan::uploadBuffer(VkBuffer destination, VkDeviceSize destinationOffset, const void* data, size_t size)
+{
+    StagingAllocation allocation = alloc(size, 16);
+    memcpy_s(allocation.data, size, data, size);
+    return uploadBuffer(destination, destinationOffset, allocation, size);
+}
+
+moraine::UploadTicket moraine::StagingRing_IVulkan::uploadBuffer(VkBuffer destination, VkDeviceSize destinationOffset, const StagingAllocation& source, size_t size)
+{
+    VkBuffer sourceBuffer = getBuffer(source);
+
+    VkBufferCopy copy;
+    copy.srcOffset  = source.offset;
+    copy.dstOffset  = destinationOffset;
+    copy.size       = size;
+
+    // Consecutive copies between the same pair of buffers are recorded as one vkCmdCopyBuffer()
+    if (not m_pendingUploads.empty() and not m_pendingUploads.back().task and
+        m_pendingUploads.back().source == sourceBuffer and m_pendingUploads.back().destination == destination)
+    {
+        VkBufferCopy& last = m_pendingUploads.back().regions.back();
+
+        if (last.srcOffset + last.size == copy.srcOffset and last.dstOffset + last.size == copy.dstOffset)
+            last.size += copy.size;
+        else
+            m_pendingUploads.back().regions.push_back(copy);
+    }
     else
-        throw std::exception("Invalid StaginStackMarker!");
+        m_pendingUploads.push_back({ sourceBuffer, destination, { copy }, nullptr });
+
+    return m_nextTicket;
+}
+
+moraine::UploadTicket moraine::StagingRing_IVulkan::uploadTask(std::function<void(VkCommandBuffer)> task)
+{
+    m_pendingUploads.push_back({ VK_NULL_HANDLE, VK_NULL_HANDLE, { }, std::move(task) });
+    return m_nextTicket;
+}
+
+void moraine::StagingRing_IVulkan::graphicsTask(std::function<void(VkCommandBuffer)> task)
+{
+    m_graphicsTasks.push_back(std::move(task));
+}
+
+moraine::UploadTicket moraine::StagingRing_IVulkan::submitUploads()
+{
+    reclaim();
+
+    if (m_pendingUploads.empty() and not m_batchUsed)
+        return m_submittedTicket;
+
+    UploadTicket completed = getCompletedTicket();
+
+    VkCommandBuffer buffer = VK_NULL_HANDLE;
+
+    if (not m_pendingUploads.empty())
+    {
+        auto reusable = std::find_if(m_commandBuffers.begin(), m_commandBuffers.end(), [completed](const auto& a) { return a.second <= completed; });
+
+        if (reusable == m_commandBuffers.end())
+        {
+            VkCommandBufferAllocateInfo vcbai;
+            vcbai.sType                     = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+            vcbai.pNext                     = nullptr;
+            vcbai.commandPool               = m_context->m_mainThreadCommandPools[m_context->m_transferQueue.queueFamilyIndex];
+            vcbai.level                     = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+            vcbai.commandBufferCount        = 1;
+
+            assert_vulkan(m_context->getLogfile(), vkAllocateCommandBuffers(m_context->m_device, &vcbai, &buffer), L"vkAllocateCommandBuffers() failed", MRN_DEBUG_INFO);
+
+            m_commandBuffers.emplace_back(buffer, m_nextTicket);
+        }
+        else
+        {
+            buffer = reusable->first;
+            reusable->second = m_nextTicket;
+        }
+
+        VkCommandBufferBeginInfo vcbbi;
+        vcbbi.sType                 = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        vcbbi.pNext                 = nullptr;
+        vcbbi.flags                 = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+        vcbbi.pInheritanceInfo      = nullptr;
+
+        assert_vulkan(m_context->getLogfile(), vkBeginCommandBuffer(buffer, &vcbbi), L"vkBeginCommandBuffer() failed", MRN_DEBUG_INFO);
+
+        for (const auto& a : m_pendingUploads)
+        {
+            if (a.task)
+                a.task(buffer);
+            else
+                vkCmdCopyBuffer(buffer, a.source, a.destination, static_cast<uint32_t>(a.regions.size()), a.regions.data());
+        }
+
+        assert_vulkan(m_context->getLogfile(), vkEndCommandBuffer(buffer), L"vkEndCommandBuffer() failed", MRN_DEBUG_INFO);
+
+        m_pendingUploads.clear();
+    }
+
+    // Visibility for the graphics queue is provided by waiting on the semaphore, no release barrier is recorded
+    VkTimelineSemaphoreSubmitInfoKHR vtssi;
+    vtssi.sType                     = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO_KHR;
+    vtssi.pNext                     = nullptr;
+    vtssi.waitSemaphoreValueCount   = 0;
+    vtssi.pWaitSemaphoreValues      = nullptr;
+    vtssi.signalSemaphoreValueCount = 1;
+    vtssi.pSignalSemaphoreValues    = &m_nextTicket;
+
+    VkSubmitInfo submitInfo;
+    submitInfo.sType                = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.pNext                = &vtssi;
+    submitInfo.waitSemaphoreCount   = 0;
+    submitInfo.pWaitSemaphores      = nullptr;
+    submitInfo.pWaitDstStageMask    = nullptr;
+    submitInfo.commandBufferCount   = buffer ? 1 : 0; // An empty submit still signals, so staging memory without uploads is reclaimed
+    submitInfo.pCommandBuffers      = &buffer;
+    submitInfo.signalSemaphoreCount = 1;
+    submitInfo.pSignalSemaphores    = &m_semaphore;
+
+    assert_vulkan(m_context->getLogfile(), vkQueueSubmit(m_context->m_transferQueue.queue, 1, &submitInfo, VK_NULL_HANDLE), L"vkQueueSubmit() failed", MRN_DEBUG_INFO);
+
+    m_submittedTicket = m_nextTicket++;
+    m_batchUsed = false;
+
+    return m_submittedTicket;
+}
+
+moraine::UploadTicket moraine::StagingRing_IVulkan::recordGraphicsTasks(VkCommandBuffer buffer)
+{
+    for (const auto& a : m_graphicsTasks)
+        a(buffer);
+
+    m_graphicsTasks.clear();
+
+    // Staging memory of the batches up to the last submitted one may be read by this frame
+    m_graphicsTickets.push_back(m_submittedTicket);
+    return m_submittedTicket;
+}
+
+void moraine::StagingRing_IVulkan::completeFrame(UploadTicket ticket)
+{
+    while (not m_graphicsTickets.empty() and m_graphicsTickets.front() <= ticket)
+        m_graphicsTickets.pop_front();
+}
+
+moraine::UploadTicket moraine::StagingRing_IVulkan::getCompletedTicket()
+{
+    UploadTicket value;
+    assert_vulkan(m_context->getLogfile(), m_context->m_vkGetSemaphoreCounterValueKHR(m_context->m_device, m_semaphore, &value), L"vkGetSemaphoreCounterValueKHR() failed", MRN_DEBUG_INFO);
+    return value;
+}
+
+void moraine::StagingRing_IVulkan::reclaim()
+{
+    UploadTicket completed = getCompletedTicket();
+
+    // Batches that graphics tasks of frames in flight read from stay alive until those frames are done
+    if (not m_graphicsTickets.empty())
+        completed = min(completed, m_graphicsTickets.front() - 1);
+
+    for (auto& a : m_blocks)
+    {
+        while (not a->regions.empty() and a->regions.front().first <= completed)
+        {
+            a->tail = a->regions.front().second;
+            a->regions.pop_front();
+        }
+    }
+
+    // Free chained blocks that were not needed for a while, the first block is always kept
+    for (size_t i = m_blocks.size() - 1; i > 0; --i)
+    {
+        if (m_blocks[i]->regions.empty() and m_nextTicket - m_blocks[i]->lastUsedTicket > s_blockRetireBatches)
+        {
+            vmaDestroyBuffer(m_context->m_allocator, m_blocks[i]->buffer, m_blocks[i]->allocation);
+            m_blocks.erase(m_blocks.begin() + i);
+        }
+    }
+
+    m_currentBlock = min(m_currentBlock, m_blocks.size() - 1);
 }
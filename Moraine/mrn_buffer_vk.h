@@ -2,6 +2,7 @@
 
 #include "mrn_buffer.h"
 #include "mrn_constset_vk.h"
+#include "mrn_arena_vk.h"
 
 namespace moraine
 {
@@ -9,45 +10,139 @@ namespace moraine
     {
     protected:
 
-        Buffer_IVulkan(GraphicsContext context, size_t size, void* data, VkBufferUsageFlags usage, bool useVram, bool keepMapped);
+        // VRAM buffers are sub-allocated from the arena if one is given, m_buffer is the arena chunk then
+        Buffer_IVulkan(GraphicsContext context, size_t size, void* data, VkBufferUsageFlags usage, bool useVram, bool keepMapped,
+                       BufferArena_IVulkan* arena = nullptr, VkDeviceSize alignment = 0);
         virtual ~Buffer_IVulkan();
 
         VmaAllocation m_allocation;
         VkBuffer m_buffer;
+        VkDeviceSize m_offset; // Offset of the data in m_buffer
+        BufferArena_IVulkan* m_arena;
+        ArenaAllocation m_arenaAllocation;
         void* m_data;
+        UploadTicket m_uploadTicket;
         std::shared_ptr<GraphicsContext_IVulkan> m_context;
     };
 
-    class StagingStack_IVulkan : public StagingStack_T, Buffer_IVulkan
+    class StagingRing_IVulkan : public StagingRing_T
     {
     public:
 
-        StagingStack_IVulkan(GraphicsContext context, size_t size);
-        ~StagingStack_IVulkan() override;
+        StagingRing_IVulkan(GraphicsContext context, size_t blockSize);
+        ~StagingRing_IVulkan() override;
 
-        StagingStackMarker createMarker() override;
-        void* alloc(size_t size, size_t alignment = alignof(void*)) override;
-        void free(StagingStackMarker m = 0) override;
+        StagingAllocation alloc(size_t size, size_t alignment = alignof(void*)) override;
 
-        void* getStart() const { return m_data; }
-        VkBuffer getBuffer() const { return m_buffer; }
+        bool isUploadComplete(UploadTicket ticket) override;
+        void waitForUpload(UploadTicket ticket) override;
+
+        VkBuffer getBuffer(const StagingAllocation& allocation) const;
+        VkSemaphore getSemaphore() const { return m_semaphore; }
+
+        // Transfer queue uploads, batched into one submit per frame that signals the returned ticket on the upload semaphore
+        UploadTicket uploadBuffer(VkBuffer destination, VkDeviceSize destinationOffset, const void* data, size_t size);
+        UploadTicket uploadBuffer(VkBuffer destination, VkDeviceSize destinationOffset, const StagingAllocation& source, size_t size);
+        UploadTicket uploadTask(std::function<void(VkCommandBuffer)> task);
+
+        // Graphics queue tasks for resources that frames in flight may use, recorded in front of the next frame
+        void graphicsTask(std::function<void(VkCommandBuffer)> task);
+
+        UploadTicket submitUploads(); // Submits the pending batch to the transfer queue, returns the last submitted ticket
+
+        bool hasGraphicsTasks() const { return not m_graphicsTasks.empty(); }
+        UploadTicket recordGraphicsTasks(VkCommandBuffer buffer); // Returns the ticket the frame must complete before its staging memory is reclaimed
+        void completeFrame(UploadTicket ticket); // Called when the frame that recorded graphics tasks with this ticket has finished
 
     private:
 
-        void* m_head;
-        void* m_end;
+        struct Block
+        {
+            VkBuffer                                    buffer;
+            VmaAllocation                               allocation;
+            uint8_t*                                    data;
+            size_t                                      size;
+            size_t                                      head;
+            size_t                                      tail;
+            UploadTicket                                lastUsedTicket;
+            std::deque<std::pair<UploadTicket, size_t>> regions; // first: upload batch, second: end offset of the region
+        };
+
+        struct PendingUpload
+        {
+            VkBuffer                                    source;
+            VkBuffer                                    destination;
+            std::vector<VkBufferCopy>                   regions;
+            std::function<void(VkCommandBuffer)>        task; // if set, source, destination and regions are unused
+        };
+
+        bool allocFromBlock(Block& block, size_t size, size_t alignment, size_t* out_offset);
+        Block& createBlock(size_t size);
+        UploadTicket getCompletedTicket();
+        void reclaim();
+
+        static constexpr UploadTicket s_blockRetireBatches = 256; // Chained blocks unused for this many upload batches are freed
+
+        GraphicsContext_IVulkan*                                m_context;
+        size_t                                                  m_blockSize;
+        std::vector<std::unique_ptr<Block>>                     m_blocks;
+        size_t                                                  m_currentBlock;
+
+        VkSemaphore                                             m_semaphore; // Timeline semaphore, signaled with the ticket of each submitted batch
+        UploadTicket                                            m_nextTicket; // Ticket of the batch that is currently recorded
+        UploadTicket                                            m_submittedTicket;
+        bool                                                    m_batchUsed; // Staging memory was allocated for the current batch
+        std::vector<PendingUpload>                              m_pendingUploads;
+        std::vector<std::pair<VkCommandBuffer, UploadTicket>>   m_commandBuffers; // Transfer command buffers, reusable once their ticket completed
+
+        std::vector<std::function<void(VkCommandBuffer)>>       m_graphicsTasks;
+        std::deque<UploadTicket>                                m_graphicsTickets; // Tickets of frames in flight that recorded graphics tasks
     };
 
-    class VertexBuffer_IVulkan : public VertexBuffer_T, Buffer_IVulkan
+    class VertexBuffer_IVulkan : public VertexBuffer_T, Buffer_IVulkan, public FlushableResource_IVulkan
     {
     public:
 
-        VertexBuffer_IVulkan(GraphicsContext context, size_t size, void* data, bool frequentUpdate, size_t reservedSize);
+        VertexBuffer_IVulkan(GraphicsContext context, size_t size, void* data, bool frequentUpdate, size_t reservedSize, size_t vertexStride);
         ~VertexBuffer_IVulkan() override;
 
         void bind(VkCommandBuffer buffer, uint32_t binding, size_t offset);
 
         void* data() override;
+        void write(size_t offset, const void* data, size_t size) override;
+        void append(const void* data, size_t size) override;
+        void resize(size_t size) override;
+
+        void flushFrame(uint32_t frameIndex) override;
+
+        UploadTicket getUploadTicket() const override { return m_uploadTicket; }
+
+        // Frequently updated buffers have one copy per frame
+        VkBuffer getBuffer() const { return m_buffer; }
+        VkDeviceSize getOffset(uint32_t frameIndex) const { return m_offset + (m_dynamic ? m_reservedSize * frameIndex : 0); }
+
+        // With a known stride static buffers can be bound at offset 0 and drawn with vertexOffset / firstVertex
+        bool usesVertexOffset() const { return m_vertexStride != 0 and not m_dynamic; }
+        int32_t getVertexOffset() const { return static_cast<int32_t>(m_offset / m_vertexStride); }
+
+    private:
+
+        void markChanged(size_t begin, size_t end);
+        void grow(size_t requiredSize);
+
+        struct RetiredBuffer
+        {
+            uint64_t        frame; // Frame counter value after which no frame in flight uses the buffer
+            VkBuffer        buffer;
+            VmaAllocation   allocation;
+        };
+
+        size_t m_vertexStride;
+        bool m_dynamic;
+        std::vector<uint8_t> m_shadow; // CPU copy of frequently updated buffers
+        std::vector<std::pair<size_t, size_t>> m_changedRanges; // [begin, end) of changed bytes per frame copy
+        uint64_t m_frameCounter;
+        std::vector<RetiredBuffer> m_retiredBuffers; // Buffers replaced by grow(), destroyed once no frame uses them
     };
 
     class IndexBuffer_IVulkan : public IndexBuffer_T, Buffer_IVulkan
@@ -60,6 +155,12 @@ namespace moraine
 
         void bind(VkCommandBuffer buffer);
 
+        UploadTicket getUploadTicket() const override { return m_uploadTicket; }
+
+        VkBuffer getBuffer() const { return m_buffer; }
+        VkIndexType getIndexType() const { return m_32bitIndicies ? VK_INDEX_TYPE_UINT32 : VK_INDEX_TYPE_UINT16; }
+        uint32_t getFirstIndex() const { return static_cast<uint32_t>(m_offset / (m_32bitIndicies ? sizeof(uint32_t) : sizeof(uint16_t))); } // With the buffer bound at offset 0
+
     private:
 
         bool m_32bitIndicies;
@@ -80,26 +181,87 @@ namespace moraine
         size_t m_elementSize;
     };
 
-    class ConstantArray_IVulkan : public ConstantArray_T, Buffer_IVulkan
+    class StorageBuffer_IVulkan : public StorageBuffer_T, Buffer_IVulkan
+    {
+        friend class ConstantSet_IVulkan;
+
+    public:
+
+        StorageBuffer_IVulkan(GraphicsContext context, size_t size, bool updateEveryFrame);
+        ~StorageBuffer_IVulkan() override;
+
+        void* data(uint32_t frameIndex) override;
+        size_t size() const override { return m_elementSize; }
+
+        size_t m_elementAlignedSize; // 0 if the buffer has no per frame data
+        size_t m_elementSize;
+    };
+
+    class ConstantArray_IVulkan : public ConstantArray_T, public FlushableResource_IVulkan
     {
         friend class ConstantSet_IVulkan;
 
     public:
 
-        ConstantArray_IVulkan(GraphicsContext context, size_t elementSize, uint32_t initialElementCount, bool updateEveryFrame);
+        ConstantArray_IVulkan(GraphicsContext context, size_t elementSize, uint32_t initialElementCount, bool updateEveryFrame, uint32_t arrayFlags);
         ~ConstantArray_IVulkan() override;
 
         uint32_t addElement() override;
         void removeElement(uint32_t element) override;
 
         void* data(uint32_t frameIndex, uint32_t elementIndex) override;
+        void* data(uint32_t elementIndex) override;
 
+        uint32_t getBindlessIndex(uint32_t elementIndex, uint32_t* out_slot = nullptr) const override;
+
+        void flushFrame(uint32_t frameIndex) override;
+
+        // Returns the dense element index of a handle, element indicies are returned as they are if the array isn't compacting
+        uint32_t resolve(uint32_t element) const;
+
+        // Dense element indicies are (page << m_pageShift) | slot
+        uint32_t getPage(uint32_t elementIndex) const { return elementIndex >> m_pageShift; }
+        uint32_t getSlot(uint32_t elementIndex) const { return elementIndex & ((1u << m_pageShift) - 1); }
+        uint32_t getPageCount() const { return static_cast<uint32_t>(m_pages.size()); }
+
+    private:
+
+        struct Page
+        {
+            VkBuffer                buffer;
+            VmaAllocation           allocation;
+            uint8_t*                data;
+            std::vector<uint8_t>    shadow; // CPU copy of the page's slots, only with CONSTANT_ARRAY_TRACK_CHANGES
+            std::vector<uint64_t>   dirty; // Bitset of changed slots per GPU copy: [copy][word]
+            uint32_t                dirtyCopies; // Bitset of GPU copies the page is listed in m_dirtyPages for
+            uint32_t                bindlessIndex; // UINT32_MAX if the context isn't bindless
+        };
+
+        void addPage();
+        uint8_t* getElementData(uint32_t copy, uint32_t elementIndex);
+        uint8_t* markChanged(uint32_t elementIndex); // Returns the CPU copy of the element
+        void moveElement(uint32_t from, uint32_t to);
+        uint32_t getCopyCount() const { return m_perFrameData ? m_context->m_framesInFlight : 1; }
+        uint32_t getDirtyWordCount() const { return ((1u << m_pageShift) + 63) / 64; }
+
+        static constexpr uint32_t s_minPageElementCount = 256;
+        static constexpr uint32_t s_handleIndexBits = 24; // Handles are (generation << s_handleIndexBits) | handle table index
+        static constexpr uint32_t s_handleIndexMask = (1u << s_handleIndexBits) - 1;
+
+        std::shared_ptr<GraphicsContext_IVulkan> m_context;
+        std::vector<Page> m_pages; // Each page stores its elements for every frame: [frame][slot]
+        uint32_t m_pageShift;
         size_t m_elementAlignedSize;
-        uint32_t m_elementCount;
-        uint32_t m_reservedElementCount;
         bool m_perFrameData;
+        bool m_trackChanges;
+        bool m_compact;
+        std::vector<uint32_t> m_freeElements;
+        uint32_t m_elementCount; // Dense elements in use, only with CONSTANT_ARRAY_COMPACT
+        std::vector<uint32_t> m_handleElements; // Dense element index per handle
+        std::vector<uint8_t> m_handleGenerations; // Incremented when a handle is removed, so stale handles are detected
+        std::vector<uint32_t> m_elementHandles; // Handle table index per dense element
+        std::vector<uint32_t> m_freeHandles;
         std::vector<std::pair<ConstantSet_IVulkan*, uint32_t>> m_constantSetBindings;
-
-        void* m_head;
+        std::vector<std::vector<uint32_t>> m_dirtyPages; // Pages with changed slots per GPU copy
     };
 }
\ No newline at end of file
@@ -3,236 +3,201 @@
 
 moraine::ConstantSet_IVulkan::ConstantSet_IVulkan(Shader shader, uint32_t set, std::initializer_list<std::pair<ConstantResource, uint32_t>> resources) :
     m_shader(std::static_pointer_cast<Shader_IVulkan>(shader)),
-    m_setIndex(set)
+    m_setIndex(set),
+    m_frameCount(m_shader->m_context->m_framesInFlight),
+    m_resources(resources),
+    m_dynamicOffsetCount(0),
+    m_pageCount(0)
 {
-    uint32_t nSwapchainImages = static_cast<uint32_t>(m_shader->m_context->m_swapchainImages.size());
+    uint32_t pageCount = 1;
 
-    VkDescriptorPoolCreateInfo vdpci;
-    vdpci.sType                         = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
-    vdpci.pNext                         = nullptr;
-    vdpci.flags                         = 0;
-    vdpci.maxSets                       = nSwapchainImages;
-    vdpci.poolSizeCount                 = static_cast<uint32_t>(m_shader->m_desriptorPoolSizes[set].size());
-    vdpci.pPoolSizes                    = m_shader->m_desriptorPoolSizes[set].data();
+    assert(m_shader->m_logfile, m_setIndex != m_shader->m_bindlessSet, sprintf(L"Wrong API Usage: Set %d of the shader is its bindless set!", m_setIndex), MRN_DEBUG_INFO);
 
-    assert_vulkan(m_shader->m_logfile, vkCreateDescriptorPool(m_shader->m_context->m_device, &vdpci, nullptr, &m_descriptorPool), L"vkCreateDescriptorPool() failed", MRN_DEBUG_INFO);
+    // The update template of the layout writes every binding
+    const auto& types = m_shader->m_descriptorTypes[m_setIndex];
 
-    std::vector<VkDescriptorSetLayout> layouts(nSwapchainImages, m_shader->m_descriptorLayouts[set]);
+    for (const auto& a : m_resources)
+        assert(m_shader->m_logfile, a.second < types.size() and types[a.second] != VK_DESCRIPTOR_TYPE_MAX_ENUM,
+               sprintf(L"Wrong API Usage: Set %d of the shader has no binding %d!", m_setIndex, a.second), MRN_DEBUG_INFO);
 
-    m_descriptorSets.resize(nSwapchainImages);
+    for (const auto& a : m_shader->m_descriptorBindings[m_setIndex])
+        assert(m_shader->m_logfile, std::find_if(m_resources.begin(), m_resources.end(), [&a](const std::pair<ConstantResource, uint32_t>& resource) { return resource.second == a.binding; }) != m_resources.end(),
+               sprintf(L"Wrong API Usage: No resource for binding %d of set %d!", a.binding, m_setIndex), MRN_DEBUG_INFO);
 
-    VkDescriptorSetAllocateInfo vdsai;
-    vdsai.sType                         = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
-    vdsai.pNext                         = nullptr;
-    vdsai.descriptorPool                = m_descriptorPool;
-    vdsai.descriptorSetCount            = nSwapchainImages;
-    vdsai.pSetLayouts                   = layouts.data();
+    for (auto& a : m_resources)
+        switch (a.first->m_type)
+        {
+        case CONSTANT_RESOURCE_TYPE_CONSTANT_ARRAY:
+        {
+            auto c = std::static_pointer_cast<ConstantArray_IVulkan>(a.first);
+            bool instanced = m_shader->m_descriptorTypes[m_setIndex].size() > a.second and m_shader->m_descriptorTypes[m_setIndex][a.second] == VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+            m_arrayBindings.push_back({ c.get(), c->m_elementAlignedSize, a.second, instanced });
+            m_dynamicOffsetCount += instanced ? 0 : 1;
+            c->m_constantSetBindings.push_back(std::pair<ConstantSet_IVulkan*, uint32_t>(this, a.second));
+            pageCount = max(pageCount, c->getPageCount());
+            break;
+        }
 
-    assert_vulkan(m_shader->m_logfile, vkAllocateDescriptorSets(m_shader->m_context->m_device, &vdsai, m_descriptorSets.data()), L"vkAllocateDescriptorSets() failed", MRN_DEBUG_INFO);
+        case CONSTANT_RESOURCE_TYPE_COMBINED_IMAGE_SAMPLER:
+        {
+            auto c = std::static_pointer_cast<Texture_IVulkan>(a.first);
+            c->m_constantSetBindings.push_back(std::pair<ConstantSet_IVulkan*, uint32_t>(this, a.second));
+            break;
+        }
+
+        default:
+            break;
+        }
 
-    updateDescriptorSets(resources);
+    addPage(pageCount - 1);
 }
 
 moraine::ConstantSet_IVulkan::~ConstantSet_IVulkan()
 {
-    vkDestroyDescriptorPool(m_shader->m_context->m_device, m_descriptorPool, nullptr);
+    m_shader->m_context->m_descriptorAllocator->free(m_shader->m_descriptorLayouts[m_setIndex], m_descriptorSets.data(), static_cast<uint32_t>(m_descriptorSets.size()));
 }
 
-void moraine::ConstantSet_IVulkan::bind(VkCommandBuffer buffer, uint32_t frameIndex, std::initializer_list<uint32_t> arrayIndicies)
+void moraine::ConstantSet_IVulkan::addPage(uint32_t page)
 {
-    assert(m_shader->m_context->getLogfile(), arrayIndicies.size() == m_arrayAlignedElementSizes.size(), L"Wrong API Usage: Not all arrayIndicies provided!", MRN_DEBUG_INFO);
+    uint32_t firstPage = m_pageCount;
 
-    std::vector<uint32_t> offsets(arrayIndicies.size());
+    if (page < firstPage) // Another array of this set already reached that page
+        return;
 
-    for (size_t i = 0; i < arrayIndicies.size(); ++i)
-        offsets[i] = static_cast<uint32_t>(m_arrayAlignedElementSizes[i].first * arrayIndicies.begin()[i]);
+    m_pageCount = page + 1;
+    m_descriptorSets.resize(m_pageCount * m_frameCount);
 
-    vkCmdBindDescriptorSets(buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, m_shader->m_layout, m_setIndex, 1, &m_descriptorSets[frameIndex], static_cast<uint32_t>(offsets.size()), offsets.data());
+    m_shader->m_context->m_descriptorAllocator->alloc(m_shader->m_descriptorLayouts[m_setIndex], m_shader->m_descriptorBindings[m_setIndex],
+                                                      (m_pageCount - firstPage) * m_frameCount, &m_descriptorSets[firstPage * m_frameCount]);
+
+    writeDescriptorSets(firstPage, m_pageCount - firstPage);
 }
 
-void moraine::ConstantSet_IVulkan::bind(VkCommandBuffer buffer, uint32_t frameIndex, const std::vector<uint32_t>& arrayIndicies)
+VkDescriptorSet moraine::ConstantSet_IVulkan::getDescriptorSet(uint32_t frameIndex, const uint32_t* arrayIndicies, size_t arrayIndexCount)
 {
-    assert(m_shader->m_logfile, arrayIndicies.size() == m_arrayAlignedElementSizes.size(), L"Wrong API Usage: Not all arrayIndicies provided!", MRN_DEBUG_INFO);
+    assert(m_shader->m_context->getLogfile(), arrayIndexCount == m_arrayBindings.size(), L"Wrong API Usage: Not all arrayIndicies provided!", MRN_DEBUG_INFO);
 
-    std::vector<uint32_t> offsets(arrayIndicies.size());
+    if (arrayIndexCount == 0)
+        return m_descriptorSets[frameIndex];
 
-    for (size_t i = 0; i < arrayIndicies.size(); ++i)
-        offsets[i] = static_cast<uint32_t>(m_arrayAlignedElementSizes[i].first * arrayIndicies.begin()[i]);
+    // The page of the first array selects the descriptor set, the other arrays of the set must use the same page
+    uint32_t page = m_arrayBindings[0].array->getPage(m_arrayBindings[0].array->resolve(arrayIndicies[0]));
+
+    for (size_t i = 1; i < arrayIndexCount; ++i)
+        assert(m_shader->m_context->getLogfile(), m_arrayBindings[i].array->getPage(m_arrayBindings[i].array->resolve(arrayIndicies[i])) == page, 
+               L"Wrong API Usage: Constant array elements bound through one set must be on the same page!", MRN_DEBUG_INFO);
 
-    vkCmdBindDescriptorSets(buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, m_shader->m_layout, m_setIndex, 1, &m_descriptorSets[frameIndex], static_cast<uint32_t>(offsets.size()), offsets.data());
+    return m_descriptorSets[page * m_frameCount + frameIndex];
 }
 
-void moraine::ConstantSet_IVulkan::updateDescriptorSets(std::initializer_list<std::pair<ConstantResource, uint32_t>> resources)
+void moraine::ConstantSet_IVulkan::bind(VkCommandBuffer buffer, uint32_t frameIndex, std::initializer_list<uint32_t> arrayIndicies)
 {
-    std::vector<VkWriteDescriptorSet> writeSets;
-    std::vector<VkDescriptorBufferInfo> bufferInfos;
-    std::vector<VkDescriptorImageInfo> imageInfos;
+    bind(buffer, frameIndex, std::vector<uint32_t>(arrayIndicies));
+}
 
-    for (size_t i = 0; i < m_descriptorSets.size(); ++i)
-    {
-        for (auto& b : resources)
-        {
-            VkWriteDescriptorSet writeSet;
-            writeSet.sType                  = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-            writeSet.pNext                  = nullptr;
-            writeSet.dstSet                 = m_descriptorSets[i];
-            writeSet.dstBinding             = b.second;
-            writeSet.dstArrayElement        = 0;
-            writeSet.descriptorCount        = 1;
-            writeSet.descriptorType         = getVulkanDescriptorType(b.first->m_type);
-            writeSet.pImageInfo             = nullptr;
-            writeSet.pBufferInfo            = nullptr;
-            writeSet.pTexelBufferView       = nullptr;
-
-
-            switch (b.first->m_type)
-            {
-            case CONSTANT_RESOURCE_TYPE_CONSTANT_BUFFER:
-            {
-                auto c = std::static_pointer_cast<ConstantBuffer_IVulkan>(b.first);
-                bufferInfos.push_back({ c->m_buffer, c->m_elementAlignedSize * i, c->m_elementSize }); // if buffer doesn't have per frame data "m_elementAlignedSize" is 0, and no offset is applied
-                writeSet.pBufferInfo = reinterpret_cast<VkDescriptorBufferInfo*>(bufferInfos.size()); // write (vector index + 1) instead of pointer
-                break;
-            }
-
-            case CONSTANT_RESOURCE_TYPE_CONSTANT_ARRAY:
-            {
-                auto c = std::static_pointer_cast<ConstantArray_IVulkan>(b.first);
-                bufferInfos.push_back({ c->m_buffer, c->m_elementAlignedSize * c->m_reservedElementCount * (c->m_perFrameData ? i : 0), c->m_elementAlignedSize });
-                writeSet.pBufferInfo = reinterpret_cast<VkDescriptorBufferInfo*>(bufferInfos.size()); // write (vector index + 1) instead of pointer
-
-                if (i == 0)
-                {
-                    m_arrayAlignedElementSizes.push_back(std::make_pair(c->m_elementAlignedSize, b.second));
-                    c->m_constantSetBindings.push_back(std::pair<ConstantSet_IVulkan*, uint32_t>(this, b.second));
-                }
-
-                break;
-            }
-
-            case CONSTANT_RESOURCE_TYPE_COMBINED_IMAGE_SAMPLER:
-            {
-                auto c = std::static_pointer_cast<Texture_IVulkan>(b.first);
-                imageInfos.push_back({ c->m_sampler, c->m_imageView, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL });
-                writeSet.pImageInfo = reinterpret_cast<VkDescriptorImageInfo*>(imageInfos.size()); // write (vector index + 1) instead of pointer
-
-                if (i == 0)
-                {
-                    c->m_constantSetBindings.push_back(std::pair<ConstantSet_IVulkan*, uint32_t>(this, b.second));
-                }
-
-                break;
-            }
-
-            default:
-            {
-                m_shader->m_logfile->print(RED, L"API ERROR: Unknown resource type!", MRN_DEBUG_INFO);
-                throw std::exception();
-            }
-            }
-
-            writeSets.push_back(writeSet);
-        }
-    }
+void moraine::ConstantSet_IVulkan::bind(VkCommandBuffer buffer, uint32_t frameIndex, const std::vector<uint32_t>& arrayIndicies)
+{
+    std::vector<uint32_t> offsets(m_dynamicOffsetCount);
 
-    for (auto& a : writeSets)
-        if (a.pBufferInfo != nullptr)
-            a.pBufferInfo = &bufferInfos[reinterpret_cast<size_t>(a.pBufferInfo) - 1];
-        else if (a.pImageInfo != nullptr)
-            a.pImageInfo = &imageInfos[reinterpret_cast<size_t>(a.pImageInfo) - 1];
+    VkDescriptorSet set = getBindState(frameIndex, arrayIndicies, offsets.data());
 
-    vkUpdateDescriptorSets(m_shader->m_context->m_device, static_cast<uint32_t>(writeSets.size()), writeSets.data(), 0, nullptr);
+    vkCmdBindDescriptorSets(buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, m_shader->m_layout, m_setIndex, 1, &set, static_cast<uint32_t>(offsets.size()), offsets.data());
 }
 
-void moraine::ConstantSet_IVulkan::updateDescriptorSet(std::pair<ConstantResource_T*, uint32_t> resource, uint32_t frameIndex)
+VkDescriptorSet moraine::ConstantSet_IVulkan::getBindState(uint32_t frameIndex, const std::vector<uint32_t>& arrayIndicies, uint32_t* out_dynamicOffsets)
 {
-    VkWriteDescriptorSet writeSet;
-    writeSet.sType                  = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-    writeSet.pNext                  = nullptr;
-    writeSet.dstSet                 = m_descriptorSets[frameIndex];
-    writeSet.dstBinding             = resource.second;
-    writeSet.dstArrayElement        = 0;
-    writeSet.descriptorCount        = 1;
-    writeSet.descriptorType         = getVulkanDescriptorType(resource.first->m_type);
-    writeSet.pImageInfo             = nullptr;
-    writeSet.pBufferInfo            = nullptr;
-    writeSet.pTexelBufferView       = nullptr;
-
-
-    switch (resource.first->m_type)
-    {
-    case CONSTANT_RESOURCE_TYPE_CONSTANT_BUFFER:
-    {
-        auto c = static_cast<ConstantBuffer_IVulkan*>(resource.first);
+    VkDescriptorSet set = getDescriptorSet(frameIndex, arrayIndicies.data(), arrayIndicies.size());
 
-        VkDescriptorBufferInfo bufferInfo;
-        bufferInfo.buffer           = c->m_buffer;
-        bufferInfo.offset           = c->m_elementAlignedSize * frameIndex;
-        bufferInfo.range            = c->m_elementSize;
+    // Instanced arrays are bound as a whole page and have no dynamic offset
+    for (size_t i = 0; i < arrayIndicies.size(); ++i)
+        if (not m_arrayBindings[i].instanced)
+            *out_dynamicOffsets++ = static_cast<uint32_t>(m_arrayBindings[i].alignedElementSize * m_arrayBindings[i].array->getSlot(m_arrayBindings[i].array->resolve(arrayIndicies[i])));
 
-        writeSet.pBufferInfo = &bufferInfo;
+    return set;
+}
 
-        vkUpdateDescriptorSets(m_shader->m_context->m_device, 1, &writeSet, 0, nullptr);
+uint32_t moraine::ConstantSet_IVulkan::getInstanceSlot(const std::vector<uint32_t>& arrayIndicies)
+{
+    for (size_t i = 0; i < arrayIndicies.size(); ++i)
+        if (m_arrayBindings[i].instanced)
+            return static_cast<uint32_t>(m_arrayBindings[i].alignedElementSize * m_arrayBindings[i].array->getSlot(m_arrayBindings[i].array->resolve(arrayIndicies[i])) / 16);
 
-        break;
-    }
+    return UINT32_MAX;
+}
 
-    case CONSTANT_RESOURCE_TYPE_CONSTANT_ARRAY:
+void moraine::ConstantSet_IVulkan::getDescriptorInfos(uint32_t page, uint32_t frame, DescriptorInfo_IVulkan* out_infos)
+{
+    for (auto& b : m_resources)
     {
-        auto c = static_cast<ConstantArray_IVulkan*>(resource.first);
-
-        VkDescriptorBufferInfo bufferInfo;
-        bufferInfo.buffer           = c->m_buffer;
-        bufferInfo.offset           = c->m_elementAlignedSize *  c->m_reservedElementCount * (c->m_perFrameData ? frameIndex : 0);
-        bufferInfo.range            = c->m_elementAlignedSize;
+        DescriptorInfo_IVulkan& info = out_infos[b.second];
 
-        writeSet.pBufferInfo = &bufferInfo;
-
-        vkUpdateDescriptorSets(m_shader->m_context->m_device, 1, &writeSet, 0, nullptr);
+        switch (b.first->m_type)
+        {
+        case CONSTANT_RESOURCE_TYPE_CONSTANT_BUFFER:
+        {
+            auto c = std::static_pointer_cast<ConstantBuffer_IVulkan>(b.first);
+            info.buffer = { c->m_buffer, c->m_elementAlignedSize * frame, c->m_elementSize }; // if buffer doesn't have per frame data "m_elementAlignedSize" is 0, and no offset is applied
+            break;
+        }
 
-        for(auto& a : m_arrayAlignedElementSizes)
-            if (a.second == resource.second)
-            {
-                a.first = c->m_elementAlignedSize;
-                break;
-            }
+        case CONSTANT_RESOURCE_TYPE_STORAGE_BUFFER:
+        {
+            auto c = std::static_pointer_cast<StorageBuffer_IVulkan>(b.first);
+            info.buffer = { c->m_buffer, c->m_elementAlignedSize * frame, c->m_elementSize }; // if buffer doesn't have per frame data "m_elementAlignedSize" is 0, and no offset is applied
+            break;
+        }
 
-        break;
-    }
+        case CONSTANT_RESOURCE_TYPE_CONSTANT_ARRAY:
+        {
+            auto c = std::static_pointer_cast<ConstantArray_IVulkan>(b.first);
+            uint32_t arrayPage = page < c->getPageCount() ? page : 0; // Arrays with fewer pages than the set are never bound with that page
+            bool instanced = std::find_if(m_arrayBindings.begin(), m_arrayBindings.end(), [&b](const ArrayBinding& binding) { return binding.binding == b.second; })->instanced;
 
-    case CONSTANT_RESOURCE_TYPE_COMBINED_IMAGE_SAMPLER:
-    {
-        auto c = static_cast<Texture_IVulkan*>(resource.first);
+            info.buffer = { c->m_pages[arrayPage].buffer, (c->m_elementAlignedSize << c->m_pageShift) * (c->m_perFrameData ? frame : 0), instanced ? c->m_elementAlignedSize << c->m_pageShift : c->m_elementAlignedSize };
+            break;
+        }
 
-        VkDescriptorImageInfo imageInfo;
-        imageInfo.sampler           = c->m_sampler;
-        imageInfo.imageView         = c->m_imageView;
-        imageInfo.imageLayout       = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+        case CONSTANT_RESOURCE_TYPE_COMBINED_IMAGE_SAMPLER:
+        {
+            auto c = std::static_pointer_cast<Texture_IVulkan>(b.first);
+            info.image = { c->m_sampler, c->m_imageView, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL };
+            break;
+        }
 
-        writeSet.pImageInfo = &imageInfo;
+        default:
+        {
+            m_shader->m_logfile->print(RED, L"API ERROR: Unknown resource type!", MRN_DEBUG_INFO);
+            throw std::exception();
+        }
+        }
+    }
+}
 
-        vkUpdateDescriptorSets(m_shader->m_context->m_device, 1, &writeSet, 0, nullptr);
-        break;
+void moraine::ConstantSet_IVulkan::writeDescriptorSets(uint32_t firstPage, uint32_t pageCount)
+{
+    auto allocator = m_shader->m_context->m_descriptorAllocator.get();
+    VkDescriptorSetLayout layout = m_shader->m_descriptorLayouts[m_setIndex];
 
-    }
+    std::vector<DescriptorInfo_IVulkan> infos(allocator->getInfoCount(layout));
 
-    default:
+    for (uint32_t i = firstPage * m_frameCount; i < (firstPage + pageCount) * m_frameCount; ++i)
     {
-        m_shader->m_logfile->print(RED, L"API ERROR: Unknown resource type!", MRN_DEBUG_INFO);
-        throw std::exception();
-    }
+        getDescriptorInfos(i / m_frameCount, i % m_frameCount, infos.data());
+        allocator->update(layout, m_descriptorSets[i], infos.data());
     }
 }
 
-VkDescriptorType moraine::ConstantSet_IVulkan::getVulkanDescriptorType(ConstantResourceType type)
+void moraine::ConstantSet_IVulkan::updateDescriptorSets(uint32_t frameIndex)
 {
-    switch (type)
+    // The template writes whole sets, descriptors of the other resources are written again with their current values
+    auto allocator = m_shader->m_context->m_descriptorAllocator.get();
+    VkDescriptorSetLayout layout = m_shader->m_descriptorLayouts[m_setIndex];
+
+    std::vector<DescriptorInfo_IVulkan> infos(allocator->getInfoCount(layout));
+
+    for (uint32_t page = 0; page < m_pageCount; ++page)
     {
-    case CONSTANT_RESOURCE_TYPE_CONSTANT_BUFFER:            return VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-    case CONSTANT_RESOURCE_TYPE_CONSTANT_ARRAY:             return VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
-    case CONSTANT_RESOURCE_TYPE_STORAGE_BUFFER:             return VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-    case CONSTANT_RESOURCE_TYPE_STORAGE_BUFFER_DYNAMIC:     return VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC;
-    case CONSTANT_RESOURCE_TYPE_COMBINED_IMAGE_SAMPLER:     return VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-    default:                                                return VK_DESCRIPTOR_TYPE_MAX_ENUM;
+        getDescriptorInfos(page, frameIndex, infos.data());
+        allocator->update(layout, m_descriptorSets[page * m_frameCount + frameIndex], infos.data());
     }
 }
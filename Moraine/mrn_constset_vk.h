@@ -5,6 +5,7 @@
 #include "mrn_shader_vk.h"
 #include "mrn_buffer_vk.h"
 #include "mrn_texture_vk.h"
+#include "mrn_descriptors_vk.h"
 
 #ifdef assert
 #undef assert
@@ -12,6 +13,8 @@
 
 namespace moraine
 {
+    class ConstantArray_IVulkan;
+
     class ConstantSet_IVulkan : public ConstantSet_T
     {
     public:
@@ -22,18 +25,39 @@ namespace moraine
         void bind(VkCommandBuffer buffer, uint32_t frameIndex, std::initializer_list<uint32_t> arrayIndicies);
         void bind(VkCommandBuffer buffer, uint32_t frameIndex, const std::vector<uint32_t>& arrayIndicies);
 
+        // Descriptor set and dynamic offsets bind() would use, out_dynamicOffsets receives m_dynamicOffsetCount offsets
+        VkDescriptorSet getBindState(uint32_t frameIndex, const std::vector<uint32_t>& arrayIndicies, uint32_t* out_dynamicOffsets);
+
+        // Offset of the element of the first instanced array in 16 byte units, UINT32_MAX if the set has no instanced array
+        uint32_t getInstanceSlot(const std::vector<uint32_t>& arrayIndicies);
 
-        void updateDescriptorSets(std::initializer_list<std::pair<ConstantResource, uint32_t>> resources);
-        void updateDescriptorSet(std::pair<ConstantResource_T*, uint32_t> resource, uint32_t frameIndex);
+        void addPage(uint32_t page); // Called by constant arrays when they grow, allocates and writes descriptor sets for the new page
+        void updateDescriptorSets(uint32_t frameIndex); // Rewrites the frame's sets of every page, called when a resource got a new buffer or image
 
-        VkDescriptorType getVulkanDescriptorType(ConstantResourceType type);
+        struct ArrayBinding
+        {
+            ConstantArray_IVulkan*  array;
+            size_t                  alignedElementSize;
+            uint32_t                binding;
+            bool                    instanced; // Bound as "instancedConstantArray": the whole page is one storage buffer
+        };
 
+        // One descriptor set per page of the bound constant arrays and frame: m_descriptorSets[page * m_frameCount + frame]
+        // The sets come from the context's DescriptorAllocator_IVulkan and are written with the update template of the set layout
         std::vector<VkDescriptorSet> m_descriptorSets;
-        VkDescriptorPool m_descriptorPool;
+        uint32_t m_pageCount;
         std::shared_ptr<Shader_IVulkan> m_shader;
         uint32_t m_setIndex;
+        uint32_t m_frameCount;
+        uint32_t m_dynamicOffsetCount; // Constant arrays that aren't instanced
+
+        std::vector<std::pair<ConstantResource, uint32_t>> m_resources;
+        std::vector<ArrayBinding> m_arrayBindings; // Constant arrays in the order their indicies are passed to bind()
+
+    private:
 
-        // Stores the aligned element sizes of constant arrays and storage arrays
-        std::vector<std::pair<size_t, uint32_t>> m_arrayAlignedElementSizes; // first: elementSize, second: binding
+        void writeDescriptorSets(uint32_t firstPage, uint32_t pageCount);
+        void getDescriptorInfos(uint32_t page, uint32_t frame, DescriptorInfo_IVulkan* out_infos); // out_infos is indexed by binding
+        VkDescriptorSet getDescriptorSet(uint32_t frameIndex, const uint32_t* arrayIndicies, size_t arrayIndexCount);
     };
 }
\ No newline at end of file
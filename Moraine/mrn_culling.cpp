@@ -0,0 +1,62 @@
+#include "mrn_core.h"
+#include "mrn_culling.h"
+
+moraine::Frustum moraine::createFrustum(const float viewProjection[16])
+{
+    // Gribb/Hartmann: the planes are sums and differences of the matrix rows, -w <= x, y <= w and 0 <= z <= w in clip space
+    auto row = [viewProjection](uint32_t i) { return float4(viewProjection[i], viewProjection[4 + i], viewProjection[8 + i], viewProjection[12 + i]); };
+
+    float4 x = row(0), y = row(1), z = row(2), w = row(3);
+
+    Frustum frustum;
+    frustum.planes[0] = w + x;   // left
+    frustum.planes[1] = w - x;   // right
+    frustum.planes[2] = w + y;   // top
+    frustum.planes[3] = w - y;   // bottom
+    frustum.planes[4] = z;       // near
+    frustum.planes[5] = w - z;   // far
+    frustum.planeCount = 6;
+
+    // Normalized so w is a distance and the radius of the bounds can be compared against it
+    for (auto& a : frustum.planes)
+        a /= length(float3(a.m_sse));
+
+    return frustum;
+}
+
+moraine::Frustum moraine::createFrustum(const RectangleF& viewport)
+{
+    Frustum frustum;
+    frustum.planes[0] = float4(+1.0f, 0.0f, 0.0f, -viewport.x);
+    frustum.planes[1] = float4(-1.0f, 0.0f, 0.0f, viewport.x + viewport.width);
+    frustum.planes[2] = float4(0.0f, +1.0f, 0.0f, -viewport.y);
+    frustum.planes[3] = float4(0.0f, -1.0f, 0.0f, viewport.y + viewport.height);
+    frustum.planeCount = 4;
+
+    return frustum;
+}
+
+moraine::FrustumCuller::FrustumCuller(const Frustum& frustum)
+{
+    float4 planes[8];
+
+    for (uint32_t i = 0; i < 8; ++i)
+        planes[i] = i < frustum.planeCount ? frustum.planes[i] : float4(0.0f, 0.0f, 0.0f, 1.0f);
+
+    __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+
+    for (uint32_t i = 0; i < 2; ++i)
+    {
+        __m128 a = planes[i * 4 + 0].m_sse, b = planes[i * 4 + 1].m_sse, c = planes[i * 4 + 2].m_sse, d = planes[i * 4 + 3].m_sse;
+        _MM_TRANSPOSE4_PS(a, b, c, d);
+
+        m_x[i] = a;
+        m_y[i] = b;
+        m_z[i] = c;
+        m_w[i] = d;
+
+        m_absX[i] = _mm_and_ps(a, absMask);
+        m_absY[i] = _mm_and_ps(b, absMask);
+        m_absZ[i] = _mm_and_ps(c, absMask);
+    }
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include "mrn_math.h"
+
+namespace moraine
+{
+    // A box with rounded corners: points within radius of the box are inside. Spheres have no extent, boxes no radius
+    struct Bounds
+    {
+        float3  center;
+        float3  halfExtent;
+        float   radius;
+    };
+
+    inline Bounds createSphereBounds(float3 center, float radius)           { return { center, float3(0.0f), radius }; }
+    inline Bounds createBoxBounds(float3 min, float3 max)                   { return { 0.5f * float3(_mm_add_ps(min.m_sse, max.m_sse)), 0.5f * float3(_mm_sub_ps(max.m_sse, min.m_sse)), 0.0f }; }
+    inline Bounds createRectBounds(const RectangleF& rect)                  { return createBoxBounds(float3(rect.x, rect.y, 0.0f), float3(rect.x + rect.width, rect.y + rect.height, 0.0f)); }
+
+    // Planes with the normal in xyz and the distance in w, a point p is on the visible side of a plane if dot(normal, p) + w >= 0
+    struct Frustum
+    {
+        float4      planes[6];
+        uint32_t    planeCount;
+    };
+
+    // viewProjection is column major (as in GLSL) and maps to Vulkan's clip space, where z goes from 0 to 1
+    MRN_API Frustum createFrustum(const float viewProjection[16]);
+
+    // 2D frustum for objects in viewport coordinates, e.g. GraphicsString positions in pixels. z is ignored
+    MRN_API Frustum createFrustum(const RectangleF& viewport);
+
+    // Tests bounds against four planes at a time, the planes are stored transposed so one register holds the x of four normals
+    class FrustumCuller
+    {
+    public:
+
+        MRN_API FrustumCuller(const Frustum& frustum);
+
+        inline bool isVisible(const Bounds& bounds) const
+        {
+            __m128 cx = _mm_shuffle_ps(bounds.center.m_sse, bounds.center.m_sse, _MM_SHUFFLE(0, 0, 0, 0));
+            __m128 cy = _mm_shuffle_ps(bounds.center.m_sse, bounds.center.m_sse, _MM_SHUFFLE(1, 1, 1, 1));
+            __m128 cz = _mm_shuffle_ps(bounds.center.m_sse, bounds.center.m_sse, _MM_SHUFFLE(2, 2, 2, 2));
+            __m128 ex = _mm_shuffle_ps(bounds.halfExtent.m_sse, bounds.halfExtent.m_sse, _MM_SHUFFLE(0, 0, 0, 0));
+            __m128 ey = _mm_shuffle_ps(bounds.halfExtent.m_sse, bounds.halfExtent.m_sse, _MM_SHUFFLE(1, 1, 1, 1));
+            __m128 ez = _mm_shuffle_ps(bounds.halfExtent.m_sse, bounds.halfExtent.m_sse, _MM_SHUFFLE(2, 2, 2, 2));
+            __m128 r = _mm_set_ps1(bounds.radius);
+
+            __m128 outside = _mm_setzero_ps();
+
+            for (uint32_t i = 0; i < 2; ++i)
+            {
+                // Signed distance of the center plus how far the bounds reach towards the plane
+                __m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(m_x[i], cx), _mm_mul_ps(m_y[i], cy)), _mm_add_ps(_mm_mul_ps(m_z[i], cz), m_w[i]));
+                __m128 reach = _mm_add_ps(_mm_add_ps(_mm_mul_ps(m_absX[i], ex), _mm_mul_ps(m_absY[i], ey)), _mm_add_ps(_mm_mul_ps(m_absZ[i], ez), r));
+
+                outside = _mm_or_ps(outside, _mm_cmplt_ps(_mm_add_ps(distance, reach), _mm_setzero_ps()));
+            }
+
+            return _mm_movemask_ps(outside) == 0;
+        }
+
+    private:
+
+        __m128 m_x[2], m_y[2], m_z[2], m_w[2]; // Missing planes are 0, 0, 0, 1, which everything is in front of
+        __m128 m_absX[2], m_absY[2], m_absZ[2];
+    };
+}
@@ -0,0 +1,378 @@
+#include "mrn_core.h"
+#include "mrn_descriptors_vk.h"
+
+moraine::DescriptorAllocator_IVulkan::DescriptorAllocator_IVulkan(GraphicsContext_IVulkan* context) :
+    m_context(context), // Raw pointer, the context owns the allocator
+    m_frameCounter(0)
+{
+    m_context->m_flushableResources.push_back(this);
+}
+
+moraine::DescriptorAllocator_IVulkan::~DescriptorAllocator_IVulkan()
+{
+    m_context->m_flushableResources.erase(std::find(m_context->m_flushableResources.begin(), m_context->m_flushableResources.end(), this));
+
+    for (const auto& a : m_layouts)
+    {
+        for (const auto& b : a.second.pools)
+            vkDestroyDescriptorPool(m_context->m_device, b, nullptr);
+
+        if (a.second.updateTemplate != VK_NULL_HANDLE)
+            vkDestroyDescriptorUpdateTemplate(m_context->m_device, a.second.updateTemplate, nullptr);
+    }
+
+    for (const auto& a : m_retiredPools)
+        vkDestroyDescriptorPool(m_context->m_device, a.second, nullptr);
+}
+
+moraine::DescriptorAllocator_IVulkan::Layout& moraine::DescriptorAllocator_IVulkan::getLayout(VkDescriptorSetLayout layout, const std::vector<VkDescriptorSetLayoutBinding>* bindings)
+{
+    auto entry = m_layouts.find(layout);
+
+    if (entry != m_layouts.end())
+        return entry->second;
+
+    assert(m_context->getLogfile(), bindings != nullptr, L"Wrong API Usage: No descriptor set of this layout was allocated yet!", MRN_DEBUG_INFO);
+
+    Layout& l = m_layouts[layout];
+    l.poolSetsLeft = 0;
+    l.updateTemplate = VK_NULL_HANDLE;
+    l.infoCount = 0;
+
+    std::vector<VkDescriptorUpdateTemplateEntry> entries;
+
+    for (const auto& a : *bindings)
+    {
+        auto poolSize = std::find_if(l.poolSizes.begin(), l.poolSizes.end(), [&a](const VkDescriptorPoolSize& poolSize) { return poolSize.type == a.descriptorType; });
+
+        if (poolSize == l.poolSizes.end())
+            l.poolSizes.push_back({ a.descriptorType, a.descriptorCount * s_setsPerPool });
+        else
+            poolSize->descriptorCount += a.descriptorCount * s_setsPerPool;
+
+        VkDescriptorUpdateTemplateEntry vdute;
+        vdute.dstBinding                        = a.binding;
+        vdute.dstArrayElement                   = 0;
+        vdute.descriptorCount                   = 1;
+        vdute.descriptorType                    = a.descriptorType;
+        vdute.offset                            = a.binding * sizeof(DescriptorInfo_IVulkan);
+        vdute.stride                            = sizeof(DescriptorInfo_IVulkan);
+
+        entries.push_back(vdute);
+        l.infoCount = max(l.infoCount, a.binding + 1);
+    }
+
+    // Templates need at least one entry, sets without bindings are never written
+    if (not entries.empty())
+    {
+        VkDescriptorUpdateTemplateCreateInfo vdutci;
+        vdutci.sType                            = VK_STRUCTURE_TYPE_DESCRIPTOR_UPDATE_TEMPLATE_CREATE_INFO;
+        vdutci.pNext                            = nullptr;
+        vdutci.flags                            = 0;
+        vdutci.descriptorUpdateEntryCount       = static_cast<uint32_t>(entries.size());
+        vdutci.pDescriptorUpdateEntries         = entries.data();
+        vdutci.templateType                     = VK_DESCRIPTOR_UPDATE_TEMPLATE_TYPE_DESCRIPTOR_SET;
+        vdutci.descriptorSetLayout              = layout;
+        vdutci.pipelineBindPoint                = VK_PIPELINE_BIND_POINT_GRAPHICS;
+        vdutci.pipelineLayout                   = VK_NULL_HANDLE;
+        vdutci.set                              = 0;
+
+        assert_vulkan(m_context->getLogfile(), vkCreateDescriptorUpdateTemplate(m_context->m_device, &vdutci, nullptr, &l.updateTemplate), L"vkCreateDescriptorUpdateTemplate() failed", MRN_DEBUG_INFO);
+    }
+
+    return l;
+}
+
+void moraine::DescriptorAllocator_IVulkan::alloc(VkDescriptorSetLayout layout, const std::vector<VkDescriptorSetLayoutBinding>& bindings, uint32_t count, VkDescriptorSet* out_sets)
+{
+    Layout& l = getLayout(layout, &bindings);
+
+    uint32_t allocated = min(count, static_cast<uint32_t>(l.freeSets.size()));
+
+    std::copy(l.freeSets.end() - allocated, l.freeSets.end(), out_sets);
+    l.freeSets.resize(l.freeSets.size() - allocated);
+
+    while (allocated < count)
+    {
+        if (l.poolSetsLeft == 0)
+        {
+            VkDescriptorPoolCreateInfo vdpci;
+            vdpci.sType                         = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+            vdpci.pNext                         = nullptr;
+            vdpci.flags                         = 0; // Sets are never freed to the pool, they are recycled through freeSets
+            vdpci.maxSets                       = s_setsPerPool;
+            vdpci.poolSizeCount                 = static_cast<uint32_t>(l.poolSizes.size());
+            vdpci.pPoolSizes                    = l.poolSizes.data();
+
+            VkDescriptorPool pool;
+            assert_vulkan(m_context->getLogfile(), vkCreateDescriptorPool(m_context->m_device, &vdpci, nullptr, &pool), L"vkCreateDescriptorPool() failed", MRN_DEBUG_INFO);
+
+            l.pools.push_back(pool);
+            l.poolSetsLeft = s_setsPerPool;
+        }
+
+        uint32_t batch = min(count - allocated, l.poolSetsLeft);
+
+        std::vector<VkDescriptorSetLayout> layouts(batch, layout);
+
+        VkDescriptorSetAllocateInfo vdsai;
+        vdsai.sType                             = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+        vdsai.pNext                             = nullptr;
+        vdsai.descriptorPool                    = l.pools.back();
+        vdsai.descriptorSetCount                = batch;
+        vdsai.pSetLayouts                       = layouts.data();
+
+        assert_vulkan(m_context->getLogfile(), vkAllocateDescriptorSets(m_context->m_device, &vdsai, out_sets + allocated), L"vkAllocateDescriptorSets() failed", MRN_DEBUG_INFO);
+
+        l.poolSetsLeft -= batch;
+        allocated += batch;
+    }
+}
+
+void moraine::DescriptorAllocator_IVulkan::free(VkDescriptorSetLayout layout, const VkDescriptorSet* sets, uint32_t count)
+{
+    for (uint32_t i = 0; i < count; ++i)
+        m_pendingFrees.push_back({ m_frameCounter + m_context->m_framesInFlight, { layout, sets[i] } });
+}
+
+void moraine::DescriptorAllocator_IVulkan::update(VkDescriptorSetLayout layout, VkDescriptorSet set, const DescriptorInfo_IVulkan* infos)
+{
+    Layout& l = getLayout(layout, nullptr);
+
+    if (l.updateTemplate != VK_NULL_HANDLE)
+        vkUpdateDescriptorSetWithTemplate(m_context->m_device, set, l.updateTemplate, infos);
+}
+
+uint32_t moraine::DescriptorAllocator_IVulkan::getInfoCount(VkDescriptorSetLayout layout)
+{
+    return getLayout(layout, nullptr).infoCount;
+}
+
+void moraine::DescriptorAllocator_IVulkan::releaseLayout(VkDescriptorSetLayout layout)
+{
+    auto entry = m_layouts.find(layout);
+
+    if (entry == m_layouts.end())
+        return;
+
+    // Sets of the layout are freed with their pools, which the GPU could still read from
+    for (const auto& a : entry->second.pools)
+        m_retiredPools.push_back({ m_frameCounter + m_context->m_framesInFlight, a });
+
+    m_pendingFrees.erase(std::remove_if(m_pendingFrees.begin(), m_pendingFrees.end(), [layout](const std::pair<uint64_t, std::pair<VkDescriptorSetLayout, VkDescriptorSet>>& pendingFree)
+    {
+        return pendingFree.second.first == layout;
+    }), m_pendingFrees.end());
+
+    if (entry->second.updateTemplate != VK_NULL_HANDLE)
+        vkDestroyDescriptorUpdateTemplate(m_context->m_device, entry->second.updateTemplate, nullptr);
+
+    m_layouts.erase(entry);
+}
+
+void moraine::DescriptorAllocator_IVulkan::flushFrame(uint32_t frameIndex)
+{
+    ++m_frameCounter;
+
+    while (not m_pendingFrees.empty() and m_pendingFrees.front().first <= m_frameCounter)
+    {
+        m_layouts[m_pendingFrees.front().second.first].freeSets.push_back(m_pendingFrees.front().second.second);
+        m_pendingFrees.pop_front();
+    }
+
+    while (not m_retiredPools.empty() and m_retiredPools.front().first <= m_frameCounter)
+    {
+        vkDestroyDescriptorPool(m_context->m_device, m_retiredPools.front().second, nullptr);
+        m_retiredPools.pop_front();
+    }
+}
+
+
+moraine::BindlessTable_IVulkan::BindlessTable_IVulkan(GraphicsContext_IVulkan* context) :
+    m_context(context), // Raw pointer, the context owns the table
+    m_frameCounter(0)
+{
+    VkPhysicalDeviceDescriptorIndexingPropertiesEXT indexingProperties = { };
+    indexingProperties.sType                    = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_PROPERTIES_EXT;
+
+    VkPhysicalDeviceProperties2 vpdp2 = { };
+    vpdp2.sType                                 = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+    vpdp2.pNext                                 = &indexingProperties;
+
+    vkGetPhysicalDeviceProperties2(m_context->m_physicalDevice.device, &vpdp2); // Core in Vulkan 1.1
+
+    // A pipeline layout with the table counts all of its descriptors against the update after bind limits, so the constant sets
+    // bound next to the table keep some headroom. Combined image samplers count as sampler and as sampled image
+    auto headroom = [](uint32_t limit) { return limit > s_reservedDescriptors ? limit - s_reservedDescriptors : 0; };
+
+    m_textures.capacity = min(s_maxTextures, headroom(min(min(indexingProperties.maxPerStageDescriptorUpdateAfterBindSampledImages, indexingProperties.maxDescriptorSetUpdateAfterBindSampledImages),
+                                                          min(indexingProperties.maxPerStageDescriptorUpdateAfterBindSamplers, indexingProperties.maxDescriptorSetUpdateAfterBindSamplers))));
+    m_textures.used = 0;
+    m_buffers.capacity = min(s_maxBuffers, headroom(min(indexingProperties.maxPerStageDescriptorUpdateAfterBindStorageBuffers, indexingProperties.maxDescriptorSetUpdateAfterBindStorageBuffers)));
+    m_buffers.used = 0;
+
+    // Both bindings are visible to the same stages, together they have to fit into the resources of one stage
+    uint32_t resources = headroom(indexingProperties.maxPerStageUpdateAfterBindResources);
+
+    if (m_textures.capacity + m_buffers.capacity > resources)
+    {
+        m_buffers.capacity = min(m_buffers.capacity, resources / 2);
+        m_textures.capacity = min(m_textures.capacity, resources - m_buffers.capacity);
+    }
+
+    assert(m_context->getLogfile(), m_textures.capacity > 0 and m_buffers.capacity > 0, L"The update after bind limits of the device leave no room for the bindless table!", MRN_DEBUG_INFO);
+
+    VkDescriptorSetLayoutBinding bindings[2];
+    bindings[0].binding                         = 0;
+    bindings[0].descriptorType                  = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    bindings[0].descriptorCount                 = m_textures.capacity;
+    bindings[0].stageFlags                      = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT;
+    bindings[0].pImmutableSamplers              = nullptr;
+    bindings[1].binding                         = 1;
+    bindings[1].descriptorType                  = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    bindings[1].descriptorCount                 = m_buffers.capacity;
+    bindings[1].stageFlags                      = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT;
+    bindings[1].pImmutableSamplers              = nullptr;
+
+    // Recorded command buffers are kept while resources are added, indicies that aren't handed out are never read
+    VkDescriptorBindingFlagsEXT bindingFlags[2];
+    bindingFlags[0]                             = VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT_EXT | VK_DESCRIPTOR_BINDING_UPDATE_UNUSED_WHILE_PENDING_BIT_EXT | VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT_EXT;
+    bindingFlags[1]                             = bindingFlags[0];
+
+    VkDescriptorSetLayoutBindingFlagsCreateInfoEXT vdslbfci;
+    vdslbfci.sType                              = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO_EXT;
+    vdslbfci.pNext                              = nullptr;
+    vdslbfci.bindingCount                       = 2;
+    vdslbfci.pBindingFlags                      = bindingFlags;
+
+    VkDescriptorSetLayoutCreateInfo vdslci;
+    vdslci.sType                                = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    vdslci.pNext                                = &vdslbfci;
+    vdslci.flags                                = VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT_EXT;
+    vdslci.bindingCount                         = 2;
+    vdslci.pBindings                            = bindings;
+
+    assert_vulkan(m_context->getLogfile(), vkCreateDescriptorSetLayout(m_context->m_device, &vdslci, nullptr, &m_layout), L"vkCreateDescriptorSetLayout() failed", MRN_DEBUG_INFO);
+
+    VkDescriptorPoolSize poolSizes[2] =
+    {
+        { VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, m_textures.capacity * m_context->m_framesInFlight },
+        { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, m_buffers.capacity * m_context->m_framesInFlight }
+    };
+
+    VkDescriptorPoolCreateInfo vdpci;
+    vdpci.sType                                 = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    vdpci.pNext                                 = nullptr;
+    vdpci.flags                                 = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT_EXT;
+    vdpci.maxSets                               = m_context->m_framesInFlight;
+    vdpci.poolSizeCount                         = 2;
+    vdpci.pPoolSizes                            = poolSizes;
+
+    assert_vulkan(m_context->getLogfile(), vkCreateDescriptorPool(m_context->m_device, &vdpci, nullptr, &m_pool), L"vkCreateDescriptorPool() failed", MRN_DEBUG_INFO);
+
+    std::vector<VkDescriptorSetLayout> layouts(m_context->m_framesInFlight, m_layout);
+    m_sets.resize(m_context->m_framesInFlight);
+
+    VkDescriptorSetAllocateInfo vdsai;
+    vdsai.sType                                 = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    vdsai.pNext                                 = nullptr;
+    vdsai.descriptorPool                        = m_pool;
+    vdsai.descriptorSetCount                    = m_context->m_framesInFlight;
+    vdsai.pSetLayouts                           = layouts.data();
+
+    assert_vulkan(m_context->getLogfile(), vkAllocateDescriptorSets(m_context->m_device, &vdsai, m_sets.data()), L"vkAllocateDescriptorSets() failed", MRN_DEBUG_INFO);
+
+    m_context->m_flushableResources.push_back(this);
+
+    m_context->getLogfile()->print(YELLOW, sprintf(L"Created bindless table (%d textures, %d storage buffers)", m_textures.capacity, m_buffers.capacity), MRN_DEBUG_INFO);
+}
+
+moraine::BindlessTable_IVulkan::~BindlessTable_IVulkan()
+{
+    m_context->m_flushableResources.erase(std::find(m_context->m_flushableResources.begin(), m_context->m_flushableResources.end(), this));
+
+    vkDestroyDescriptorPool(m_context->m_device, m_pool, nullptr);
+    vkDestroyDescriptorSetLayout(m_context->m_device, m_layout, nullptr);
+}
+
+uint32_t moraine::BindlessTable_IVulkan::allocSlot(Slots& slots, const wchar_t* name)
+{
+    if (not slots.freeSlots.empty())
+    {
+        uint32_t index = slots.freeSlots.back();
+        slots.freeSlots.pop_back();
+        return index;
+    }
+
+    assert(m_context->getLogfile(), slots.used < slots.capacity, sprintf(L"The bindless table has no space for more than %d %s!", slots.capacity, name), MRN_DEBUG_INFO);
+
+    return slots.used++;
+}
+
+void moraine::BindlessTable_IVulkan::write(uint32_t frameIndex, uint32_t binding, uint32_t index, const VkDescriptorImageInfo* imageInfo, const VkDescriptorBufferInfo* bufferInfo)
+{
+    VkWriteDescriptorSet writeSet;
+    writeSet.sType                              = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    writeSet.pNext                              = nullptr;
+    writeSet.dstSet                             = m_sets[frameIndex];
+    writeSet.dstBinding                         = binding;
+    writeSet.dstArrayElement                    = index;
+    writeSet.descriptorCount                    = 1;
+    writeSet.descriptorType                     = imageInfo ? VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER : VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    writeSet.pImageInfo                         = imageInfo;
+    writeSet.pBufferInfo                        = bufferInfo;
+    writeSet.pTexelBufferView                   = nullptr;
+
+    vkUpdateDescriptorSets(m_context->m_device, 1, &writeSet, 0, nullptr);
+}
+
+uint32_t moraine::BindlessTable_IVulkan::addTexture(VkImageView imageView, VkSampler sampler)
+{
+    uint32_t index = allocSlot(m_textures, L"textures");
+
+    for (uint32_t i = 0; i < m_context->m_framesInFlight; ++i)
+        updateTexture(index, imageView, sampler, i);
+
+    return index;
+}
+
+void moraine::BindlessTable_IVulkan::updateTexture(uint32_t index, VkImageView imageView, VkSampler sampler, uint32_t frameIndex)
+{
+    VkDescriptorImageInfo imageInfo = { sampler, imageView, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL };
+    write(frameIndex, 0, index, &imageInfo, nullptr);
+}
+
+void moraine::BindlessTable_IVulkan::removeTexture(uint32_t index)
+{
+    m_textures.pendingFrees.push_back({ m_frameCounter + m_context->m_framesInFlight, index });
+}
+
+uint32_t moraine::BindlessTable_IVulkan::addBuffer(VkBuffer buffer, VkDeviceSize range, VkDeviceSize frameStride)
+{
+    uint32_t index = allocSlot(m_buffers, L"storage buffers");
+
+    for (uint32_t i = 0; i < m_context->m_framesInFlight; ++i)
+    {
+        VkDescriptorBufferInfo bufferInfo = { buffer, frameStride * i, range };
+        write(i, 1, index, nullptr, &bufferInfo);
+    }
+
+    return index;
+}
+
+void moraine::BindlessTable_IVulkan::removeBuffer(uint32_t index)
+{
+    m_buffers.pendingFrees.push_back({ m_frameCounter + m_context->m_framesInFlight, index });
+}
+
+void moraine::BindlessTable_IVulkan::flushFrame(uint32_t frameIndex)
+{
+    ++m_frameCounter;
+
+    for (Slots* slots : { &m_textures, &m_buffers })
+        while (not slots->pendingFrees.empty() and slots->pendingFrees.front().first <= m_frameCounter)
+        {
+            slots->freeSlots.push_back(slots->pendingFrees.front().second);
+            slots->pendingFrees.pop_front();
+        }
+}
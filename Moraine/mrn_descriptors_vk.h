@@ -0,0 +1,117 @@
+#pragma once
+
+#include "mrn_gfxcontext_vk.h"
+
+#include <deque>
+#include <unordered_map>
+
+namespace moraine
+{
+    // Element of the data vkUpdateDescriptorSetWithTemplate() reads, the descriptor of binding b is element b
+    union DescriptorInfo_IVulkan
+    {
+        VkDescriptorBufferInfo  buffer;
+        VkDescriptorImageInfo   image;
+    };
+
+    // Descriptor sets of all constant sets. Every set layout gets its own pools of s_setsPerPool sets, so a pool never fragments: freed sets
+    // go to a free list of their layout and are handed out again before a new pool is created. Layouts also get an update template that
+    // writes descriptor 0 of every binding from an array of DescriptorInfo_IVulkan. Only used by the thread that ticks the renderer
+    class DescriptorAllocator_IVulkan : public FlushableResource_IVulkan
+    {
+    public:
+
+        DescriptorAllocator_IVulkan(GraphicsContext_IVulkan* context);
+        ~DescriptorAllocator_IVulkan() override;
+
+        DescriptorAllocator_IVulkan(const DescriptorAllocator_IVulkan&) = delete;
+        DescriptorAllocator_IVulkan& operator=(const DescriptorAllocator_IVulkan&) = delete;
+
+        // bindings are the ones layout was created with, they are only read the first time the layout is seen
+        void alloc(VkDescriptorSetLayout layout, const std::vector<VkDescriptorSetLayoutBinding>& bindings, uint32_t count, VkDescriptorSet* out_sets);
+        void free(VkDescriptorSetLayout layout, const VkDescriptorSet* sets, uint32_t count); // The sets are reused once frames that might bind them have finished
+
+        // infos holds one element per binding number up to the highest binding of the layout
+        void update(VkDescriptorSetLayout layout, VkDescriptorSet set, const DescriptorInfo_IVulkan* infos);
+        uint32_t getInfoCount(VkDescriptorSetLayout layout);
+
+        void releaseLayout(VkDescriptorSetLayout layout); // Called by the shader object cache before it destroys a layout, its handle could be reused
+
+        void flushFrame(uint32_t frameIndex) override; // Returns sets freed a swapchain length ago to the free lists, destroys pools of released layouts
+
+    private:
+
+        struct Layout
+        {
+            std::vector<VkDescriptorPoolSize>   poolSizes; // For a whole pool
+            std::vector<VkDescriptorPool>       pools;
+            uint32_t                            poolSetsLeft; // Sets that can still be allocated from the last pool
+            std::vector<VkDescriptorSet>        freeSets;
+            VkDescriptorUpdateTemplate          updateTemplate;
+            uint32_t                            infoCount;
+        };
+
+        Layout& getLayout(VkDescriptorSetLayout layout, const std::vector<VkDescriptorSetLayoutBinding>* bindings);
+
+        static constexpr uint32_t s_setsPerPool = 64;
+
+        GraphicsContext_IVulkan*                                        m_context;
+        std::unordered_map<VkDescriptorSetLayout, Layout>               m_layouts;
+
+        uint64_t                                                        m_frameCounter;
+        std::deque<std::pair<uint64_t, std::pair<VkDescriptorSetLayout, VkDescriptorSet>>> m_pendingFrees; // first: frame counter value after which the set can be reused
+        std::deque<std::pair<uint64_t, VkDescriptorPool>>               m_retiredPools; // Pools of released layouts, destroyed after the given frame counter value
+    };
+
+    // The global descriptor set of the bindless mode (GraphicsContextDesc::bindless, VK_EXT_descriptor_indexing). Binding 0 is an array of every texture,
+    // binding 1 an array of every constant array page as storage buffer. Resources keep their index for their lifetime, so objects that only differ
+    // in their textures share one set and are merged into the same batches. Shaders select the set they find the table in with "bindlessSet".
+    // There is one set per frame in flight, the descriptors of per frame constant arrays point to the frame's copy
+    class BindlessTable_IVulkan : public FlushableResource_IVulkan
+    {
+    public:
+
+        BindlessTable_IVulkan(GraphicsContext_IVulkan* context);
+        ~BindlessTable_IVulkan() override;
+
+        BindlessTable_IVulkan(const BindlessTable_IVulkan&) = delete;
+        BindlessTable_IVulkan& operator=(const BindlessTable_IVulkan&) = delete;
+
+        uint32_t addTexture(VkImageView imageView, VkSampler sampler);
+        void updateTexture(uint32_t index, VkImageView imageView, VkSampler sampler, uint32_t frameIndex); // Only the frame's set, the others may be in use
+        void removeTexture(uint32_t index); // The index is reused once frames that might read it have finished
+
+        uint32_t addBuffer(VkBuffer buffer, VkDeviceSize range, VkDeviceSize frameStride); // Frame f reads range bytes at f * frameStride
+        void removeBuffer(uint32_t index);
+
+        VkDescriptorSetLayout getLayout() const { return m_layout; }
+        VkDescriptorSet getSet(uint32_t frameIndex) const { return m_sets[frameIndex]; }
+
+        void flushFrame(uint32_t frameIndex) override; // Returns indicies removed a swapchain length ago to the free lists
+
+    private:
+
+        struct Slots
+        {
+            uint32_t                                    capacity;
+            uint32_t                                    used; // Indicies above were never handed out
+            std::vector<uint32_t>                       freeSlots;
+            std::deque<std::pair<uint64_t, uint32_t>>   pendingFrees; // first: frame counter value after which the index can be reused
+        };
+
+        uint32_t allocSlot(Slots& slots, const wchar_t* name);
+        void write(uint32_t frameIndex, uint32_t binding, uint32_t index, const VkDescriptorImageInfo* imageInfo, const VkDescriptorBufferInfo* bufferInfo);
+
+        static constexpr uint32_t s_maxTextures = 4096;
+        static constexpr uint32_t s_maxBuffers = 4096;
+        static constexpr uint32_t s_reservedDescriptors = 256; // Per type and stage, left to the constant sets in the same pipeline layouts
+
+        GraphicsContext_IVulkan*                        m_context;
+        VkDescriptorSetLayout                           m_layout;
+        VkDescriptorPool                                m_pool;
+        std::vector<VkDescriptorSet>                    m_sets; // One per frame in flight
+        Slots                                           m_textures;
+        Slots                                           m_buffers;
+        uint64_t                                        m_frameCounter;
+    };
+}
@@ -39,7 +39,6 @@ namespace moraine
         //void allocUndefinedChars(Stringr chars);
 
         constexpr const static wchar_t* s_fontShaderPath = L"C:\\dev\\Moraine\\Env1\\res\\shaders\\font\\shader.json";
-        static std::weak_ptr<Shader_T> s_fontShader;
 
         Allocation      m_ttfFile;
         stbtt_fontinfo  m_fontInfo;
@@ -72,13 +71,7 @@ moraine::Font_I::Font_I(GraphicsContext context, Stringr ttfPath, uint32_t maxPi
 
     stbtt_GetFontVMetrics(&m_fontInfo, &m_ascent, &m_descent, &m_lineGap);
 
-    if (s_fontShader.expired())
-    {
-        m_fontShader = createShader(s_fontShaderPath, context);
-        s_fontShader = m_fontShader;
-    }
-    else
-        m_fontShader = s_fontShader.lock();
+    m_fontShader = createShader(s_fontShaderPath, context); // Fonts share the pipeline through the context's shader object cache
 
     m_atlas = createTextureAtlas(context, IMAGE_COLOR_CHANNELS_BW, 2048);
 
@@ -163,6 +156,4 @@ moraine::Font_I::FontChar moraine::Font_I::findOrAllocChar(wchar_t character) co
 moraine::Font moraine::createFont(GraphicsContext context, Stringr ttfFile, uint32_t maxPixelHeight)
 {
     return std::make_shared<Font_I>(context, ttfFile, maxPixelHeight);
-}
-
-std::weak_ptr<moraine::Shader_T> moraine::Font_I::s_fontShader;
\ No newline at end of file
+}
\ No newline at end of file
@@ -6,6 +6,6 @@
 moraine::GraphicsContext moraine::createGraphicsContext(const GraphicsContextDesc& desc, Logfile logfile, Window window)
 {
     GraphicsContext context = std::make_shared<GraphicsContext_IVulkan>(desc, std::move(logfile), std::move(window));
-    context->m_stagingStack = createStagingStack(context, 10 * 1024 * 1024); // 10MB
+    context->m_stagingRing = createStagingRing(context, 10 * 1024 * 1024); // 10MB blocks
     return context;
 }
\ No newline at end of file
@@ -5,13 +5,24 @@
 
 namespace moraine
 {
-    class StagingStack_T;
-    typedef std::shared_ptr<StagingStack_T> StagingStack;
-
+    // The device must support VK_KHR_timeline_semaphore, creating the context fails otherwise
     struct GraphicsContextDesc
     {
-        String  applicationName;
-        bool    enableValidation;
+        String      applicationName;
+        bool        enableValidation;
+        uint32_t    framesInFlight = 2; // 1 to 4, frames the CPU prepares while the GPU still works on earlier ones. Independent of the swapchain length
+
+        // Headless contexts render into offscreen images instead of a window's swapchain, the window passed to createGraphicsContext() may be nullptr
+        bool        headless = false;
+        uint32_t    headlessWidth = 1280;
+        uint32_t    headlessHeight = 720;
+        uint32_t    renderTargetCount = 3; // Offscreen images the frames rotate through, at least framesInFlight
+
+        String      pipelineCachePath; // Compiled pipelines are kept in this file between runs, no file is written if it is empty
+
+        // Textures and constant array pages get an index into one global descriptor set (VK_EXT_descriptor_indexing), shaders read it through "bindlessSet".
+        // Turned off with a warning if the device doesn't support it
+        bool        bindless = false;
     };
 
     class GraphicsContext_T
@@ -29,7 +40,7 @@ namespace moraine
         Logfile getLogfile() const { return m_logfile; };
         float2 getViewportSize() const { return float2(static_cast<float>(m_viewportWidth), static_cast<float>(m_viewportHeight)); }
 
-        StagingStack m_stagingStack;
+        StagingRing m_stagingRing;
         uint32_t m_viewportWidth, m_viewportHeight;
 
     protected:
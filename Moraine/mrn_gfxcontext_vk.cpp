@@ -1,7 +1,12 @@
 #include "mrn_core.h"
 #include "mrn_gfxcontext_vk.h"
+#include "mrn_arena_vk.h"
+#include "mrn_shadercache_vk.h"
+#include "mrn_shadercompiler_vk.h"
+#include "mrn_descriptors_vk.h"
 
 #include <bitset>
+#include <fstream>
 
 
 moraine::GraphicsContext_IVulkan::GraphicsContext_IVulkan(const GraphicsContextDesc& desc, Logfile logfile, Window window) :
@@ -9,37 +14,90 @@ moraine::GraphicsContext_IVulkan::GraphicsContext_IVulkan(const GraphicsContextD
     m_description(desc),
     m_instance(0),
     m_messenger(0),
-    m_window(window)
+    m_window(window),
+    m_windowSurface(VK_NULL_HANDLE),
+    m_swapchain(VK_NULL_HANDLE),
+    m_pipelineCacheLoaded(false),
+    m_pipelineCacheDirty(false),
+    m_pipelineCacheSaveTime(Time::now()),
+    m_creationTime(Time::now()),
+    m_framesInFlight(desc.framesInFlight),
+    m_commandBufferVersion(0)
 {
+    assert(m_logfile, m_framesInFlight >= 1 and m_framesInFlight <= 4, L"Wrong API Usage: GraphicsContextDesc::framesInFlight has to be between 1 and 4!", MRN_DEBUG_INFO);
+    assert(m_logfile, not desc.headless or desc.renderTargetCount >= m_framesInFlight, L"Wrong API Usage: GraphicsContextDesc::renderTargetCount has to be at least framesInFlight!", MRN_DEBUG_INFO);
+
     constructVulkanInstance();
-    constructVulkanSurface();
+
+    if (not m_description.headless)
+        constructVulkanSurface();
+
     constructVulkanPhysicalDevice();
     constructVulkanLogicalDevice();
-    constructVulkanSwapchain();
-    constructVulkanRenderPass();
-    constructVulkanFrameBuffers();
 
+    // Created before the render targets, headless contexts allocate them through VMA
     VmaAllocatorCreateInfo vmaaci = { };
     vmaaci.device = m_device;
     vmaaci.physicalDevice = m_physicalDevice.device;
 
     assert_vulkan(m_logfile, vmaCreateAllocator(&vmaaci, &m_allocator), L"vmaCreateAllocator() failed", MRN_DEBUG_INFO);
+
+    if (m_description.headless)
+        constructVulkanRenderTargets();
+    else
+        constructVulkanSwapchain();
+
+    constructVulkanRenderPass();
+    constructVulkanPipelineCache();
+
+    m_descriptorAllocator = std::make_unique<DescriptorAllocator_IVulkan>(this); // Before the shader object cache, which releases layouts from it
+    m_shaderObjects = std::make_unique<ShaderObjectCache_IVulkan>(this);
+
+    if (m_description.bindless)
+        m_bindlessTable = std::make_unique<BindlessTable_IVulkan>(this);
+
+    m_shaderCompiler = std::make_unique<ShaderCompiler_IVulkan>();
+
+    m_vertexArena = std::make_unique<BufferArena_IVulkan>(this, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, 24); // 16MB chunks
+    m_indexArena = std::make_unique<BufferArena_IVulkan>(this, VK_BUFFER_USAGE_INDEX_BUFFER_BIT, 22); // 4MB chunks
 }
 
 
 moraine::GraphicsContext_IVulkan::~GraphicsContext_IVulkan()
 {
-    vmaDestroyAllocator(m_allocator);
+    vkDeviceWaitIdle(m_device);
+
+    // Destruction of resources is deferred through async tasks, frames that were never ticked can't use them anymore
+    for (const auto& a : m_asyncTasks)
+        if (a.finalizationTask)
+            a.finalizationTask();
 
-    for (const auto& a : m_frameBuffers)
-        vkDestroyFramebuffer(m_device, a, nullptr);
+    m_asyncTasks.clear();
+
+    m_stagingRing.reset(); // Staging blocks are allocated through VMA
+    m_vertexArena.reset();
+    m_indexArena.reset();
+
+    m_shaderCompiler.reset();
+    m_shaderObjects.reset();
+    m_bindlessTable.reset();
+    m_descriptorAllocator.reset();
+
+    savePipelineCache(true);
+    vkDestroyPipelineCache(m_device, m_pipelineCache, nullptr);
 
     vkDestroyRenderPass(m_device, m_renderPass, nullptr);
 
     for (const auto& a : m_swapchainImageViews)
         vkDestroyImageView(m_device, a, nullptr);
 
-    vkDestroySwapchainKHR(m_device, m_swapchain, nullptr);
+    for (size_t i = 0; i < m_renderTargetAllocations.size(); ++i)
+        vmaDestroyImage(m_allocator, m_swapchainImages[i], m_renderTargetAllocations[i]);
+
+    vmaDestroyAllocator(m_allocator);
+
+    if (m_swapchain != VK_NULL_HANDLE)
+        vkDestroySwapchainKHR(m_device, m_swapchain, nullptr);
 
     for (const auto& a : m_mainThreadCommandPools)
         if(a != VK_NULL_HANDLE)
@@ -47,7 +105,8 @@ moraine::GraphicsContext_IVulkan::~GraphicsContext_IVulkan()
 
     vkDestroyDevice(m_device, nullptr);
 
-    vkDestroySurfaceKHR(m_instance, m_windowSurface, nullptr);
+    if (m_windowSurface != VK_NULL_HANDLE)
+        vkDestroySurfaceKHR(m_instance, m_windowSurface, nullptr);
 
     if (m_messenger)
     {
@@ -73,7 +132,7 @@ void moraine::GraphicsContext_IVulkan::constructVulkanInstance()
     vai.applicationVersion                  = VK_MAKE_VERSION(1, 0, 0);
     vai.pEngineName                         = "Moraine Graphics Libraray";
     vai.engineVersion                       = VK_MAKE_VERSION(0, 0, 1010);
-    vai.apiVersion                          = VK_VERSION_1_1;
+    vai.apiVersion                          = VK_API_VERSION_1_1; // Descriptor update templates and vkGetPhysicalDevice*2() are core in 1.1
 
     std::vector<String> requestedLayers;
 
@@ -88,7 +147,10 @@ void moraine::GraphicsContext_IVulkan::constructVulkanInstance()
 
     auto enabledLayers = listAndEnableInstanceLayers(requestedLayers);
     
-    std::vector<String> requestedExtensions = { "VK_KHR_surface", "VK_KHR_win32_surface" };
+    std::vector<String> requestedExtensions;
+
+    if (not m_description.headless)
+        requestedExtensions = { "VK_KHR_surface", "VK_KHR_win32_surface" };
 
     if (m_description.enableValidation)
         requestedExtensions.push_back("VK_EXT_debug_utils");
@@ -185,9 +247,15 @@ void moraine::GraphicsContext_IVulkan::constructVulkanPhysicalDevice()
         deviceSpecs[i].queueFamilyProperties.resize(n_queueFamilies);
         vkGetPhysicalDeviceQueueFamilyProperties(p_devices[i], &n_queueFamilies, deviceSpecs[i].queueFamilyProperties.data());
 
-        if (vkGetPhysicalDeviceSurfaceCapabilitiesKHR(p_devices[i], m_windowSurface, &deviceSpecs[i].surfaceProperites) != VK_SUCCESS)
+        if (not m_description.headless and vkGetPhysicalDeviceSurfaceCapabilitiesKHR(p_devices[i], m_windowSurface, &deviceSpecs[i].surfaceProperites) != VK_SUCCESS)
             m_logfile->print(YELLOW, sprintf(L"vkGetPhysicalDeviceSurfaceCapabilitiesKHR failed for GPU %S", deviceSpecs[i].deviceProperties.deviceName), MRN_DEBUG_INFO);
 
+        if (deviceSpecs[i].deviceProperties.apiVersion < VK_API_VERSION_1_1)
+        {
+            m_logfile->print(YELLOW, sprintf(L"GPU %S only supports Vulkan 1.0 and is skipped", deviceSpecs[i].deviceProperties.deviceName), MRN_DEBUG_INFO);
+            continue;
+        }
+
         if (deviceSpecs[i].deviceProperties.deviceType == VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU)
             score += 10000;
 
@@ -577,6 +645,8 @@ void moraine::GraphicsContext_IVulkan::constructVulkanLogicalDevice()
     features.wideLines = VK_TRUE;
     features.fillModeNonSolid = VK_TRUE;
     features.samplerAnisotropy = VK_TRUE;
+    features.multiDrawIndirect = m_physicalDevice.deviceFeatures.multiDrawIndirect; // Optional, the renderer falls back to direct draws
+    features.drawIndirectFirstInstance = m_physicalDevice.deviceFeatures.drawIndirectFirstInstance;
 
     std::vector<String> requestedLayers;
 
@@ -585,20 +655,47 @@ void moraine::GraphicsContext_IVulkan::constructVulkanLogicalDevice()
 
     auto enabledLayers = listAndEnableDeviceLayers(requestedLayers);
 
-    std::vector<String> requestedExtensions = { "VK_KHR_swapchain" };
+    VkPhysicalDeviceDescriptorIndexingFeaturesEXT indexingFeatures = { };
+    indexingFeatures.sType                      = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT;
+
+    if (m_description.bindless)
+        m_description.bindless = checkDescriptorIndexingSupport(indexingFeatures);
+
+    // Uploads and frames are synchronized with a timeline semaphore, there is no fallback to fences
+    assert(m_logfile, isDeviceExtensionAvailable(VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME),
+           sprintf(L"The selected device (%S) doesn't support VK_KHR_timeline_semaphore! Update the driver or select another device", m_physicalDevice.deviceProperties.deviceName), MRN_DEBUG_INFO);
+
+    std::vector<String> requestedExtensions = { "VK_KHR_timeline_semaphore" };
+
+    if (not m_description.headless)
+        requestedExtensions.push_back("VK_KHR_swapchain");
+
+    if (m_description.bindless)
+        requestedExtensions.push_back("VK_EXT_descriptor_indexing");
 
     auto enabledExtensions = listAndEnableDeviceExtensions(requestedExtensions);
 
+    assert(m_logfile, enabledExtensions.size() == requestedExtensions.size(),
+           sprintf(L"The selected device (%S) doesn't support all required extensions!", m_physicalDevice.deviceProperties.deviceName), MRN_DEBUG_INFO);
+
+    VkPhysicalDeviceTimelineSemaphoreFeaturesKHR timelineFeatures;
+    timelineFeatures.sType                      = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES_KHR;
+    timelineFeatures.pNext                      = nullptr;
+    timelineFeatures.timelineSemaphore          = VK_TRUE;
+
+    if (m_description.bindless)
+        timelineFeatures.pNext                  = &indexingFeatures; // Only the features the bindless table needs are enabled
+
     std::vector<VkDeviceQueueCreateInfo> enabledQueues;
     
-    assert(m_logfile, getQueue(m_graphicsQueue, enabledQueues, VK_QUEUE_GRAPHICS_BIT, true),
+    assert(m_logfile, getQueue(m_graphicsQueue, enabledQueues, VK_QUEUE_GRAPHICS_BIT, not m_description.headless),
            sprintf(L"The selected device (%S) doesn't support Graphics or Presenation! Please manually select a device!", m_physicalDevice.deviceProperties.deviceName), MRN_DEBUG_INFO);
 
     bool transferAvailable = getQueue(m_transferQueue, enabledQueues, VK_QUEUE_TRANSFER_BIT, false);
 
     VkDeviceCreateInfo vdci;
     vdci.sType                                  = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
-    vdci.pNext                                  = nullptr;
+    vdci.pNext                                  = &timelineFeatures;
     vdci.flags                                  = 0;
     vdci.queueCreateInfoCount                   = static_cast<uint32_t>(enabledQueues.size());
     vdci.pQueueCreateInfos                      = enabledQueues.data();
@@ -626,10 +723,74 @@ void moraine::GraphicsContext_IVulkan::constructVulkanLogicalDevice()
     activateQueue(m_graphicsQueue);
     if(transferAvailable)
         activateQueue(m_transferQueue);
+    else
+        m_transferQueue = m_graphicsQueue; // Uploads are submitted to the graphics queue
+
+    if (m_transferQueue.queueFamilyIndex != m_graphicsQueue.queueFamilyIndex)
+        m_sharedQueueFamilies = { m_graphicsQueue.queueFamilyIndex, m_transferQueue.queueFamilyIndex };
+
+    m_vkGetSemaphoreCounterValueKHR = reinterpret_cast<PFN_vkGetSemaphoreCounterValueKHR>(vkGetDeviceProcAddr(m_device, "vkGetSemaphoreCounterValueKHR"));
+    m_vkWaitSemaphoresKHR = reinterpret_cast<PFN_vkWaitSemaphoresKHR>(vkGetDeviceProcAddr(m_device, "vkWaitSemaphoresKHR"));
 
     m_logfile->print(WHITE, sprintf(L"Created VkDevice (%.3f ms)", Time::duration(start, Time::now()).getMillisecondsF()));
 }
 
+bool moraine::GraphicsContext_IVulkan::isDeviceExtensionAvailable(const char* extensionName)
+{
+    uint32_t n_extensions;
+    vkEnumerateDeviceExtensionProperties(m_physicalDevice.device, nullptr, &n_extensions, nullptr);
+
+    std::vector<VkExtensionProperties> p_extensions(n_extensions);
+    vkEnumerateDeviceExtensionProperties(m_physicalDevice.device, nullptr, &n_extensions, p_extensions.data());
+
+    return std::find_if(p_extensions.begin(), p_extensions.end(), [extensionName](const VkExtensionProperties& extension)
+    {
+        return strcmp(extension.extensionName, extensionName) == 0;
+    }) != p_extensions.end();
+}
+
+bool moraine::GraphicsContext_IVulkan::checkDescriptorIndexingSupport(VkPhysicalDeviceDescriptorIndexingFeaturesEXT& out_enabledFeatures)
+{
+    // The extension depends on VK_KHR_get_physical_device_properties2 and VK_KHR_maintenance3, which are core in the Vulkan 1.1
+    // instance and devices the context requires, so neither is enabled separately
+    bool extensionAvailable = m_physicalDevice.deviceProperties.apiVersion >= VK_API_VERSION_1_1 and isDeviceExtensionAvailable(VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME);
+
+    VkPhysicalDeviceDescriptorIndexingFeaturesEXT available = { };
+    available.sType                             = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT;
+
+    if (extensionAvailable)
+    {
+        VkPhysicalDeviceFeatures2 vpdf2 = { };
+        vpdf2.sType                             = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+        vpdf2.pNext                             = &available;
+
+        vkGetPhysicalDeviceFeatures2(m_physicalDevice.device, &vpdf2);
+    }
+
+    if (not extensionAvailable or
+        not available.shaderSampledImageArrayNonUniformIndexing or
+        not available.shaderStorageBufferArrayNonUniformIndexing or
+        not available.descriptorBindingSampledImageUpdateAfterBind or
+        not available.descriptorBindingStorageBufferUpdateAfterBind or
+        not available.descriptorBindingUpdateUnusedWhilePending or
+        not available.descriptorBindingPartiallyBound or
+        not available.runtimeDescriptorArray)
+    {
+        m_logfile->print(YELLOW, sprintf(L"The selected device (%S) doesn't support descriptor indexing, bindless mode is disabled", m_physicalDevice.deviceProperties.deviceName), MRN_DEBUG_INFO);
+        return false;
+    }
+
+    out_enabledFeatures.shaderSampledImageArrayNonUniformIndexing      = VK_TRUE;
+    out_enabledFeatures.shaderStorageBufferArrayNonUniformIndexing     = VK_TRUE;
+    out_enabledFeatures.descriptorBindingSampledImageUpdateAfterBind   = VK_TRUE;
+    out_enabledFeatures.descriptorBindingStorageBufferUpdateAfterBind  = VK_TRUE;
+    out_enabledFeatures.descriptorBindingUpdateUnusedWhilePending      = VK_TRUE;
+    out_enabledFeatures.descriptorBindingPartiallyBound                = VK_TRUE;
+    out_enabledFeatures.runtimeDescriptorArray                         = VK_TRUE;
+
+    return true;
+}
+
 
 void moraine::GraphicsContext_IVulkan::constructVulkanSurface()
 {
@@ -709,8 +870,31 @@ void moraine::GraphicsContext_IVulkan::constructVulkanSwapchain()
 }
 
 
+void moraine::GraphicsContext_IVulkan::constructVulkanRenderTargets()
+{
+    Time start = Time::now();
+
+    m_swapchainFormat = VK_FORMAT_R8G8B8A8_UNORM; // Byte order of FrameCapture::pixels
+    m_viewportWidth = m_description.headlessWidth;
+    m_viewportHeight = m_description.headlessHeight;
+
+    m_swapchainImages.resize(m_description.renderTargetCount);
+    m_swapchainImageViews.resize(m_description.renderTargetCount);
+    m_renderTargetAllocations.resize(m_description.renderTargetCount);
+
+    for (uint32_t i = 0; i < m_description.renderTargetCount; ++i)
+        createVulkanImage(m_swapchainFormat, m_viewportWidth, m_viewportHeight, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+                          &m_swapchainImages[i], &m_renderTargetAllocations[i], &m_swapchainImageViews[i]);
+
+    m_logfile->print(WHITE, sprintf(L"Created %d offscreen render targets (%dx%d)! (%.3f ms)", m_description.renderTargetCount, m_viewportWidth, m_viewportHeight,
+                                    Time::duration(start, Time::now()).getMillisecondsF()));
+}
+
+
 void moraine::GraphicsContext_IVulkan::constructVulkanRenderPass()
 {
+    // Pipelines and secondary command buffers are created for this render pass. Frames are rendered with the render passes of the
+    // renderer's render graph, which are compatible as long as they have one color attachment of the swapchain format
     std::vector<VkAttachmentDescription> attachments(1);
 
     attachments[0].flags                        = 0;
@@ -721,7 +905,7 @@ void moraine::GraphicsContext_IVulkan::constructVulkanRenderPass()
     attachments[0].stencilLoadOp                = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
     attachments[0].stencilStoreOp               = VK_ATTACHMENT_STORE_OP_DONT_CARE;
     attachments[0].initialLayout                = VK_IMAGE_LAYOUT_UNDEFINED;
-    attachments[0].finalLayout                  = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+    attachments[0].finalLayout                  = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
 
     VkAttachmentReference reference;
     reference.attachment                        = 0;
@@ -764,25 +948,111 @@ void moraine::GraphicsContext_IVulkan::constructVulkanRenderPass()
 }
 
 
-void moraine::GraphicsContext_IVulkan::constructVulkanFrameBuffers()
+void moraine::GraphicsContext_IVulkan::constructVulkanPipelineCache()
 {
-    m_frameBuffers.resize(m_swapchainImages.size());
+    Time start = Time::now();
 
-    for (size_t i = 0; i < m_frameBuffers.size(); ++i)
+    const VkPhysicalDeviceProperties& properties = m_physicalDevice.deviceProperties;
+    std::vector<uint8_t> initialData;
+    const wchar_t* status = L"no cache file set";
+
+    if (m_description.pipelineCachePath.length() > 0)
     {
-        VkFramebufferCreateInfo vfbci;
-        vfbci.sType                              = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
-        vfbci.pNext                              = nullptr;
-        vfbci.flags                              = 0;
-        vfbci.renderPass                         = m_renderPass;  
-        vfbci.attachmentCount                    = 1;
-        vfbci.pAttachments                       = &m_swapchainImageViews[i];
-        vfbci.width                              = m_viewportWidth;
-        vfbci.height                             = m_viewportHeight;
-        vfbci.layers                             = 1;
-
-        assert_vulkan(m_logfile, vkCreateFramebuffer(m_device, &vfbci, nullptr, &m_frameBuffers[i]), L"vkCreateFramebuffer() failed", MRN_DEBUG_INFO);
+        std::ifstream file(m_description.pipelineCachePath.wcstr(), std::ios::binary | std::ios::ate);
+        PipelineCacheFileHeader header;
+
+        status = L"cache file doesn't exist";
+
+        if (file.is_open())
+        {
+            size_t fileSize = file.tellg();
+            file.seekg(0, std::ios::beg);
+
+            status = L"cache file is corrupted";
+
+            if (fileSize >= sizeof(header) and file.read(reinterpret_cast<char*>(&header), sizeof(header)) and header.magic == s_pipelineCacheMagic and
+                header.dataSize == fileSize - sizeof(header))
+            {
+                status = L"cache file is from another device or driver";
+
+                if (header.vendorID == properties.vendorID and header.deviceID == properties.deviceID and header.driverVersion == properties.driverVersion and
+                    memcmp(header.pipelineCacheUUID, properties.pipelineCacheUUID, VK_UUID_SIZE) == 0)
+                {
+                    initialData.resize(static_cast<size_t>(header.dataSize));
+
+                    if (file.read(reinterpret_cast<char*>(initialData.data()), initialData.size()))
+                        m_pipelineCacheLoaded = true;
+                    else
+                        initialData.clear();
+                }
+            }
+        }
     }
+
+    VkPipelineCacheCreateInfo vpcci;
+    vpcci.sType                                 = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+    vpcci.pNext                                 = nullptr;
+    vpcci.flags                                 = 0;
+    vpcci.initialDataSize                       = initialData.size();
+    vpcci.pInitialData                          = initialData.data();
+
+    assert_vulkan(m_logfile, vkCreatePipelineCache(m_device, &vpcci, nullptr, &m_pipelineCache), L"vkCreatePipelineCache() failed", MRN_DEBUG_INFO);
+
+    if (m_pipelineCacheLoaded)
+        m_logfile->print(WHITE, sprintf(L"Loaded pipeline cache \"%s\" (%llu KiB) (%.3f ms)", m_description.pipelineCachePath.wcstr(), static_cast<unsigned long long>(initialData.size() / 1024),
+                                        Time::duration(start, Time::now()).getMillisecondsF()));
+    else
+        m_logfile->print(YELLOW, sprintf(L"Created empty pipeline cache, %s", status), MRN_DEBUG_INFO);
+}
+
+
+void moraine::GraphicsContext_IVulkan::savePipelineCache(bool force)
+{
+    if (not m_pipelineCacheDirty or m_description.pipelineCachePath.length() == 0)
+        return;
+
+    if (not force and Time::duration(m_pipelineCacheSaveTime, Time::now()).getSecondsF() < s_pipelineCacheSaveInterval)
+        return;
+
+    // Cleared before the data is read, pipelines the shader compiler workers create meanwhile mark the cache dirty again
+    if (not m_pipelineCacheDirty.exchange(false))
+        return;
+
+    Time start = Time::now();
+
+    size_t dataSize;
+    assert_vulkan(m_logfile, vkGetPipelineCacheData(m_device, m_pipelineCache, &dataSize, nullptr), L"vkGetPipelineCacheData() failed", MRN_DEBUG_INFO);
+
+    std::vector<uint8_t> data(dataSize);
+    assert_vulkan(m_logfile, vkGetPipelineCacheData(m_device, m_pipelineCache, &dataSize, data.data()), L"vkGetPipelineCacheData() failed", MRN_DEBUG_INFO);
+
+    PipelineCacheFileHeader header;
+    header.magic                                = s_pipelineCacheMagic;
+    header.vendorID                             = m_physicalDevice.deviceProperties.vendorID;
+    header.deviceID                             = m_physicalDevice.deviceProperties.deviceID;
+    header.driverVersion                        = m_physicalDevice.deviceProperties.driverVersion;
+    header.dataSize                             = dataSize;
+    memcpy(header.pipelineCacheUUID, m_physicalDevice.deviceProperties.pipelineCacheUUID, VK_UUID_SIZE);
+
+    // Written next to the cache and moved over it, so a crash while writing doesn't leave a truncated cache behind
+    String temporaryPath = sprintf(L"%s.tmp", m_description.pipelineCachePath.wcstr());
+
+    std::ofstream file(temporaryPath.wcstr(), std::ios::binary | std::ios::trunc);
+    bool written = file.is_open() and file.write(reinterpret_cast<const char*>(&header), sizeof(header)) and file.write(reinterpret_cast<const char*>(data.data()), dataSize);
+    file.close();
+
+    // The last good cache is only replaced by a complete file, in one step
+    if (not written or not MoveFileExW(temporaryPath.wcstr(), m_description.pipelineCachePath.wcstr(), MOVEFILE_REPLACE_EXISTING))
+    {
+        m_logfile->print(YELLOW, sprintf(L"Writing pipeline cache \"%s\" failed", m_description.pipelineCachePath.wcstr()), MRN_DEBUG_INFO);
+        _wremove(temporaryPath.wcstr());
+        m_pipelineCacheDirty = true; // Retried after the save interval
+    }
+    else
+        m_logfile->print(GREY, sprintf(L"Saved pipeline cache \"%s\" (%llu KiB) (%.3f ms)", m_description.pipelineCachePath.wcstr(), static_cast<unsigned long long>(dataSize / 1024),
+                                       Time::duration(start, Time::now()).getMillisecondsF()), MRN_DEBUG_INFO);
+
+    m_pipelineCacheSaveTime = Time::now();
 }
 
 
@@ -848,9 +1118,9 @@ void moraine::GraphicsContext_IVulkan::createVulkanBuffer(size_t size, VkBufferU
     vbci.flags                          = 0;
     vbci.size                           = size;
     vbci.usage                          = bufferUsage;
-    vbci.sharingMode                    = VK_SHARING_MODE_EXCLUSIVE;
-    vbci.queueFamilyIndexCount          = 0;
-    vbci.pQueueFamilyIndices            = nullptr;
+    vbci.sharingMode                    = m_sharedQueueFamilies.empty() ? VK_SHARING_MODE_EXCLUSIVE : VK_SHARING_MODE_CONCURRENT;
+    vbci.queueFamilyIndexCount          = static_cast<uint32_t>(m_sharedQueueFamilies.size());
+    vbci.pQueueFamilyIndices            = m_sharedQueueFamilies.data();
 
     VmaAllocationCreateInfo vaci = { };
     vaci.usage                          = memoryUsage;
@@ -881,7 +1151,7 @@ void moraine::GraphicsContext_IVulkan::createVulkanImage(VkFormat format, uint32
     image_info.samples                              = VK_SAMPLE_COUNT_1_BIT;
     image_info.tiling                               = VK_IMAGE_TILING_OPTIMAL;
     image_info.usage                                = usage;
-    image_info.sharingMode                          = VK_SHARING_MODE_EXCLUSIVE;
+    image_info.sharingMode                          = VK_SHARING_MODE_EXCLUSIVE; // Concurrent images can lose compression, uploads transfer ownership instead
     image_info.queueFamilyIndexCount                = 0;
     image_info.pQueueFamilyIndices                  = nullptr;
     image_info.initialLayout                        = VK_IMAGE_LAYOUT_UNDEFINED;
@@ -1110,7 +1380,19 @@ VkPresentModeKHR moraine::GraphicsContext_IVulkan::getPresentMode(bool useTriple
 
 bool moraine::GraphicsContext_IVulkan::getQueue(Queue& out_queue, std::vector<VkDeviceQueueCreateInfo>& out_vdqci, VkQueueFlags flags, bool present)
 {
-    for (size_t i = 0; i < m_physicalDevice.queueFamilyProperties.size(); ++i) // Loop through all queue families
+    // Prefer queue families with few other capabilities, e.g. a dedicated transfer family for VK_QUEUE_TRANSFER_BIT
+    std::vector<size_t> families(m_physicalDevice.queueFamilyProperties.size());
+
+    for (size_t i = 0; i < families.size(); ++i)
+        families[i] = i;
+
+    std::stable_sort(families.begin(), families.end(), [this](size_t a, size_t b)
+    {
+        return std::bitset<32>(m_physicalDevice.queueFamilyProperties[a].queueFlags).count() < 
+               std::bitset<32>(m_physicalDevice.queueFamilyProperties[b].queueFlags).count();
+    });
+
+    for (size_t i : families) // Loop through all queue families
     {
         if ((flags & ~m_physicalDevice.queueFamilyProperties[i].queueFlags) == 0) // Check if queue family matches flags
         {
@@ -1196,5 +1478,5 @@ VkBool32 __stdcall moraine::GraphicsContext_IVulkan::debugCallback(VkDebugUtilsM
 
 void moraine::GraphicsContext_IVulkan::addAsyncTask(std::function<void(uint32_t)> perFrameTasks, std::function<void()> finalizationTask)
 {
-    m_asyncTasks.push_back({ perFrameTasks, (1u << m_swapchainImages.size()) - 1, finalizationTask });
+    m_asyncTasks.push_back({ perFrameTasks, (1u << m_framesInFlight) - 1, finalizationTask });
 }
\ No newline at end of file
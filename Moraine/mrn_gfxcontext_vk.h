@@ -4,6 +4,7 @@
 
 #include <vulkan/vulkan.h>
 #include <vk_mem_alloc.h>
+#include <atomic>
 
 #ifdef _WIN32
 #include "mrn_window_win32.h"
@@ -61,6 +62,22 @@ namespace moraine
         }
     }
 
+    // Resources that keep a CPU copy of their data and copy the changes into the frame's GPU copy before it is submitted
+    class FlushableResource_IVulkan
+    {
+    public:
+
+        virtual ~FlushableResource_IVulkan() = default;
+
+        virtual void flushFrame(uint32_t frameIndex) = 0;
+    };
+
+    class BufferArena_IVulkan;
+    class ShaderObjectCache_IVulkan;
+    class ShaderCompiler_IVulkan;
+    class DescriptorAllocator_IVulkan;
+    class BindlessTable_IVulkan;
+
     class GraphicsContext_IVulkan : public GraphicsContext_T
     {
     public:
@@ -73,6 +90,13 @@ namespace moraine
 
         void addAsyncTask(std::function<void(uint32_t)> perFrameTasks, std::function<void()> finalizationTask);
 
+        // Writes the pipeline cache to GraphicsContextDesc::pipelineCachePath if pipelines were created since it was last written,
+        // unless it was written less than s_pipelineCacheSaveInterval seconds ago and force is false
+        void savePipelineCache(bool force);
+
+        // Resources call this when recorded commands became stale (new buffer handle, moved offsets), every layer is re-recorded for every frame
+        void invalidateCommandBuffers() { ++m_commandBufferVersion; }
+
         struct Queue
         {
             union
@@ -104,8 +128,9 @@ namespace moraine
         void constructVulkanLogicalDevice();
         void constructVulkanSurface();
         void constructVulkanSwapchain();
+        void constructVulkanRenderTargets();
         void constructVulkanRenderPass();
-        void constructVulkanFrameBuffers();
+        void constructVulkanPipelineCache();
 
         std::vector<const char*> listAndEnableInstanceLayers(std::vector<String>& requestedLayers);
         std::vector<const char*> listAndEnableInstanceExtensions(std::vector<String>& requestedExtensions);
@@ -113,6 +138,8 @@ namespace moraine
         std::vector<const char*> listAndEnableDeviceExtensions(std::vector<String>& requestedExtensions);
         VkSurfaceFormatKHR       getSurfaceFormat();
         VkPresentModeKHR         getPresentMode(bool useTripleBuffering);
+        bool                     isDeviceExtensionAvailable(const char* extensionName);
+        bool                     checkDescriptorIndexingSupport(VkPhysicalDeviceDescriptorIndexingFeaturesEXT& out_enabledFeatures);
 
         VkBool32 __stdcall debugCallback(VkDebugUtilsMessageSeverityFlagBitsEXT messageSeverity,
                                          VkDebugUtilsMessageTypeFlagsEXT messageType,
@@ -123,6 +150,20 @@ namespace moraine
         
         static constexpr float s_vulkanQueuePriorities[16] = { 1.0f };
 
+        // Written in front of the driver's cache data, which is only valid for the same device and driver version
+        struct PipelineCacheFileHeader
+        {
+            uint32_t    magic;
+            uint32_t    vendorID;
+            uint32_t    deviceID;
+            uint32_t    driverVersion;
+            uint8_t     pipelineCacheUUID[VK_UUID_SIZE];
+            uint64_t    dataSize;
+        };
+
+        static constexpr uint32_t s_pipelineCacheMagic = 0x504e524d; // "MRNP"
+        static constexpr float s_pipelineCacheSaveInterval = 60.0f;
+
     public:
 
         struct PhysicalDevice
@@ -153,17 +194,35 @@ namespace moraine
         VkFormat                    m_swapchainFormat;
         std::vector<VkImage>        m_swapchainImages;
         std::vector<VkImageView>    m_swapchainImageViews;
-        std::vector<VkFramebuffer>  m_frameBuffers;
+        std::vector<VmaAllocation>  m_renderTargetAllocations; // Headless only, m_swapchainImages are offscreen images then
         VkRenderPass                m_renderPass;
+        VkPipelineCache             m_pipelineCache; // Every pipeline is created through it, Vulkan synchronizes access internally
+        bool                        m_pipelineCacheLoaded; // The cache was read from disk, pipelines the last run created are not compiled again
+        std::atomic<bool>           m_pipelineCacheDirty; // Set by the shader compiler workers as well
+        std::unique_ptr<ShaderObjectCache_IVulkan> m_shaderObjects; // Shader modules, layouts and pipelines shared by all shaders
+        std::unique_ptr<ShaderCompiler_IVulkan> m_shaderCompiler; // Pipelines of createShaderAsync()
+        std::unique_ptr<DescriptorAllocator_IVulkan> m_descriptorAllocator; // Descriptor sets of all constant sets
+        std::unique_ptr<BindlessTable_IVulkan> m_bindlessTable; // Only if m_description.bindless
+        Time                        m_pipelineCacheSaveTime;
+        Time                        m_creationTime; // For the time to the first frame
         VkImage                     m_colorImage;
         VkImage                     m_depthImage;
         VmaAllocator                m_allocator;
         std::vector<VkCommandPool>  m_mainThreadCommandPools;
         std::list<AsyncTask>        m_asyncTasks;
+        std::vector<FlushableResource_IVulkan*> m_flushableResources; // Flushed by the renderer before each frame is submitted
+        std::unique_ptr<BufferArena_IVulkan> m_vertexArena; // Static vertex buffers are sub-allocated from here
+        std::unique_ptr<BufferArena_IVulkan> m_indexArena;
 
-        bool mt_updateCommandBuffers;
+        uint32_t m_framesInFlight; // Per frame resources (copies, descriptor sets, command buffers) exist once per frame in flight, frame indicies go from 0 to m_framesInFlight - 1
+        uint64_t m_commandBufferVersion;
 
         Queue m_graphicsQueue;
         Queue m_transferQueue;
+        std::vector<uint32_t> m_sharedQueueFamilies; // Graphics and transfer family if they differ, buffers are created with concurrent sharing then. Images stay exclusive
+
+        // VK_KHR_timeline_semaphore
+        PFN_vkGetSemaphoreCounterValueKHR m_vkGetSemaphoreCounterValueKHR;
+        PFN_vkWaitSemaphoresKHR m_vkWaitSemaphoresKHR;
     };
 }
\ No newline at end of file
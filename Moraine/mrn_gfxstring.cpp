@@ -16,10 +16,12 @@ moraine::GraphicsString_T::GraphicsString_T(Stringr text, Font font, size_t font
                                                            6u, 
                                                            (uint32_t) text.size())),
     m_font(font),
-    m_pos(static_cast<float>(x), static_cast<float>(y))
+    m_pos(static_cast<float>(x), static_cast<float>(y)),
+    m_fontSize(fontSize)
 {
     m_buffer = createVertexBuffer(font->getGraphicsContext(), sizeof(GraphicsStringCharData) * text.size(), nullptr, true, sizeof(GraphicsStringCharData) * max<size_t>(reservedChars, text.size()));
     m_font->createGraphicsStringVertexData(text, static_cast<GraphicsStringCharData*>(m_buffer->data()), fontSize);
+    updateBounds(text.size());
 
     m_graphicsParameters->m_vertexBuffers.push_back(m_buffer);
 
@@ -34,6 +36,43 @@ moraine::GraphicsString_T::~GraphicsString_T()
 {
 }
 
+void moraine::GraphicsString_T::setText(Stringr text)
+{
+    // One instance per character, the buffer keeps its capacity and only grows if the text doesn't fit
+    m_graphicsParameters->m_instanceCount = static_cast<uint32_t>(text.size());
+
+    m_buffer->resize(sizeof(GraphicsStringCharData) * text.size());
+    m_font->createGraphicsStringVertexData(text, static_cast<GraphicsStringCharData*>(m_buffer->data()), m_fontSize);
+    updateBounds(text.size());
+
+    markChanged();
+}
+
+void moraine::GraphicsString_T::updateBounds(size_t charCount)
+{
+    auto chars = static_cast<const GraphicsStringCharData*>(m_buffer->data());
+
+    // Same quad as the font shader: string position + character offset + sprite size * size
+    RectangleF rect(m_pos.x, m_pos.y, 0.0f, 0.0f);
+    float right = m_pos.x, bottom = m_pos.y;
+
+    for (size_t i = 0; i < charCount; ++i)
+    {
+        float x = m_pos.x + chars[i].xOffset;
+        float y = m_pos.y + chars[i].yOffset;
+
+        rect.x = min(rect.x, x);
+        rect.y = min(rect.y, y);
+        right = max(right, x + chars[i].spriteSheetLocation.width * chars[i].size);
+        bottom = max(bottom, y + chars[i].spriteSheetLocation.height * chars[i].size);
+    }
+
+    rect.width = right - rect.x;
+    rect.height = bottom - rect.y;
+
+    setBounds(createRectBounds(rect));
+}
+
 moraine::bRemove moraine::GraphicsString_T::tick(float delta, uint32_t frameIndex)
 {
     
@@ -19,11 +19,16 @@ namespace moraine
 
         bRemove tick(float delta, uint32_t frameIndex) override;
 
+        MRN_API void setText(Stringr text);
+
     private:
 
+        void updateBounds(size_t charCount); // From the character data in m_buffer, in pixels like the culling frustum of a 2D layer
+
         Font m_font;
         VertexBuffer m_buffer;
         float2 m_pos;
+        size_t m_fontSize;
 
     };
 
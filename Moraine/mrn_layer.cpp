@@ -31,7 +31,9 @@ moraine::Layer moraine::createLayer(Stringr layerName)
 
 void moraine::Layer_I::add(std::unique_ptr<Object_T>&& object)
 {
+    object->m_layer = this;
     m_objects.push_back(std::move(object));
+    markChanged();
 }
 
 
@@ -43,7 +45,16 @@ void moraine::Layer_I::tick(float delta, uint32_t frameIndex)
 {
     for (auto a = m_objects.begin(); a != m_objects.end();)
         if ((**a).tick(delta, frameIndex))
+        {
             a = m_objects.erase(a);
+            markChanged();
+        }
         else
             ++a;
 }
+
+void moraine::Object_T::markChanged()
+{
+    if (m_layer != nullptr)
+        m_layer->markChanged();
+}
\ No newline at end of file
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "mrn_object.h"
+#include "mrn_culling.h"
 
 #include <list>
 
@@ -22,12 +23,24 @@ namespace moraine
 
         Stringr name() const { return m_name; }
 
+        // Incremented whenever objects are added, removed or changed, the renderer re-records the layer when it differs from the recorded version
+        uint64_t version() const { return m_version; }
+        void markChanged() { ++m_version; }
+
+        // Objects whose bounds are outside of the frustum aren't drawn, culling runs every frame so moving cameras set it again
+        void setCullingFrustum(const Frustum& frustum) { m_cullingFrustum = frustum; m_culling = true; }
+        void disableCulling() { m_culling = false; }
+        const Frustum* getCullingFrustum() const { return m_culling ? &m_cullingFrustum : nullptr; }
+
         virtual std::list<std::unique_ptr<Object_T>>::iterator begin() = 0;
         virtual std::list<std::unique_ptr<Object_T>>::iterator end() = 0;
 
     private:
 
         String m_name;
+        uint64_t m_version = 0;
+        Frustum m_cullingFrustum;
+        bool m_culling = false;
     };
 
     typedef std::shared_ptr<Layer_T> Layer;
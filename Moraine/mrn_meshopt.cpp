@@ -0,0 +1,573 @@
+#include "mrn_core.h"
+#include "mrn_meshopt.h"
+
+#include <cmath>
+#include <cfloat>
+#include <intrin.h>
+
+namespace
+{
+    constexpr uint32_t s_forsythCacheSize = 32;
+    constexpr uint32_t s_analysisCacheSize = 16; // FIFO size used for the report, a conservative guess for current hardware
+
+    // Vertex score of Tom Forsyth's "Linear-Speed Vertex Cache Optimisation"
+    float forsythVertexScore(int32_t cachePosition, uint32_t remainingTriangles)
+    {
+        if (remainingTriangles == 0)
+            return -1.0f;
+
+        float score = 0.0f;
+
+        if (cachePosition >= 0)
+            score = cachePosition < 3 ? 0.75f : std::pow(1.0f - static_cast<float>(cachePosition - 3) / (s_forsythCacheSize - 3), 1.5f);
+
+        return score + 2.0f / std::sqrt(static_cast<float>(remainingTriangles));
+    }
+
+    const float* getPosition(const float* positions, size_t positionStride, uint32_t index)
+    {
+        return reinterpret_cast<const float*>(reinterpret_cast<const uint8_t*>(positions) + positionStride * index);
+    }
+}
+
+float moraine::analyzeVertexCache(const uint32_t* indicies, size_t indexCount, size_t vertexCount, uint32_t cacheSize, float* out_atvr)
+{
+    // A vertex is cached while less than cacheSize misses happened since it was loaded
+    std::vector<uint32_t> loadTime(vertexCount, 0);
+    std::vector<bool> referenced(vertexCount, false);
+    uint32_t time = cacheSize + 1;
+    size_t misses = 0;
+    size_t uniqueVertices = 0;
+
+    for (size_t i = 0; i < indexCount; ++i)
+    {
+        uint32_t index = indicies[i];
+
+        if (time - loadTime[index] > cacheSize)
+        {
+            loadTime[index] = time++;
+            ++misses;
+        }
+
+        if (not referenced[index])
+        {
+            referenced[index] = true;
+            ++uniqueVertices;
+        }
+    }
+
+    if (out_atvr)
+        *out_atvr = uniqueVertices > 0 ? static_cast<float>(misses) / uniqueVertices : 0.0f;
+
+    return indexCount >= 3 ? static_cast<float>(misses) / (indexCount / 3) : 0.0f;
+}
+
+void moraine::optimizeVertexCache(uint32_t* indicies, size_t indexCount, size_t vertexCount)
+{
+    uint32_t triangleCount = static_cast<uint32_t>(indexCount / 3);
+
+    if (triangleCount == 0)
+        return;
+
+    // Triangles of every vertex, the first remainingTriangles[v] entries of a vertex are the ones not emitted yet
+    std::vector<uint32_t> triangleOffsets(vertexCount + 1, 0);
+    std::vector<uint32_t> remainingTriangles(vertexCount, 0);
+
+    for (size_t i = 0; i < triangleCount * 3; ++i)
+        ++remainingTriangles[indicies[i]];
+
+    for (size_t i = 0; i < vertexCount; ++i)
+        triangleOffsets[i + 1] = triangleOffsets[i] + remainingTriangles[i];
+
+    std::vector<uint32_t> vertexTriangles(triangleCount * 3);
+    std::vector<uint32_t> fillCursor(triangleOffsets.begin(), triangleOffsets.end() - 1);
+
+    for (uint32_t i = 0; i < triangleCount * 3; ++i)
+        vertexTriangles[fillCursor[indicies[i]]++] = i / 3;
+
+    std::vector<int32_t> cachePosition(vertexCount, -1);
+    std::vector<float> vertexScore(vertexCount);
+
+    for (size_t i = 0; i < vertexCount; ++i)
+        vertexScore[i] = forsythVertexScore(-1, remainingTriangles[i]);
+
+    std::vector<bool> emitted(triangleCount, false);
+
+    // The first triangle is the best scored one, afterwards only triangles of cached vertices are candidates
+    uint32_t bestTriangle = 0;
+    float bestScore = -1.0f;
+
+    for (uint32_t i = 0; i < triangleCount; ++i)
+    {
+        float score = vertexScore[indicies[i * 3]] + vertexScore[indicies[i * 3 + 1]] + vertexScore[indicies[i * 3 + 2]];
+
+        if (score > bestScore)
+        {
+            bestScore = score;
+            bestTriangle = i;
+        }
+    }
+
+    std::vector<uint32_t> output;
+    output.reserve(triangleCount * 3);
+
+    std::vector<uint32_t> cache, newCache;
+    cache.reserve(s_forsythCacheSize + 3);
+    newCache.reserve(s_forsythCacheSize + 3);
+
+    uint32_t nextUnemitted = 0;
+
+    for (uint32_t n = 0; n < triangleCount; ++n)
+    {
+        if (bestTriangle == UINT32_MAX) // No cached vertex has triangles left, continue with the next triangle in input order
+        {
+            while (emitted[nextUnemitted])
+                ++nextUnemitted;
+
+            bestTriangle = nextUnemitted;
+        }
+
+        emitted[bestTriangle] = true;
+        const uint32_t* triangle = indicies + bestTriangle * 3;
+
+        newCache.clear();
+
+        for (uint32_t i = 0; i < 3; ++i)
+        {
+            uint32_t vertex = triangle[i];
+            output.push_back(vertex);
+
+            if (std::find(newCache.begin(), newCache.end(), vertex) == newCache.end())
+                newCache.push_back(vertex);
+
+            uint32_t* triangles = &vertexTriangles[triangleOffsets[vertex]];
+
+            for (uint32_t j = 0; j < remainingTriangles[vertex]; ++j)
+                if (triangles[j] == bestTriangle)
+                {
+                    std::swap(triangles[j], triangles[remainingTriangles[vertex] - 1]);
+                    break;
+                }
+
+            --remainingTriangles[vertex];
+        }
+
+        for (uint32_t vertex : cache)
+            if (std::find(newCache.begin(), newCache.end(), vertex) == newCache.end())
+                newCache.push_back(vertex);
+
+        for (size_t i = s_forsythCacheSize; i < newCache.size(); ++i)
+        {
+            cachePosition[newCache[i]] = -1;
+            vertexScore[newCache[i]] = forsythVertexScore(-1, remainingTriangles[newCache[i]]);
+        }
+
+        newCache.resize(min<size_t>(newCache.size(), s_forsythCacheSize));
+
+        for (size_t i = 0; i < newCache.size(); ++i)
+        {
+            cachePosition[newCache[i]] = static_cast<int32_t>(i);
+            vertexScore[newCache[i]] = forsythVertexScore(static_cast<int32_t>(i), remainingTriangles[newCache[i]]);
+        }
+
+        bestTriangle = UINT32_MAX;
+        bestScore = -1.0f;
+
+        for (uint32_t vertex : newCache)
+        {
+            const uint32_t* triangles = &vertexTriangles[triangleOffsets[vertex]];
+
+            for (uint32_t j = 0; j < remainingTriangles[vertex]; ++j)
+            {
+                const uint32_t* candidate = indicies + triangles[j] * 3;
+                float score = vertexScore[candidate[0]] + vertexScore[candidate[1]] + vertexScore[candidate[2]];
+
+                if (score > bestScore)
+                {
+                    bestScore = score;
+                    bestTriangle = triangles[j];
+                }
+            }
+        }
+
+        std::swap(cache, newCache);
+    }
+
+    memcpy_s(indicies, triangleCount * 3 * sizeof(uint32_t), output.data(), output.size() * sizeof(uint32_t));
+}
+
+void moraine::optimizeOverdraw(uint32_t* indicies, size_t indexCount, const float* positions, size_t vertexCount, size_t positionStride)
+{
+    uint32_t triangleCount = static_cast<uint32_t>(indexCount / 3);
+
+    if (triangleCount == 0)
+        return;
+
+    // A triangle that misses the cache with all three vertices starts a new cluster, reordering clusters keeps the cache behaviour
+    std::vector<uint32_t> clusterStarts;
+    std::vector<uint32_t> loadTime(vertexCount, 0);
+    uint32_t time = s_analysisCacheSize + 1;
+
+    for (uint32_t i = 0; i < triangleCount; ++i)
+    {
+        uint32_t misses = 0;
+
+        for (uint32_t j = 0; j < 3; ++j)
+            if (time - loadTime[indicies[i * 3 + j]] > s_analysisCacheSize)
+            {
+                loadTime[indicies[i * 3 + j]] = time++;
+                ++misses;
+            }
+
+        if (i == 0 or misses == 3)
+            clusterStarts.push_back(i);
+    }
+
+    clusterStarts.push_back(triangleCount);
+
+    float meshCenter[3] = { 0.0f, 0.0f, 0.0f };
+
+    for (uint32_t i = 0; i < triangleCount * 3; ++i)
+        for (uint32_t k = 0; k < 3; ++k)
+            meshCenter[k] += getPosition(positions, positionStride, indicies[i])[k] / (triangleCount * 3);
+
+    struct Cluster
+    {
+        uint32_t    firstTriangle;
+        uint32_t    triangleCount;
+        float       sortKey;
+    };
+
+    std::vector<Cluster> clusters(clusterStarts.size() - 1);
+
+    for (size_t c = 0; c < clusters.size(); ++c)
+    {
+        float center[3] = { 0.0f, 0.0f, 0.0f };
+        float normal[3] = { 0.0f, 0.0f, 0.0f };
+        float area = 0.0f;
+
+        for (uint32_t i = clusterStarts[c]; i < clusterStarts[c + 1]; ++i)
+        {
+            const float* p0 = getPosition(positions, positionStride, indicies[i * 3]);
+            const float* p1 = getPosition(positions, positionStride, indicies[i * 3 + 1]);
+            const float* p2 = getPosition(positions, positionStride, indicies[i * 3 + 2]);
+
+            float e1[3] = { p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2] };
+            float e2[3] = { p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2] };
+            float n[3] = { e1[1] * e2[2] - e1[2] * e2[1], e1[2] * e2[0] - e1[0] * e2[2], e1[0] * e2[1] - e1[1] * e2[0] };
+            float triangleArea = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+
+            for (uint32_t k = 0; k < 3; ++k)
+            {
+                center[k] += (p0[k] + p1[k] + p2[k]) / 3.0f * triangleArea;
+                normal[k] += n[k];
+            }
+
+            area += triangleArea;
+        }
+
+        float normalLength = std::sqrt(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+
+        clusters[c].firstTriangle = clusterStarts[c];
+        clusters[c].triangleCount = clusterStarts[c + 1] - clusterStarts[c];
+        clusters[c].sortKey = 0.0f;
+
+        // Clusters that face away from the mesh center occlude the rest of the mesh and are drawn first
+        if (area > 0.0f and normalLength > 0.0f)
+            for (uint32_t k = 0; k < 3; ++k)
+                clusters[c].sortKey += (center[k] / area - meshCenter[k]) * normal[k] / normalLength;
+    }
+
+    std::stable_sort(clusters.begin(), clusters.end(), [](const Cluster& a, const Cluster& b) { return a.sortKey > b.sortKey; });
+
+    std::vector<uint32_t> output;
+    output.reserve(triangleCount * 3);
+
+    for (auto& a : clusters)
+        output.insert(output.end(), indicies + a.firstTriangle * 3, indicies + (a.firstTriangle + a.triangleCount) * 3);
+
+    memcpy_s(indicies, triangleCount * 3 * sizeof(uint32_t), output.data(), output.size() * sizeof(uint32_t));
+}
+
+size_t moraine::optimizeVertexFetch(void* vertices, size_t vertexCount, size_t vertexSize, uint32_t* indicies, size_t indexCount)
+{
+    std::vector<uint32_t> remap(vertexCount, UINT32_MAX);
+    uint32_t usedVertexCount = 0;
+
+    for (size_t i = 0; i < indexCount; ++i)
+    {
+        if (remap[indicies[i]] == UINT32_MAX)
+            remap[indicies[i]] = usedVertexCount++;
+
+        indicies[i] = remap[indicies[i]];
+    }
+
+    std::vector<uint8_t> source(static_cast<uint8_t*>(vertices), static_cast<uint8_t*>(vertices) + vertexCount * vertexSize);
+
+    for (size_t i = 0; i < vertexCount; ++i)
+        if (remap[i] != UINT32_MAX)
+            memcpy_s(static_cast<uint8_t*>(vertices) + remap[i] * vertexSize, vertexSize, source.data() + i * vertexSize, vertexSize);
+
+    return usedVertexCount;
+}
+
+moraine::MeshOptimizationReport moraine::optimizeMesh(void* vertices, size_t* vertexCount, size_t vertexSize, size_t positionOffset, uint32_t* indicies, size_t indexCount)
+{
+    MeshOptimizationReport report;
+    report.vertexCountBefore = *vertexCount;
+    report.acmrBefore = analyzeVertexCache(indicies, indexCount, *vertexCount, s_analysisCacheSize, &report.atvrBefore);
+
+    optimizeVertexCache(indicies, indexCount, *vertexCount);
+    optimizeOverdraw(indicies, indexCount, reinterpret_cast<const float*>(static_cast<uint8_t*>(vertices) + positionOffset), *vertexCount, vertexSize);
+    *vertexCount = optimizeVertexFetch(vertices, *vertexCount, vertexSize, indicies, indexCount);
+
+    report.vertexCountAfter = *vertexCount;
+    report.acmrAfter = analyzeVertexCache(indicies, indexCount, *vertexCount, s_analysisCacheSize, &report.atvrAfter);
+    report.fits16BitIndicies = *vertexCount < UINT16_MAX;
+
+    return report;
+}
+
+namespace
+{
+    __m128 loadAttribute(const uint8_t* source, moraine::VertexAttributeFormat format)
+    {
+        const float* f = reinterpret_cast<const float*>(source);
+
+        switch (format)
+        {
+        case moraine::VERTEX_ATTRIBUTE_FORMAT_FLOAT2: return _mm_castpd_ps(_mm_load_sd(reinterpret_cast<const double*>(f)));
+        case moraine::VERTEX_ATTRIBUTE_FORMAT_FLOAT3: return _mm_movelh_ps(_mm_castpd_ps(_mm_load_sd(reinterpret_cast<const double*>(f))), _mm_load_ss(f + 2));
+        default:                                      return _mm_loadu_ps(f);
+        }
+    }
+
+    size_t getQuantizedSize(moraine::VertexAttributeFormat format)
+    {
+        switch (format)
+        {
+        case moraine::VERTEX_ATTRIBUTE_FORMAT_FLOAT2:                   return 8;
+        case moraine::VERTEX_ATTRIBUTE_FORMAT_FLOAT3:                   return 12;
+        case moraine::VERTEX_ATTRIBUTE_FORMAT_FLOAT4:                   return 16;
+        case moraine::VERTEX_ATTRIBUTE_FORMAT_SNORM16X4_BOUNDS:         return 8;
+        case moraine::VERTEX_ATTRIBUTE_FORMAT_HALF4:                    return 8;
+        default:                                                        return 4;
+        }
+    }
+
+    // _mm_cvtps_ph() is VEX encoded, so the OS must also save the AVX state
+    bool isF16CSupported()
+    {
+        int info[4];
+        __cpuid(info, 1);
+
+        bool osxsave = info[2] & 1 << 27;
+        bool avx = info[2] & 1 << 28;
+        bool f16c = info[2] & 1 << 29;
+
+        return osxsave and avx and f16c and (_xgetbv(0) & 0b110) == 0b110;
+    }
+
+    // Rounds to nearest even like _mm_cvtps_ph(value, _MM_FROUND_TO_NEAREST_INT)
+    uint16_t floatToHalf(float value)
+    {
+        uint32_t bits;
+        memcpy(&bits, &value, sizeof(bits));
+
+        uint16_t sign = static_cast<uint16_t>(bits >> 16 & 0x8000);
+        uint32_t absolute = bits & 0x7fffffff;
+
+        if (absolute >= 0x7f800000) // Infinity and NaN
+            return sign | 0x7c00 | (absolute > 0x7f800000 ? 0x200 : 0);
+
+        if (absolute >= 0x477ff000) // Rounds to 65520 or more
+            return sign | 0x7c00;
+
+        uint32_t half, remainder, halfway;
+
+        if (absolute < 0x38800000) // Below 2^-14, the result is denormal
+        {
+            uint32_t shift = 126 - (absolute >> 23);
+
+            if (shift > 24)
+                return sign;
+
+            uint32_t mantissa = (absolute & 0x7fffff) | 0x800000;
+            half = mantissa >> shift;
+            remainder = mantissa & ((1u << shift) - 1);
+            halfway = 1u << (shift - 1);
+        }
+        else
+        {
+            half = (absolute >> 13) - 0x1c000; // Exponent bias 127 -> 15
+            remainder = absolute & 0x1fff;
+            halfway = 0x1000;
+        }
+
+        if (remainder > halfway or (remainder == halfway and half & 1))
+            ++half; // Carries into the exponent if the mantissa overflows
+
+        return sign | static_cast<uint16_t>(half);
+    }
+
+    void storeHalf(uint8_t* destination, __m128 value, uint32_t componentCount)
+    {
+        static const bool f16c = isF16CSupported();
+
+        if (f16c)
+        {
+            __m128i half = _mm_cvtps_ph(value, _MM_FROUND_TO_NEAREST_INT);
+
+            if (componentCount == 2)
+                *reinterpret_cast<int32_t*>(destination) = _mm_cvtsi128_si32(half);
+            else
+                _mm_storel_epi64(reinterpret_cast<__m128i*>(destination), half);
+
+            return;
+        }
+
+        alignas(16) float components[4];
+        _mm_store_ps(components, value);
+
+        for (uint32_t k = 0; k < componentCount; ++k)
+        {
+            uint16_t half = floatToHalf(components[k]);
+            memcpy(destination + k * sizeof(uint16_t), &half, sizeof(uint16_t));
+        }
+    }
+
+    const char* getShaderType(moraine::VertexAttributeFormat format)
+    {
+        switch (format)
+        {
+        case moraine::VERTEX_ATTRIBUTE_FORMAT_FLOAT2:                   return "float2";
+        case moraine::VERTEX_ATTRIBUTE_FORMAT_FLOAT3:                   return "float3";
+        case moraine::VERTEX_ATTRIBUTE_FORMAT_FLOAT4:                   return "float4";
+        case moraine::VERTEX_ATTRIBUTE_FORMAT_SNORM16X4_BOUNDS:         return "snorm16x4";
+        case moraine::VERTEX_ATTRIBUTE_FORMAT_UNORM16X2:                return "unorm16x2";
+        case moraine::VERTEX_ATTRIBUTE_FORMAT_HALF2:                    return "half2";
+        case moraine::VERTEX_ATTRIBUTE_FORMAT_HALF4:                    return "half4";
+        case moraine::VERTEX_ATTRIBUTE_FORMAT_OCTAHEDRAL_SNORM16X2:     return "snorm16x2";
+        default:                                                        return "";
+        }
+    }
+}
+
+moraine::QuantizedVertices moraine::quantizeVertices(const void* vertices, size_t vertexCount, size_t vertexSize, std::initializer_list<VertexAttributeQuantization> attributes)
+{
+    const uint8_t* source = static_cast<const uint8_t*>(vertices);
+
+    QuantizedVertices result;
+    result.stride = 0;
+
+    for (auto& a : attributes)
+    {
+        QuantizedAttribute attribute = { };
+        attribute.offset = result.stride;
+        attribute.shaderType = getShaderType(a.outputFormat);
+
+        if (a.outputFormat == VERTEX_ATTRIBUTE_FORMAT_SNORM16X4_BOUNDS)
+        {
+            __m128 minimum = _mm_set_ps1(FLT_MAX);
+            __m128 maximum = _mm_set_ps1(-FLT_MAX);
+
+            for (size_t i = 0; i < vertexCount; ++i)
+            {
+                __m128 value = loadAttribute(source + i * vertexSize + a.inputOffset, a.inputFormat);
+                minimum = _mm_min_ps(minimum, value);
+                maximum = _mm_max_ps(maximum, value);
+            }
+
+            alignas(16) float center[4], halfExtent[4];
+            _mm_store_ps(center, _mm_mul_ps(_mm_add_ps(minimum, maximum), _mm_set_ps1(0.5f)));
+            _mm_store_ps(halfExtent, _mm_max_ps(_mm_mul_ps(_mm_sub_ps(maximum, minimum), _mm_set_ps1(0.5f)), _mm_set_ps1(FLT_MIN)));
+
+            for (uint32_t k = 0; k < 3; ++k)
+            {
+                attribute.boundsCenter[k] = center[k];
+                attribute.boundsHalfExtent[k] = halfExtent[k];
+            }
+        }
+
+        result.stride += getQuantizedSize(a.outputFormat);
+        result.attributes.push_back(attribute);
+    }
+
+    result.stride = getAlignedSize(result.stride, 4);
+    result.data.resize(result.stride * vertexCount);
+
+    size_t attributeIndex = 0;
+
+    for (auto& a : attributes)
+    {
+        const QuantizedAttribute& attribute = result.attributes[attributeIndex++];
+
+        __m128 center = _mm_set_ps(0.0f, attribute.boundsCenter[2], attribute.boundsCenter[1], attribute.boundsCenter[0]);
+        __m128 inverseHalfExtent = _mm_div_ps(_mm_set_ps1(1.0f), _mm_set_ps(1.0f, attribute.boundsHalfExtent[2], attribute.boundsHalfExtent[1], attribute.boundsHalfExtent[0]));
+
+        for (size_t i = 0; i < vertexCount; ++i)
+        {
+            __m128 value = loadAttribute(source + i * vertexSize + a.inputOffset, a.inputFormat);
+            uint8_t* destination = result.data.data() + i * result.stride + attribute.offset;
+
+            switch (a.outputFormat)
+            {
+            case VERTEX_ATTRIBUTE_FORMAT_SNORM16X4_BOUNDS:
+            {
+                value = _mm_mul_ps(_mm_sub_ps(value, center), inverseHalfExtent);
+                value = _mm_insert_ps(value, _mm_set_ss(1.0f), 0b00110000); // w = 1
+                value = _mm_min_ps(_mm_max_ps(value, _mm_set_ps1(-1.0f)), _mm_set_ps1(1.0f));
+                __m128i quantized = _mm_cvtps_epi32(_mm_mul_ps(value, _mm_set_ps1(32767.0f)));
+                _mm_storel_epi64(reinterpret_cast<__m128i*>(destination), _mm_packs_epi32(quantized, quantized));
+                break;
+            }
+
+            case VERTEX_ATTRIBUTE_FORMAT_UNORM16X2:
+            {
+                value = _mm_min_ps(_mm_max_ps(value, _mm_setzero_ps()), _mm_set_ps1(1.0f));
+                __m128i quantized = _mm_cvtps_epi32(_mm_mul_ps(value, _mm_set_ps1(65535.0f)));
+                *reinterpret_cast<int32_t*>(destination) = _mm_cvtsi128_si32(_mm_packus_epi32(quantized, quantized));
+                break;
+            }
+
+            case VERTEX_ATTRIBUTE_FORMAT_HALF2:
+                storeHalf(destination, value, 2);
+                break;
+
+            case VERTEX_ATTRIBUTE_FORMAT_HALF4:
+                storeHalf(destination, value, 4);
+                break;
+
+            case VERTEX_ATTRIBUTE_FORMAT_OCTAHEDRAL_SNORM16X2:
+            {
+                // Project onto the octahedron |x| + |y| + |z| = 1, the lower half is folded over the diagonals
+                __m128 absolute = _mm_andnot_ps(_mm_set_ps1(-0.0f), value);
+                __m128 l1 = _mm_dp_ps(absolute, _mm_set_ps(0.0f, 1.0f, 1.0f, 1.0f), 0b01111111);
+                __m128 projected = _mm_div_ps(value, _mm_max_ps(l1, _mm_set_ps1(FLT_MIN)));
+
+                if (_mm_cvtss_f32(_mm_shuffle_ps(projected, projected, 0b10)) < 0.0f)
+                {
+                    __m128 sign = _mm_or_ps(_mm_and_ps(projected, _mm_set_ps1(-0.0f)), _mm_set_ps1(1.0f));
+                    __m128 swapped = _mm_andnot_ps(_mm_set_ps1(-0.0f), _mm_shuffle_ps(projected, projected, 0b11100001)); // |y|, |x|
+                    projected = _mm_mul_ps(_mm_sub_ps(_mm_set_ps1(1.0f), swapped), sign);
+                }
+
+                projected = _mm_min_ps(_mm_max_ps(projected, _mm_set_ps1(-1.0f)), _mm_set_ps1(1.0f));
+                __m128i quantized = _mm_cvtps_epi32(_mm_mul_ps(projected, _mm_set_ps1(32767.0f)));
+                *reinterpret_cast<int32_t*>(destination) = _mm_cvtsi128_si32(_mm_packs_epi32(quantized, quantized));
+                break;
+            }
+
+            default:
+            {
+                // Components the input doesn't have stay zero, result.data was zero initialized
+                size_t size = min(getQuantizedSize(a.inputFormat), getQuantizedSize(a.outputFormat));
+                memcpy_s(destination, size, source + i * vertexSize + a.inputOffset, size);
+                break;
+            }
+            }
+        }
+    }
+
+    return result;
+}
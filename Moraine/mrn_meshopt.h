@@ -0,0 +1,71 @@
+#pragma once
+
+namespace moraine
+{
+    struct MeshOptimizationReport
+    {
+        float   acmrBefore;         // Average cache miss ratio: vertex shader invocations per triangle
+        float   acmrAfter;
+        float   atvrBefore;         // Average transformed vertex ratio: vertex shader invocations per referenced vertex, 1.0 is optimal
+        float   atvrAfter;
+        size_t  vertexCountBefore;
+        size_t  vertexCountAfter;   // Vertices that aren't referenced by any triangle are removed
+        bool    fits16BitIndicies;  // The index buffer is narrowed to uint16_t by createIndexBuffer()
+    };
+
+    // Simulates a FIFO post transform cache, returns the ACMR and writes the ATVR
+    MRN_API float analyzeVertexCache(const uint32_t* indicies, size_t indexCount, size_t vertexCount, uint32_t cacheSize, float* out_atvr = nullptr);
+
+    // Reorders triangles for the post transform cache (Forsyth)
+    MRN_API void optimizeVertexCache(uint32_t* indicies, size_t indexCount, size_t vertexCount);
+
+    // Reorders clusters of the cache optimized triangles so outward facing clusters come first, which reduces overdraw
+    // without breaking vertex locality inside a cluster. positions points to the first float3 position, positionStride is the vertex size
+    MRN_API void optimizeOverdraw(uint32_t* indicies, size_t indexCount, const float* positions, size_t vertexCount, size_t positionStride);
+
+    // Reorders vertices in the order the triangles first use them and drops unused vertices, returns the new vertex count
+    MRN_API size_t optimizeVertexFetch(void* vertices, size_t vertexCount, size_t vertexSize, uint32_t* indicies, size_t indexCount);
+
+    // Runs all of the above, positionOffset is the byte offset of the float3 position inside a vertex
+    MRN_API MeshOptimizationReport optimizeMesh(void* vertices, size_t* vertexCount, size_t vertexSize, size_t positionOffset, uint32_t* indicies, size_t indexCount);
+
+    enum VertexAttributeFormat
+    {
+        // Input formats
+        VERTEX_ATTRIBUTE_FORMAT_FLOAT2,
+        VERTEX_ATTRIBUTE_FORMAT_FLOAT3,
+        VERTEX_ATTRIBUTE_FORMAT_FLOAT4,
+
+        // Quantized formats
+        VERTEX_ATTRIBUTE_FORMAT_SNORM16X4_BOUNDS,       // 8 bytes, xyz relative to the bounds of all vertices, w = 1: position = center + value.xyz * halfExtent
+        VERTEX_ATTRIBUTE_FORMAT_UNORM16X2,              // 4 bytes, clamped to [0, 1], e.g. texture coordinates
+        VERTEX_ATTRIBUTE_FORMAT_HALF2,                  // 4 bytes
+        VERTEX_ATTRIBUTE_FORMAT_HALF4,                  // 8 bytes
+        VERTEX_ATTRIBUTE_FORMAT_OCTAHEDRAL_SNORM16X2    // 4 bytes, octahedral encoded unit vectors, e.g. normals
+    };
+
+    struct VertexAttributeQuantization
+    {
+        size_t                  inputOffset;
+        VertexAttributeFormat   inputFormat;
+        VertexAttributeFormat   outputFormat;
+    };
+
+    struct QuantizedAttribute
+    {
+        size_t                  offset;                 // "offset" of the attribute in the shader config
+        const char*             shaderType;             // "type" of the attribute in the shader config
+        float                   boundsCenter[3];        // Only for VERTEX_ATTRIBUTE_FORMAT_SNORM16X4_BOUNDS
+        float                   boundsHalfExtent[3];
+    };
+
+    struct QuantizedVertices
+    {
+        std::vector<uint8_t>            data;
+        size_t                          stride;         // "stride" of the vertex binding in the shader config
+        std::vector<QuantizedAttribute> attributes;     // In the order the attributes were passed
+    };
+
+    // Converts every vertex to the quantized layout, attributes that aren't listed are dropped
+    MRN_API QuantizedVertices quantizeVertices(const void* vertices, size_t vertexCount, size_t vertexSize, std::initializer_list<VertexAttributeQuantization> attributes);
+}
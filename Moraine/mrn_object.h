@@ -13,8 +13,12 @@ namespace moraine
         OBJECT_TYPE_AUDIO       = 0b10 << 30
     };
 
+    class Layer_T;
+
     class Object_T
     {
+        friend class Layer_I;
+
     public:
 
         virtual ~Object_T() = default;
@@ -24,5 +28,14 @@ namespace moraine
         
 
         virtual ObjectType type() = 0;
+
+    protected:
+
+        // Call after changing anything the draw depends on (parameters, counts, buffers), the renderer re-records the object's layer
+        MRN_API void markChanged();
+
+    private:
+
+        Layer_T* m_layer = nullptr; // Set when the object is added to a layer
     };
 }
\ No newline at end of file
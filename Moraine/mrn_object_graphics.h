@@ -3,6 +3,7 @@
 #include "mrn_object.h"
 #include "mrn_buffer.h"
 #include "mrn_constset.h"
+#include "mrn_culling.h"
 
 namespace moraine
 {
@@ -51,13 +52,28 @@ namespace moraine
                     m_constantArrayIndicies[i] = m_graphicsParameters->m_constantArrays[i]->addElement();
         }
 
-        ~Object_Graphics_T() = default;
+        ~Object_Graphics_T()
+        {
+            // Elements the object created are given back, compacting arrays fill the gap right away
+            for (uint32_t i = 0; i < m_constantArrayIndicies.size(); ++i)
+                if (m_graphicsParameters->m_constantArrayIndicies[i] == UINT32_MAX)
+                    m_graphicsParameters->m_constantArrays[i]->removeElement(m_constantArrayIndicies[i]);
+        }
 
         inline ObjectType type() { return OBJECT_TYPE_GRAPHICS; }
 
+        // Bounds are in the space of the culling frustum of the object's layer, objects without bounds are never culled
+        void setBounds(const Bounds& bounds) { m_bounds = bounds; m_hasBounds = true; }
+        void clearBounds() { m_hasBounds = false; }
+
     protected:
 
         std::shared_ptr<GraphicsParameters> m_graphicsParameters;
         std::vector<uint32_t> m_constantArrayIndicies;
+
+    private:
+
+        Bounds m_bounds;
+        bool m_hasBounds = false;
     };
 }
\ No newline at end of file
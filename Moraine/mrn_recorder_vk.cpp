@@ -0,0 +1,179 @@
+#include "mrn_core.h"
+#include "mrn_recorder_vk.h"
+
+moraine::CommandRecorder_IVulkan::CommandRecorder_IVulkan(GraphicsContext_IVulkan* context) :
+    m_context(context),
+    m_generation(0),
+    m_busyThreads(0),
+    m_shutdown(false),
+    m_jobCount(0),
+    m_jobFunction(nullptr),
+    m_nextJob(0)
+{
+    // One core stays with the calling thread, which records jobs as well
+    uint32_t workerCount = clamp(1u, std::thread::hardware_concurrency(), 16u) - 1;
+
+    for (uint32_t i = 0; i < workerCount; ++i)
+        m_threads.emplace_back(&CommandRecorder_IVulkan::workerMain, this);
+}
+
+moraine::CommandRecorder_IVulkan::~CommandRecorder_IVulkan()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_shutdown = true;
+    }
+
+    m_wakeCondition.notify_all();
+
+    for (auto& a : m_threads)
+        a.join();
+}
+
+void moraine::CommandRecorder_IVulkan::record(const VkCommandBufferInheritanceInfo& inheritanceInfo, const std::vector<SecondaryCommandBuffer*>& targets,
+                                              const std::function<void(VkCommandBuffer, uint32_t)>& recordFunction)
+{
+    run(static_cast<uint32_t>(targets.size()), [&](uint32_t job)
+    {
+        beginTarget(*targets[job], inheritanceInfo);
+        recordFunction(targets[job]->commandBuffer, job);
+        assert_vulkan(m_context->getLogfile(), vkEndCommandBuffer(targets[job]->commandBuffer), L"vkEndCommandBuffer() failed", MRN_DEBUG_INFO);
+    });
+}
+
+void moraine::CommandRecorder_IVulkan::run(uint32_t jobCount, const std::function<void(uint32_t)>& jobFunction)
+{
+    m_jobCount = jobCount;
+    m_jobFunction = &jobFunction;
+    m_nextJob = 0;
+
+    // Single jobs aren't worth waking the workers
+    bool useWorkers = jobCount > 1 and not m_threads.empty();
+
+    if (useWorkers)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_busyThreads = static_cast<uint32_t>(m_threads.size());
+            ++m_generation;
+        }
+
+        m_wakeCondition.notify_all();
+    }
+
+    std::exception_ptr exception;
+
+    try
+    {
+        runJobs();
+    }
+    catch (...)
+    {
+        exception = std::current_exception();
+        m_nextJob = jobCount; // Stops the workers after their current job
+    }
+
+    if (useWorkers)
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_doneCondition.wait(lock, [this] { return m_busyThreads == 0; });
+
+        if (not exception)
+            exception = m_exception;
+
+        m_exception = nullptr;
+    }
+
+    if (exception)
+        std::rethrow_exception(exception);
+}
+
+void moraine::CommandRecorder_IVulkan::destroy(SecondaryCommandBuffer& commandBuffer)
+{
+    // Destroying the pool frees its command buffer
+    if (commandBuffer.pool != VK_NULL_HANDLE)
+        vkDestroyCommandPool(m_context->m_device, commandBuffer.pool, nullptr);
+
+    commandBuffer.pool = VK_NULL_HANDLE;
+    commandBuffer.commandBuffer = VK_NULL_HANDLE;
+}
+
+void moraine::CommandRecorder_IVulkan::workerMain()
+{
+    uint64_t generation = 0;
+
+    while (true)
+    {
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_wakeCondition.wait(lock, [&] { return m_shutdown or m_generation != generation; });
+
+            if (m_shutdown)
+                return;
+
+            generation = m_generation;
+        }
+
+        std::exception_ptr exception;
+
+        try
+        {
+            runJobs();
+        }
+        catch (...)
+        {
+            exception = std::current_exception();
+            m_nextJob = m_jobCount;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+
+            if (exception and not m_exception)
+                m_exception = exception;
+
+            if (--m_busyThreads == 0)
+                m_doneCondition.notify_one();
+        }
+    }
+}
+
+void moraine::CommandRecorder_IVulkan::runJobs()
+{
+    // Jobs are handed out one at a time, so threads that got cheap jobs take over the remaining ones
+    for (uint32_t job = m_nextJob++; job < m_jobCount; job = m_nextJob++)
+        (*m_jobFunction)(job);
+}
+
+void moraine::CommandRecorder_IVulkan::beginTarget(SecondaryCommandBuffer& target, const VkCommandBufferInheritanceInfo& inheritanceInfo)
+{
+    if (target.pool == VK_NULL_HANDLE)
+    {
+        VkCommandPoolCreateInfo vcpci;
+        vcpci.sType                 = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+        vcpci.pNext                 = nullptr;
+        vcpci.flags                 = 0; // Only reset as a whole
+        vcpci.queueFamilyIndex      = m_context->m_graphicsQueue.queueFamilyIndex;
+
+        assert_vulkan(m_context->getLogfile(), vkCreateCommandPool(m_context->m_device, &vcpci, nullptr, &target.pool), L"vkCreateCommandPool() failed", MRN_DEBUG_INFO);
+
+        VkCommandBufferAllocateInfo vcbai;
+        vcbai.sType                     = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        vcbai.pNext                     = nullptr;
+        vcbai.commandPool               = target.pool;
+        vcbai.level                     = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+        vcbai.commandBufferCount        = 1;
+
+        assert_vulkan(m_context->getLogfile(), vkAllocateCommandBuffers(m_context->m_device, &vcbai, &target.commandBuffer), L"vkAllocateCommandBuffers() failed", MRN_DEBUG_INFO);
+    }
+    else
+        assert_vulkan(m_context->getLogfile(), vkResetCommandPool(m_context->m_device, target.pool, 0), L"vkResetCommandPool() failed", MRN_DEBUG_INFO);
+
+    VkCommandBufferBeginInfo vcbbi;
+    vcbbi.sType                 = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    vcbbi.pNext                 = nullptr;
+    vcbbi.flags                 = VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+    vcbbi.pInheritanceInfo      = &inheritanceInfo;
+
+    assert_vulkan(m_context->getLogfile(), vkBeginCommandBuffer(target.commandBuffer, &vcbbi), L"vkBeginCommandBuffer() failed", MRN_DEBUG_INFO);
+}
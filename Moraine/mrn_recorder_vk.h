@@ -0,0 +1,61 @@
+#pragma once
+
+#include "mrn_gfxcontext_vk.h"
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+namespace moraine
+{
+    struct SecondaryCommandBuffer
+    {
+        VkCommandPool           pool = VK_NULL_HANDLE; // Every command buffer has its own pool, so it can be reset and recorded on any thread
+        VkCommandBuffer         commandBuffer = VK_NULL_HANDLE;
+    };
+
+    // Records secondary command buffers on worker threads. Command buffers are kept by their owner between recordings,
+    // so parts of a frame that didn't change are executed again without being recorded. Other per frame work can run on the same threads
+    class CommandRecorder_IVulkan
+    {
+    public:
+
+        CommandRecorder_IVulkan(GraphicsContext_IVulkan* context);
+        ~CommandRecorder_IVulkan();
+
+        // Calls recordFunction(commandBuffer, jobIndex) for every target on the workers and the calling thread, returns once all jobs are recorded.
+        // Targets are created on first use and reset otherwise, none of them may be pending execution
+        void record(const VkCommandBufferInheritanceInfo& inheritanceInfo, const std::vector<SecondaryCommandBuffer*>& targets,
+                    const std::function<void(VkCommandBuffer, uint32_t)>& recordFunction);
+
+        void destroy(SecondaryCommandBuffer& commandBuffer);
+
+        // Calls jobFunction(jobIndex) for every job on the workers and the calling thread, returns once all jobs are done
+        void run(uint32_t jobCount, const std::function<void(uint32_t)>& jobFunction);
+
+        uint32_t threadCount() const { return static_cast<uint32_t>(m_threads.size()) + 1; }
+
+    private:
+
+        void workerMain();
+        void runJobs();
+        void beginTarget(SecondaryCommandBuffer& target, const VkCommandBufferInheritanceInfo& inheritanceInfo); // Creates or resets the target and begins it
+
+        GraphicsContext_IVulkan*                                m_context;
+        std::vector<std::thread>                                m_threads;
+
+        std::mutex                                              m_mutex;
+        std::condition_variable                                 m_wakeCondition;
+        std::condition_variable                                 m_doneCondition;
+        uint64_t                                                m_generation;   // Incremented for every run() call, wakes the workers
+        uint32_t                                                m_busyThreads;
+        bool                                                    m_shutdown;
+        std::exception_ptr                                      m_exception;    // First exception thrown by a worker, rethrown by run()
+
+        // Parameters of the current run() call, only written while the workers are idle
+        uint32_t                                                m_jobCount;
+        const std::function<void(uint32_t)>*                    m_jobFunction;
+        std::atomic<uint32_t>                                   m_nextJob;
+    };
+}
@@ -7,3 +7,34 @@ moraine::Renderer moraine::createRenderer(GraphicsContext context, std::list<Lay
 {
     return std::make_shared<Renderer_IVulkan>(context, layerStack);
 }
+
+bool moraine::saveFrame(const FrameCapture& frame, Stringr path)
+{
+    FILE* file;
+
+    if (_wfopen_s(&file, path.wcstr(), L"wb") or file == 0)
+        return false;
+
+    fprintf(file, "P6\n%u %u\n255\n", frame.width, frame.height);
+
+    std::vector<uint8_t> row(frame.width * 3);
+    bool success = true;
+
+    for (uint32_t y = 0; y < frame.height and success; ++y)
+    {
+        const uint8_t* pixel = frame.pixels + static_cast<size_t>(y) * frame.rowPitch;
+
+        for (uint32_t x = 0; x < frame.width; ++x, pixel += 4)
+        {
+            row[x * 3 + 0] = pixel[0];
+            row[x * 3 + 1] = pixel[1];
+            row[x * 3 + 2] = pixel[2];
+        }
+
+        success = fwrite(row.data(), 1, row.size(), file) == row.size();
+    }
+
+    fclose(file);
+
+    return success;
+}
@@ -5,6 +5,32 @@
 
 namespace moraine
 {
+    struct RenderStatistics
+    {
+        uint32_t drawCount;
+        uint32_t bindCount;             // Pipeline, vertex buffer, index buffer and descriptor set binds of the last recorded frame
+        uint32_t unsortedBindCount;     // Binds the same draws would need in list order without skipping redundant state
+        uint32_t indirectObjectCount;   // Objects drawn from the draw lists, each indirect draw counts once in drawCount
+        uint32_t visibleObjectCount;    // Graphics objects of the last frame that passed culling or aren't culled
+        uint32_t culledObjectCount;     // Graphics objects of the last frame whose bounds were outside of their layer's culling frustum
+        uint32_t renderPassCount;       // Render passes of the frame's render graph
+        uint32_t barrierCount;          // Image barriers the render graph inserted into the frame
+        uint64_t transientMemory;       // Bytes of the render graph's transient images, which share memory if their lifetimes don't overlap
+        uint64_t transientMemoryUnaliased;
+    };
+
+    // A frame of a headless context in host memory, the pixels are only valid during the FrameCallback
+    struct FrameCapture
+    {
+        uint64_t        frameNumber;    // Counts the submitted frames, starting at 0
+        uint32_t        width;
+        uint32_t        height;
+        uint32_t        rowPitch;       // Bytes per row
+        const uint8_t*  pixels;         // 4 bytes per pixel in RGBA order, top row first
+    };
+
+    typedef std::function<void(const FrameCapture&)> FrameCallback;
+
     class Renderer_T
     {
     public:
@@ -12,9 +38,18 @@ namespace moraine
         virtual ~Renderer_T() = default;
 
         virtual uint32_t tick(float delta) = 0; // return frame index for next frame
+
+        virtual RenderStatistics getStatistics() const = 0;
+
+        // Headless only. Frames are read back while later frames render and handed over in order once the GPU finished them,
+        // framesInFlight ticks after they were submitted. The remaining frames are handed over when the renderer is destroyed
+        virtual void setFrameCallback(FrameCallback callback) = 0;
     };
 
     typedef std::shared_ptr<Renderer_T> Renderer;
 
     MRN_API Renderer createRenderer(GraphicsContext context, std::list<Layer>* layerStack);
+
+    // Writes a binary PPM (P6), alpha is dropped. Returns false if the file couldn't be written
+    MRN_API bool saveFrame(const FrameCapture& frame, Stringr path);
 }
\ No newline at end of file
@@ -1,14 +1,19 @@
 #include "mrn_core.h"
 #include "mrn_renderer_vk.h"
+#include "mrn_shadercompiler_vk.h"
 
 // temp
 #include <stb_image.h>
 
 moraine::Renderer_IVulkan::Renderer_IVulkan(GraphicsContext context, std::list<Layer>* layerStack) :
     m_context(std::static_pointer_cast<GraphicsContext_IVulkan>(context)),
-    m_syncObjectIndex(0),
+    m_frameIndex(0),
+    m_frameNumber(0),
+    m_startTime(Time::now()),
     m_layerStack(layerStack)
 {
+    m_indirectDraws = m_context->m_physicalDevice.deviceFeatures.multiDrawIndirect == VK_TRUE and m_context->m_physicalDevice.deviceFeatures.drawIndirectFirstInstance == VK_TRUE;
+
     t_shader = createShader(L"C:\\dev\\Moraine\\shader\\sweden.json", context);
 
     std::vector<T_ImageVertex> t_verticies =
@@ -60,52 +65,167 @@ moraine::Renderer_IVulkan::Renderer_IVulkan(GraphicsContext context, std::list<L
 
     //t_constantSet2 = createConstantSet(t_fontShader, 0, { { t, 0 } });
 
-    m_commandBuffers.resize(m_context->m_swapchainImages.size());
+    // One primary command buffer per frame in flight, it is recorded every frame for the framebuffer of the acquired image
+    m_commandBuffers.resize(m_context->m_framesInFlight);
 
     VkCommandBufferAllocateInfo vcbai;
     vcbai.sType                     = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
     vcbai.pNext                     = nullptr;
     vcbai.commandPool               = m_context->m_mainThreadCommandPools[m_context->m_graphicsQueue.queueFamilyIndex];
     vcbai.level                     = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-    vcbai.commandBufferCount        = static_cast<uint32_t>(m_context->m_swapchainImages.size());
+    vcbai.commandBufferCount        = static_cast<uint32_t>(m_commandBuffers.size());
 
     assert_vulkan(m_context->getLogfile(), vkAllocateCommandBuffers(m_context->m_device, &vcbai, m_commandBuffers.data()), L"vkAllocateCommandBuffers() failed", MRN_DEBUG_INFO);
 
+    m_statistics = { };
+    m_layerCaches.push_back({ nullptr, std::vector<LayerFrame>(m_commandBuffers.size()), { }, 0, false, true, 0 }); // Test quad
+    m_executedLayers.resize(m_commandBuffers.size());
+
+    m_recorder = std::make_unique<CommandRecorder_IVulkan>(m_context.get());
+
+    m_context->getLogfile()->print(GREY, sprintf(L"Recording command buffers on %d threads", m_recorder->threadCount()), MRN_DEBUG_INFO);
+    m_context->getLogfile()->print(GREY, sprintf(m_context->m_description.headless ? L"%d frames in flight, %d offscreen render targets" : L"%d frames in flight, %d swapchain images",
+                                                 m_context->m_framesInFlight, static_cast<uint32_t>(m_context->m_swapchainImages.size())), MRN_DEBUG_INFO);
+
+    if (not m_indirectDraws)
+        m_context->getLogfile()->print(YELLOW, L"multiDrawIndirect isn't supported, every object is drawn with its own draw call", MRN_DEBUG_INFO);
+
+    // Constructed in place, every frame gets its own semaphores and fence
+    m_syncObjects.reserve(m_commandBuffers.size());
+
     for (uint32_t i = 0; i < m_commandBuffers.size(); ++i)
-        recordCommandBuffer(i);
+        m_syncObjects.emplace_back(m_context->m_device, m_context->getLogfile());
+
+    m_uploadCommandBuffers.resize(m_commandBuffers.size());
+    m_graphicsTaskTickets.resize(m_commandBuffers.size(), 0);
+
+    vcbai.commandBufferCount        = static_cast<uint32_t>(m_uploadCommandBuffers.size());
+
+    assert_vulkan(m_context->getLogfile(), vkAllocateCommandBuffers(m_context->m_device, &vcbai, m_uploadCommandBuffers.data()), L"vkAllocateCommandBuffers() failed", MRN_DEBUG_INFO);
+
+    if (m_context->m_description.headless)
+    {
+        m_readbacks.resize(m_commandBuffers.size());
+
+        for (auto& a : m_readbacks)
+            m_context->createVulkanBuffer(static_cast<size_t>(m_context->m_viewportWidth) * m_context->m_viewportHeight * 4, VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_MEMORY_USAGE_GPU_TO_CPU,
+                                          &a.buffer, &a.allocation, reinterpret_cast<void**>(&a.data));
+    }
+
+    // The frame: the layers are drawn into the swapchain image, headless frames are then copied into the readback buffer
+    bool headless = m_context->m_description.headless;
+
+    m_renderGraph = std::make_unique<RenderGraph_IVulkan>(m_context.get());
+
+    // The image was last used by the presentation engine (which the acquire semaphore waits for at color output) or by an earlier readback
+    RenderGraph_IVulkan::ImageState initialState = { VK_IMAGE_LAYOUT_UNDEFINED, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, 0 };
+    RenderGraph_IVulkan::ImageState finalState = { VK_IMAGE_LAYOUT_PRESENT_SRC_KHR, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0 };
+
+    if (headless)
+    {
+        initialState.stages = VK_PIPELINE_STAGE_TRANSFER_BIT;
+        finalState.layout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+    }
+
+    m_backbuffer = m_renderGraph->importImage(L"Backbuffer", m_context->m_swapchainFormat, m_context->m_viewportWidth, m_context->m_viewportHeight, { 0.0f, 0.0f, 0.2f, 1.0f }, initialState, finalState);
+
+    m_renderGraph->addPass(L"Layers", { { m_backbuffer, RENDER_GRAPH_USAGE_COLOR_ATTACHMENT } }, [this](VkCommandBuffer commandBuffer, uint32_t i)
+    {
+        // Executed in the order of the layer stack
+        std::vector<VkCommandBuffer> secondaryCommandBuffers;
 
-    m_syncObjects.resize(m_context->m_swapchainImages.size() - 1, SyncObjects(m_context->m_device, m_context->getLogfile()));
+        for (auto a : m_executedLayers[i])
+        {
+            const LayerFrame& frame = a->frames[i];
 
-    assert_vulkan(m_context->getLogfile(), vkAcquireNextImageKHR(m_context->m_device,
-                  m_context->m_swapchain,
-                  UINT64_MAX,
-                  m_syncObjects[m_syncObjectIndex].m_renderWaitSemaphore,
-                  VK_NULL_HANDLE,
-                  &m_imageIndex),
-                  L"vkAcquireNextImageKHR() failed", MRN_DEBUG_INFO);
+            for (uint32_t b = 0; b < frame.commandBufferCount; ++b)
+                secondaryCommandBuffers.push_back(frame.commandBuffers[b].commandBuffer);
+        }
+
+        if (not secondaryCommandBuffers.empty())
+            vkCmdExecuteCommands(commandBuffer, static_cast<uint32_t>(secondaryCommandBuffers.size()), secondaryCommandBuffers.data());
+    }, RENDER_GRAPH_PASS_SECONDARY_COMMAND_BUFFERS);
+
+    if (headless)
+        m_renderGraph->addPass(L"Readback", { { m_backbuffer, RENDER_GRAPH_USAGE_TRANSFER_SRC } }, [this](VkCommandBuffer commandBuffer, uint32_t i)
+        {
+            recordReadback(commandBuffer, i);
+        }, RENDER_GRAPH_PASS_SIDE_EFFECTS);
+
+    m_renderGraph->compile();
 }
 
 moraine::Renderer_IVulkan::~Renderer_IVulkan()
 {
+    m_context->m_shaderCompiler->cancel();
+
     vkDeviceWaitIdle(m_context->m_device);
 
+    // Oldest frame first, m_frameIndex is the frame in flight that was submitted the longest time ago
+    for (uint32_t i = 0; i < m_readbacks.size(); ++i)
+        deliverReadback((m_frameIndex + i) % static_cast<uint32_t>(m_readbacks.size()));
+
+    for (auto& a : m_readbacks)
+        vmaDestroyBuffer(m_context->m_allocator, a.buffer, a.allocation);
+
+    m_renderGraph.reset();
+
+    if (m_context->m_description.headless and m_frameNumber > 0)
+    {
+        float seconds = Time::duration(m_startTime, Time::now()).getSecondsF();
+
+        m_context->getLogfile()->print(WHITE, sprintf(L"Rendered %llu headless frames (%dx%d) in %.3f s, %.1f fps", m_frameNumber, m_context->m_viewportWidth, m_context->m_viewportHeight,
+                                                      seconds, static_cast<float>(m_frameNumber) / seconds), MRN_DEBUG_INFO);
+    }
+
     vkFreeCommandBuffers(m_context->m_device, m_context->m_mainThreadCommandPools[m_context->m_graphicsQueue.queueFamilyIndex], static_cast<uint32_t>(m_commandBuffers.size()), m_commandBuffers.data());
+    vkFreeCommandBuffers(m_context->m_device, m_context->m_mainThreadCommandPools[m_context->m_graphicsQueue.queueFamilyIndex], static_cast<uint32_t>(m_uploadCommandBuffers.size()), m_uploadCommandBuffers.data());
+
+    for (auto& a : m_layerCaches)
+        for (auto& b : a.frames)
+            destroyLayerFrame(b);
 }
 
 uint32_t moraine::Renderer_IVulkan::tick(float delta)
 {
-    assert_vulkan(m_context->getLogfile(), vkWaitForFences(m_context->m_device, 1, &m_syncObjects[m_syncObjectIndex].m_fence, VK_TRUE, UINT64_MAX), L"vkWaitForFences() failed", MRN_DEBUG_INFO);
-    assert_vulkan(m_context->getLogfile(), vkResetFences(m_context->m_device, 1, &m_syncObjects[m_syncObjectIndex].m_fence), L"vkResetFences() failed", MRN_DEBUG_INFO);
+    uint32_t i = m_frameIndex;
+    SyncObjects& syncObjects = m_syncObjects[i];
+
+    // Everything below writes resources of frame index i, which the frame submitted m_framesInFlight frames ago may still read.
+    // Layers were ticked before, so the CPU worked on this frame while the GPU rendered the previous ones
+    assert_vulkan(m_context->getLogfile(), vkWaitForFences(m_context->m_device, 1, &syncObjects.m_fence, VK_TRUE, UINT64_MAX), L"vkWaitForFences() failed", MRN_DEBUG_INFO);
+
+    if (m_frameNumber == 0)
+        m_startTime = Time::now();
+
+    if (not m_readbacks.empty())
+        deliverReadback(i);
+
+    // Shaders that became ready invalidate the recorded commands, so objects that were skipped are drawn from this frame on
+    m_context->m_shaderCompiler->deliverCompletedJobs();
+
+    auto stagingRing = std::static_pointer_cast<StagingRing_IVulkan>(m_context->m_stagingRing);
+
+    // Graphics tasks of the frame that last used this frame index have finished reading their staging memory
+    stagingRing->completeFrame(m_graphicsTaskTickets[i]);
+
+    // Copy the data that changed since this frame's copy was last submitted
+    for (auto a : m_context->m_flushableResources)
+        a->flushFrame(i);
+
+    bool tasksDispatched = false;
 
     if (not m_context->m_asyncTasks.empty())
     {
         for (auto a = m_context->m_asyncTasks.begin(); a != m_context->m_asyncTasks.end();)
-            if (a->completedFramesBitset & 1 << m_imageIndex) // frame not dispatched
+            if (a->completedFramesBitset & 1 << i) // frame not dispatched
             {
                 if(a->perFrameTasks)
-                    a->perFrameTasks(m_imageIndex);
+                    a->perFrameTasks(i);
 
-                a->completedFramesBitset ^= 1 << m_imageIndex; // mark frame as dispatched
+                tasksDispatched = true;
+
+                a->completedFramesBitset ^= 1 << i; // mark frame as dispatched
 
                 if (a->completedFramesBitset == 0) // all frames dispatched
                 {
@@ -118,30 +238,107 @@ uint32_t moraine::Renderer_IVulkan::tick(float delta)
             }
             else
                 ++a; // increment
+    }
 
-        recordCommandBuffer(m_imageIndex);
+    // Tasks may rewrite descriptor sets this frame's commands use
+    recordLayers(i, tasksDispatched);
+
+    // All uploads of this frame go to the transfer queue in one submit, the frame waits for them on the upload semaphore
+    UploadTicket uploadTicket = stagingRing->submitUploads();
+
+    VkCommandBuffer submitBuffers[2];
+    uint32_t submitBufferCount = 0;
+
+    m_graphicsTaskTickets[i] = 0;
+
+    if (stagingRing->hasGraphicsTasks())
+    {
+        VkCommandBuffer uploadBuffer = m_uploadCommandBuffers[i];
+
+        VkCommandBufferBeginInfo vcbbi;
+        vcbbi.sType                 = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        vcbbi.pNext                 = nullptr;
+        vcbbi.flags                 = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+        vcbbi.pInheritanceInfo      = nullptr;
+
+        assert_vulkan(m_context->getLogfile(), vkBeginCommandBuffer(uploadBuffer, &vcbbi), L"vkBeginCommandBuffer() failed", MRN_DEBUG_INFO);
+
+        m_graphicsTaskTickets[i] = stagingRing->recordGraphicsTasks(uploadBuffer);
+
+        assert_vulkan(m_context->getLogfile(), vkEndCommandBuffer(uploadBuffer), L"vkEndCommandBuffer() failed", MRN_DEBUG_INFO);
+
+        submitBuffers[submitBufferCount++] = uploadBuffer;
     }
 
-    VkPipelineStageFlags waitStages[] = { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT };
+    bool headless = m_context->m_description.headless;
+
+    // The render target of frame n - renderTargetCount is free, renderTargetCount is at least m_framesInFlight and that frame's fence was waited for
+    if (headless)
+        m_imageIndex = static_cast<uint32_t>(m_frameNumber % m_context->m_swapchainImages.size());
+    else // Acquired as late as possible, the call blocks until the presentation engine gives an image back
+        assert_vulkan(m_context->getLogfile(), vkAcquireNextImageKHR(m_context->m_device,
+                      m_context->m_swapchain,
+                      UINT64_MAX,
+                      syncObjects.m_renderWaitSemaphore,
+                      VK_NULL_HANDLE,
+                      &m_imageIndex),
+                      L"vkAcquireNextImageKHR() failed", MRN_DEBUG_INFO);
+
+    recordPrimary(i, m_imageIndex);
+
+    submitBuffers[submitBufferCount++] = m_commandBuffers[i];
+
+    // Headless frames have no image to wait for and nothing to present, they skip the binary semaphores
+    uint32_t firstWait = headless ? 1 : 0;
+
+    VkSemaphore waitSemaphores[] = { syncObjects.m_renderWaitSemaphore, stagingRing->getSemaphore() };
+    uint64_t waitValues[] = { 0, uploadTicket }; // The value for the binary semaphore is ignored
+    VkPipelineStageFlags waitStages[] = 
+    { 
+        VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, 
+        VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT 
+    };
+
+    VkTimelineSemaphoreSubmitInfoKHR vtssi;
+    vtssi.sType                     = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO_KHR;
+    vtssi.pNext                     = nullptr;
+    vtssi.waitSemaphoreValueCount   = 2 - firstWait;
+    vtssi.pWaitSemaphoreValues      = waitValues + firstWait;
+    vtssi.signalSemaphoreValueCount = 0;
+    vtssi.pSignalSemaphoreValues    = nullptr;
 
     VkSubmitInfo submitInfo;
     submitInfo.sType                = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-    submitInfo.pNext                = nullptr;
-    submitInfo.waitSemaphoreCount   = 1;
-    submitInfo.pWaitSemaphores      = &m_syncObjects[m_syncObjectIndex].m_renderWaitSemaphore;
-    submitInfo.pWaitDstStageMask    = waitStages;
-    submitInfo.commandBufferCount   = 1;
-    submitInfo.pCommandBuffers      = &m_commandBuffers[m_imageIndex];
-    submitInfo.signalSemaphoreCount = 1;
-    submitInfo.pSignalSemaphores    = &m_syncObjects[m_syncObjectIndex].m_presentWaitSemaphore;
+    submitInfo.pNext                = &vtssi;
+    submitInfo.waitSemaphoreCount   = 2 - firstWait;
+    submitInfo.pWaitSemaphores      = waitSemaphores + firstWait;
+    submitInfo.pWaitDstStageMask    = waitStages + firstWait;
+    submitInfo.commandBufferCount   = submitBufferCount;
+    submitInfo.pCommandBuffers      = submitBuffers;
+    submitInfo.signalSemaphoreCount = headless ? 0 : 1;
+    submitInfo.pSignalSemaphores    = &syncObjects.m_presentWaitSemaphore;
 
-    assert_vulkan(m_context->getLogfile(), vkQueueSubmit(m_context->m_graphicsQueue.queue, 1, &submitInfo, m_syncObjects[m_syncObjectIndex].m_fence), L"vkQueueSubmit() failed", MRN_DEBUG_INFO);
+    assert_vulkan(m_context->getLogfile(), vkResetFences(m_context->m_device, 1, &syncObjects.m_fence), L"vkResetFences() failed", MRN_DEBUG_INFO);
+    assert_vulkan(m_context->getLogfile(), vkQueueSubmit(m_context->m_graphicsQueue.queue, 1, &submitInfo, syncObjects.m_fence), L"vkQueueSubmit() failed", MRN_DEBUG_INFO);
+
+    if (++m_frameNumber == 1) // Pipelines of a warm cache aren't compiled again, which is most of the difference
+        m_context->getLogfile()->print(WHITE, sprintf(L"First frame submitted %.3f ms after the context was created (%s pipeline cache)",
+                                                      Time::duration(m_context->m_creationTime, Time::now()).getMillisecondsF(), m_context->m_pipelineCacheLoaded ? L"warm" : L"cold"), MRN_DEBUG_INFO);
+
+    // Pipelines created while the application runs are written out every now and then, not only on shutdown
+    m_context->savePipelineCache(false);
+
+    // The layers are ticked for this frame index next
+    m_frameIndex = (m_frameIndex + 1) % static_cast<uint32_t>(m_syncObjects.size());
+
+    if (headless)
+        return m_frameIndex;
 
     VkPresentInfoKHR vpi;
     vpi.sType                       = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
     vpi.pNext                       = nullptr;
     vpi.waitSemaphoreCount          = 1;
-    vpi.pWaitSemaphores             = &m_syncObjects[m_syncObjectIndex].m_presentWaitSemaphore;
+    vpi.pWaitSemaphores             = &syncObjects.m_presentWaitSemaphore;
     vpi.swapchainCount              = 1;
     vpi.pSwapchains                 = &m_context->m_swapchain;
     vpi.pImageIndices               = &m_imageIndex;
@@ -149,44 +346,582 @@ uint32_t moraine::Renderer_IVulkan::tick(float delta)
 
     assert_vulkan(m_context->getLogfile(), vkQueuePresentKHR(m_context->m_graphicsQueue.queue, &vpi), L"vkQueuePresentKHR() failed", MRN_DEBUG_INFO);
 
-    m_syncObjectIndex = (m_syncObjectIndex + 1) % m_syncObjects.size();
+    return m_frameIndex;
+}
+
+void moraine::Renderer_IVulkan::setFrameCallback(FrameCallback callback)
+{
+    assert(m_context->getLogfile(), m_context->m_description.headless, L"Wrong API Usage: Frames can only be read back from headless contexts!", MRN_DEBUG_INFO);
+
+    m_frameCallback = std::move(callback);
+}
+
+void moraine::Renderer_IVulkan::deliverReadback(uint32_t i)
+{
+    Readback& readback = m_readbacks[i];
+
+    if (not readback.pending)
+        return;
+
+    readback.pending = false;
+
+    // GPU_TO_CPU memory may be cached without being coherent
+    vmaInvalidateAllocation(m_context->m_allocator, readback.allocation, 0, VK_WHOLE_SIZE);
+
+    FrameCapture frame;
+    frame.frameNumber           = readback.frameNumber;
+    frame.width                 = m_context->m_viewportWidth;
+    frame.height                = m_context->m_viewportHeight;
+    frame.rowPitch              = m_context->m_viewportWidth * 4;
+    frame.pixels                = readback.data;
+
+    if (m_frameCallback)
+        m_frameCallback(frame);
+}
+
+void moraine::Renderer_IVulkan::recordLayers(uint32_t i, bool recordAllLayers)
+{
+    // Match the layer stack with the layer caches, the test quad is always drawn first
+    std::vector<LayerCache*> order = { &m_layerCaches.front() };
+
+    for (auto& a : m_layerCaches)
+        a.inStack = a.layer == nullptr;
+
+    for (auto& a : *m_layerStack)
+    {
+        auto cache = std::find_if(m_layerCaches.begin(), m_layerCaches.end(), [&a](const LayerCache& cache) { return cache.layer == a; });
+
+        if (cache == m_layerCaches.end())
+        {
+            m_layerCaches.push_back({ a, std::vector<LayerFrame>(m_commandBuffers.size()), { }, 0, false, true, 0 });
+            cache = std::prev(m_layerCaches.end());
+        }
+
+        // Added again before all frames released it
+        if (cache->releasedFrameCount != 0)
+        {
+            for (auto& b : cache->frames)
+                b.released = false;
 
-    assert_vulkan(m_context->getLogfile(), vkAcquireNextImageKHR(m_context->m_device,
-                  m_context->m_swapchain,
-                  UINT64_MAX,
-                  m_syncObjects[m_syncObjectIndex].m_renderWaitSemaphore,
-                  VK_NULL_HANDLE,
-                  &m_imageIndex),
-                  L"vkAcquireNextImageKHR() failed", MRN_DEBUG_INFO);
+            cache->releasedFrameCount = 0;
+        }
 
-    return m_imageIndex;
+        cache->inStack = true;
+        order.push_back(&*cache);
+
+        // Cameras move without changing the layer, so visibility is checked every frame
+        cullLayer(*cache);
+    }
+
+    // Only layers that changed since this frame's commands were recorded are recorded again
+    m_recordJobs.clear();
+    std::vector<SecondaryCommandBuffer*> targets;
+
+    for (auto a : order)
+    {
+        LayerFrame& frame = a->frames[i];
+        uint64_t layerVersion = a->layer ? a->layer->version() : 0;
+        bool current = not recordAllLayers and frame.recorded and frame.contextVersion == m_context->m_commandBufferVersion;
+
+        if (current and frame.layerVersion == layerVersion and frame.visibility == a->visibility)
+            continue;
+
+        frame.visibility = a->visibility;
+
+        uint32_t jobCount = 1;
+        uint32_t indirectJobCount = 0;
+
+        if (a->layer)
+        {
+            buildDrawPackets(*a, i);
+
+            // Draws that were added, removed or changed inside the recorded batches only patch the draw list
+            if (updateDrawList(*a, i, current))
+            {
+                frame.layerVersion = layerVersion;
+                continue;
+            }
+
+            indirectJobCount = frame.indirectBatches.empty() ? 0 : 1;
+            jobCount = indirectJobCount + (frame.directPacketCount + s_packetsPerJob - 1) / s_packetsPerJob;
+        }
+        else
+            frame.unsortedBindCount = 3; // Test quad
+
+        frame.recorded = true;
+        frame.layerVersion = layerVersion;
+        frame.contextVersion = m_context->m_commandBufferVersion;
+        frame.bindCount = 0;
+        frame.drawCount = 0;
+
+        if (frame.commandBuffers.size() < jobCount)
+            frame.commandBuffers.resize(jobCount);
+
+        frame.commandBufferCount = jobCount;
+
+        for (uint32_t b = 0; b < jobCount; ++b)
+        {
+            if (b < indirectJobCount)
+                m_recordJobs.push_back({ a, true, 0, 0, 0, 0 });
+            else
+            {
+                uint32_t firstPacket = a->indirectPacketCount + (b - indirectJobCount) * s_packetsPerJob;
+                m_recordJobs.push_back({ a, false, firstPacket, a->layer ? min(s_packetsPerJob, static_cast<uint32_t>(a->packets.size()) - firstPacket) : 0, 0, 0 });
+            }
+
+            targets.push_back(&frame.commandBuffers[b]);
+        }
+    }
+
+    VkCommandBufferInheritanceInfo vcbii;
+    vcbii.sType                 = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+    vcbii.pNext                 = nullptr;
+    vcbii.renderPass            = m_context->m_renderPass;
+    vcbii.subpass               = 0;
+    vcbii.framebuffer           = VK_NULL_HANDLE; // The image is acquired after the layers are recorded
+    vcbii.occlusionQueryEnable  = VK_FALSE;
+    vcbii.queryFlags            = 0;
+    vcbii.pipelineStatistics    = 0;
+
+    if (not targets.empty())
+        m_recorder->record(vcbii, targets, [this, i](VkCommandBuffer commandBuffer, uint32_t job) { recordJob(commandBuffer, i, m_recordJobs[job]); });
+
+    for (const auto& a : m_recordJobs)
+    {
+        a.cache->frames[i].bindCount += a.bindCount;
+        a.cache->frames[i].drawCount += a.drawCount;
+    }
+
+    // The primary command buffer of this frame no longer executes the commands of removed layers
+    for (auto a = m_layerCaches.begin(); a != m_layerCaches.end();)
+    {
+        if (a->inStack or a->frames[i].released)
+        {
+            ++a;
+            continue;
+        }
+
+        destroyLayerFrame(a->frames[i]);
+        a->frames[i].released = true;
+
+        if (++a->releasedFrameCount == a->frames.size())
+            a = m_layerCaches.erase(a);
+        else
+            ++a;
+    }
+
+    RenderStatistics previous = m_statistics;
+    m_statistics = { };
+
+    for (auto a : order)
+    {
+        const LayerFrame& frame = a->frames[i];
+
+        m_statistics.visibleObjectCount += static_cast<uint32_t>(a->objects.size()) - a->culledObjectCount;
+        m_statistics.culledObjectCount += a->culledObjectCount;
+        m_statistics.bindCount += frame.bindCount;
+        m_statistics.drawCount += frame.drawCount;
+        m_statistics.unsortedBindCount += frame.unsortedBindCount;
+        m_statistics.indirectObjectCount += frame.indirectObjectCount;
+    }
+
+    m_executedLayers[i] = std::move(order);
+
+    // Only reported when the scene changed, frames are re-recorded one after another with the same result
+    if (m_statistics.drawCount != previous.drawCount or m_statistics.bindCount != previous.bindCount)
+        m_context->getLogfile()->print(GREY, sprintf(L"Recorded %d draws with %d binds (%d binds unsorted), %d objects drawn indirectly, %d of %d objects culled",
+                                                     m_statistics.drawCount, m_statistics.bindCount, m_statistics.unsortedBindCount, m_statistics.indirectObjectCount,
+                                                     m_statistics.culledObjectCount, m_statistics.visibleObjectCount + m_statistics.culledObjectCount), MRN_DEBUG_INFO);
 }
 
-void moraine::Renderer_IVulkan::recordCommandBuffer(uint32_t i)
+void moraine::Renderer_IVulkan::recordPrimary(uint32_t i, uint32_t imageIndex)
 {
     VkCommandBufferBeginInfo vcbbi;
     vcbbi.sType                 = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
     vcbbi.pNext                 = nullptr;
-    vcbbi.flags                 = 0;
+    vcbbi.flags                 = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
     vcbbi.pInheritanceInfo      = nullptr;
 
     assert_vulkan(m_context->getLogfile(), vkBeginCommandBuffer(m_commandBuffers[i], &vcbbi), L"vkBeginCommandBuffer() failed", MRN_DEBUG_INFO);
 
-    std::vector<VkClearValue> clearValues(1);
-    clearValues[0].color = { 0.0f, 0.0f, 0.2f, 1.0f };
+    m_renderGraph->setImportedImage(m_backbuffer, m_context->m_swapchainImages[imageIndex], m_context->m_swapchainImageViews[imageIndex]);
+    m_renderGraph->execute(m_commandBuffers[i], i);
+
+    assert_vulkan(m_context->getLogfile(), vkEndCommandBuffer(m_commandBuffers[i]), L"vkEndCommandBuffer() failed", MRN_DEBUG_INFO);
+
+    const RenderGraphStatistics& graphStatistics = m_renderGraph->getStatistics();
+    m_statistics.renderPassCount = graphStatistics.renderPassCount;
+    m_statistics.barrierCount = graphStatistics.barrierCount;
+    m_statistics.transientMemory = graphStatistics.transientMemory;
+    m_statistics.transientMemoryUnaliased = graphStatistics.transientMemoryUnaliased;
+}
+
+void moraine::Renderer_IVulkan::recordReadback(VkCommandBuffer commandBuffer, uint32_t i)
+{
+    // Frames are only copied while someone listens
+    if (not m_frameCallback)
+        return;
+
+    Readback& readback = m_readbacks[i];
+
+    VkBufferImageCopy vbic;
+    vbic.bufferOffset                       = 0;
+    vbic.bufferRowLength                    = 0; // Tightly packed
+    vbic.bufferImageHeight                  = 0;
+    vbic.imageSubresource.aspectMask        = VK_IMAGE_ASPECT_COLOR_BIT;
+    vbic.imageSubresource.mipLevel          = 0;
+    vbic.imageSubresource.baseArrayLayer    = 0;
+    vbic.imageSubresource.layerCount        = 1;
+    vbic.imageOffset                        = { 0, 0, 0 };
+    vbic.imageExtent                        = { m_context->m_viewportWidth, m_context->m_viewportHeight, 1 };
+
+    vkCmdCopyImageToBuffer(commandBuffer, m_renderGraph->getImage(m_backbuffer), VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, readback.buffer, 1, &vbic);
+
+    // Makes the copy visible to the host once the frame's fence signaled
+    VkBufferMemoryBarrier vbmb;
+    vbmb.sType                              = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+    vbmb.pNext                              = nullptr;
+    vbmb.srcAccessMask                      = VK_ACCESS_TRANSFER_WRITE_BIT;
+    vbmb.dstAccessMask                      = VK_ACCESS_HOST_READ_BIT;
+    vbmb.srcQueueFamilyIndex                = VK_QUEUE_FAMILY_IGNORED;
+    vbmb.dstQueueFamilyIndex                = VK_QUEUE_FAMILY_IGNORED;
+    vbmb.buffer                             = readback.buffer;
+    vbmb.offset                             = 0;
+    vbmb.size                               = VK_WHOLE_SIZE;
+
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 0, nullptr, 1, &vbmb, 0, nullptr);
+
+    readback.frameNumber = m_frameNumber;
+    readback.pending = true;
+}
+
+void moraine::Renderer_IVulkan::buildDrawPackets(LayerCache& cache, uint32_t i)
+{
+    // Sort key, most significant first: direct (1 bit) | pipeline (15) | descriptor set (16) | vertex buffer (16) | index buffer (16).
+    // Objects that are drawn from the draw list come first, objects of the layer with the same state end up next to each other.
+    // Ids are handed out in the order states first appear, so they are stable while the layer doesn't change.
+    // Handles are keyed as uint64_t, non-dispatchable handles aren't pointers on 32 bit platforms
+    for (auto& a : m_stateIds)
+        a.clear();
+
+    auto stateId = [this](uint32_t field, uint64_t state, uint64_t maxId) -> uint64_t
+    {
+        auto id = m_stateIds[field].emplace(state, m_stateIds[field].size()).first->second;
+        return min<uint64_t>(id, maxId); // Overflowing ids share the last value, they only sort worse
+    };
+
+    LayerFrame& frame = cache.frames[i];
+
+    cache.packets.clear();
+    cache.usesInstanceSlots = false;
+    frame.unsortedBindCount = 0;
+
+    std::vector<uint32_t> dynamicOffsets;
+
+    for (uint32_t a = 0; a < cache.objects.size(); ++a)
+    {
+        if (not cache.visibility.empty() and not cache.visibility[a])
+            continue;
+
+        auto obj = cache.objects[a];
+        auto& params = *obj->m_graphicsParameters;
+
+        // Skipped while the shader is compiling, the layers are recorded again once it is ready
+        auto shader = static_cast<Shader_IVulkan*>(params.m_shader.get())->getDrawShader();
+
+        if (not shader)
+            continue;
+
+        VkDescriptorSet set = VK_NULL_HANDLE;
+
+        if (not params.m_constantSets.empty())
+        {
+            auto constantSet = std::static_pointer_cast<ConstantSet_IVulkan>(params.m_constantSets[0]);
+            dynamicOffsets.resize(constantSet->m_dynamicOffsetCount);
+            set = constantSet->getBindState(i, obj->m_constantArrayIndicies, dynamicOffsets.data());
+        }
+
+        // Per object data has to come from the instance slot, dynamic offsets would need a bind per object
+        bool indirect = false;
+
+        if (shader->m_instanceSlotBinding != UINT32_MAX)
+        {
+            assert(m_context->getLogfile(), params.m_instanceCount <= 1, L"Wrong API Usage: Objects with a shader that has instance slots can't set an instance count!", MRN_DEBUG_INFO);
+            cache.usesInstanceSlots = true;
+
+            indirect = m_indirectDraws and std::all_of(params.m_constantSets.begin(), params.m_constantSets.end(),
+                                                       [](const ConstantSet& c) { return std::static_pointer_cast<ConstantSet_IVulkan>(c)->m_dynamicOffsetCount == 0; });
+        }
+
+        VkBuffer vertexBuffer = params.m_vertexBuffers.empty() ? VK_NULL_HANDLE : std::static_pointer_cast<VertexBuffer_IVulkan>(params.m_vertexBuffers[0])->getBuffer();
+        VkBuffer indexBuffer = static_cast<bool>(params.m_indexBuffer) ? std::static_pointer_cast<IndexBuffer_IVulkan>(params.m_indexBuffer)->getBuffer() : VK_NULL_HANDLE;
+
+        DrawPacket packet;
+        packet.key                  = (indirect ? 0 : 1ull << 63) |
+                                      stateId(0, (uint64_t)shader->m_pipeline, 0x7fff) << 48 |
+                                      stateId(1, (uint64_t)set, 0xffff) << 32 |
+                                      stateId(2, (uint64_t)vertexBuffer, 0xffff) << 16 |
+                                      stateId(3, (uint64_t)indexBuffer, 0xffff);
+        packet.object               = obj;
+
+        cache.packets.push_back(packet);
+
+        frame.unsortedBindCount += static_cast<uint32_t>(1 + params.m_vertexBuffers.size() + params.m_constantSets.size() + (static_cast<bool>(params.m_indexBuffer) ? 1 : 0));
+    }
+
+    sortDrawPackets(cache.packets, m_drawPacketScratch);
+
+    cache.indirectPacketCount = static_cast<uint32_t>(std::find_if(cache.packets.begin(), cache.packets.end(), [](const DrawPacket& a) { return (a.key >> 63) != 0; }) - cache.packets.begin());
+}
+
+void moraine::Renderer_IVulkan::cullLayer(LayerCache& cache)
+{
+    if (cache.objectsVersion != cache.layer->version())
+    {
+        cache.objects.clear();
+
+        for (auto& a : *cache.layer)
+            if (a->type() & OBJECT_TYPE_GRAPHICS)
+                cache.objects.push_back(static_cast<Object_Graphics_T*>(&*a));
+
+        cache.objectsVersion = cache.layer->version();
+    }
+
+    const Frustum* frustum = cache.layer->getCullingFrustum();
+
+    if (frustum == nullptr)
+    {
+        cache.visibility.clear();
+        cache.culledObjectCount = 0;
+        return;
+    }
+
+    FrustumCuller culler(*frustum);
+    uint32_t objectCount = static_cast<uint32_t>(cache.objects.size());
+
+    cache.visibility.resize(objectCount);
+
+    // Large layers are split across the recording threads
+    m_recorder->run((objectCount + s_objectsPerCullJob - 1) / s_objectsPerCullJob, [&](uint32_t job)
+    {
+        uint32_t end = min(objectCount, (job + 1) * s_objectsPerCullJob);
+
+        for (uint32_t a = job * s_objectsPerCullJob; a < end; ++a)
+            cache.visibility[a] = not cache.objects[a]->m_hasBounds or culler.isVisible(cache.objects[a]->m_bounds);
+    });
+
+    cache.culledObjectCount = static_cast<uint32_t>(std::count(cache.visibility.begin(), cache.visibility.end(), 0));
+}
+
+bool moraine::Renderer_IVulkan::updateDrawList(LayerCache& cache, uint32_t i, bool patch)
+{
+    LayerFrame& frame = cache.frames[i];
+    uint32_t maxDrawCount = m_context->m_physicalDevice.deviceProperties.limits.maxDrawIndirectCount;
+
+    // Consecutive indirect packets that bind the same state form a batch
+    std::vector<IndirectBatch> batches;
+    IndirectBatch batch;
+
+    for (uint32_t a = 0; a < cache.indirectPacketCount; ++a)
+    {
+        auto& params = *cache.packets[a].object->m_graphicsParameters;
+
+        batch.shader = static_cast<Shader_IVulkan*>(params.m_shader.get())->getDrawShader();
+        batch.vertexBuffers.clear();
+        batch.indexBuffer = VK_NULL_HANDLE;
+        batch.indexType = VK_INDEX_TYPE_MAX_ENUM;
+        batch.sets.clear();
+
+        for (uint32_t j = 0; j < params.m_vertexBuffers.size(); ++j)
+        {
+            auto vertexBuffer = std::static_pointer_cast<VertexBuffer_IVulkan>(params.m_vertexBuffers[j]);
+            batch.vertexBuffers.emplace_back(vertexBuffer->getBuffer(), usesVertexOffset(params) ? 0 : vertexBuffer->getOffset(i));
+        }
+
+        if (static_cast<bool>(params.m_indexBuffer))
+        {
+            auto indexBuffer = std::static_pointer_cast<IndexBuffer_IVulkan>(params.m_indexBuffer);
+            batch.indexBuffer = indexBuffer->getBuffer();
+            batch.indexType = indexBuffer->getIndexType();
+        }
+
+        for (const auto& c : params.m_constantSets)
+        {
+            auto constantSet = std::static_pointer_cast<ConstantSet_IVulkan>(c);
+            batch.sets.emplace_back(constantSet->m_setIndex, constantSet->getBindState(i, cache.packets[a].object->m_constantArrayIndicies, nullptr));
+        }
+
+        if (batches.empty() or batches.back().drawCount == maxDrawCount or not batches.back().sameState(batch))
+        {
+            batch.drawCount = 1;
+            batches.push_back(batch);
+        }
+        else
+            ++batches.back().drawCount;
+    }
+
+    uint32_t directPacketCount = static_cast<uint32_t>(cache.packets.size()) - cache.indirectPacketCount;
 
-    VkRenderPassBeginInfo vrpbi;
-    vrpbi.sType                 = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-    vrpbi.pNext                 = nullptr;
-    vrpbi.renderPass            = m_context->m_renderPass;
-    vrpbi.framebuffer           = m_context->m_frameBuffers[i];
-    vrpbi.renderArea.offset     = { 0, 0 };
-    vrpbi.renderArea.extent     = { m_context->m_viewportWidth, m_context->m_viewportHeight };
-    vrpbi.clearValueCount       = static_cast<uint32_t>(clearValues.size());
-    vrpbi.pClearValues          = clearValues.data();
+    // The recorded commands draw every entry up to the capacity of each batch, so the draw list can change under them
+    // as long as the batches stay the same and nothing is drawn directly
+    bool keep = patch and directPacketCount == 0 and frame.directPacketCount == 0 and batches.size() == frame.indirectBatches.size();
 
-    vkCmdBeginRenderPass(m_commandBuffers[i], &vrpbi, VK_SUBPASS_CONTENTS_INLINE);
+    for (uint32_t b = 0; keep and b < batches.size(); ++b)
+        keep = batches[b].sameState(frame.indirectBatches[b]) and batches[b].drawCount <= frame.indirectBatches[b].capacity;
 
+    if (keep)
+        for (uint32_t b = 0; b < batches.size(); ++b)
+            frame.indirectBatches[b].drawCount = batches[b].drawCount;
+    else
+    {
+        // Batches get room to grow before the layer has to be recorded again
+        uint32_t entryCount = 0;
+
+        for (auto& a : batches)
+        {
+            a.firstDraw = entryCount;
+            a.capacity = min(max(a.drawCount + a.drawCount / 2, s_minBatchCapacity), maxDrawCount);
+            entryCount += a.capacity;
+        }
+
+        frame.indirectBatches = std::move(batches);
+        frame.directInstanceBase = entryCount;
+        frame.directPacketCount = directPacketCount;
+
+        // The command buffers that read the old buffers are the ones being re-recorded
+        DrawList& drawList = frame.drawList;
+
+        if (drawList.capacity < entryCount)
+        {
+            if (drawList.buffer != VK_NULL_HANDLE)
+                vmaDestroyBuffer(m_context->m_allocator, drawList.buffer, drawList.allocation);
+
+            drawList.capacity = max(entryCount, drawList.capacity * 2);
+
+            void* data;
+            m_context->createVulkanBuffer(drawList.capacity * sizeof(VkDrawIndexedIndirectCommand), VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU, &drawList.buffer, &drawList.allocation, &data);
+            drawList.data = static_cast<VkDrawIndexedIndirectCommand*>(data);
+            drawList.commands.resize(drawList.capacity);
+            drawList.instanceSlots.resize(drawList.capacity);
+        }
+
+        // Direct packets write their instance slots behind the draw list entries when their job is recorded
+        InstanceBuffer& instanceBuffer = frame.instanceBuffer;
+        uint32_t slotCount = entryCount + (cache.usesInstanceSlots ? directPacketCount : 0);
+
+        if (slotCount != 0 and instanceBuffer.capacity < slotCount)
+        {
+            if (instanceBuffer.buffer != VK_NULL_HANDLE)
+                vmaDestroyBuffer(m_context->m_allocator, instanceBuffer.buffer, instanceBuffer.allocation);
+
+            instanceBuffer.capacity = max(slotCount, max(instanceBuffer.capacity * 2, s_packetsPerJob));
+
+            void* data;
+            m_context->createVulkanBuffer(instanceBuffer.capacity * sizeof(uint32_t), VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU, &instanceBuffer.buffer, &instanceBuffer.allocation, &data);
+            instanceBuffer.data = static_cast<uint32_t*>(data);
+        }
+    }
+
+    // Unused entries stay zero, which draws nothing. Only entries that differ from what the buffers hold are written
+    DrawList& drawList = frame.drawList;
+    uint32_t packet = 0;
+
+    for (const auto& b : frame.indirectBatches)
+        for (uint32_t k = 0; k < b.capacity; ++k)
+        {
+            uint32_t entry = b.firstDraw + k;
+            VkDrawIndexedIndirectCommand command = { };
+            uint32_t instanceSlot = 0;
+
+            if (k < b.drawCount)
+            {
+                auto obj = cache.packets[packet++].object;
+                auto& params = *obj->m_graphicsParameters;
+
+                int32_t vertexOffset = 0;
+
+                if (usesVertexOffset(params))
+                    vertexOffset = std::static_pointer_cast<VertexBuffer_IVulkan>(params.m_vertexBuffers[0])->getVertexOffset();
+
+                command.indexCount      = params.m_vertexCount;
+                command.instanceCount   = 1;
+
+                if (b.indexBuffer != VK_NULL_HANDLE)
+                {
+                    command.firstIndex      = std::static_pointer_cast<IndexBuffer_IVulkan>(params.m_indexBuffer)->getFirstIndex();
+                    command.vertexOffset    = vertexOffset;
+                    command.firstInstance   = entry;
+                }
+                else // VkDrawIndirectCommand: vertexCount, instanceCount, firstVertex, firstInstance
+                {
+                    command.firstIndex      = static_cast<uint32_t>(vertexOffset);
+                    command.vertexOffset    = static_cast<int32_t>(entry);
+                }
+
+                instanceSlot = getInstanceSlot(obj);
+            }
+
+            if (not keep or memcmp(&drawList.commands[entry], &command, sizeof(command)) != 0)
+            {
+                drawList.data[entry] = command;
+                drawList.commands[entry] = command;
+            }
+
+            if (not keep or drawList.instanceSlots[entry] != instanceSlot)
+            {
+                frame.instanceBuffer.data[entry] = instanceSlot;
+                drawList.instanceSlots[entry] = instanceSlot;
+            }
+        }
+
+    frame.indirectObjectCount = cache.indirectPacketCount;
+
+    return keep;
+}
+
+uint32_t moraine::Renderer_IVulkan::getInstanceSlot(Object_Graphics_T* object)
+{
+    for (const auto& c : object->m_graphicsParameters->m_constantSets)
+    {
+        uint32_t slot = std::static_pointer_cast<ConstantSet_IVulkan>(c)->getInstanceSlot(object->m_constantArrayIndicies);
+
+        if (slot != UINT32_MAX)
+            return slot;
+    }
+
+    return 0;
+}
+
+bool moraine::Renderer_IVulkan::usesVertexOffset(const GraphicsParameters& params)
+{
+    return params.m_vertexBuffers.size() == 1 and std::static_pointer_cast<VertexBuffer_IVulkan>(params.m_vertexBuffers[0])->usesVertexOffset();
+}
+
+void moraine::Renderer_IVulkan::destroyLayerFrame(LayerFrame& frame)
+{
+    for (auto& a : frame.commandBuffers)
+        m_recorder->destroy(a);
+
+    frame.commandBuffers.clear();
+    frame.commandBufferCount = 0;
+
+    if (frame.instanceBuffer.buffer != VK_NULL_HANDLE)
+        vmaDestroyBuffer(m_context->m_allocator, frame.instanceBuffer.buffer, frame.instanceBuffer.allocation);
+
+    frame.instanceBuffer = { };
+
+    if (frame.drawList.buffer != VK_NULL_HANDLE)
+        vmaDestroyBuffer(m_context->m_allocator, frame.drawList.buffer, frame.drawList.allocation);
+
+    frame.drawList = { };
+    frame.indirectBatches.clear();
+    frame.directPacketCount = 0;
+    frame.recorded = false;
+}
+
+void moraine::Renderer_IVulkan::recordJob(VkCommandBuffer commandBuffer, uint32_t i, RecordJob& job)
+{
+    // Dynamic state isn't inherited from the primary command buffer
     VkViewport viewport;
     viewport.x                  = 0.0f;
     viewport.y                  = 0.0f;
@@ -195,62 +930,329 @@ void moraine::Renderer_IVulkan::recordCommandBuffer(uint32_t i)
     viewport.minDepth           = 0.0f;
     viewport.maxDepth           = 1.0f;
 
-    vkCmdSetViewport(m_commandBuffers[i], 0, 1, &viewport);
+    vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
 
     VkRect2D scissor;
     scissor.offset              = { 0, 0 };
     scissor.extent              = { m_context->m_viewportWidth,m_context->m_viewportHeight };
 
-    vkCmdSetScissor(m_commandBuffers[i], 0, 1, &scissor);
+    vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
 
-    std::static_pointer_cast<Shader_IVulkan>(t_shader)->bind(m_commandBuffers[i]);
-    std::static_pointer_cast<VertexBuffer_IVulkan>(t_vertexBuffer)->bind(m_commandBuffers[i], 0, 0);
-    std::static_pointer_cast<ConstantSet_IVulkan>(t_constantSet)->bind(m_commandBuffers[i], static_cast<uint32_t>(i), { });
-    vkCmdDraw(m_commandBuffers[i], 6, 1, 0, 0);
+    if (job.cache->layer == nullptr)
+    {
+        std::static_pointer_cast<Shader_IVulkan>(t_shader)->bind(commandBuffer);
+        std::static_pointer_cast<VertexBuffer_IVulkan>(t_vertexBuffer)->bind(commandBuffer, 0, 0);
+        std::static_pointer_cast<ConstantSet_IVulkan>(t_constantSet)->bind(commandBuffer, static_cast<uint32_t>(i), { });
+        vkCmdDraw(commandBuffer, 6, 1, 0, 0);
 
-    //std::static_pointer_cast<Shader_IVulkan>(t_fontShader)->bind(m_commandBuffers[i]);
-    //std::static_pointer_cast<VertexBuffer_IVulkan>(t_vertexBuffer)->bind(m_commandBuffers[i], 0, sizeof(T_ImageVertex) * 6);
-    //std::static_pointer_cast<ConstantSet_IVulkan>(t_constantSet2)->bind(m_commandBuffers[i], static_cast<uint32_t>(i), { });
-    //vkCmdDraw(m_commandBuffers[i], 6, 1, 0, 0);
+        job.bindCount = 3;
+        job.drawCount = 1;
 
+        //std::static_pointer_cast<Shader_IVulkan>(t_fontShader)->bind(commandBuffer);
+        //std::static_pointer_cast<VertexBuffer_IVulkan>(t_vertexBuffer)->bind(commandBuffer, 0, sizeof(T_ImageVertex) * 6);
+        //std::static_pointer_cast<ConstantSet_IVulkan>(t_constantSet2)->bind(commandBuffer, static_cast<uint32_t>(i), { });
+        //vkCmdDraw(commandBuffer, 6, 1, 0, 0);
 
-    for (auto& a : *m_layerStack)
+        return;
+    }
+
+    if (job.indirect)
+    {
+        recordIndirectJob(commandBuffer, i, job);
+        return;
+    }
+
+    // State of the command buffer, binds that wouldn't change it are skipped
+    VkPipeline boundPipeline = VK_NULL_HANDLE;
+    VkPipelineLayout boundLayout = VK_NULL_HANDLE;
+    std::vector<std::pair<VkBuffer, VkDeviceSize>> boundVertexBuffers;
+    VkBuffer boundIndexBuffer = VK_NULL_HANDLE;
+    VkIndexType boundIndexType = VK_INDEX_TYPE_MAX_ENUM;
+    std::vector<VkDescriptorSet> boundSets;
+    std::vector<std::vector<uint32_t>> boundOffsets;
+    std::vector<uint32_t> dynamicOffsets;
+
+    const std::vector<DrawPacket>& packets = job.cache->packets;
+    InstanceBuffer& instanceBuffer = job.cache->frames[i].instanceBuffer;
+    uint32_t instanceBase = job.cache->frames[i].directInstanceBase;
+    uint32_t directPacketBase = job.cache->indirectPacketCount; // Direct packets are stored behind the indirect ones, their slots start at instanceBase
+    uint32_t endPacket = job.firstPacket + job.packetCount;
+
+    for (uint32_t a = job.firstPacket, next; a < endPacket; a = next)
     {
-        for(auto& b : *a)
-            if (b->type() & OBJECT_TYPE_GRAPHICS)
+        next = a + 1;
+
+        auto obj = packets[a].object;
+        auto& params = *obj->m_graphicsParameters;
+        auto shader = static_cast<Shader_IVulkan*>(params.m_shader.get())->getDrawShader();
+
+        if (shader->m_pipeline != boundPipeline)
+        {
+            shader->bind(commandBuffer);
+            boundPipeline = shader->m_pipeline;
+            ++job.bindCount;
+
+            // Sets stay bound across compatible layouts, but only the same layout is known to be compatible
+            if (shader->m_layout != boundLayout)
             {
-                auto obj = static_cast<Object_Graphics_T*>(&*b);
-                
-                std::static_pointer_cast<Shader_IVulkan>(obj->m_graphicsParameters->m_shader)->bind(m_commandBuffers[i]);
-
-                for (const auto& c : obj->m_graphicsParameters->m_vertexBuffers)
-                        std::static_pointer_cast<VertexBuffer_IVulkan>(c)->bind(m_commandBuffers[i], 0, 0);
-
-                if(static_cast<bool>(obj->m_graphicsParameters->m_indexBuffer))
-                    std::static_pointer_cast<IndexBuffer_IVulkan>(obj->m_graphicsParameters->m_indexBuffer)->bind(m_commandBuffers[i]);
-
-                for (const auto& c : obj->m_graphicsParameters->m_constantSets)
-                    std::static_pointer_cast<ConstantSet_IVulkan>(c)->bind(m_commandBuffers[i], static_cast<uint32_t>(i), obj->m_constantArrayIndicies);
-
-                if (static_cast<bool>(obj->m_graphicsParameters->m_indexBuffer))
-                    vkCmdDrawIndexed(m_commandBuffers[i],
-                                     obj->m_graphicsParameters->m_vertexCount,
-                                     obj->m_graphicsParameters->m_instanceCount > 1 ? obj->m_graphicsParameters->m_instanceCount : 1,
-                                     0,
-                                     0,
-                                     0);
-                else
-                    vkCmdDraw(m_commandBuffers[i],
-                              obj->m_graphicsParameters->m_vertexCount,
-                              obj->m_graphicsParameters->m_instanceCount > 1 ? obj->m_graphicsParameters->m_instanceCount : 1,
-                              0,
-                              0);
+                boundLayout = shader->m_layout;
+                boundSets.clear();
+                boundOffsets.clear();
+
+                // The bindless table is the same for all objects, so it is only bound with the layout
+                if (shader->m_bindlessSet != UINT32_MAX)
+                {
+                    VkDescriptorSet set = m_context->m_bindlessTable->getSet(i);
+                    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, shader->m_layout, shader->m_bindlessSet, 1, &set, 0, nullptr);
+                    ++job.bindCount;
+                }
+            }
+        }
+
+        int32_t vertexOffset = 0;
+
+        for (uint32_t j = 0; j < params.m_vertexBuffers.size(); ++j)
+        {
+            auto vertexBuffer = std::static_pointer_cast<VertexBuffer_IVulkan>(params.m_vertexBuffers[j]);
+
+            // A single binding selects its vertices with vertexOffset if the stride is known, otherwise every binding is bound at its offset
+            VkBuffer buffer = vertexBuffer->getBuffer();
+            VkDeviceSize offset = vertexBuffer->getOffset(static_cast<uint32_t>(i));
+
+            if (usesVertexOffset(params))
+            {
+                vertexOffset = vertexBuffer->getVertexOffset();
+                offset = 0;
+            }
+
+            if (boundVertexBuffers.size() <= j)
+                boundVertexBuffers.resize(j + 1, { VK_NULL_HANDLE, 0 });
+
+            if (boundVertexBuffers[j].first == buffer and boundVertexBuffers[j].second == offset)
+                continue;
+
+            vkCmdBindVertexBuffers(commandBuffer, j, 1, &buffer, &offset);
+            boundVertexBuffers[j] = { buffer, offset };
+            ++job.bindCount;
+        }
+
+        uint32_t firstIndex = 0;
+
+        if (static_cast<bool>(params.m_indexBuffer))
+        {
+            auto indexBuffer = std::static_pointer_cast<IndexBuffer_IVulkan>(params.m_indexBuffer);
+            firstIndex = indexBuffer->getFirstIndex();
+
+            if (indexBuffer->getBuffer() != boundIndexBuffer or indexBuffer->getIndexType() != boundIndexType)
+            {
+                boundIndexBuffer = indexBuffer->getBuffer();
+                boundIndexType = indexBuffer->getIndexType();
+                vkCmdBindIndexBuffer(commandBuffer, boundIndexBuffer, 0, boundIndexType);
+                ++job.bindCount;
             }
+        }
+
+        for (const auto& c : params.m_constantSets)
+        {
+            auto constantSet = std::static_pointer_cast<ConstantSet_IVulkan>(c);
+
+            dynamicOffsets.resize(constantSet->m_dynamicOffsetCount);
+            VkDescriptorSet set = constantSet->getBindState(static_cast<uint32_t>(i), obj->m_constantArrayIndicies, dynamicOffsets.data());
+
+            if (boundSets.size() <= constantSet->m_setIndex)
+            {
+                boundSets.resize(constantSet->m_setIndex + 1, VK_NULL_HANDLE);
+                boundOffsets.resize(constantSet->m_setIndex + 1);
+            }
+
+            if (boundSets[constantSet->m_setIndex] == set and boundOffsets[constantSet->m_setIndex] == dynamicOffsets)
+                continue;
+
+            vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, shader->m_layout, constantSet->m_setIndex, 1, &set, static_cast<uint32_t>(dynamicOffsets.size()), dynamicOffsets.data());
+            boundSets[constantSet->m_setIndex] = set;
+            boundOffsets[constantSet->m_setIndex] = dynamicOffsets;
+            ++job.bindCount;
+        }
+
+        uint32_t instanceCount = params.m_instanceCount > 1 ? params.m_instanceCount : 1;
+        uint32_t firstInstance = 0;
+
+        if (shader->m_instanceSlotBinding != UINT32_MAX)
+        {
+            VkBuffer buffer = instanceBuffer.buffer;
+            VkDeviceSize offset = 0;
+
+            if (boundVertexBuffers.size() <= shader->m_instanceSlotBinding)
+                boundVertexBuffers.resize(shader->m_instanceSlotBinding + 1, { VK_NULL_HANDLE, 0 });
+
+            if (boundVertexBuffers[shader->m_instanceSlotBinding].first != buffer)
+            {
+                vkCmdBindVertexBuffers(commandBuffer, shader->m_instanceSlotBinding, 1, &buffer, &offset);
+                boundVertexBuffers[shader->m_instanceSlotBinding] = { buffer, offset };
+                ++job.bindCount;
+            }
+
+            // Following objects with the same parameters become further instances, as long as they bind the same descriptor sets
+            auto sameDescriptorSets = [&](Object_Graphics_T* object)
+            {
+                for (const auto& c : params.m_constantSets)
+                {
+                    auto constantSet = std::static_pointer_cast<ConstantSet_IVulkan>(c);
+
+                    dynamicOffsets.resize(constantSet->m_dynamicOffsetCount);
+
+                    if (constantSet->getBindState(static_cast<uint32_t>(i), object->m_constantArrayIndicies, dynamicOffsets.data()) != boundSets[constantSet->m_setIndex] or
+                        dynamicOffsets != boundOffsets[constantSet->m_setIndex])
+                        return false;
+                }
+
+                return true;
+            };
+
+            instanceBuffer.data[instanceBase + a - directPacketBase] = getInstanceSlot(obj);
+
+            while (next < endPacket and packets[next].key == packets[a].key and
+                   packets[next].object->m_graphicsParameters == obj->m_graphicsParameters and sameDescriptorSets(packets[next].object))
+            {
+                instanceBuffer.data[instanceBase + next - directPacketBase] = getInstanceSlot(packets[next].object);
+                ++next;
+            }
+
+            instanceCount = next - a;
+            firstInstance = instanceBase + a - directPacketBase;
+        }
+
+        if (static_cast<bool>(params.m_indexBuffer))
+            vkCmdDrawIndexed(commandBuffer,
+                             params.m_vertexCount,
+                             instanceCount,
+                             firstIndex,
+                             vertexOffset,
+                             firstInstance);
+        else
+            vkCmdDraw(commandBuffer,
+                      params.m_vertexCount,
+                      instanceCount,
+                      static_cast<uint32_t>(vertexOffset),
+                      firstInstance);
+
+        ++job.drawCount;
     }
+}
 
-    vkCmdEndRenderPass(m_commandBuffers[i]);
+void moraine::Renderer_IVulkan::recordIndirectJob(VkCommandBuffer commandBuffer, uint32_t i, RecordJob& job)
+{
+    const LayerFrame& frame = job.cache->frames[i];
 
-    assert_vulkan(m_context->getLogfile(), vkEndCommandBuffer(m_commandBuffers[i]), L"vkEndCommandBuffer() failed", MRN_DEBUG_INFO);
+    VkPipeline boundPipeline = VK_NULL_HANDLE;
+    VkPipelineLayout boundLayout = VK_NULL_HANDLE;
+    std::vector<std::pair<VkBuffer, VkDeviceSize>> boundVertexBuffers;
+    VkBuffer boundIndexBuffer = VK_NULL_HANDLE;
+    VkIndexType boundIndexType = VK_INDEX_TYPE_MAX_ENUM;
+    std::vector<VkDescriptorSet> boundSets;
+
+    auto bindVertexBuffer = [&](uint32_t binding, VkBuffer buffer, VkDeviceSize offset)
+    {
+        if (boundVertexBuffers.size() <= binding)
+            boundVertexBuffers.resize(binding + 1, { VK_NULL_HANDLE, 0 });
+
+        if (boundVertexBuffers[binding].first == buffer and boundVertexBuffers[binding].second == offset)
+            return;
+
+        vkCmdBindVertexBuffers(commandBuffer, binding, 1, &buffer, &offset);
+        boundVertexBuffers[binding] = { buffer, offset };
+        ++job.bindCount;
+    };
+
+    for (const auto& b : frame.indirectBatches)
+    {
+        if (b.shader->m_pipeline != boundPipeline)
+        {
+            b.shader->bind(commandBuffer);
+            boundPipeline = b.shader->m_pipeline;
+            ++job.bindCount;
+
+            if (b.shader->m_layout != boundLayout)
+            {
+                boundLayout = b.shader->m_layout;
+                boundSets.clear();
+
+                if (b.shader->m_bindlessSet != UINT32_MAX)
+                {
+                    VkDescriptorSet set = m_context->m_bindlessTable->getSet(i);
+                    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, b.shader->m_layout, b.shader->m_bindlessSet, 1, &set, 0, nullptr);
+                    ++job.bindCount;
+                }
+            }
+        }
+
+        for (uint32_t j = 0; j < b.vertexBuffers.size(); ++j)
+            bindVertexBuffer(j, b.vertexBuffers[j].first, b.vertexBuffers[j].second);
+
+        bindVertexBuffer(b.shader->m_instanceSlotBinding, frame.instanceBuffer.buffer, 0);
+
+        if (b.indexBuffer != VK_NULL_HANDLE and (b.indexBuffer != boundIndexBuffer or b.indexType != boundIndexType))
+        {
+            boundIndexBuffer = b.indexBuffer;
+            boundIndexType = b.indexType;
+            vkCmdBindIndexBuffer(commandBuffer, boundIndexBuffer, 0, boundIndexType);
+            ++job.bindCount;
+        }
+
+        for (const auto& c : b.sets)
+        {
+            if (boundSets.size() <= c.first)
+                boundSets.resize(c.first + 1, VK_NULL_HANDLE);
+
+            if (boundSets[c.first] == c.second)
+                continue;
+
+            vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, b.shader->m_layout, c.first, 1, &c.second, 0, nullptr);
+            boundSets[c.first] = c.second;
+            ++job.bindCount;
+        }
+
+        VkDeviceSize offset = b.firstDraw * sizeof(VkDrawIndexedIndirectCommand);
+
+        if (b.indexBuffer != VK_NULL_HANDLE)
+            vkCmdDrawIndexedIndirect(commandBuffer, frame.drawList.buffer, offset, b.capacity, sizeof(VkDrawIndexedIndirectCommand));
+        else
+            vkCmdDrawIndirect(commandBuffer, frame.drawList.buffer, offset, b.capacity, sizeof(VkDrawIndexedIndirectCommand));
+
+        ++job.drawCount;
+    }
+}
+
+void moraine::Renderer_IVulkan::sortDrawPackets(std::vector<DrawPacket>& packets, std::vector<DrawPacket>& scratch)
+{
+    // LSD radix sort, 8 bits per pass. Stable, so packets with equal keys keep their list order
+    scratch.resize(packets.size());
+
+    for (uint32_t shift = 0; shift < 64; shift += 8)
+    {
+        uint32_t histogram[256] = { };
+
+        for (const auto& a : packets)
+            ++histogram[(a.key >> shift) & 0xff];
+
+        // All keys share this byte, the pass wouldn't move anything
+        if (histogram[(packets.empty() ? 0 : packets[0].key >> shift) & 0xff] == packets.size())
+            continue;
+
+        uint32_t offset = 0;
+
+        for (uint32_t a = 0; a < 256; ++a)
+        {
+            uint32_t count = histogram[a];
+            histogram[a] = offset;
+            offset += count;
+        }
+
+        for (const auto& a : packets)
+            scratch[histogram[(a.key >> shift) & 0xff]++] = a;
+
+        packets.swap(scratch);
+    }
 }
 
 moraine::Renderer_IVulkan::SyncObjects::SyncObjects(VkDevice device, Logfile logfile) :
@@ -282,11 +1284,11 @@ moraine::Renderer_IVulkan::SyncObjects::~SyncObjects()
     vkDestroyFence(m_device, m_fence, nullptr);
 }
 
-moraine::Renderer_IVulkan::SyncObjects::SyncObjects(const SyncObjects& o)
+moraine::Renderer_IVulkan::SyncObjects::SyncObjects(SyncObjects&& o) noexcept :
+    m_device(o.m_device),
+    m_renderWaitSemaphore(o.m_renderWaitSemaphore),
+    m_presentWaitSemaphore(o.m_presentWaitSemaphore),
+    m_fence(o.m_fence)
 {
-    m_device = o.m_device;
-    m_renderWaitSemaphore = o.m_renderWaitSemaphore;
-    m_presentWaitSemaphore = o.m_presentWaitSemaphore;
-    m_fence = o.m_fence;
     o.m_device = nullptr;
 }
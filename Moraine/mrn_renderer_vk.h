@@ -7,9 +7,13 @@
 #include "mrn_buffer_vk.h"
 #include "mrn_constset_vk.h"
 #include "mrn_texture_vk.h"
+#include "mrn_recorder_vk.h"
+#include "mrn_rendergraph_vk.h"
 #include "mrn_object_graphics.h"
 #include "mrn_font.h"
 
+#include <unordered_map>
+
 namespace moraine
 {
     class Renderer_IVulkan : public Renderer_T
@@ -23,30 +27,175 @@ namespace moraine
 
         std::shared_ptr<GraphicsContext_IVulkan> m_context;
 
-        std::vector<VkCommandBuffer> m_commandBuffers;
+        std::vector<VkCommandBuffer> m_commandBuffers; // Primary command buffer per frame in flight
 
         struct SyncObjects
         {
             SyncObjects(VkDevice device, Logfile logfile);
             ~SyncObjects();
 
-            SyncObjects(const SyncObjects&);
-            SyncObjects(SyncObjects&&) = delete;
+            SyncObjects(const SyncObjects&) = delete;
+            SyncObjects(SyncObjects&& o) noexcept; // Only for the vector, the moved from object owns nothing
             SyncObjects& operator=(const SyncObjects&) = delete;
             SyncObjects& operator=(SyncObjects&&) = delete;
 
-            mutable VkDevice m_device;
+            VkDevice m_device;
             VkSemaphore m_renderWaitSemaphore;
             VkSemaphore m_presentWaitSemaphore;
             VkFence m_fence;
         };
 
-        void recordCommandBuffer(uint32_t frameIndex);
+        // One per graphics object of a layer, sorted by key so objects with the same state are drawn back to back
+        struct DrawPacket
+        {
+            uint64_t                key; // direct | pipeline | descriptor set | vertex buffer | index buffer, see buildDrawPackets()
+            Object_Graphics_T*      object;
+        };
+
+        // Objects with the same bound state that are drawn with one indirect draw from the layer's draw list
+        struct IndirectBatch
+        {
+            Shader_IVulkan*                                     shader;
+            std::vector<std::pair<VkBuffer, VkDeviceSize>>      vertexBuffers;
+            VkBuffer                                            indexBuffer;
+            VkIndexType                                         indexType;
+            std::vector<std::pair<uint32_t, VkDescriptorSet>>   sets; // Set index, set
+            uint32_t                                            firstDraw; // Draw list entry, also the instance slot of the first entry
+            uint32_t                                            drawCount; // Entries in use, the others up to capacity draw nothing
+            uint32_t                                            capacity;
+
+            bool sameState(const IndirectBatch& o) const
+            {
+                // Shaders with identical contents share their pipeline and layout, see ShaderObjectCache_IVulkan
+                return shader->m_pipeline == o.shader->m_pipeline and shader->m_layout == o.shader->m_layout and shader->m_instanceSlotBinding == o.shader->m_instanceSlotBinding and
+                       vertexBuffers == o.vertexBuffers and indexBuffer == o.indexBuffer and indexType == o.indexType and sets == o.sets;
+            }
+        };
+
+        // Persistently mapped VkDrawIndexedIndirectCommand per batch entry. Non-indexed batches read the same
+        // entries as VkDrawIndirectCommand, which is the first 16 bytes of the indexed layout
+        struct DrawList
+        {
+            VkBuffer                                    buffer = VK_NULL_HANDLE;
+            VmaAllocation                               allocation = nullptr;
+            VkDrawIndexedIndirectCommand*               data = nullptr;
+            uint32_t                                    capacity = 0;
+            std::vector<VkDrawIndexedIndirectCommand>   commands; // Copy of data, only entries that differ are written
+            std::vector<uint32_t>                       instanceSlots; // Copy of the instance buffer's draw list region
+        };
+
+        struct InstanceBuffer
+        {
+            VkBuffer                buffer = VK_NULL_HANDLE;
+            VmaAllocation           allocation = nullptr;
+            uint32_t*               data = nullptr; // Instance slot per draw packet, see Shader_IVulkan::m_instanceSlotBinding
+            uint32_t                capacity = 0;
+        };
+
+        // Commands of one layer for one frame, kept until the layer or the context changes
+        struct LayerFrame
+        {
+            bool                                    recorded = false;
+            bool                                    released = false; // Only for removed layers
+            uint64_t                                layerVersion = 0;
+            uint64_t                                contextVersion = 0;
+            std::vector<SecondaryCommandBuffer>     commandBuffers; // One per job, the first commandBufferCount are executed
+            uint32_t                                commandBufferCount = 0;
+            InstanceBuffer                          instanceBuffer; // Draw list entries first, then one slot per direct packet
+            std::vector<IndirectBatch>              indirectBatches;
+            DrawList                                drawList;
+            uint32_t                                directInstanceBase = 0; // Instance slot of the first direct packet, behind the draw list entries
+            uint32_t                                directPacketCount = 0;
+            uint32_t                                bindCount = 0;
+            uint32_t                                drawCount = 0;
+            uint32_t                                unsortedBindCount = 0;
+            uint32_t                                indirectObjectCount = 0;
+            std::vector<uint8_t>                    visibility; // Culling result the commands were recorded with
+        };
+
+        struct LayerCache
+        {
+            Layer                                   layer; // nullptr for the test quad
+            std::vector<LayerFrame>                 frames;
+            std::vector<DrawPacket>                 packets; // Packets of the frame that is being recorded
+            uint32_t                                indirectPacketCount; // Packets in front that are drawn from the draw list
+            bool                                    usesInstanceSlots;
+            bool                                    inStack;
+            uint32_t                                releasedFrameCount; // The cache is erased once every frame of a removed layer was released
+            std::vector<Object_Graphics_T*>         objects; // Graphics objects of the layer, gathered again when its version changes
+            uint64_t                                objectsVersion = UINT64_MAX;
+            std::vector<uint8_t>                    visibility; // Per object for the frame that is being recorded, empty if the layer isn't culled
+            uint32_t                                culledObjectCount = 0;
+        };
+
+        struct RecordJob
+        {
+            LayerCache*             cache;
+            bool                    indirect; // Records the layer's indirect batches instead of packets
+            uint32_t                firstPacket;
+            uint32_t                packetCount;
+            uint32_t                bindCount;   // Written by the thread that records the job
+            uint32_t                drawCount;
+        };
+
+        void recordLayers(uint32_t frameIndex, bool recordAllLayers); // Records the secondary command buffers of layers that changed
+        void recordPrimary(uint32_t frameIndex, uint32_t imageIndex);
+        void recordReadback(VkCommandBuffer commandBuffer, uint32_t frameIndex);
+        void deliverReadback(uint32_t frameIndex); // Hands the frame read back into the frame's buffer to the callback, the frame has to be finished
+        void cullLayer(LayerCache& cache);
+        void buildDrawPackets(LayerCache& cache, uint32_t frameIndex);
+        bool updateDrawList(LayerCache& cache, uint32_t frameIndex, bool patch); // Returns true if the recorded commands could be kept
+        void recordJob(VkCommandBuffer commandBuffer, uint32_t frameIndex, RecordJob& job);
+        void recordIndirectJob(VkCommandBuffer commandBuffer, uint32_t frameIndex, RecordJob& job);
+        uint32_t getInstanceSlot(Object_Graphics_T* object);
+        void destroyLayerFrame(LayerFrame& frame);
+
+        static bool usesVertexOffset(const GraphicsParameters& params); // vertexOffset is added to every per-vertex binding, so it is only used with a single one
+        static void sortDrawPackets(std::vector<DrawPacket>& packets, std::vector<DrawPacket>& scratch);
+
+        static constexpr uint32_t s_packetsPerJob = 256; // Large enough that a secondary command buffer outweighs its overhead
+        static constexpr uint32_t s_minBatchCapacity = 16; // Draw list entries a batch has at least, so growing layers can be patched
+        static constexpr uint32_t s_objectsPerCullJob = 4096;
+
+        bool m_indirectDraws; // multiDrawIndirect and drawIndirectFirstInstance are supported
+
+        std::unique_ptr<CommandRecorder_IVulkan> m_recorder;
+        std::unique_ptr<RenderGraph_IVulkan> m_renderGraph;
+        RenderGraph_IVulkan::Resource m_backbuffer; // The swapchain image or offscreen render target of the frame
+        std::list<LayerCache> m_layerCaches; // Test quad first, a list so jobs and frames can point into it
+        std::vector<std::vector<LayerCache*>> m_executedLayers; // Per frame in flight, the layers its primary command buffer executes
+        std::vector<RecordJob> m_recordJobs;
+        std::vector<DrawPacket> m_drawPacketScratch;
+        std::array<std::unordered_map<uint64_t, uint64_t>, 4> m_stateIds; // Dense ids of the pipelines, descriptor sets, vertex and index buffers in the sort keys
 
-        std::vector<SyncObjects> m_syncObjects;
-        uint32_t m_syncObjectIndex;
+        RenderStatistics getStatistics() const override { return m_statistics; }
+
+        RenderStatistics m_statistics;
+
+        std::vector<SyncObjects> m_syncObjects; // Per frame in flight
+        uint32_t m_frameIndex; // Frame in flight the next tick() renders, resources of all other frames may be in use by the GPU
+
+        std::vector<VkCommandBuffer> m_uploadCommandBuffers; // Per frame in flight, submitted in front of the frame if graphics tasks are pending
+        std::vector<UploadTicket> m_graphicsTaskTickets; // Staging ticket the graphics tasks of each frame in flight read from
+
+        uint32_t m_imageIndex; // Swapchain image of the last submitted frame
+
+        void setFrameCallback(FrameCallback callback) override;
+
+        // Headless only, the render target is copied into the buffer of its frame in flight, so one frame is read back while the next renders
+        struct Readback
+        {
+            VkBuffer                buffer = VK_NULL_HANDLE;
+            VmaAllocation           allocation = nullptr;
+            uint8_t*                data = nullptr;
+            uint64_t                frameNumber = 0;
+            bool                    pending = false; // Copied but not handed to the callback yet
+        };
 
-        uint32_t m_imageIndex;
+        std::vector<Readback> m_readbacks; // Per frame in flight
+        FrameCallback m_frameCallback;
+        uint64_t m_frameNumber; // Frames submitted so far, picks the render target in headless mode
+        Time m_startTime;
 
         struct T_Vertex
         {
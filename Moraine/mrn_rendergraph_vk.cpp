@@ -0,0 +1,556 @@
+#include "mrn_core.h"
+#include "mrn_rendergraph_vk.h"
+
+moraine::RenderGraph_IVulkan::RenderGraph_IVulkan(GraphicsContext_IVulkan* context) :
+    m_context(context),
+    m_transientMemory(nullptr),
+    m_statistics()
+{ }
+
+moraine::RenderGraph_IVulkan::~RenderGraph_IVulkan()
+{
+    destroyCompiledObjects();
+}
+
+moraine::RenderGraph_IVulkan::Resource moraine::RenderGraph_IVulkan::createImage(Stringr name, VkFormat format, uint32_t width, uint32_t height, VkClearColorValue clearColor)
+{
+    ImageResource resource;
+    resource.name                   = name;
+    resource.format                 = format;
+    resource.width                  = width;
+    resource.height                 = height;
+    resource.clearColor             = clearColor;
+    resource.imported               = false;
+    resource.initialState           = { VK_IMAGE_LAYOUT_UNDEFINED, 0, 0 };
+    resource.finalState             = { VK_IMAGE_LAYOUT_UNDEFINED, 0, 0 };
+
+    m_resources.push_back(std::move(resource));
+    return static_cast<Resource>(m_resources.size() - 1);
+}
+
+moraine::RenderGraph_IVulkan::Resource moraine::RenderGraph_IVulkan::importImage(Stringr name, VkFormat format, uint32_t width, uint32_t height, VkClearColorValue clearColor,
+                                                                                   ImageState initialState, ImageState finalState)
+{
+    Resource resource = createImage(name, format, width, height, clearColor);
+    m_resources[resource].imported      = true;
+    m_resources[resource].initialState  = initialState;
+    m_resources[resource].finalState    = finalState;
+
+    return resource;
+}
+
+void moraine::RenderGraph_IVulkan::setImportedImage(Resource resource, VkImage image, VkImageView imageView)
+{
+    assert(m_context->getLogfile(), m_resources[resource].imported, L"Wrong API Usage: Only imported render graph images can be set!", MRN_DEBUG_INFO);
+
+    m_resources[resource].image = image;
+    m_resources[resource].imageView = imageView;
+}
+
+void moraine::RenderGraph_IVulkan::addPass(Stringr name, std::initializer_list<PassUsage> usages, RecordFunction recordFunction, uint32_t passFlags)
+{
+    Pass pass;
+    pass.name                       = name;
+    pass.usages                     = usages;
+    pass.recordFunction             = std::move(recordFunction);
+    pass.flags                      = passFlags;
+    pass.culled                     = false;
+
+    m_passes.push_back(std::move(pass));
+}
+
+void moraine::RenderGraph_IVulkan::compile()
+{
+    Time start = Time::now();
+
+    destroyCompiledObjects();
+
+    cullPasses();
+
+    for (auto& a : m_resources)
+    {
+        a.firstPass = UINT32_MAX;
+        a.lastPass = UINT32_MAX;
+        a.usage = 0;
+    }
+
+    for (uint32_t i = 0; i < m_passes.size(); ++i)
+    {
+        if (m_passes[i].culled)
+            continue;
+
+        for (const auto& a : m_passes[i].usages)
+        {
+            ImageResource& resource = m_resources[a.resource];
+
+            if (resource.firstPass == UINT32_MAX)
+                resource.firstPass = i;
+
+            resource.lastPass = i;
+
+            switch (a.usage)
+            {
+            case RENDER_GRAPH_USAGE_COLOR_ATTACHMENT:   resource.usage |= VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT; break;
+            case RENDER_GRAPH_USAGE_SAMPLED:            resource.usage |= VK_IMAGE_USAGE_SAMPLED_BIT; break;
+            case RENDER_GRAPH_USAGE_TRANSFER_SRC:       resource.usage |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT; break;
+            case RENDER_GRAPH_USAGE_TRANSFER_DST:       resource.usage |= VK_IMAGE_USAGE_TRANSFER_DST_BIT; break;
+            }
+        }
+    }
+
+    allocateTransientImages();
+    computeBarriers();
+
+    m_statistics.passCount = 0;
+    m_statistics.culledPassCount = 0;
+    m_statistics.renderPassCount = 0;
+    m_statistics.barrierCount = static_cast<uint32_t>(m_finalBarriers.size());
+    m_statistics.pipelineBarrierCount = m_finalBarriers.empty() ? 0 : 1;
+
+    for (auto& a : m_passes)
+    {
+        if (a.culled)
+        {
+            ++m_statistics.culledPassCount;
+            continue;
+        }
+
+        ++m_statistics.passCount;
+        m_statistics.barrierCount += static_cast<uint32_t>(a.barriers.size());
+        m_statistics.pipelineBarrierCount += a.barriers.empty() ? 0 : 1;
+
+        if (not a.attachments.empty())
+        {
+            createRenderPass(a);
+            ++m_statistics.renderPassCount;
+        }
+    }
+
+    m_context->getLogfile()->print(GREY, sprintf(L"Compiled render graph: %d passes (%d culled), %d barriers in %d pipeline barriers, %.2f MB transient memory (%.2f MB without aliasing) (%.3f ms)",
+                                                 m_statistics.passCount, m_statistics.culledPassCount, m_statistics.barrierCount, m_statistics.pipelineBarrierCount,
+                                                 m_statistics.transientMemory / (1024.0f * 1024.0f), m_statistics.transientMemoryUnaliased / (1024.0f * 1024.0f),
+                                                 Time::duration(start, Time::now()).getMillisecondsF()), MRN_DEBUG_INFO);
+}
+
+void moraine::RenderGraph_IVulkan::execute(VkCommandBuffer commandBuffer, uint32_t frameIndex)
+{
+    for (auto& a : m_passes)
+    {
+        if (a.culled)
+            continue;
+
+        recordBarriers(commandBuffer, a.barriers);
+
+        if (a.renderPass != VK_NULL_HANDLE)
+        {
+            const ImageResource& target = m_resources[a.attachments.front()];
+
+            std::vector<VkClearValue> clearValues(a.attachments.size());
+
+            for (size_t b = 0; b < a.attachments.size(); ++b)
+                clearValues[b].color = m_resources[a.attachments[b]].clearColor;
+
+            VkRenderPassBeginInfo vrpbi;
+            vrpbi.sType                 = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+            vrpbi.pNext                 = nullptr;
+            vrpbi.renderPass            = a.renderPass;
+            vrpbi.framebuffer           = getFramebuffer(a);
+            vrpbi.renderArea.offset     = { 0, 0 };
+            vrpbi.renderArea.extent     = { target.width, target.height };
+            vrpbi.clearValueCount       = static_cast<uint32_t>(clearValues.size());
+            vrpbi.pClearValues          = clearValues.data();
+
+            vkCmdBeginRenderPass(commandBuffer, &vrpbi, a.flags & RENDER_GRAPH_PASS_SECONDARY_COMMAND_BUFFERS ? VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS : VK_SUBPASS_CONTENTS_INLINE);
+        }
+
+        a.recordFunction(commandBuffer, frameIndex);
+
+        if (a.renderPass != VK_NULL_HANDLE)
+            vkCmdEndRenderPass(commandBuffer);
+    }
+
+    recordBarriers(commandBuffer, m_finalBarriers);
+}
+
+moraine::RenderGraph_IVulkan::ImageState moraine::RenderGraph_IVulkan::getUsageState(RenderGraphUsage usage)
+{
+    switch (usage)
+    {
+    case RENDER_GRAPH_USAGE_COLOR_ATTACHMENT:   return { VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT };
+    case RENDER_GRAPH_USAGE_SAMPLED:            return { VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT };
+    case RENDER_GRAPH_USAGE_TRANSFER_SRC:       return { VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_READ_BIT };
+    case RENDER_GRAPH_USAGE_TRANSFER_DST:       return { VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT };
+    default:                                    return { VK_IMAGE_LAYOUT_UNDEFINED, 0, 0 };
+    }
+}
+
+bool moraine::RenderGraph_IVulkan::isWrite(VkAccessFlags access)
+{
+    return access & (VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT |
+                     VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_HOST_WRITE_BIT | VK_ACCESS_MEMORY_WRITE_BIT);
+}
+
+void moraine::RenderGraph_IVulkan::cullPasses()
+{
+    // Walks back from the outputs: a pass is needed if it writes an image whose content a later needed pass or the frame's result uses.
+    // Every usage reads the image's previous content (attachments are loaded, copies may not cover everything), so it is needed from there on
+    std::vector<bool> needed(m_resources.size());
+
+    for (size_t i = 0; i < m_resources.size(); ++i)
+        needed[i] = m_resources[i].imported;
+
+    for (auto a = m_passes.rbegin(); a != m_passes.rend(); ++a)
+    {
+        bool writesNeeded = false;
+
+        for (const auto& b : a->usages)
+            if (isWrite(getUsageState(b.usage).access) and needed[b.resource])
+                writesNeeded = true;
+
+        a->culled = not writesNeeded and not (a->flags & RENDER_GRAPH_PASS_SIDE_EFFECTS);
+
+        if (not a->culled)
+            for (const auto& b : a->usages)
+                needed[b.resource] = true;
+    }
+}
+
+void moraine::RenderGraph_IVulkan::allocateTransientImages()
+{
+    std::vector<Resource> transients;
+    uint32_t memoryTypeBits = UINT32_MAX;
+
+    m_statistics.transientMemory = 0;
+    m_statistics.transientMemoryUnaliased = 0;
+
+    for (Resource i = 0; i < m_resources.size(); ++i)
+    {
+        ImageResource& resource = m_resources[i];
+
+        if (resource.imported or resource.firstPass == UINT32_MAX)
+            continue;
+
+        VkImageCreateInfo vici;
+        vici.sType                  = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+        vici.pNext                  = nullptr;
+        vici.flags                  = 0;
+        vici.imageType              = VK_IMAGE_TYPE_2D;
+        vici.format                 = resource.format;
+        vici.extent                 = { resource.width, resource.height, 1 };
+        vici.mipLevels              = 1;
+        vici.arrayLayers            = 1;
+        vici.samples                = VK_SAMPLE_COUNT_1_BIT;
+        vici.tiling                 = VK_IMAGE_TILING_OPTIMAL;
+        vici.usage                  = resource.usage;
+        vici.sharingMode            = VK_SHARING_MODE_EXCLUSIVE; // Only the graphics queue uses the frame's images
+        vici.queueFamilyIndexCount  = 0;
+        vici.pQueueFamilyIndices    = nullptr;
+        vici.initialLayout          = VK_IMAGE_LAYOUT_UNDEFINED;
+
+        assert_vulkan(m_context->getLogfile(), vkCreateImage(m_context->m_device, &vici, nullptr, &resource.image), L"vkCreateImage() failed", MRN_DEBUG_INFO);
+
+        vkGetImageMemoryRequirements(m_context->m_device, resource.image, &resource.memoryRequirements);
+
+        memoryTypeBits &= resource.memoryRequirements.memoryTypeBits;
+        m_statistics.transientMemoryUnaliased += resource.memoryRequirements.size;
+        transients.push_back(i);
+    }
+
+    if (transients.empty())
+        return;
+
+    // Largest images first, each one goes to the lowest offset where it doesn't overlap the memory of an image that is alive at the same time
+    std::sort(transients.begin(), transients.end(), [this](Resource a, Resource b) { return m_resources[a].memoryRequirements.size > m_resources[b].memoryRequirements.size; });
+
+    VkMemoryRequirements heapRequirements;
+    heapRequirements.size = 0;
+    heapRequirements.alignment = 1;
+    heapRequirements.memoryTypeBits = memoryTypeBits;
+
+    for (size_t i = 0; i < transients.size(); ++i)
+    {
+        ImageResource& resource = m_resources[transients[i]];
+        VkDeviceSize alignment = resource.memoryRequirements.alignment;
+        VkDeviceSize offset = 0;
+        bool moved = true;
+
+        while (moved)
+        {
+            moved = false;
+
+            for (size_t j = 0; j < i; ++j)
+            {
+                const ImageResource& placed = m_resources[transients[j]];
+
+                bool aliveTogether = resource.firstPass <= placed.lastPass and placed.firstPass <= resource.lastPass;
+                bool memoryOverlaps = offset < placed.memoryOffset + placed.memoryRequirements.size and placed.memoryOffset < offset + resource.memoryRequirements.size;
+
+                if (aliveTogether and memoryOverlaps)
+                {
+                    offset = (placed.memoryOffset + placed.memoryRequirements.size + alignment - 1) / alignment * alignment;
+                    moved = true;
+                }
+            }
+        }
+
+        resource.memoryOffset = offset;
+        heapRequirements.size = max(heapRequirements.size, offset + resource.memoryRequirements.size);
+        heapRequirements.alignment = max(heapRequirements.alignment, alignment);
+    }
+
+    assert(m_context->getLogfile(), memoryTypeBits != 0, L"The transient images of the render graph have no memory type in common!", MRN_DEBUG_INFO);
+
+    VmaAllocationCreateInfo vaci = { };
+    vaci.usage                      = VMA_MEMORY_USAGE_GPU_ONLY;
+
+    VmaAllocationInfo allocationInfo;
+    assert_vulkan(m_context->getLogfile(), vmaAllocateMemory(m_context->m_allocator, &heapRequirements, &vaci, &m_transientMemory, &allocationInfo), L"vmaAllocateMemory() failed", MRN_DEBUG_INFO);
+
+    m_statistics.transientMemory = heapRequirements.size;
+
+    for (Resource i : transients)
+    {
+        ImageResource& resource = m_resources[i];
+
+        assert_vulkan(m_context->getLogfile(), vkBindImageMemory(m_context->m_device, resource.image, allocationInfo.deviceMemory, allocationInfo.offset + resource.memoryOffset),
+                      L"vkBindImageMemory() failed", MRN_DEBUG_INFO);
+
+        VkImageViewCreateInfo vivci;
+        vivci.sType                             = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+        vivci.pNext                             = nullptr;
+        vivci.flags                             = 0;
+        vivci.image                             = resource.image;
+        vivci.viewType                          = VK_IMAGE_VIEW_TYPE_2D;
+        vivci.format                            = resource.format;
+        vivci.components                        = { VK_COMPONENT_SWIZZLE_IDENTITY, VK_COMPONENT_SWIZZLE_IDENTITY, VK_COMPONENT_SWIZZLE_IDENTITY, VK_COMPONENT_SWIZZLE_IDENTITY };
+        vivci.subresourceRange.aspectMask       = VK_IMAGE_ASPECT_COLOR_BIT;
+        vivci.subresourceRange.baseMipLevel     = 0;
+        vivci.subresourceRange.levelCount       = 1;
+        vivci.subresourceRange.baseArrayLayer   = 0;
+        vivci.subresourceRange.layerCount       = 1;
+
+        assert_vulkan(m_context->getLogfile(), vkCreateImageView(m_context->m_device, &vivci, nullptr, &resource.imageView), L"vkCreateImageView() failed", MRN_DEBUG_INFO);
+    }
+}
+
+void moraine::RenderGraph_IVulkan::computeBarriers()
+{
+    std::vector<ImageState> states(m_resources.size());
+
+    // Run twice: the first run finds the state every image is left in. The second one emits the barriers, transient images wait for
+    // the last use of every image that shares their memory, which is earlier in this frame or in the previous one
+    for (uint32_t run = 0; run < 2; ++run)
+    {
+        for (size_t i = 0; i < m_resources.size(); ++i)
+        {
+            const ImageResource& resource = m_resources[i];
+            states[i] = resource.imported ? resource.initialState : ImageState{ VK_IMAGE_LAYOUT_UNDEFINED, 0, 0 };
+
+            if (run == 1 and not resource.imported and resource.firstPass != UINT32_MAX)
+                for (const auto& a : m_resources)
+                    if (not a.imported and a.firstPass != UINT32_MAX and a.memoryOffset < resource.memoryOffset + resource.memoryRequirements.size and
+                        resource.memoryOffset < a.memoryOffset + a.memoryRequirements.size)
+                    {
+                        states[i].stages |= a.lastState.stages;
+                        states[i].access |= a.lastState.access;
+                    }
+        }
+
+        for (auto& a : m_passes)
+        {
+            a.barriers.clear();
+            a.attachments.clear();
+            a.loadOps.clear();
+
+            if (a.culled)
+                continue;
+
+            for (const auto& b : a.usages)
+            {
+                ImageState& state = states[b.resource];
+                ImageState usageState = getUsageState(b.usage);
+
+                if (b.usage == RENDER_GRAPH_USAGE_COLOR_ATTACHMENT)
+                {
+                    a.attachments.push_back(b.resource);
+                    a.loadOps.push_back(state.layout == VK_IMAGE_LAYOUT_UNDEFINED ? VK_ATTACHMENT_LOAD_OP_CLEAR : VK_ATTACHMENT_LOAD_OP_LOAD);
+                }
+
+                // Reads after reads in the same layout need nothing, the later barrier waits for all of them
+                if (state.layout != usageState.layout or isWrite(state.access) or isWrite(usageState.access))
+                {
+                    a.barriers.push_back({ b.resource, state, usageState });
+                    state = usageState;
+                }
+                else
+                {
+                    state.stages |= usageState.stages;
+                    state.access |= usageState.access;
+                }
+            }
+        }
+
+        for (size_t i = 0; i < m_resources.size(); ++i)
+            m_resources[i].lastState = states[i];
+    }
+
+    m_finalBarriers.clear();
+
+    for (size_t i = 0; i < m_resources.size(); ++i)
+    {
+        const ImageResource& resource = m_resources[i];
+
+        if (resource.imported and (states[i].layout != resource.finalState.layout or isWrite(states[i].access)))
+            m_finalBarriers.push_back({ static_cast<Resource>(i), states[i], resource.finalState });
+    }
+}
+
+void moraine::RenderGraph_IVulkan::createRenderPass(Pass& pass)
+{
+    // The graph's barriers move the attachments into and out of the subpass layout, the render pass itself transitions nothing.
+    // Render passes with one attachment of the swapchain format are compatible with the context's render pass the pipelines were created with
+    std::vector<VkAttachmentDescription> attachments(pass.attachments.size());
+    std::vector<VkAttachmentReference> references(pass.attachments.size());
+
+    for (size_t i = 0; i < attachments.size(); ++i)
+    {
+        attachments[i].flags                    = 0;
+        attachments[i].format                   = m_resources[pass.attachments[i]].format;
+        attachments[i].samples                  = VK_SAMPLE_COUNT_1_BIT;
+        attachments[i].loadOp                   = pass.loadOps[i];
+        attachments[i].storeOp                  = VK_ATTACHMENT_STORE_OP_STORE;
+        attachments[i].stencilLoadOp            = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+        attachments[i].stencilStoreOp           = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+        attachments[i].initialLayout            = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+        attachments[i].finalLayout              = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+
+        references[i].attachment                = static_cast<uint32_t>(i);
+        references[i].layout                    = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+    }
+
+    VkSubpassDescription subpass;
+    subpass.flags                               = 0;
+    subpass.pipelineBindPoint                   = VK_PIPELINE_BIND_POINT_GRAPHICS;
+    subpass.inputAttachmentCount                = 0;
+    subpass.pInputAttachments                   = nullptr;
+    subpass.colorAttachmentCount                = static_cast<uint32_t>(references.size());
+    subpass.pColorAttachments                   = references.data();
+    subpass.pResolveAttachments                 = nullptr;
+    subpass.pDepthStencilAttachment             = nullptr;
+    subpass.preserveAttachmentCount             = 0;
+    subpass.pPreserveAttachments                = nullptr;
+
+    VkRenderPassCreateInfo vrpci;
+    vrpci.sType                                 = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+    vrpci.pNext                                 = nullptr;
+    vrpci.flags                                 = 0;
+    vrpci.attachmentCount                       = static_cast<uint32_t>(attachments.size());
+    vrpci.pAttachments                          = attachments.data();
+    vrpci.subpassCount                          = 1;
+    vrpci.pSubpasses                            = &subpass;
+    vrpci.dependencyCount                       = 0;
+    vrpci.pDependencies                         = nullptr;
+
+    assert_vulkan(m_context->getLogfile(), vkCreateRenderPass(m_context->m_device, &vrpci, nullptr, &pass.renderPass), L"vkCreateRenderPass() failed", MRN_DEBUG_INFO);
+}
+
+VkFramebuffer moraine::RenderGraph_IVulkan::getFramebuffer(Pass& pass)
+{
+    std::vector<VkImageView> views(pass.attachments.size());
+
+    for (size_t i = 0; i < views.size(); ++i)
+        views[i] = m_resources[pass.attachments[i]].imageView;
+
+    for (const auto& a : pass.framebuffers)
+        if (a.first == views)
+            return a.second;
+
+    const ImageResource& target = m_resources[pass.attachments.front()];
+
+    VkFramebufferCreateInfo vfbci;
+    vfbci.sType                                 = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+    vfbci.pNext                                 = nullptr;
+    vfbci.flags                                 = 0;
+    vfbci.renderPass                            = pass.renderPass;
+    vfbci.attachmentCount                       = static_cast<uint32_t>(views.size());
+    vfbci.pAttachments                          = views.data();
+    vfbci.width                                 = target.width;
+    vfbci.height                                = target.height;
+    vfbci.layers                                = 1;
+
+    VkFramebuffer framebuffer;
+    assert_vulkan(m_context->getLogfile(), vkCreateFramebuffer(m_context->m_device, &vfbci, nullptr, &framebuffer), L"vkCreateFramebuffer() failed", MRN_DEBUG_INFO);
+
+    pass.framebuffers.emplace_back(std::move(views), framebuffer);
+    return framebuffer;
+}
+
+void moraine::RenderGraph_IVulkan::recordBarriers(VkCommandBuffer commandBuffer, const std::vector<Barrier>& barriers)
+{
+    if (barriers.empty())
+        return;
+
+    std::vector<VkImageMemoryBarrier> imageBarriers(barriers.size());
+    VkPipelineStageFlags srcStages = 0, dstStages = 0;
+
+    for (size_t i = 0; i < barriers.size(); ++i)
+    {
+        const Barrier& barrier = barriers[i];
+
+        imageBarriers[i].sType                              = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        imageBarriers[i].pNext                              = nullptr;
+        imageBarriers[i].srcAccessMask                      = isWrite(barrier.src.access) ? barrier.src.access : 0; // Only writes have to be made available
+        imageBarriers[i].dstAccessMask                      = barrier.dst.access;
+        imageBarriers[i].oldLayout                          = barrier.src.layout;
+        imageBarriers[i].newLayout                          = barrier.dst.layout;
+        imageBarriers[i].srcQueueFamilyIndex                = VK_QUEUE_FAMILY_IGNORED;
+        imageBarriers[i].dstQueueFamilyIndex                = VK_QUEUE_FAMILY_IGNORED;
+        imageBarriers[i].image                              = m_resources[barrier.resource].image;
+        imageBarriers[i].subresourceRange.aspectMask        = VK_IMAGE_ASPECT_COLOR_BIT;
+        imageBarriers[i].subresourceRange.baseMipLevel      = 0;
+        imageBarriers[i].subresourceRange.levelCount        = 1;
+        imageBarriers[i].subresourceRange.baseArrayLayer    = 0;
+        imageBarriers[i].subresourceRange.layerCount        = 1;
+
+        srcStages |= barrier.src.stages;
+        dstStages |= barrier.dst.stages;
+    }
+
+    vkCmdPipelineBarrier(commandBuffer, srcStages ? srcStages : VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, dstStages ? dstStages : VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+                         0, 0, nullptr, 0, nullptr, static_cast<uint32_t>(imageBarriers.size()), imageBarriers.data());
+}
+
+void moraine::RenderGraph_IVulkan::destroyCompiledObjects()
+{
+    for (auto& a : m_passes)
+    {
+        for (auto& b : a.framebuffers)
+            vkDestroyFramebuffer(m_context->m_device, b.second, nullptr);
+
+        if (a.renderPass != VK_NULL_HANDLE)
+            vkDestroyRenderPass(m_context->m_device, a.renderPass, nullptr);
+
+        a.framebuffers.clear();
+        a.renderPass = VK_NULL_HANDLE;
+    }
+
+    for (auto& a : m_resources)
+    {
+        if (a.imported)
+            continue;
+
+        if (a.imageView != VK_NULL_HANDLE)
+            vkDestroyImageView(m_context->m_device, a.imageView, nullptr);
+
+        if (a.image != VK_NULL_HANDLE)
+            vkDestroyImage(m_context->m_device, a.image, nullptr);
+
+        a.imageView = VK_NULL_HANDLE;
+        a.image = VK_NULL_HANDLE;
+    }
+
+    if (m_transientMemory)
+        vmaFreeMemory(m_context->m_allocator, m_transientMemory);
+
+    m_transientMemory = nullptr;
+}
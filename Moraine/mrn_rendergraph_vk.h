@@ -0,0 +1,143 @@
+#pragma once
+
+#include "mrn_gfxcontext_vk.h"
+
+namespace moraine
+{
+    enum RenderGraphUsage
+    {
+        RENDER_GRAPH_USAGE_COLOR_ATTACHMENT,    // Written by the pass's render pass, loaded if an earlier pass wrote it this frame and cleared otherwise
+        RENDER_GRAPH_USAGE_SAMPLED,             // Read in fragment shaders
+        RENDER_GRAPH_USAGE_TRANSFER_SRC,
+        RENDER_GRAPH_USAGE_TRANSFER_DST
+    };
+
+    enum RenderGraphPassFlags
+    {
+        RENDER_GRAPH_PASS_SECONDARY_COMMAND_BUFFERS     = 0x1, // The render pass contents are executed from secondary command buffers
+        RENDER_GRAPH_PASS_SIDE_EFFECTS                  = 0x2  // Never culled, e.g. passes that read back to the host
+    };
+
+    struct RenderGraphStatistics
+    {
+        uint32_t        passCount;              // Passes that are executed
+        uint32_t        culledPassCount;        // Passes whose results nothing reads
+        uint32_t        renderPassCount;
+        uint32_t        barrierCount;           // Image barriers per frame
+        uint32_t        pipelineBarrierCount;   // vkCmdPipelineBarrier() calls per frame, all barriers in front of a pass are one call
+        VkDeviceSize    transientMemory;        // Memory of the transient images with aliasing
+        VkDeviceSize    transientMemoryUnaliased; // Memory the transient images would need without aliasing
+    };
+
+    // Orders the passes of a frame and derives the barriers, layouts and load operations from the resources the passes declare.
+    // Passes run in the order they were added, a read sees the last write of an earlier pass. Transient images only live within the frame,
+    // images whose first and last use don't overlap share memory. Imported images (e.g. the swapchain image) are the outputs of the graph,
+    // passes that don't contribute to an imported image and have no side effects are culled
+    class RenderGraph_IVulkan
+    {
+    public:
+
+        typedef uint32_t Resource;
+        typedef std::function<void(VkCommandBuffer, uint32_t)> RecordFunction; // Command buffer, frame index
+
+        // Layout, stages and accesses an image is used with
+        struct ImageState
+        {
+            VkImageLayout           layout;
+            VkPipelineStageFlags    stages;
+            VkAccessFlags           access;
+        };
+
+        struct PassUsage
+        {
+            Resource                resource;
+            RenderGraphUsage        usage;
+        };
+
+        RenderGraph_IVulkan(GraphicsContext_IVulkan* context);
+        ~RenderGraph_IVulkan();
+
+        RenderGraph_IVulkan(const RenderGraph_IVulkan&) = delete;
+        RenderGraph_IVulkan& operator=(const RenderGraph_IVulkan&) = delete;
+
+        Resource createImage(Stringr name, VkFormat format, uint32_t width, uint32_t height, VkClearColorValue clearColor);
+
+        // initialState is the state of the image before the frame (its content is discarded if the layout is undefined), finalState the state it is left in.
+        // The image itself is set with setImportedImage() before every execute()
+        Resource importImage(Stringr name, VkFormat format, uint32_t width, uint32_t height, VkClearColorValue clearColor, ImageState initialState, ImageState finalState);
+        void setImportedImage(Resource resource, VkImage image, VkImageView imageView);
+
+        void addPass(Stringr name, std::initializer_list<PassUsage> usages, RecordFunction recordFunction, uint32_t passFlags = 0);
+
+        // Culls the passes, creates the render passes and transient images and precomputes the barriers. Has to be called again after passes or images were added
+        void compile();
+
+        // Records all passes into a primary command buffer that was begun by the caller
+        void execute(VkCommandBuffer commandBuffer, uint32_t frameIndex);
+
+        VkImage getImage(Resource resource) const { return m_resources[resource].image; }
+
+        const RenderGraphStatistics& getStatistics() const { return m_statistics; }
+
+    private:
+
+        struct ImageResource
+        {
+            String                  name;
+            VkFormat                format;
+            uint32_t                width;
+            uint32_t                height;
+            VkClearColorValue       clearColor;
+            bool                    imported;
+            ImageState              initialState;       // Imported only
+            ImageState              finalState;
+            VkImage                 image = VK_NULL_HANDLE;
+            VkImageView             imageView = VK_NULL_HANDLE;
+            VkImageUsageFlags       usage = 0;
+            VkMemoryRequirements    memoryRequirements;
+            VkDeviceSize            memoryOffset = 0;   // Transient only, offset in m_transientMemory
+            uint32_t                firstPass;          // Executed passes that use the image first and last, UINT32_MAX if no executed pass does
+            uint32_t                lastPass;
+            ImageState              lastState;          // State after the last pass, the next frame's first barrier waits for it
+        };
+
+        struct Barrier
+        {
+            Resource                resource;
+            ImageState              src;
+            ImageState              dst;
+        };
+
+        struct Pass
+        {
+            String                  name;
+            std::vector<PassUsage>  usages;
+            RecordFunction          recordFunction;
+            uint32_t                flags;
+            bool                    culled;
+            std::vector<Barrier>    barriers;           // Issued in front of the pass
+            VkRenderPass            renderPass = VK_NULL_HANDLE; // Only if the pass has color attachments
+            std::vector<Resource>   attachments;
+            std::vector<VkAttachmentLoadOp> loadOps;    // Per attachment, cleared if nothing wrote the image before in this frame
+            std::vector<std::pair<std::vector<VkImageView>, VkFramebuffer>> framebuffers; // Per set of attachment views, imported images change every frame
+        };
+
+        static ImageState getUsageState(RenderGraphUsage usage);
+        static bool isWrite(VkAccessFlags access);
+
+        void cullPasses();
+        void allocateTransientImages();
+        void computeBarriers();
+        void createRenderPass(Pass& pass);
+        VkFramebuffer getFramebuffer(Pass& pass);
+        void recordBarriers(VkCommandBuffer commandBuffer, const std::vector<Barrier>& barriers);
+        void destroyCompiledObjects();
+
+        GraphicsContext_IVulkan*    m_context;
+        std::vector<ImageResource>  m_resources;
+        std::vector<Pass>           m_passes;
+        std::vector<Barrier>        m_finalBarriers;    // Bring the imported images into their final state
+        VmaAllocation               m_transientMemory;
+        RenderGraphStatistics       m_statistics;
+    };
+}
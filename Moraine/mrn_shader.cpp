@@ -5,5 +5,19 @@
 
 moraine::Shader moraine::createShader(Stringr shader, GraphicsContext context)
 {
-    return std::make_shared<Shader_IVulkan>(shader, context);
+    return std::make_shared<Shader_IVulkan>(shader, context, false, nullptr);
+}
+
+moraine::Shader moraine::createShaderAsync(Stringr shader, GraphicsContext context, ShaderReadyCallback readyCallback, Shader fallback)
+{
+    auto vulkanShader = std::make_shared<Shader_IVulkan>(shader, context, true, std::static_pointer_cast<Shader_IVulkan>(fallback));
+    Shader_IVulkan::compileAsync(vulkanShader, readyCallback);
+    return vulkanShader;
+}
+
+bool moraine::compileShaderBinary(Stringr shader, Stringr binary, Logfile logfile)
+{
+    ShaderDescription_IVulkan description;
+    description.load(shader, logfile);
+    return description.writeBinary(binary, logfile);
 }
@@ -9,9 +9,22 @@ namespace moraine
     public:
 
         virtual ~Shader_T() = default;
+
+        virtual bool isReady() const = 0; // False while the pipeline of a shader from createShaderAsync() is compiling
     };
 
     typedef std::shared_ptr<Shader_T> Shader;
+    typedef std::function<void(Shader)> ShaderReadyCallback;
 
+    // shader is a JSON config or a binary from compileShaderBinary(), which is read without parsing or opening the SPIR-V files
     MRN_API Shader createShader(Stringr shader, GraphicsContext context);
+
+    // Reads the config and creates the descriptor set layouts right away, so constant sets can be created from the returned shader, the pipeline
+    // is compiled on a worker thread. Until then objects with the shader are drawn with fallback, which needs the same descriptor and vertex
+    // bindings, or skipped if there is none. readyCallback is called on the thread that ticks the renderer
+    MRN_API Shader createShaderAsync(Stringr shader, GraphicsContext context, ShaderReadyCallback readyCallback = nullptr, Shader fallback = nullptr);
+
+    // Writes the config, its SPIR-V files and all values parsed from it to one binary file, which createShader() and createShaderAsync() accept
+    // instead of the config. Meant to be run when the assets are built, returns false if the binary couldn't be written
+    MRN_API bool compileShaderBinary(Stringr shader, Stringr binary, Logfile logfile);
 }
\ No newline at end of file
@@ -1,91 +1,98 @@
 #include "mrn_core.h"
 #include "mrn_shader_vk.h"
+#include "mrn_shadercache_vk.h"
+#include "mrn_shadercompiler_vk.h"
+#include "mrn_descriptors_vk.h"
 
 #include <fstream>
 
-moraine::Shader_IVulkan::Shader_IVulkan(String shader, GraphicsContext context) :
+moraine::Shader_IVulkan::Shader_IVulkan(String shader, GraphicsContext context, bool async, std::shared_ptr<Shader_IVulkan> fallback) :
     m_context(std::static_pointer_cast<GraphicsContext_IVulkan>(context)),
     m_logfile(m_context->getLogfile()),
+    m_path(shader),
     m_pipeline(VK_NULL_HANDLE),
-    m_layout(VK_NULL_HANDLE)
+    m_layout(VK_NULL_HANDLE),
+    m_instanceSlotBinding(UINT32_MAX),
+    m_bindlessSet(UINT32_MAX),
+    m_ready(false),
+    m_fallback(fallback)
 {
     Time start = Time::now();
 
-    std::ifstream configFile(shader.wcstr(), std::ifstream::binary);
-    assert(m_logfile, configFile.is_open(), sprintf(L"Couldn't open Shader\"%s\"", shader.wcstr()), MRN_DEBUG_INFO);
+    m_description.load(shader, m_logfile);
+    m_instanceSlotBinding = m_description.instanceSlotBinding;
+    m_bindlessSet = m_description.bindlessSet;
 
-    Json::Value jsonFile;
-    configFile >> jsonFile;
-    assert(m_logfile, jsonFile["fileType"].asString() == std::string("MORAINE_SHADER"), sprintf(L"Shader \"%s\" is not a shader config file!", shader.wcstr()), MRN_DEBUG_INFO);
+    // Constant sets are created from the layouts, so they exist before the pipeline is compiled
+    createPipelineLayout();
 
-    configFile.close();
+    assert(m_logfile, not m_fallback or m_fallback->m_layout == m_layout, sprintf(L"Wrong API Usage: The fallback of shader \"%s\" has different descriptor bindings!", shader.wcstr()), MRN_DEBUG_INFO);
 
-    String path = shader;
-    *(wcsrchr(path.wcbuf(), L'\\') + 1) = L'\0';
+    if (not async)
+    {
+        createPipeline(start, false);
+        m_ready = true;
+    }
+}
 
-    std::vector<VkPipelineShaderStageCreateInfo> shaderStages;
-    std::vector<VkShaderModule> shaderModules;
+void moraine::Shader_IVulkan::compileAsync(std::shared_ptr<Shader_IVulkan> shader, ShaderReadyCallback readyCallback)
+{
+    // The job holds the shader, so it stays alive until the callback was called
+    shader->m_context->m_shaderCompiler->enqueue([shader]()
+    {
+        shader->createPipeline(Time::now(), true);
+    },
+    [shader, readyCallback]()
+    {
+        shader->m_ready = true;
+        shader->m_context->invalidateCommandBuffers(); // Objects with the shader were skipped or drawn with the fallback
 
-    if (jsonFile["vertexShader"]["spirvVulkan"].isString())
-        compileShaderStage(sprintf(L"%s%S", path.wcstr(), jsonFile["vertexShader"]["spirvVulkan"].asString().c_str()), shaderStages, shaderModules, VK_SHADER_STAGE_VERTEX_BIT);
+        if (readyCallback)
+            readyCallback(shader);
+    });
+}
 
-    if (jsonFile["fragmentShader"]["spirvVulkan"].isString())
-        compileShaderStage(sprintf(L"%s%S", path.wcstr(), jsonFile["fragmentShader"]["spirvVulkan"].asString().c_str()), shaderStages, shaderModules, VK_SHADER_STAGE_FRAGMENT_BIT);
+void moraine::Shader_IVulkan::createPipeline(Time start, bool onWorker)
+{
+    m_description.loadStageCode(m_logfile);
 
-    std::vector<VkVertexInputBindingDescription> bindings;
-    std::vector<VkVertexInputAttributeDescription> attributes;
+    std::vector<VkPipelineShaderStageCreateInfo> shaderStages;
 
-    createVertexInputState(jsonFile, bindings, attributes, shader);
+    for (const auto& a : m_description.stages)
+    {
+        VkShaderModule module = m_context->m_shaderObjects->acquireShaderModule(a.code, a.codeSize);
+        m_shaderModules.push_back(module);
+
+        VkPipelineShaderStageCreateInfo vpssci;
+        vpssci.sType                            = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+        vpssci.pNext                            = nullptr;
+        vpssci.flags                            = 0;
+        vpssci.stage                            = a.stage;
+        vpssci.module                           = module;
+        vpssci.pName                            = "main";
+        vpssci.pSpecializationInfo              = nullptr;
+
+        shaderStages.push_back(vpssci);
+    }
 
     VkPipelineVertexInputStateCreateInfo vi_state;
     vi_state.sType                              = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
     vi_state.pNext                              = nullptr;
     vi_state.flags                              = 0;
-    vi_state.vertexBindingDescriptionCount      = static_cast<uint32_t>(bindings.size());
-    vi_state.pVertexBindingDescriptions         = bindings.data();
-    vi_state.vertexAttributeDescriptionCount    = static_cast<uint32_t>(attributes.size());
-    vi_state.pVertexAttributeDescriptions       = attributes.data();
+    vi_state.vertexBindingDescriptionCount      = static_cast<uint32_t>(m_description.vertexBindings.size());
+    vi_state.pVertexBindingDescriptions         = m_description.vertexBindings.data();
+    vi_state.vertexAttributeDescriptionCount    = static_cast<uint32_t>(m_description.vertexAttributes.size());
+    vi_state.pVertexAttributeDescriptions       = m_description.vertexAttributes.data();
 
     VkPipelineInputAssemblyStateCreateInfo ia_state;
     ia_state.sType                              = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
     ia_state.pNext                              = nullptr;
     ia_state.flags                              = 0;
-    ia_state.topology                           = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+    ia_state.topology                           = m_description.topology;
     ia_state.primitiveRestartEnable             = VK_FALSE;
 
-    if (jsonFile["topology"].isString())
-    {
-        auto topology = jsonFile["topology"].asString();
-
-        if (topology == "pointList")
-            ia_state.topology = VK_PRIMITIVE_TOPOLOGY_POINT_LIST;
-        else if (topology == "lineList")
-            ia_state.topology = VK_PRIMITIVE_TOPOLOGY_LINE_LIST;
-        else if (topology == "lineStrip")
-            ia_state.topology = VK_PRIMITIVE_TOPOLOGY_LINE_STRIP;
-        else if (topology == "triangleList")
-            ia_state.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
-        else if (topology == "triangleStrip")
-            ia_state.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_STRIP;
-        else if (topology == "triangleFan")
-            ia_state.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_FAN;
-        else if (topology == "lineListAdj")
-            ia_state.topology = VK_PRIMITIVE_TOPOLOGY_LINE_LIST_WITH_ADJACENCY;
-        else if (topology == "lineStripAdj")
-            ia_state.topology = VK_PRIMITIVE_TOPOLOGY_LINE_STRIP_WITH_ADJACENCY;
-        else if (topology == "triangleListAdj")
-            ia_state.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST_WITH_ADJACENCY;
-        else if (topology == "triangleStripAdj")
-            ia_state.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_STRIP_WITH_ADJACENCY;
-        else if (topology == "patchList")
-            ia_state.topology = VK_PRIMITIVE_TOPOLOGY_PATCH_LIST;
-        else
-            m_logfile->print(YELLOW, sprintf(L"The argument \"%S\" for \"topology\" in shader config file \"%s\" is invalid! Using \"triangleList\" as default parameter", 
-                             topology.c_str(), shader.wcstr()), MRN_DEBUG_INFO);
-    }
-
-    uint32_t width = dynamic_cast<GraphicsContext_IVulkan*>(context.get())->m_viewportWidth;
-    uint32_t height = dynamic_cast<GraphicsContext_IVulkan*>(context.get())->m_viewportHeight;
+    uint32_t width = m_context->m_viewportWidth;
+    uint32_t height = m_context->m_viewportHeight;
 
     VkViewport viewport;
     viewport.x                                  = 0;
@@ -114,66 +121,32 @@ moraine::Shader_IVulkan::Shader_IVulkan(String shader, GraphicsContext context)
     rz_state.flags                              = 0;
     rz_state.depthClampEnable                   = VK_FALSE;
     rz_state.rasterizerDiscardEnable            = VK_FALSE;
-    rz_state.polygonMode                        = VK_POLYGON_MODE_FILL;
-    rz_state.cullMode                           = VK_CULL_MODE_BACK_BIT;
+    rz_state.polygonMode                        = m_description.polygonMode;
+    rz_state.cullMode                           = m_description.cullMode;
     rz_state.frontFace                          = VK_FRONT_FACE_CLOCKWISE;
     rz_state.depthBiasEnable                    = VK_FALSE;
     rz_state.depthBiasConstantFactor            = 0.0f;
     rz_state.depthBiasClamp                     = 0.0f;
     rz_state.depthBiasSlopeFactor               = 0.0f;
-    rz_state.lineWidth                          = 5.0f;
-
-    if (jsonFile["polygonMode"].isString())
-    {
-        auto polygonMode = jsonFile["polygonMode"].asString();
-
-        if (polygonMode == "fill")
-            rz_state.polygonMode = VK_POLYGON_MODE_FILL;
-        else if (polygonMode == "line")
-            rz_state.polygonMode = VK_POLYGON_MODE_LINE;
-        else if (polygonMode == "point")
-            rz_state.polygonMode = VK_POLYGON_MODE_POINT;
-        else
-            m_logfile->print(YELLOW, sprintf(L"The argument \"%S\" for \"polygonMode\" in shader config file \"%s\" is invalid! Using \"fill\" as default parameter",
-                             polygonMode.c_str(), shader.wcstr()), MRN_DEBUG_INFO);
-    }
-
-    if (jsonFile["backfaceCulling"].isBool())
-        rz_state.cullMode = jsonFile["backfaceCulling"].asBool() ? VK_CULL_MODE_BACK_BIT : VK_CULL_MODE_NONE;
-
-    if (jsonFile["lineWidth"].isDouble())
-        rz_state.lineWidth = static_cast<float>(jsonFile["lineWidth"].asDouble());
+    rz_state.lineWidth                          = m_description.lineWidth;
 
     VkPipelineMultisampleStateCreateInfo ms_state;
     ms_state.sType                              = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
     ms_state.pNext                              = nullptr;
     ms_state.flags                              = 0;
     ms_state.rasterizationSamples               = VK_SAMPLE_COUNT_1_BIT;
-    ms_state.sampleShadingEnable                = VK_FALSE;
-    ms_state.minSampleShading                   = 0.0f;
+    ms_state.sampleShadingEnable                = m_description.minSampleShading > 0.0f ? VK_TRUE : VK_FALSE;
+    ms_state.minSampleShading                   = m_description.minSampleShading;
     ms_state.pSampleMask                        = nullptr;
     ms_state.alphaToCoverageEnable              = VK_FALSE;
     ms_state.alphaToOneEnable                   = VK_FALSE;
 
-    if (jsonFile["multiSampling"].isDouble())
-    {
-        float multiSampling = static_cast<float>(jsonFile["multiSampling"].asDouble());
-
-        if (multiSampling > 0.0f)
-        {
-            ms_state.sampleShadingEnable = VK_TRUE;
-            ms_state.minSampleShading = clamp(0.0f, multiSampling, 1.0f);
-        }
-    }
-
-    VkBool32 depthBuffering = VK_FALSE;
-
     VkPipelineDepthStencilStateCreateInfo ds_state;
     ds_state.sType                              = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
     ds_state.pNext                              = nullptr;
     ds_state.flags                              = 0;
-    ds_state.depthTestEnable                    = depthBuffering;
-    ds_state.depthWriteEnable                   = depthBuffering;
+    ds_state.depthTestEnable                    = m_description.depthTest;
+    ds_state.depthWriteEnable                   = m_description.depthTest;
     ds_state.depthCompareOp                     = VK_COMPARE_OP_LESS;
     ds_state.depthBoundsTestEnable              = VK_FALSE;
     ds_state.stencilTestEnable                  = VK_FALSE;
@@ -182,11 +155,8 @@ moraine::Shader_IVulkan::Shader_IVulkan(String shader, GraphicsContext context)
     ds_state.minDepthBounds                     = 0.0f;
     ds_state.maxDepthBounds                     = 1.0f;
 
-    if (jsonFile["depthTest"].isBool())
-        depthBuffering = jsonFile["depthTest"].asBool() ? VK_TRUE : VK_FALSE;
-
     VkPipelineColorBlendAttachmentState cba_state;
-    cba_state.blendEnable                       = VK_FALSE;
+    cba_state.blendEnable                       = m_description.blending;
     cba_state.srcColorBlendFactor               = VK_BLEND_FACTOR_SRC_ALPHA;
     cba_state.dstColorBlendFactor               = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
     cba_state.colorBlendOp                      = VK_BLEND_OP_ADD;
@@ -195,9 +165,6 @@ moraine::Shader_IVulkan::Shader_IVulkan(String shader, GraphicsContext context)
     cba_state.alphaBlendOp                      = VK_BLEND_OP_ADD;
     cba_state.colorWriteMask                    = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
 
-    if (jsonFile["blending"].isBool())
-        cba_state.blendEnable = jsonFile["blending"].asBool() ? VK_TRUE : VK_FALSE;
-
     VkPipelineColorBlendStateCreateInfo cb_state;
     cb_state.sType                              = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
     cb_state.pNext                              = nullptr;
@@ -224,19 +191,6 @@ moraine::Shader_IVulkan::Shader_IVulkan(String shader, GraphicsContext context)
     dy_state.dynamicStateCount                  = static_cast<uint32_t>(dynamicStates.size());
     dy_state.pDynamicStates                     = dynamicStates.data();
 
-    //VkPipelineLayoutCreateInfo vplci;
-    //vplci.sType                                 = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-    //vplci.pNext                                 = nullptr;
-    //vplci.flags                                 = 0;
-    //vplci.setLayoutCount                        = 0;
-    //vplci.pSetLayouts                           = nullptr;
-    //vplci.pushConstantRangeCount                = 0;
-    //vplci.pPushConstantRanges                   = nullptr;
-    //
-    //assert_vulkan(m_logfile, vkCreatePipelineLayout(m_context->m_device, &vplci, nullptr, &m_layout), L"vkCreatePipelineLayout() failed", MRN_DEBUG_INFO);
-
-    createPipelineLayout(jsonFile, shader);
-
     VkGraphicsPipelineCreateInfo vgpci;
     vgpci.sType                                 = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
     vgpci.pNext                                 = nullptr;
@@ -258,21 +212,30 @@ moraine::Shader_IVulkan::Shader_IVulkan(String shader, GraphicsContext context)
     vgpci.basePipelineHandle                    = VK_NULL_HANDLE;
     vgpci.basePipelineIndex                     = 0;
 
-    assert_vulkan(m_logfile, vkCreateGraphicsPipelines(m_context->m_device, VK_NULL_HANDLE, 1, &vgpci, nullptr, &m_pipeline), L"vkCreateGraphicsPipelines() failed", MRN_DEBUG_INFO);
+    bool pipelineCreated;
+    m_pipeline = m_context->m_shaderObjects->acquireGraphicsPipeline(vgpci, &pipelineCreated);
 
-    for (const auto& a : shaderModules)
-        vkDestroyShaderModule(m_context->m_device, a, nullptr);
+    m_logfile->print(WHITE, sprintf(L"Created shader \"%s\" (%.3f ms%s%s)", m_path.wcstr(), Time::duration(start, Time::now()).getMillisecondsF(),
+                                    pipelineCreated ? L"" : L", shares its pipeline", onWorker ? L", on a worker" : L""));
 
-    m_logfile->print(WHITE, sprintf(L"Created shader \"%s\" (%.3f ms)", shader.wcstr(), Time::duration(start, Time::now()).getMillisecondsF()));
+    m_description = ShaderDescription_IVulkan(); // The SPIR-V is only needed until the pipeline exists
 }
 
 moraine::Shader_IVulkan::~Shader_IVulkan()
 {
-    for (const auto& a : m_descriptorLayouts)
-        vkDestroyDescriptorSetLayout(m_context->m_device, a, nullptr);
+    // The pipeline's cache entry refers to the layout and modules by handle, so they are released after it.
+    // Asynchronous shaders have no pipeline if their job was cancelled
+    if (m_pipeline != VK_NULL_HANDLE)
+        m_context->m_shaderObjects->releasePipeline(m_pipeline);
+
+    m_context->m_shaderObjects->releasePipelineLayout(m_layout);
+
+    for (size_t i = 0; i < m_descriptorLayouts.size(); ++i)
+        if (i != m_bindlessSet) // Owned by the bindless table
+            m_context->m_shaderObjects->releaseDescriptorSetLayout(m_descriptorLayouts[i]);
 
-    vkDestroyPipeline(m_context->m_device, m_pipeline, nullptr);
-    vkDestroyPipelineLayout(m_context->m_device, m_layout, nullptr);
+    for (const auto& a : m_shaderModules)
+        m_context->m_shaderObjects->releaseShaderModule(a);
 }
 
 void moraine::Shader_IVulkan::bind(VkCommandBuffer buffer)
@@ -280,241 +243,498 @@ void moraine::Shader_IVulkan::bind(VkCommandBuffer buffer)
     vkCmdBindPipeline(buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, m_pipeline);
 }
 
-void moraine::Shader_IVulkan::compileShaderStage(Stringr path, std::vector<VkPipelineShaderStageCreateInfo>& outStage, std::vector<VkShaderModule>& outModule, VkShaderStageFlagBits stage)
+void moraine::Shader_IVulkan::createPipelineLayout()
+{
+    const auto& descriptorSets = m_description.descriptorSets;
+
+    m_descriptorLayouts.resize(descriptorSets.size());
+    m_descriptorBindings = descriptorSets;
+    m_descriptorTypes.resize(descriptorSets.size());
+
+    for (size_t i = 0; i < descriptorSets.size(); ++i)
+    {
+        for (const auto& binding : descriptorSets[i])
+        {
+            if (m_descriptorTypes[i].size() <= binding.binding)
+                m_descriptorTypes[i].resize(binding.binding + 1, VK_DESCRIPTOR_TYPE_MAX_ENUM);
+
+            m_descriptorTypes[i][binding.binding] = binding.descriptorType;
+        }
+
+        if (i == m_bindlessSet)
+        {
+            assert(m_logfile, m_context->m_bindlessTable != nullptr, sprintf(L"Wrong API Usage: Shader \"%s\" has a \"bindlessSet\", but the context isn't bindless!", m_path.wcstr()), MRN_DEBUG_INFO);
+            m_descriptorLayouts[i] = m_context->m_bindlessTable->getLayout();
+        }
+        else
+            m_descriptorLayouts[i] = m_context->m_shaderObjects->acquireDescriptorSetLayout(descriptorSets[i]);
+    }
+
+    m_layout = m_context->m_shaderObjects->acquirePipelineLayout(m_descriptorLayouts);
+}
+
+
+void moraine::ShaderDescription_IVulkan::load(Stringr shader, Logfile logfile)
 {
-    auto binary = loadFile(m_logfile, path);
-
-    VkShaderModuleCreateInfo vsmci;
-    vsmci.sType             = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
-    vsmci.pNext             = nullptr;
-    vsmci.flags             = 0;
-    vsmci.codeSize          = binary.size;
-    vsmci.pCode             = reinterpret_cast<const uint32_t*>(binary.allocation.get());
-
-    VkShaderModule module;
-
-    assert_vulkan(m_logfile, vkCreateShaderModule(m_context->m_device, &vsmci, nullptr, &module), L"vkCreateShaderModule() failed", MRN_DEBUG_INFO);
-
-    VkPipelineShaderStageCreateInfo vpssci;
-    vpssci.sType                                = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-    vpssci.pNext                                = nullptr;
-    vpssci.flags                                = 0;
-    vpssci.stage                                = stage;
-    vpssci.module                               = module;
-    vpssci.pName                                = "main";
-    vpssci.pSpecializationInfo                  = nullptr;
-
-    outStage.push_back(vpssci);
-    outModule.push_back(module);
+    Allocation file = loadFile(logfile, shader);
+
+    if (file.size >= sizeof(uint32_t) and *reinterpret_cast<const uint32_t*>(file.allocation.get()) == s_binaryMagic)
+        readBinary(std::move(file), shader, logfile);
+    else
+        parseConfig(file, shader, logfile);
 }
 
+void moraine::ShaderDescription_IVulkan::loadStageCode(Logfile logfile)
+{
+    for (auto& a : stages)
+    {
+        if (a.path.length() == 0)
+            continue;
+
+        files.push_back(loadFile(logfile, a.path));
 
-void moraine::Shader_IVulkan::createVertexInputState(Json::Value& jsonfile, std::vector<VkVertexInputBindingDescription>& bindings, std::vector<VkVertexInputAttributeDescription>& attributes, Stringr fileName)
+        a.path = String();
+        a.code = reinterpret_cast<const uint32_t*>(files.back().allocation.get());
+        a.codeSize = files.back().size;
+    }
+}
+
+bool moraine::ShaderDescription_IVulkan::writeBinary(Stringr path, Logfile logfile)
 {
-    if (not jsonfile["vertexBindings"].isArray())
+    loadStageCode(logfile);
+
+    BinaryHeader header;
+    header.magic                                = s_binaryMagic;
+    header.version                              = s_binaryVersion;
+    header.stageCount                           = static_cast<uint32_t>(stages.size());
+    header.vertexBindingCount                   = static_cast<uint32_t>(vertexBindings.size());
+    header.vertexAttributeCount                 = static_cast<uint32_t>(vertexAttributes.size());
+    header.instanceSlotBinding                  = instanceSlotBinding;
+    header.setCount                             = static_cast<uint32_t>(descriptorSets.size());
+    header.topology                             = topology;
+    header.polygonMode                          = polygonMode;
+    header.cullMode                             = cullMode;
+    header.lineWidth                            = lineWidth;
+    header.minSampleShading                     = minSampleShading;
+    header.depthTest                            = depthTest;
+    header.blending                             = blending;
+    header.bindlessSet                          = bindlessSet;
+
+    std::vector<uint8_t> data;
+
+    auto append = [&data](const void* values, size_t size)
     {
-        m_logfile->print(GREY, sprintf(L"Shader \"%s\" does not contain any vertex bindings!", fileName.wcstr()), MRN_DEBUG_INFO);
+        data.insert(data.end(), static_cast<const uint8_t*>(values), static_cast<const uint8_t*>(values) + size);
+    };
+
+    append(&header, sizeof(header));
+
+    // The code follows the tables, its offsets are known once their size is
+    size_t codeOffset = sizeof(header) + sizeof(BinaryStage) * stages.size() + sizeof(VkVertexInputBindingDescription) * vertexBindings.size() +
+                        sizeof(VkVertexInputAttributeDescription) * vertexAttributes.size() + sizeof(uint32_t) * descriptorSets.size();
+
+    for (const auto& a : descriptorSets)
+        codeOffset += sizeof(BinaryDescriptorBinding) * a.size();
+
+    for (const auto& a : stages)
+    {
+        BinaryStage stage = { static_cast<uint32_t>(a.stage), static_cast<uint32_t>(codeOffset), static_cast<uint32_t>(a.codeSize) };
+        append(&stage, sizeof(stage));
+        codeOffset += (a.codeSize + 3) & ~static_cast<size_t>(3);
+    }
+
+    append(vertexBindings.data(), sizeof(VkVertexInputBindingDescription) * vertexBindings.size());
+    append(vertexAttributes.data(), sizeof(VkVertexInputAttributeDescription) * vertexAttributes.size());
+
+    for (const auto& a : descriptorSets)
+    {
+        uint32_t bindingCount = static_cast<uint32_t>(a.size());
+        append(&bindingCount, sizeof(bindingCount));
+    }
+
+    for (const auto& a : descriptorSets)
+        for (const auto& b : a)
+        {
+            BinaryDescriptorBinding binding = { b.binding, static_cast<uint32_t>(b.descriptorType), b.descriptorCount, b.stageFlags };
+            append(&binding, sizeof(binding));
+        }
+
+    for (const auto& a : stages)
+    {
+        append(a.code, a.codeSize);
+        data.resize((data.size() + 3) & ~static_cast<size_t>(3), 0);
+    }
+
+    // Moved over an older binary once complete, a running application could be loading it
+    String temporaryPath = sprintf(L"%s.tmp", path.wcstr());
+
+    std::ofstream file(temporaryPath.wcstr(), std::ios::binary | std::ios::trunc);
+    bool written = file.is_open() and file.write(reinterpret_cast<const char*>(data.data()), data.size());
+    file.close();
+
+    // An existing binary is only replaced by a complete file, in one step
+    if (not written or not MoveFileExW(temporaryPath.wcstr(), path.wcstr(), MOVEFILE_REPLACE_EXISTING))
+    {
+        logfile->print(YELLOW, sprintf(L"Writing shader binary \"%s\" failed", path.wcstr()), MRN_DEBUG_INFO);
+        _wremove(temporaryPath.wcstr());
+        return false;
+    }
+
+    logfile->print(GREY, sprintf(L"Wrote shader binary \"%s\" (%d bytes)", path.wcstr(), static_cast<uint32_t>(data.size())), MRN_DEBUG_INFO);
+    return true;
+}
+
+void moraine::ShaderDescription_IVulkan::parseConfig(const Allocation& file, Stringr shader, Logfile logfile)
+{
+    Json::Value config;
+    std::string errors;
+
+    std::unique_ptr<Json::CharReader> reader(Json::CharReaderBuilder().newCharReader());
+    const char* begin = reinterpret_cast<const char*>(file.allocation.get());
+
+    assert(logfile, reader->parse(begin, begin + file.size, &config, &errors), sprintf(L"Shader \"%s\" is not a valid JSON file: %S", shader.wcstr(), errors.c_str()), MRN_DEBUG_INFO);
+    assert(logfile, config["fileType"].asString() == std::string("MORAINE_SHADER"), sprintf(L"Shader \"%s\" is not a shader config file!", shader.wcstr()), MRN_DEBUG_INFO);
+
+    String path = shader;
+    *(wcsrchr(path.wcbuf(), L'\\') + 1) = L'\0';
+
+    if (config["vertexShader"]["spirvVulkan"].isString())
+        stages.push_back({ VK_SHADER_STAGE_VERTEX_BIT, sprintf(L"%s%S", path.wcstr(), config["vertexShader"]["spirvVulkan"].asString().c_str()), nullptr, 0 });
+
+    if (config["fragmentShader"]["spirvVulkan"].isString())
+        stages.push_back({ VK_SHADER_STAGE_FRAGMENT_BIT, sprintf(L"%s%S", path.wcstr(), config["fragmentShader"]["spirvVulkan"].asString().c_str()), nullptr, 0 });
+
+    parseVertexBindings(config, shader, logfile);
+
+    if (config["topology"].isString())
+    {
+        auto topologyName = config["topology"].asString();
+
+        if (topologyName == "pointList")
+            topology = VK_PRIMITIVE_TOPOLOGY_POINT_LIST;
+        else if (topologyName == "lineList")
+            topology = VK_PRIMITIVE_TOPOLOGY_LINE_LIST;
+        else if (topologyName == "lineStrip")
+            topology = VK_PRIMITIVE_TOPOLOGY_LINE_STRIP;
+        else if (topologyName == "triangleList")
+            topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+        else if (topologyName == "triangleStrip")
+            topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_STRIP;
+        else if (topologyName == "triangleFan")
+            topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_FAN;
+        else if (topologyName == "lineListAdj")
+            topology = VK_PRIMITIVE_TOPOLOGY_LINE_LIST_WITH_ADJACENCY;
+        else if (topologyName == "lineStripAdj")
+            topology = VK_PRIMITIVE_TOPOLOGY_LINE_STRIP_WITH_ADJACENCY;
+        else if (topologyName == "triangleListAdj")
+            topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST_WITH_ADJACENCY;
+        else if (topologyName == "triangleStripAdj")
+            topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_STRIP_WITH_ADJACENCY;
+        else if (topologyName == "patchList")
+            topology = VK_PRIMITIVE_TOPOLOGY_PATCH_LIST;
+        else
+            logfile->print(YELLOW, sprintf(L"The argument \"%S\" for \"topology\" in shader config file \"%s\" is invalid! Using \"triangleList\" as default parameter",
+                           topologyName.c_str(), shader.wcstr()), MRN_DEBUG_INFO);
+    }
+
+    if (config["polygonMode"].isString())
+    {
+        auto polygonModeName = config["polygonMode"].asString();
+
+        if (polygonModeName == "fill")
+            polygonMode = VK_POLYGON_MODE_FILL;
+        else if (polygonModeName == "line")
+            polygonMode = VK_POLYGON_MODE_LINE;
+        else if (polygonModeName == "point")
+            polygonMode = VK_POLYGON_MODE_POINT;
+        else
+            logfile->print(YELLOW, sprintf(L"The argument \"%S\" for \"polygonMode\" in shader config file \"%s\" is invalid! Using \"fill\" as default parameter",
+                           polygonModeName.c_str(), shader.wcstr()), MRN_DEBUG_INFO);
+    }
+
+    if (config["backfaceCulling"].isBool())
+        cullMode = config["backfaceCulling"].asBool() ? VK_CULL_MODE_BACK_BIT : VK_CULL_MODE_NONE;
+
+    if (config["lineWidth"].isDouble())
+        lineWidth = static_cast<float>(config["lineWidth"].asDouble());
+
+    if (config["multiSampling"].isDouble())
+    {
+        float multiSampling = static_cast<float>(config["multiSampling"].asDouble());
+
+        if (multiSampling > 0.0f)
+            minSampleShading = clamp(0.0f, multiSampling, 1.0f);
+    }
+
+    if (config["depthTest"].isBool())
+        depthTest = config["depthTest"].asBool() ? VK_TRUE : VK_FALSE;
+
+    if (config["blending"].isBool())
+        blending = config["blending"].asBool() ? VK_TRUE : VK_FALSE;
+
+    parseDescriptorBindings(config, shader, logfile);
+
+    if (config["bindlessSet"].isIntegral())
+    {
+        bindlessSet = config["bindlessSet"].asUInt();
+
+        // The table's layout replaces any bindings listed for the set
+        if (descriptorSets.size() <= bindlessSet)
+            descriptorSets.resize(bindlessSet + 1);
+
+        descriptorSets[bindlessSet].clear();
+    }
+}
+
+void moraine::ShaderDescription_IVulkan::parseVertexBindings(const Json::Value& config, Stringr shader, Logfile logfile)
+{
+    if (not config["vertexBindings"].isArray())
+    {
+        logfile->print(GREY, sprintf(L"Shader \"%s\" does not contain any vertex bindings!", shader.wcstr()), MRN_DEBUG_INFO);
         return;
     }
 
-    const Json::Value& vertexBindings = jsonfile["vertexBindings"];
+    const Json::Value& jsonBindings = config["vertexBindings"];
 
     uint32_t location = 0;
 
-    for (size_t i = 0; i < vertexBindings.size(); ++i)
+    for (size_t i = 0; i < jsonBindings.size(); ++i)
     {
         VkVertexInputRate rate = VK_VERTEX_INPUT_RATE_VERTEX;
         uint32_t stride = 0;
 
-        if (vertexBindings[static_cast<int>(i)]["inputRate"].isString())
+        if (jsonBindings[static_cast<int>(i)]["inputRate"].isString())
         {
-            auto inputRate = vertexBindings[static_cast<int>(i)]["inputRate"].asString();
+            auto inputRate = jsonBindings[static_cast<int>(i)]["inputRate"].asString();
 
             if (inputRate == "vertex")
                 rate = VK_VERTEX_INPUT_RATE_VERTEX;
             else if (inputRate == "instance")
                 rate = VK_VERTEX_INPUT_RATE_INSTANCE;
             else
-                m_logfile->print(YELLOW, sprintf(L"The value \"%S\" for \"vertexBindings[%d].inputRate\" in shader config file \"%s\" is invalid! Using \"vertex\" as default parameter",
-                                 inputRate.c_str(), i, fileName.wcstr()), MRN_DEBUG_INFO);
+                logfile->print(YELLOW, sprintf(L"The value \"%S\" for \"vertexBindings[%d].inputRate\" in shader config file \"%s\" is invalid! Using \"vertex\" as default parameter",
+                               inputRate.c_str(), i, shader.wcstr()), MRN_DEBUG_INFO);
         }
 
-        if (vertexBindings[static_cast<int>(i)]["stride"].isIntegral())
-            stride = vertexBindings[static_cast<int>(i)]["stride"].asUInt();
+        if (jsonBindings[static_cast<int>(i)]["stride"].isIntegral())
+            stride = jsonBindings[static_cast<int>(i)]["stride"].asUInt();
         else
-            m_logfile->print(YELLOW, sprintf(L"The value for \"vertexBindings[%d].stride\" in shader config file \"%s\" is invalid or missing! Using 0 as default parameter",
-                             i, fileName.wcstr()), MRN_DEBUG_INFO);
+            logfile->print(YELLOW, sprintf(L"The value for \"vertexBindings[%d].stride\" in shader config file \"%s\" is invalid or missing! Using 0 as default parameter",
+                           i, shader.wcstr()), MRN_DEBUG_INFO);
+
+        // The renderer fills this binding with the element offsets of merged objects, see Shader_IVulkan::m_instanceSlotBinding
+        if (jsonBindings[static_cast<int>(i)]["instanceSlots"].isBool() and jsonBindings[static_cast<int>(i)]["instanceSlots"].asBool())
+        {
+            if (rate != VK_VERTEX_INPUT_RATE_INSTANCE or stride != sizeof(uint32_t))
+                logfile->print(YELLOW, sprintf(L"\"vertexBindings[%d].instanceSlots\" in shader config file \"%s\" requires \"inputRate\": \"instance\" and \"stride\": 4!", i, shader.wcstr()), MRN_DEBUG_INFO);
+            else
+                instanceSlotBinding = static_cast<uint32_t>(i);
+        }
 
-        bindings.push_back({ static_cast<uint32_t>(i), stride, rate });
+        vertexBindings.push_back({ static_cast<uint32_t>(i), stride, rate });
 
-        if (not vertexBindings[static_cast<int>(i)]["locations"].isArray())
+        if (not jsonBindings[static_cast<int>(i)]["locations"].isArray())
         {
-            m_logfile->print(YELLOW, sprintf(L"The value for \"vertexBindings[%d].locations\" in shader config file \"%s\" is invalid or missing!", i, fileName.wcstr()), MRN_DEBUG_INFO);
+            logfile->print(YELLOW, sprintf(L"The value for \"vertexBindings[%d].locations\" in shader config file \"%s\" is invalid or missing!", i, shader.wcstr()), MRN_DEBUG_INFO);
             continue;
         }
 
-        const Json::Value& vertexAttributes = vertexBindings[static_cast<int>(i)]["locations"];
+        const Json::Value& jsonAttributes = jsonBindings[static_cast<int>(i)]["locations"];
 
-        for (size_t j = 0; j < vertexAttributes.size(); ++j)
+        for (size_t j = 0; j < jsonAttributes.size(); ++j)
         {
             VkFormat format = VK_FORMAT_UNDEFINED;
             uint32_t offset = 0;
 
-            if (vertexAttributes[static_cast<int>(j)]["type"].isString())
+            if (jsonAttributes[static_cast<int>(j)]["type"].isString())
             {
-                auto type = vertexAttributes[static_cast<int>(j)]["type"].asString();
+                auto type = jsonAttributes[static_cast<int>(j)]["type"].asString();
                 format = stringToVkFormat(type.c_str());
 
                 if (format == VK_FORMAT_UNDEFINED)
                 {
-                    m_logfile->print(YELLOW, sprintf(L"The value \"%S\" for \"vertexBindings[%d].locations[%d].type\" in shader config file \"%s\" is invalid! Using \"float4\" as default parameter", 
-                                     type.c_str(), i, j, fileName.wcstr()), MRN_DEBUG_INFO);
+                    logfile->print(YELLOW, sprintf(L"The value \"%S\" for \"vertexBindings[%d].locations[%d].type\" in shader config file \"%s\" is invalid! Using \"float4\" as default parameter",
+                                   type.c_str(), i, j, shader.wcstr()), MRN_DEBUG_INFO);
                     continue;
-                }   
+                }
             }
             else
             {
-                m_logfile->print(YELLOW, sprintf(L"The value for \"vertexBindings[%d].locations[%d].type\" in shader config file \"%s\" is invalid or missing!", i, j, fileName.wcstr()), MRN_DEBUG_INFO);
+                logfile->print(YELLOW, sprintf(L"The value for \"vertexBindings[%d].locations[%d].type\" in shader config file \"%s\" is invalid or missing!", i, j, shader.wcstr()), MRN_DEBUG_INFO);
                 continue;
             }
 
-            if (vertexAttributes[static_cast<int>(j)]["offset"].isIntegral())
-                offset = vertexAttributes[static_cast<int>(j)]["offset"].asUInt();
+            if (jsonAttributes[static_cast<int>(j)]["offset"].isIntegral())
+                offset = jsonAttributes[static_cast<int>(j)]["offset"].asUInt();
             else
-                m_logfile->print(YELLOW, sprintf(L"The value for \"vertexBindings[%d].locations[%d].offset\" in shader config file \"%s\" is invalid or missing! Using 0 as defualt parameter", i, j, fileName.wcstr()), MRN_DEBUG_INFO);
+                logfile->print(YELLOW, sprintf(L"The value for \"vertexBindings[%d].locations[%d].offset\" in shader config file \"%s\" is invalid or missing! Using 0 as defualt parameter", i, j, shader.wcstr()), MRN_DEBUG_INFO);
 
-            attributes.push_back({ location, static_cast<uint32_t>(i), format, offset });
+            vertexAttributes.push_back({ location, static_cast<uint32_t>(i), format, offset });
             ++location;
         }
     }
 }
 
-
-void moraine::Shader_IVulkan::createPipelineLayout(Json::Value& jsonfile, Stringr fileName)
+void moraine::ShaderDescription_IVulkan::parseDescriptorBindings(const Json::Value& config, Stringr shader, Logfile logfile)
 {
-    if (not jsonfile["descriptorBindings"].isArray())
+    if (not config["descriptorBindings"].isArray())
     {
-        m_logfile->print(GREY, sprintf(L"Shader \"%s\" does not contain any descriptor bindings!", fileName.wcstr()), MRN_DEBUG_INFO);
-        goto makePipelineLayout;
+        logfile->print(GREY, sprintf(L"Shader \"%s\" does not contain any descriptor bindings!", shader.wcstr()), MRN_DEBUG_INFO);
+        return;
     }
 
-    {
-        const Json::Value& descriptorSets = jsonfile["descriptorBindings"];
+    const Json::Value& jsonSets = config["descriptorBindings"];
 
-        m_descriptorLayouts.resize(descriptorSets.size());
-        m_desriptorPoolSizes.resize(m_descriptorLayouts.size());
+    descriptorSets.resize(jsonSets.size());
 
-        for (size_t i = 0; i < descriptorSets.size(); ++i)
+    for (size_t i = 0; i < jsonSets.size(); ++i)
+    {
+        if (not jsonSets[static_cast<int>(i)].isArray())
         {
-            std::vector<VkDescriptorSetLayoutBinding> bindings;
+            logfile->print(YELLOW, sprintf(L"The value for \"descriptorBindings[%d]\" in shader config file \"%s\" is invalid!", i, shader.wcstr()), MRN_DEBUG_INFO);
+            continue;
+        }
 
-            if (descriptorSets[static_cast<int>(i)].isArray())
-            {
-                const Json::Value& descriptorBindings = descriptorSets[static_cast<int>(i)];
+        const Json::Value& jsonBindings = jsonSets[static_cast<int>(i)];
 
-                for (size_t j = 0; j < descriptorBindings.size(); ++j)
+        for (size_t j = 0; j < jsonBindings.size(); ++j)
+        {
+            VkDescriptorSetLayoutBinding binding;
+            binding.binding                     = static_cast<uint32_t>(j);
+            binding.descriptorType              = VK_DESCRIPTOR_TYPE_MAX_ENUM;
+            binding.descriptorCount             = 1;
+            binding.stageFlags                  = VK_SHADER_STAGE_FLAG_BITS_MAX_ENUM;
+            binding.pImmutableSamplers          = nullptr;
+
+            if (jsonBindings[static_cast<int>(j)]["type"].isString())
+            {
+                auto type = jsonBindings[static_cast<int>(j)]["type"].asString();
+
+                if (type == "constantBuffer")
+                    binding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+                else if (type == "constantArray")
+                    binding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+                else if (type == "instancedConstantArray")
+                    binding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER; // Whole page, indexed with the instance slot attribute
+                else if (type == "combinedImageSampler")
+                    binding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+                else if (type == "storageBuffer")
+                    binding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+                else if (type == "storageArray")
+                    binding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC;
+                else
                 {
-                    VkDescriptorSetLayoutBinding binding;
-                    binding.binding                     = static_cast<uint32_t>(j);
-                    binding.descriptorType              = VK_DESCRIPTOR_TYPE_MAX_ENUM;
-                    binding.descriptorCount             = 1;
-                    binding.stageFlags                  = VK_SHADER_STAGE_FLAG_BITS_MAX_ENUM;
-                    binding.pImmutableSamplers          = nullptr;
-
-                    if (descriptorBindings[static_cast<int>(j)]["type"].isString())
-                    {
-                        auto type = descriptorBindings[static_cast<int>(j)]["type"].asString();
-
-                        if (type == "constantBuffer")
-                            binding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-                        else if (type == "constantArray")
-                            binding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
-                        else if (type == "combinedImageSampler")
-                            binding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-                        else if (type == "storageBuffer")
-                            binding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-                        else if (type == "storageArray")
-                            binding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC;
-                        else
-                        {
-                            m_logfile->print(YELLOW, sprintf(L"The value \"%S\" for \"descriptorBindings[%d][%d].type\" in shader config file \"%s\" is invalid!", type.c_str(), i, j, fileName.wcstr()), MRN_DEBUG_INFO);
-                            continue;
-                        }
-                    }
-                    else
-                    {
-                        m_logfile->print(YELLOW, sprintf(L"The value for \"descriptorBindings[%d][%d].type\" in shader config file \"%s\" is invalid or missing!", i, j, fileName.wcstr()), MRN_DEBUG_INFO);
-                        continue;
-                    }
-
-                    if (descriptorBindings[static_cast<int>(j)]["elementCount"].isIntegral())
-                        binding.descriptorCount = descriptorBindings[static_cast<int>(j)]["elementCount"].asUInt();
-
-                    if (descriptorBindings[static_cast<int>(j)]["stage"].isString())
-                    {
-                        auto stage = descriptorBindings[static_cast<int>(j)]["stage"].asString();
-
-                        if (stage == "vertexShader")
-                            binding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
-                        else if (stage == "fragmentShader")
-                            binding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
-                        else if (stage == "computeShader")
-                            binding.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
-                        else
-                        {
-                            m_logfile->print(YELLOW, sprintf(L"The value \"%S\" for \"descriptorBindings[%d][%d].stage\" in shader config file \"%s\" is invalid!", stage.c_str(), i, j, fileName.wcstr()), MRN_DEBUG_INFO);
-                            continue;
-                        }
-                    }
-                    else
-                    {
-                        m_logfile->print(YELLOW, sprintf(L"The value for \"descriptorBindings[%d][%d].stage\" in shader config file \"%s\" is invalid or missing!", i, j, fileName.wcstr()), MRN_DEBUG_INFO);
-                        continue;
-                    }
-
-                    bindings.push_back(binding);
-
-                    auto poolSize = std::find_if(m_desriptorPoolSizes[i].begin(), m_desriptorPoolSizes[i].end(), [binding](const VkDescriptorPoolSize& poolSize) { return poolSize.type == binding.descriptorType; });
-
-                    if (poolSize == m_desriptorPoolSizes[i].end())
-                        m_desriptorPoolSizes[i].push_back({ binding.descriptorType, static_cast<uint32_t>(m_context->m_swapchainImages.size()) });
-                    else
-                        poolSize->descriptorCount += static_cast<uint32_t>(m_context->m_swapchainImages.size());
+                    logfile->print(YELLOW, sprintf(L"The value \"%S\" for \"descriptorBindings[%d][%d].type\" in shader config file \"%s\" is invalid!", type.c_str(), i, j, shader.wcstr()), MRN_DEBUG_INFO);
+                    continue;
                 }
             }
             else
             {
-                m_logfile->print(YELLOW, sprintf(L"The value for \"descriptorBindings[%d]\" in shader config file \"%s\" is invalid!", i, fileName.wcstr()), MRN_DEBUG_INFO);
+                logfile->print(YELLOW, sprintf(L"The value for \"descriptorBindings[%d][%d].type\" in shader config file \"%s\" is invalid or missing!", i, j, shader.wcstr()), MRN_DEBUG_INFO);
+                continue;
             }
 
-            VkDescriptorSetLayoutCreateInfo vdslci;
-            vdslci.sType                           = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
-            vdslci.pNext                           = nullptr;
-            vdslci.flags                           = 0;
-            vdslci.bindingCount                    = static_cast<uint32_t>(bindings.size());
-            vdslci.pBindings                       = bindings.data();
+            if (jsonBindings[static_cast<int>(j)]["elementCount"].isIntegral())
+                binding.descriptorCount = jsonBindings[static_cast<int>(j)]["elementCount"].asUInt();
 
-            assert_vulkan(m_logfile, vkCreateDescriptorSetLayout(m_context->m_device, &vdslci, nullptr, &m_descriptorLayouts[i]), L"vkCreateDescriptorSetLayout() failed", MRN_DEBUG_INFO);
+            if (jsonBindings[static_cast<int>(j)]["stage"].isString())
+            {
+                auto stage = jsonBindings[static_cast<int>(j)]["stage"].asString();
+
+                if (stage == "vertexShader")
+                    binding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+                else if (stage == "fragmentShader")
+                    binding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+                else if (stage == "computeShader")
+                    binding.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+                else
+                {
+                    logfile->print(YELLOW, sprintf(L"The value \"%S\" for \"descriptorBindings[%d][%d].stage\" in shader config file \"%s\" is invalid!", stage.c_str(), i, j, shader.wcstr()), MRN_DEBUG_INFO);
+                    continue;
+                }
+            }
+            else
+            {
+                logfile->print(YELLOW, sprintf(L"The value for \"descriptorBindings[%d][%d].stage\" in shader config file \"%s\" is invalid or missing!", i, j, shader.wcstr()), MRN_DEBUG_INFO);
+                continue;
+            }
+
+            descriptorSets[i].push_back(binding);
         }
     }
-    
-    makePipelineLayout:
-
-    VkPipelineLayoutCreateInfo vplci;
-    vplci.sType                                 = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-    vplci.pNext                                 = nullptr;
-    vplci.flags                                 = 0;
-    vplci.setLayoutCount                        = static_cast<uint32_t>(m_descriptorLayouts.size());
-    vplci.pSetLayouts                           = m_descriptorLayouts.data();
-    vplci.pushConstantRangeCount                = 0;
-    vplci.pPushConstantRanges                   = nullptr;
-
-    assert_vulkan(m_logfile, vkCreatePipelineLayout(m_context->m_device, &vplci, nullptr, &m_layout), L"vkCreatePipelineLayout() failed", MRN_DEBUG_INFO);
+}
+
+void moraine::ShaderDescription_IVulkan::readBinary(Allocation file, Stringr shader, Logfile logfile)
+{
+    const uint8_t* data = file.allocation.get();
+    size_t offset = 0;
+
+    // Returns the next count values of the file and moves behind them
+    auto read = [&](size_t size, size_t count) -> const uint8_t*
+    {
+        assert(logfile, offset + size * count <= file.size, sprintf(L"Shader binary \"%s\" is truncated!", shader.wcstr()), MRN_DEBUG_INFO);
+
+        const uint8_t* values = data + offset;
+        offset += size * count;
+        return values;
+    };
+
+    BinaryHeader header;
+    memcpy(&header, read(sizeof(BinaryHeader), 1), sizeof(BinaryHeader));
+
+    assert(logfile, header.version == s_binaryVersion, sprintf(L"Shader binary \"%s\" has version %d, but version %d is required! Compile it again", shader.wcstr(), header.version, s_binaryVersion), MRN_DEBUG_INFO);
+
+    auto binaryStages = reinterpret_cast<const BinaryStage*>(read(sizeof(BinaryStage), header.stageCount));
+    auto bindings = reinterpret_cast<const VkVertexInputBindingDescription*>(read(sizeof(VkVertexInputBindingDescription), header.vertexBindingCount));
+    auto attributes = reinterpret_cast<const VkVertexInputAttributeDescription*>(read(sizeof(VkVertexInputAttributeDescription), header.vertexAttributeCount));
+    auto setBindingCounts = reinterpret_cast<const uint32_t*>(read(sizeof(uint32_t), header.setCount));
+
+    vertexBindings.assign(bindings, bindings + header.vertexBindingCount);
+    vertexAttributes.assign(attributes, attributes + header.vertexAttributeCount);
+    instanceSlotBinding = header.instanceSlotBinding;
+    topology = static_cast<VkPrimitiveTopology>(header.topology);
+    polygonMode = static_cast<VkPolygonMode>(header.polygonMode);
+    cullMode = header.cullMode;
+    lineWidth = header.lineWidth;
+    minSampleShading = header.minSampleShading;
+    depthTest = header.depthTest;
+    blending = header.blending;
+    bindlessSet = header.bindlessSet;
+
+    descriptorSets.resize(header.setCount);
+
+    for (uint32_t i = 0; i < header.setCount; ++i)
+    {
+        auto binaryBindings = reinterpret_cast<const BinaryDescriptorBinding*>(read(sizeof(BinaryDescriptorBinding), setBindingCounts[i]));
+
+        for (uint32_t j = 0; j < setBindingCounts[i]; ++j)
+            descriptorSets[i].push_back({ binaryBindings[j].binding, static_cast<VkDescriptorType>(binaryBindings[j].descriptorType), binaryBindings[j].descriptorCount,
+                                          binaryBindings[j].stageFlags, nullptr });
+    }
+
+    // The code stays in the file, which the description keeps
+    for (uint32_t i = 0; i < header.stageCount; ++i)
+    {
+        assert(logfile, binaryStages[i].codeOffset % 4 == 0 and binaryStages[i].codeOffset + static_cast<size_t>(binaryStages[i].codeSize) <= file.size,
+               sprintf(L"Shader binary \"%s\" is truncated!", shader.wcstr()), MRN_DEBUG_INFO);
+
+        stages.push_back({ static_cast<VkShaderStageFlagBits>(binaryStages[i].stage), String(), reinterpret_cast<const uint32_t*>(data + binaryStages[i].codeOffset), binaryStages[i].codeSize });
+    }
+
+    files.push_back(std::move(file));
 }
 
 
-VkFormat moraine::Shader_IVulkan::stringToVkFormat(const char* string)
+VkFormat moraine::ShaderDescription_IVulkan::stringToVkFormat(const char* string)
 {
+    // Quantized formats, see VertexAttributeFormat
+    if (strcmp(string, "snorm16x2") == 0)   return VK_FORMAT_R16G16_SNORM;
+    if (strcmp(string, "snorm16x4") == 0)   return VK_FORMAT_R16G16B16A16_SNORM;
+    if (strcmp(string, "unorm16x2") == 0)   return VK_FORMAT_R16G16_UNORM;
+    if (strcmp(string, "unorm16x4") == 0)   return VK_FORMAT_R16G16B16A16_UNORM;
+    if (strcmp(string, "half2") == 0)       return VK_FORMAT_R16G16_SFLOAT;
+    if (strcmp(string, "half4") == 0)       return VK_FORMAT_R16G16B16A16_SFLOAT;
+
     if (strncmp(string, "int", 3) == 0)
     {
         if (string[3] == '\0')
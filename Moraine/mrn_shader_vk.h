@@ -7,27 +7,128 @@
 
 namespace moraine
 {
+    // A shader config with every string resolved, read from a JSON config and its SPIR-V files or from a shader binary (see compileShaderBinary())
+    struct ShaderDescription_IVulkan
+    {
+        struct Stage
+        {
+            VkShaderStageFlagBits   stage;
+            String                  path;       // SPIR-V file of a JSON config, empty once the code is loaded
+            const uint32_t*         code;       // Points into files
+            size_t                  codeSize;   // Bytes
+        };
+
+        std::vector<Allocation>                                 files; // The shader binary, or the SPIR-V files of a JSON config
+        std::vector<Stage>                                      stages;
+        std::vector<VkVertexInputBindingDescription>            vertexBindings;
+        std::vector<VkVertexInputAttributeDescription>          vertexAttributes;
+        uint32_t                                                instanceSlotBinding = UINT32_MAX; // See Shader_IVulkan::m_instanceSlotBinding
+        std::vector<std::vector<VkDescriptorSetLayoutBinding>>  descriptorSets;
+        uint32_t                                                bindlessSet = UINT32_MAX; // See Shader_IVulkan::m_bindlessSet
+        VkPrimitiveTopology                                     topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+        VkPolygonMode                                           polygonMode = VK_POLYGON_MODE_FILL;
+        VkCullModeFlags                                         cullMode = VK_CULL_MODE_BACK_BIT;
+        float                                                   lineWidth = 5.0f;
+        float                                                   minSampleShading = 0.0f; // Sample shading is enabled above 0
+        VkBool32                                                depthTest = VK_FALSE;
+        VkBool32                                                blending = VK_FALSE;
+
+        // Reads a shader binary if the file starts with its magic number and parses a JSON config otherwise. The SPIR-V files of a config are read by loadStageCode()
+        void load(Stringr shader, Logfile logfile);
+        void loadStageCode(Logfile logfile);
+
+        bool writeBinary(Stringr path, Logfile logfile);
+
+    private:
+
+        // Everything is 4 byte aligned and little endian. The header is followed by stageCount BinaryStages, the vertex bindings and attributes as
+        // Vulkan structures, setCount binding counts, one BinaryDescriptorBinding per binding of all sets and the SPIR-V code of the stages
+        struct BinaryHeader
+        {
+            uint32_t    magic;
+            uint32_t    version;
+            uint32_t    stageCount;
+            uint32_t    vertexBindingCount;
+            uint32_t    vertexAttributeCount;
+            uint32_t    instanceSlotBinding;
+            uint32_t    setCount;
+            uint32_t    topology;
+            uint32_t    polygonMode;
+            uint32_t    cullMode;
+            float       lineWidth;
+            float       minSampleShading;
+            uint32_t    depthTest;
+            uint32_t    blending;
+            uint32_t    bindlessSet;
+        };
+
+        struct BinaryStage
+        {
+            uint32_t    stage;
+            uint32_t    codeOffset; // From the start of the file
+            uint32_t    codeSize;
+        };
+
+        struct BinaryDescriptorBinding
+        {
+            uint32_t    binding;
+            uint32_t    descriptorType;
+            uint32_t    descriptorCount;
+            uint32_t    stageFlags;
+        };
+
+        static constexpr uint32_t s_binaryMagic = 0x534e524d; // "MRNS"
+        static constexpr uint32_t s_binaryVersion = 2;
+
+        void parseConfig(const Allocation& file, Stringr shader, Logfile logfile);
+        void parseVertexBindings(const Json::Value& config, Stringr shader, Logfile logfile);
+        void parseDescriptorBindings(const Json::Value& config, Stringr shader, Logfile logfile);
+        void readBinary(Allocation file, Stringr shader, Logfile logfile);
+
+        static VkFormat stringToVkFormat(const char* string);
+    };
+
     class Shader_IVulkan : public Shader_T
     {
     public:
 
-        Shader_IVulkan(String shader, GraphicsContext context);
+        // Asynchronous shaders only read the config and create the layouts, the pipeline is created by compileAsync()
+        Shader_IVulkan(String shader, GraphicsContext context, bool async, std::shared_ptr<Shader_IVulkan> fallback);
         ~Shader_IVulkan() override;
 
-        void bind(VkCommandBuffer buffer);
+        static void compileAsync(std::shared_ptr<Shader_IVulkan> shader, ShaderReadyCallback readyCallback);
 
-        void compileShaderStage(Stringr path, std::vector<VkPipelineShaderStageCreateInfo>& outStage, std::vector<VkShaderModule>& outModule, VkShaderStageFlagBits stage);
+        bool isReady() const override { return m_ready; }
 
-        void createVertexInputState(Json::Value& jsonfile, std::vector<VkVertexInputBindingDescription>& bindings, std::vector<VkVertexInputAttributeDescription>& attributes, Stringr fileName);
-        void createPipelineLayout(Json::Value& jsonfile, Stringr fileName);
+        // The shader objects with this shader are drawn with, nullptr while neither it nor its fallback is ready
+        Shader_IVulkan* getDrawShader() { return m_ready ? this : (m_fallback and m_fallback->m_ready ? m_fallback.get() : nullptr); }
 
-        VkFormat stringToVkFormat(const char* string);
+        void bind(VkCommandBuffer buffer);
 
+        void createPipeline(Time start, bool onWorker);
+        void createPipelineLayout();
+
+        // Vulkan objects come from the context's ShaderObjectCache_IVulkan, shaders with identical contents share them
         std::shared_ptr<GraphicsContext_IVulkan>        m_context;
         Logfile                                         m_logfile;
+        String                                          m_path;
+        ShaderDescription_IVulkan                       m_description; // Cleared once the pipeline is created
+        std::vector<VkShaderModule>                     m_shaderModules; // Kept while the pipeline exists, its cache entry refers to them
         VkPipeline                                      m_pipeline;
         std::vector<VkDescriptorSetLayout>              m_descriptorLayouts;
-        std::vector<std::vector<VkDescriptorPoolSize>>  m_desriptorPoolSizes;
+        std::vector<std::vector<VkDescriptorSetLayoutBinding>> m_descriptorBindings; // [set], the descriptor allocator creates pools and update templates from them
         VkPipelineLayout                                m_layout;
+        std::vector<std::vector<VkDescriptorType>>      m_descriptorTypes; // [set][binding]
+
+        // Vertex binding with "instanceSlots": true, UINT32_MAX if there is none. Objects that share their GraphicsParameters are merged into
+        // one instanced draw, a uint attribute of this binding holds the offset of each instance's constant array element in 16 byte units
+        uint32_t                                        m_instanceSlotBinding;
+
+        // Set with "bindlessSet", UINT32_MAX if there is none. Its layout is the one of the context's BindlessTable_IVulkan, the renderer binds the table there
+        // and constant sets can't be created for it. Shaders read binding 0 as "sampler2D textures[]" and binding 1 as an array of storage buffers
+        uint32_t                                        m_bindlessSet;
+
+        bool                                            m_ready; // Only written by the thread that ticks the renderer, after the pipeline was created
+        std::shared_ptr<Shader_IVulkan>                 m_fallback;
     };
-}
\ No newline at end of file
+}
@@ -0,0 +1,335 @@
+#include "mrn_core.h"
+#include "mrn_shadercache_vk.h"
+#include "mrn_descriptors_vk.h"
+
+namespace
+{
+    // Descriptions are the raw bytes of the values, appended field by field so no padding ends up in them
+    template<typename T>
+    void append(std::string& description, const T& value)
+    {
+        description.append(reinterpret_cast<const char*>(&value), sizeof(T));
+    }
+
+    template<typename T>
+    void appendArray(std::string& description, const T* values, uint32_t count)
+    {
+        append(description, count);
+
+        if (count > 0)
+            description.append(reinterpret_cast<const char*>(values), sizeof(T) * count);
+    }
+
+    void appendString(std::string& description, const char* string)
+    {
+        description.append(string, strlen(string) + 1);
+    }
+}
+
+moraine::ShaderObjectCache_IVulkan::ShaderObjectCache_IVulkan(GraphicsContext_IVulkan* context) :
+    m_context(context)
+{
+}
+
+moraine::ShaderObjectCache_IVulkan::~ShaderObjectCache_IVulkan()
+{
+    // Shaders keep the context alive, so objects are only left here if a release is missing
+    size_t leaked = m_pipelines.objects.size() + m_pipelineLayouts.objects.size() + m_descriptorSetLayouts.objects.size() + m_shaderModules.objects.size();
+
+    if (leaked > 0)
+        m_context->getLogfile()->print(YELLOW, sprintf(L"%d shader objects were never released!", static_cast<uint32_t>(leaked)), MRN_DEBUG_INFO);
+
+    for (const auto& a : m_pipelines.objects)
+        vkDestroyPipeline(m_context->m_device, a.second.object, nullptr);
+
+    for (const auto& a : m_pipelineLayouts.objects)
+        vkDestroyPipelineLayout(m_context->m_device, a.second.object, nullptr);
+
+    for (const auto& a : m_descriptorSetLayouts.objects)
+        vkDestroyDescriptorSetLayout(m_context->m_device, a.second.object, nullptr);
+
+    for (const auto& a : m_shaderModules.objects)
+        vkDestroyShaderModule(m_context->m_device, a.second.object, nullptr);
+}
+
+template<typename T, typename CreateFunction, typename DestroyFunction>
+T moraine::ShaderObjectCache_IVulkan::acquire(ObjectMap<T>& map, std::string&& description, CreateFunction create, DestroyFunction destroy, bool* out_created)
+{
+    if (out_created)
+        *out_created = false;
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        auto entry = map.objects.find(description);
+
+        if (entry != map.objects.end())
+        {
+            ++entry->second.references;
+            return entry->second.object;
+        }
+    }
+
+    // Pipelines take milliseconds to compile, other threads can look up their objects in the meantime
+    T object = create();
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    auto entry = map.objects.emplace(std::move(description), typename ObjectMap<T>::Entry{ object, 1 });
+
+    if (not entry.second)
+    {
+        destroy(object);
+        ++entry.first->second.references;
+        return entry.first->second.object;
+    }
+
+    map.descriptions[object] = &entry.first->first;
+
+    if (out_created)
+        *out_created = true;
+
+    return object;
+}
+
+template<typename T, typename DestroyFunction>
+void moraine::ShaderObjectCache_IVulkan::release(ObjectMap<T>& map, T object, DestroyFunction destroy)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    auto description = map.descriptions.find(object);
+
+    assert(m_context->getLogfile(), description != map.descriptions.end(), L"Wrong API Usage: A shader object was released that isn't in the cache!", MRN_DEBUG_INFO);
+
+    auto entry = map.objects.find(*description->second);
+
+    if (--entry->second.references > 0)
+        return;
+
+    destroy(object);
+    map.descriptions.erase(description);
+    map.objects.erase(entry);
+}
+
+VkShaderModule moraine::ShaderObjectCache_IVulkan::acquireShaderModule(const uint32_t* code, size_t codeSize, bool* out_created)
+{
+    std::string description(reinterpret_cast<const char*>(code), codeSize);
+
+    return acquire(m_shaderModules, std::move(description), [this, code, codeSize]()
+    {
+        VkShaderModuleCreateInfo vsmci;
+        vsmci.sType             = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+        vsmci.pNext             = nullptr;
+        vsmci.flags             = 0;
+        vsmci.codeSize          = codeSize;
+        vsmci.pCode             = code;
+
+        VkShaderModule module;
+
+        assert_vulkan(m_context->getLogfile(), vkCreateShaderModule(m_context->m_device, &vsmci, nullptr, &module), L"vkCreateShaderModule() failed", MRN_DEBUG_INFO);
+
+        return module;
+    },
+    [this](VkShaderModule module) { vkDestroyShaderModule(m_context->m_device, module, nullptr); }, out_created);
+}
+
+VkDescriptorSetLayout moraine::ShaderObjectCache_IVulkan::acquireDescriptorSetLayout(const std::vector<VkDescriptorSetLayoutBinding>& bindings, bool* out_created)
+{
+    std::string description;
+
+    for (const auto& a : bindings)
+    {
+        assert(m_context->getLogfile(), a.pImmutableSamplers == nullptr, L"Wrong API Usage: Descriptor set layouts with immutable samplers can't be cached!", MRN_DEBUG_INFO);
+
+        append(description, a.binding);
+        append(description, a.descriptorType);
+        append(description, a.descriptorCount);
+        append(description, a.stageFlags);
+    }
+
+    return acquire(m_descriptorSetLayouts, std::move(description), [this, &bindings]()
+    {
+        VkDescriptorSetLayoutCreateInfo vdslci;
+        vdslci.sType                            = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+        vdslci.pNext                            = nullptr;
+        vdslci.flags                            = 0;
+        vdslci.bindingCount                     = static_cast<uint32_t>(bindings.size());
+        vdslci.pBindings                        = bindings.data();
+
+        VkDescriptorSetLayout layout;
+
+        assert_vulkan(m_context->getLogfile(), vkCreateDescriptorSetLayout(m_context->m_device, &vdslci, nullptr, &layout), L"vkCreateDescriptorSetLayout() failed", MRN_DEBUG_INFO);
+
+        return layout;
+    },
+    [this](VkDescriptorSetLayout layout) { vkDestroyDescriptorSetLayout(m_context->m_device, layout, nullptr); }, out_created);
+}
+
+VkPipelineLayout moraine::ShaderObjectCache_IVulkan::acquirePipelineLayout(const std::vector<VkDescriptorSetLayout>& setLayouts, bool* out_created)
+{
+    // Set layouts come from the cache, so equal handles mean equal layouts
+    std::string description;
+    appendArray(description, setLayouts.data(), static_cast<uint32_t>(setLayouts.size()));
+
+    return acquire(m_pipelineLayouts, std::move(description), [this, &setLayouts]()
+    {
+        VkPipelineLayoutCreateInfo vplci;
+        vplci.sType                             = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+        vplci.pNext                             = nullptr;
+        vplci.flags                             = 0;
+        vplci.setLayoutCount                    = static_cast<uint32_t>(setLayouts.size());
+        vplci.pSetLayouts                       = setLayouts.data();
+        vplci.pushConstantRangeCount            = 0;
+        vplci.pPushConstantRanges               = nullptr;
+
+        VkPipelineLayout layout;
+
+        assert_vulkan(m_context->getLogfile(), vkCreatePipelineLayout(m_context->m_device, &vplci, nullptr, &layout), L"vkCreatePipelineLayout() failed", MRN_DEBUG_INFO);
+
+        return layout;
+    },
+    [this](VkPipelineLayout layout) { vkDestroyPipelineLayout(m_context->m_device, layout, nullptr); }, out_created);
+}
+
+VkPipeline moraine::ShaderObjectCache_IVulkan::acquireGraphicsPipeline(const VkGraphicsPipelineCreateInfo& vgpci, bool* out_created)
+{
+    return acquire(m_pipelines, describePipeline(vgpci), [this, &vgpci]()
+    {
+        VkPipeline pipeline;
+
+        assert_vulkan(m_context->getLogfile(), vkCreateGraphicsPipelines(m_context->m_device, m_context->m_pipelineCache, 1, &vgpci, nullptr, &pipeline), L"vkCreateGraphicsPipelines() failed", MRN_DEBUG_INFO);
+
+        m_context->m_pipelineCacheDirty = true;
+
+        return pipeline;
+    },
+    [this](VkPipeline pipeline) { vkDestroyPipeline(m_context->m_device, pipeline, nullptr); }, out_created);
+}
+
+void moraine::ShaderObjectCache_IVulkan::releaseShaderModule(VkShaderModule module)
+{
+    release(m_shaderModules, module, [this](VkShaderModule module) { vkDestroyShaderModule(m_context->m_device, module, nullptr); });
+}
+
+void moraine::ShaderObjectCache_IVulkan::releaseDescriptorSetLayout(VkDescriptorSetLayout layout)
+{
+    release(m_descriptorSetLayouts, layout, [this](VkDescriptorSetLayout layout)
+    {
+        m_context->m_descriptorAllocator->releaseLayout(layout);
+        vkDestroyDescriptorSetLayout(m_context->m_device, layout, nullptr);
+    });
+}
+
+void moraine::ShaderObjectCache_IVulkan::releasePipelineLayout(VkPipelineLayout layout)
+{
+    release(m_pipelineLayouts, layout, [this](VkPipelineLayout layout) { vkDestroyPipelineLayout(m_context->m_device, layout, nullptr); });
+}
+
+void moraine::ShaderObjectCache_IVulkan::releasePipeline(VkPipeline pipeline)
+{
+    release(m_pipelines, pipeline, [this](VkPipeline pipeline) { vkDestroyPipeline(m_context->m_device, pipeline, nullptr); });
+}
+
+std::string moraine::ShaderObjectCache_IVulkan::describePipeline(const VkGraphicsPipelineCreateInfo& vgpci)
+{
+    // Every state the create info points to, structure types and pNext chains are left out, extension structures aren't supported
+    assert(m_context->getLogfile(), vgpci.pNext == nullptr and vgpci.basePipelineHandle == VK_NULL_HANDLE, L"Wrong API Usage: Derived pipelines and extension structures can't be cached!", MRN_DEBUG_INFO);
+
+    std::string description;
+    description.reserve(512);
+
+    append(description, vgpci.flags);
+    append(description, vgpci.stageCount);
+
+    for (uint32_t i = 0; i < vgpci.stageCount; ++i)
+    {
+        const VkPipelineShaderStageCreateInfo& stage = vgpci.pStages[i];
+
+        assert(m_context->getLogfile(), stage.pSpecializationInfo == nullptr, L"Wrong API Usage: Pipelines with specialization constants can't be cached!", MRN_DEBUG_INFO);
+
+        append(description, stage.flags);
+        append(description, stage.stage);
+        append(description, stage.module); // Modules come from the cache, equal handles mean equal code
+        appendString(description, stage.pName);
+    }
+
+    const VkPipelineVertexInputStateCreateInfo* vi = vgpci.pVertexInputState;
+    append(description, vi->vertexBindingDescriptionCount);
+
+    for (uint32_t i = 0; i < vi->vertexBindingDescriptionCount; ++i)
+    {
+        append(description, vi->pVertexBindingDescriptions[i].binding);
+        append(description, vi->pVertexBindingDescriptions[i].stride);
+        append(description, vi->pVertexBindingDescriptions[i].inputRate);
+    }
+
+    append(description, vi->vertexAttributeDescriptionCount);
+
+    for (uint32_t i = 0; i < vi->vertexAttributeDescriptionCount; ++i)
+    {
+        append(description, vi->pVertexAttributeDescriptions[i].location);
+        append(description, vi->pVertexAttributeDescriptions[i].binding);
+        append(description, vi->pVertexAttributeDescriptions[i].format);
+        append(description, vi->pVertexAttributeDescriptions[i].offset);
+    }
+
+    append(description, vgpci.pInputAssemblyState->topology);
+    append(description, vgpci.pInputAssemblyState->primitiveRestartEnable);
+
+    append(description, vgpci.pTessellationState ? vgpci.pTessellationState->patchControlPoints : 0u);
+
+    appendArray(description, vgpci.pViewportState->pViewports, vgpci.pViewportState->pViewports ? vgpci.pViewportState->viewportCount : 0);
+    appendArray(description, vgpci.pViewportState->pScissors, vgpci.pViewportState->pScissors ? vgpci.pViewportState->scissorCount : 0);
+    append(description, vgpci.pViewportState->viewportCount);
+    append(description, vgpci.pViewportState->scissorCount);
+
+    const VkPipelineRasterizationStateCreateInfo* rz = vgpci.pRasterizationState;
+    append(description, rz->depthClampEnable);
+    append(description, rz->rasterizerDiscardEnable);
+    append(description, rz->polygonMode);
+    append(description, rz->cullMode);
+    append(description, rz->frontFace);
+    append(description, rz->depthBiasEnable);
+    append(description, rz->depthBiasConstantFactor);
+    append(description, rz->depthBiasClamp);
+    append(description, rz->depthBiasSlopeFactor);
+    append(description, rz->lineWidth);
+
+    const VkPipelineMultisampleStateCreateInfo* ms = vgpci.pMultisampleState;
+    assert(m_context->getLogfile(), ms->pSampleMask == nullptr, L"Wrong API Usage: Pipelines with a sample mask can't be cached!", MRN_DEBUG_INFO);
+    append(description, ms->rasterizationSamples);
+    append(description, ms->sampleShadingEnable);
+    append(description, ms->minSampleShading);
+    append(description, ms->alphaToCoverageEnable);
+    append(description, ms->alphaToOneEnable);
+
+    append(description, vgpci.pDepthStencilState != nullptr);
+
+    if (vgpci.pDepthStencilState)
+    {
+        const VkPipelineDepthStencilStateCreateInfo* ds = vgpci.pDepthStencilState;
+        append(description, ds->depthTestEnable);
+        append(description, ds->depthWriteEnable);
+        append(description, ds->depthCompareOp);
+        append(description, ds->depthBoundsTestEnable);
+        append(description, ds->stencilTestEnable);
+        append(description, ds->front); // VkStencilOpState only holds 32 bit values
+        append(description, ds->back);
+        append(description, ds->minDepthBounds);
+        append(description, ds->maxDepthBounds);
+    }
+
+    const VkPipelineColorBlendStateCreateInfo* cb = vgpci.pColorBlendState;
+    append(description, cb->logicOpEnable);
+    append(description, cb->logicOp);
+    appendArray(description, cb->pAttachments, cb->attachmentCount); // Only 32 bit values as well
+    append(description, cb->blendConstants);
+
+    appendArray(description, vgpci.pDynamicState ? vgpci.pDynamicState->pDynamicStates : nullptr, vgpci.pDynamicState ? vgpci.pDynamicState->dynamicStateCount : 0);
+
+    append(description, vgpci.layout); // From the cache as well
+    append(description, vgpci.renderPass);
+    append(description, vgpci.subpass);
+
+    return description;
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include "mrn_gfxcontext_vk.h"
+
+#include <mutex>
+#include <unordered_map>
+
+namespace moraine
+{
+    // Shader modules, descriptor set layouts, pipeline layouts and pipelines shared by all shaders of a context. Objects are found by the hash
+    // of their description (SPIR-V code, bindings, layouts or the full pipeline state) and compared byte by byte, so identical requests return
+    // the same handle. Every acquire is paired with a release of the handle, the object is destroyed with its last reference
+    class ShaderObjectCache_IVulkan
+    {
+    public:
+
+        ShaderObjectCache_IVulkan(GraphicsContext_IVulkan* context);
+        ~ShaderObjectCache_IVulkan();
+
+        ShaderObjectCache_IVulkan(const ShaderObjectCache_IVulkan&) = delete;
+        ShaderObjectCache_IVulkan& operator=(const ShaderObjectCache_IVulkan&) = delete;
+
+        // out_created is set to false if an existing object was returned
+        VkShaderModule acquireShaderModule(const uint32_t* code, size_t codeSize, bool* out_created = nullptr);
+        VkDescriptorSetLayout acquireDescriptorSetLayout(const std::vector<VkDescriptorSetLayoutBinding>& bindings, bool* out_created = nullptr);
+        VkPipelineLayout acquirePipelineLayout(const std::vector<VkDescriptorSetLayout>& setLayouts, bool* out_created = nullptr);
+        VkPipeline acquireGraphicsPipeline(const VkGraphicsPipelineCreateInfo& vgpci, bool* out_created = nullptr); // The stages' modules and the layout have to come from the cache
+
+        void releaseShaderModule(VkShaderModule module);
+        void releaseDescriptorSetLayout(VkDescriptorSetLayout layout);
+        void releasePipelineLayout(VkPipelineLayout layout);
+        void releasePipeline(VkPipeline pipeline);
+
+    private:
+
+        template<typename T>
+        struct ObjectMap
+        {
+            struct Entry
+            {
+                T           object;
+                uint32_t    references;
+            };
+
+            std::unordered_map<std::string, Entry>      objects;        // By description
+            std::unordered_map<T, const std::string*>   descriptions;   // Key of each object in objects, nodes don't move on rehash
+        };
+
+        // Objects are created without holding the lock, if two threads create the same object the later one is destroyed again
+        template<typename T, typename CreateFunction, typename DestroyFunction>
+        T acquire(ObjectMap<T>& map, std::string&& description, CreateFunction create, DestroyFunction destroy, bool* out_created);
+
+        template<typename T, typename DestroyFunction>
+        void release(ObjectMap<T>& map, T object, DestroyFunction destroy);
+
+        std::string describePipeline(const VkGraphicsPipelineCreateInfo& vgpci);
+
+        GraphicsContext_IVulkan*                m_context;
+        std::mutex                              m_mutex;
+        ObjectMap<VkShaderModule>               m_shaderModules;
+        ObjectMap<VkDescriptorSetLayout>        m_descriptorSetLayouts;
+        ObjectMap<VkPipelineLayout>             m_pipelineLayouts;
+        ObjectMap<VkPipeline>                   m_pipelines;
+    };
+}
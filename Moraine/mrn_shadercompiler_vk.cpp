@@ -0,0 +1,125 @@
+#include "mrn_core.h"
+#include "mrn_shadercompiler_vk.h"
+
+moraine::ShaderCompiler_IVulkan::ShaderCompiler_IVulkan() :
+    m_runningJobs(0),
+    m_shutdown(false)
+{
+}
+
+moraine::ShaderCompiler_IVulkan::~ShaderCompiler_IVulkan()
+{
+    cancel();
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_shutdown = true;
+    }
+
+    m_wakeCondition.notify_all();
+
+    for (auto& a : m_threads)
+        a.join();
+}
+
+void moraine::ShaderCompiler_IVulkan::enqueue(std::function<void()> compileFunction, std::function<void()> readyFunction)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        // Half of the cores, the other half records command buffers and runs the application
+        if (m_threads.empty())
+        {
+            uint32_t workerCount = clamp(1u, std::thread::hardware_concurrency() / 2, 4u);
+
+            for (uint32_t i = 0; i < workerCount; ++i)
+                m_threads.emplace_back(&ShaderCompiler_IVulkan::workerMain, this);
+        }
+
+        m_queuedJobs.push_back({ std::move(compileFunction), std::move(readyFunction), nullptr });
+    }
+
+    m_wakeCondition.notify_one();
+}
+
+uint32_t moraine::ShaderCompiler_IVulkan::deliverCompletedJobs()
+{
+    std::vector<Job> jobs;
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        jobs.swap(m_completedJobs);
+    }
+
+    // The other jobs are still delivered if one failed, only the first exception is rethrown
+    std::exception_ptr exception;
+
+    for (auto& a : jobs)
+    {
+        if (a.exception)
+        {
+            if (not exception)
+                exception = a.exception;
+        }
+        else if (a.readyFunction)
+            a.readyFunction();
+    }
+
+    if (exception)
+        std::rethrow_exception(exception);
+
+    return static_cast<uint32_t>(jobs.size());
+}
+
+void moraine::ShaderCompiler_IVulkan::cancel()
+{
+    std::deque<Job> queuedJobs;
+    std::vector<Job> completedJobs;
+
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        queuedJobs.swap(m_queuedJobs);
+        m_idleCondition.wait(lock, [this] { return m_runningJobs == 0; });
+        completedJobs.swap(m_completedJobs);
+    }
+
+    // Destroyed outside of the lock, the shaders the jobs hold release their objects from the shader object cache
+}
+
+void moraine::ShaderCompiler_IVulkan::workerMain()
+{
+    while (true)
+    {
+        Job job;
+
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_wakeCondition.wait(lock, [this] { return m_shutdown or not m_queuedJobs.empty(); });
+
+            if (m_shutdown)
+                return;
+
+            job = std::move(m_queuedJobs.front());
+            m_queuedJobs.pop_front();
+            ++m_runningJobs;
+        }
+
+        try
+        {
+            job.compileFunction();
+        }
+        catch (...)
+        {
+            job.exception = std::current_exception();
+        }
+
+        // The functions are destroyed by the delivering thread, the last reference to a shader they hold could destroy the context
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_completedJobs.push_back(std::move(job));
+
+            if (--m_runningJobs == 0)
+                m_idleCondition.notify_all();
+        }
+    }
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include "mrn_gfxcontext_vk.h"
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+
+namespace moraine
+{
+    // Compiles pipelines in the background, so new content doesn't stall the frame that creates it. Jobs run on worker threads in the order they were
+    // enqueued, their ready functions are called by the renderer on the thread that ticks it. The workers are started with the first job
+    class ShaderCompiler_IVulkan
+    {
+    public:
+
+        ShaderCompiler_IVulkan();
+        ~ShaderCompiler_IVulkan();
+
+        ShaderCompiler_IVulkan(const ShaderCompiler_IVulkan&) = delete;
+        ShaderCompiler_IVulkan& operator=(const ShaderCompiler_IVulkan&) = delete;
+
+        // compileFunction runs on a worker, readyFunction on the thread that calls deliverCompletedJobs() after compileFunction returned
+        void enqueue(std::function<void()> compileFunction, std::function<void()> readyFunction);
+
+        // Calls the ready functions of the finished jobs, the first exception of a compile function is rethrown once all others were delivered.
+        // Returns the number of delivered jobs
+        uint32_t deliverCompletedJobs();
+
+        // Drops jobs that haven't started and waits for the running ones, no ready function is called. Jobs keep their shaders alive,
+        // which keep the context alive, so the renderer cancels them when it is destroyed
+        void cancel();
+
+    private:
+
+        struct Job
+        {
+            std::function<void()>   compileFunction;
+            std::function<void()>   readyFunction;
+            std::exception_ptr      exception;
+        };
+
+        void workerMain();
+
+        std::vector<std::thread>                m_threads;
+
+        std::mutex                              m_mutex;
+        std::condition_variable                 m_wakeCondition;
+        std::condition_variable                 m_idleCondition;
+        std::deque<Job>                         m_queuedJobs;
+        std::vector<Job>                        m_completedJobs;
+        uint32_t                                m_runningJobs;
+        bool                                    m_shutdown;
+    };
+}
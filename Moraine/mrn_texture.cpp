@@ -52,7 +52,7 @@ namespace moraine
 
     void* TextureAtlas_I::allocateImageSpace(uint32_t width, uint32_t height, RectangleU* out_location)
     {
-        void* allocation = m_context->m_stagingStack->alloc(width * height * m_channels, 4);
+        StagingAllocation allocation = m_context->m_stagingRing->alloc(width * height * m_channels, 16);
 
         if (m_rows.empty()) // Create row if no row exists
         {
@@ -62,7 +62,7 @@ namespace moraine
             if (out_location)
                 *out_location = RectangleU(0, 0, width, height);
 
-            return allocation;
+            return allocation.data;
         }
 
         for (auto& a : m_rows)
@@ -74,7 +74,7 @@ namespace moraine
                     *out_location = RectangleU(a.width, a.yOffset, width, height);
 
                 a.width += width;
-                return allocation;
+                return allocation.data;
             }
 
         extend_or_create_rows:
@@ -90,7 +90,7 @@ namespace moraine
                 *out_location = RectangleU(a.width, a.yOffset, width, height);
 
             a.width += width;
-            return allocation;
+            return allocation.data;
         }
 
         uint32_t yOffset = a.yOffset + a.height;
@@ -103,7 +103,7 @@ namespace moraine
             if (out_location)
                 *out_location = RectangleU(0, yOffset, width, height);
 
-            return allocation;
+            return allocation.data;
         }
 
         for (auto& a : m_rows)
@@ -115,7 +115,7 @@ namespace moraine
                     *out_location = RectangleU(a.width, a.yOffset, width, height);
 
                 a.width += width;
-                return allocation;
+                return allocation.data;
             }
 
         m_texture->resize(m_texture->getWidth(), m_texture->getHeight() * 2);
@@ -20,7 +20,7 @@ namespace moraine
 
     struct CopySubImage
     {
-        void* stagingStackLocation;
+        StagingAllocation stagingAllocation;
         RectangleU imageLocation;
     };
 
@@ -43,6 +43,11 @@ namespace moraine
 
         virtual void copyBufferRegionsToTexture(std::vector<CopySubImage>& regions, std::function<void()> operationOnComplete) = 0;
 
+        virtual UploadTicket getUploadTicket() const = 0;
+
+        // Index of the texture in the bindless table's texture array, UINT32_MAX unless the context was created with GraphicsContextDesc::bindless
+        virtual uint32_t getBindlessIndex() const = 0;
+
     protected:
 
         uint32_t m_width;
@@ -1,6 +1,7 @@
 #include "mrn_core.h"
 #include "mrn_texture_vk.h"
 #include "mrn_buffer_vk.h"
+#include "mrn_descriptors_vk.h"
 
 #include <stb_image.h>
 
@@ -12,7 +13,9 @@ moraine::Texture_IVulkan::Texture_IVulkan(GraphicsContext context, Stringr image
     Texture_T(0, 0),
     m_context(std::static_pointer_cast<GraphicsContext_IVulkan>(context)),
     m_format(VK_FORMAT_R8G8B8A8_UNORM),
-    m_textureFlags(textureFlags)
+    m_textureFlags(textureFlags),
+    m_uploadTicket(0),
+    m_bindlessIndex(UINT32_MAX)
 {
     int width, height, channelCount;
     void* data = stbi_load(imagePath.mbstr(), &width, &height, &channelCount, STBI_rgb_alpha);
@@ -22,16 +25,12 @@ moraine::Texture_IVulkan::Texture_IVulkan(GraphicsContext context, Stringr image
     m_width = static_cast<uint32_t>(width);
     m_height = static_cast<uint32_t>(height);
 
-    VkBuffer stagingBuffer;
-    VmaAllocation stagingAllocation;
-    void* stagingPointer;
+    auto stagingRing = std::static_pointer_cast<StagingRing_IVulkan>(m_context->m_stagingRing);
 
     size_t stagingBufferSize = width * height * STBI_rgb_alpha * sizeof(uint8_t);
+    StagingAllocation staging = stagingRing->alloc(stagingBufferSize, 16);
 
-    m_context->createVulkanBuffer(stagingBufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VMA_MEMORY_USAGE_CPU_ONLY,
-                                  &stagingBuffer, &stagingAllocation, &stagingPointer);
-
-    memcpy_s(stagingPointer, stagingBufferSize, data, stagingBufferSize);
+    memcpy_s(staging.data, stagingBufferSize, data, stagingBufferSize);
 
     stbi_image_free(data);
 
@@ -43,7 +42,17 @@ moraine::Texture_IVulkan::Texture_IVulkan(GraphicsContext context, Stringr image
 
     
 
-    m_context->dispatchTask(m_context->m_transferQueue, [this, imageExtent, stagingBuffer](VkCommandBuffer buffer)
+    VkImage image = m_image;
+    VkBuffer stagingBuffer = stagingRing->getBuffer(staging);
+    VkDeviceSize stagingOffset = staging.offset;
+
+    // Images are exclusive to one queue family, so a dedicated transfer family releases the image to the graphics family after the copy
+    uint32_t transferFamily = m_context->m_transferQueue.queueFamilyIndex;
+    uint32_t graphicsFamily = m_context->m_graphicsQueue.queueFamilyIndex;
+    bool ownershipTransfer = transferFamily != graphicsFamily;
+
+    // Recorded on the transfer queue, the graphics queue waits for the upload semaphore before sampling the image
+    m_uploadTicket = stagingRing->uploadTask([image, imageExtent, stagingBuffer, stagingOffset, ownershipTransfer, transferFamily, graphicsFamily](VkCommandBuffer buffer)
     {
         VkImageMemoryBarrier barrier;
         barrier.sType                               = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
@@ -54,7 +63,7 @@ moraine::Texture_IVulkan::Texture_IVulkan(GraphicsContext context, Stringr image
         barrier.newLayout                           = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
         barrier.srcQueueFamilyIndex                 = VK_QUEUE_FAMILY_IGNORED;
         barrier.dstQueueFamilyIndex                 = VK_QUEUE_FAMILY_IGNORED;
-        barrier.image                               = m_image;
+        barrier.image                               = image;
         barrier.subresourceRange.aspectMask         = VK_IMAGE_ASPECT_COLOR_BIT;
         barrier.subresourceRange.baseMipLevel       = 0;
         barrier.subresourceRange.levelCount         = 1;
@@ -70,7 +79,7 @@ moraine::Texture_IVulkan::Texture_IVulkan(GraphicsContext context, Stringr image
                              1, &barrier);
 
         VkBufferImageCopy copy;
-        copy.bufferOffset                           = 0;
+        copy.bufferOffset                           = stagingOffset;
         copy.bufferRowLength                        = 0; // tight packed data
         copy.bufferImageHeight                      = 0;
         copy.imageSubresource.aspectMask            = VK_IMAGE_ASPECT_COLOR_BIT;
@@ -81,35 +90,71 @@ moraine::Texture_IVulkan::Texture_IVulkan(GraphicsContext context, Stringr image
         copy.imageExtent                            = imageExtent;
 
         vkCmdCopyBufferToImage(buffer,
-                               stagingBuffer, m_image,
+                               stagingBuffer, image,
                                VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
                                1, &copy);
 
         barrier.srcAccessMask                       = VK_ACCESS_TRANSFER_WRITE_BIT;
-        barrier.dstAccessMask                       = VK_ACCESS_SHADER_READ_BIT;
+        barrier.dstAccessMask                       = 0;
         barrier.oldLayout                           = barrier.newLayout;
         barrier.newLayout                           = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
 
+        if (ownershipTransfer) // Release, the layout transition happens once for both halves
+        {
+            barrier.srcQueueFamilyIndex             = transferFamily;
+            barrier.dstQueueFamilyIndex             = graphicsFamily;
+        }
+
         vkCmdPipelineBarrier(buffer,
                              VK_PIPELINE_STAGE_TRANSFER_BIT,
-                             VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+                             VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
                              0,
                              0, nullptr,
                              0, nullptr,
                              1, &barrier);
     });
 
-    vmaDestroyBuffer(m_context->m_allocator, stagingBuffer, stagingAllocation);
-
-    
+    // Acquire, recorded in front of the frame that waits for the upload semaphore of this batch
+    if (ownershipTransfer)
+        stagingRing->graphicsTask([image, transferFamily, graphicsFamily](VkCommandBuffer buffer)
+        {
+            VkImageMemoryBarrier barrier;
+            barrier.sType                           = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+            barrier.pNext                           = nullptr;
+            barrier.srcAccessMask                   = 0;
+            barrier.dstAccessMask                   = VK_ACCESS_SHADER_READ_BIT;
+            barrier.oldLayout                       = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+            barrier.newLayout                       = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+            barrier.srcQueueFamilyIndex             = transferFamily;
+            barrier.dstQueueFamilyIndex             = graphicsFamily;
+            barrier.image                           = image;
+            barrier.subresourceRange.aspectMask     = VK_IMAGE_ASPECT_COLOR_BIT;
+            barrier.subresourceRange.baseMipLevel   = 0;
+            barrier.subresourceRange.levelCount     = 1;
+            barrier.subresourceRange.baseArrayLayer = 0;
+            barrier.subresourceRange.layerCount     = 1;
+
+            vkCmdPipelineBarrier(buffer,
+                                 VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                                 VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+                                 0,
+                                 0, nullptr,
+                                 0, nullptr,
+                                 1, &barrier);
+        });
 
     constructVulkanSampler();
+
+    if (m_context->m_bindlessTable)
+        m_bindlessIndex = m_context->m_bindlessTable->addTexture(m_imageView, m_sampler);
 }
 
 moraine::Texture_IVulkan::Texture_IVulkan(GraphicsContext context, ImageColorChannels channels, uint32_t width, uint32_t height, uint32_t textureFlags) :
     Texture_T(width, height),
     m_context(std::static_pointer_cast<GraphicsContext_IVulkan>(context)),
-    m_textureFlags(textureFlags)
+    m_textureFlags(textureFlags),
+    m_uploadTicket(0),
+    m_bindlessIndex(UINT32_MAX)
 {
     VkFormat format = VK_FORMAT_R8G8B8A8_UNORM;
 
@@ -126,18 +171,21 @@ moraine::Texture_IVulkan::Texture_IVulkan(GraphicsContext context, ImageColorCha
                                  VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
                                  &m_image, &m_allocation, &m_imageView);
 
-    m_context->dispatchTask(m_context->m_transferQueue, [this](VkCommandBuffer buffer)
+    VkImage image = m_image;
+
+    // Nothing is uploaded, so the layout is transitioned on the graphics queue that owns the image
+    std::static_pointer_cast<StagingRing_IVulkan>(m_context->m_stagingRing)->graphicsTask([image](VkCommandBuffer buffer)
     {
         VkImageMemoryBarrier barrier;
         barrier.sType                               = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
         barrier.pNext                               = nullptr;
         barrier.srcAccessMask                       = 0;
-        barrier.dstAccessMask                       = VK_ACCESS_SHADER_READ_BIT;
+        barrier.dstAccessMask                       = 0;
         barrier.oldLayout                           = VK_IMAGE_LAYOUT_UNDEFINED;
         barrier.newLayout                           = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
         barrier.srcQueueFamilyIndex                 = VK_QUEUE_FAMILY_IGNORED;
         barrier.dstQueueFamilyIndex                 = VK_QUEUE_FAMILY_IGNORED;
-        barrier.image                               = m_image;
+        barrier.image                               = image;
         barrier.subresourceRange.aspectMask         = VK_IMAGE_ASPECT_COLOR_BIT;
         barrier.subresourceRange.baseMipLevel       = 0;
         barrier.subresourceRange.levelCount         = 1;
@@ -146,7 +194,7 @@ moraine::Texture_IVulkan::Texture_IVulkan(GraphicsContext context, ImageColorCha
 
         vkCmdPipelineBarrier(buffer,
                              VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
-                             VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+                             VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
                              0,
                              0, nullptr,
                              0, nullptr,
@@ -154,13 +202,33 @@ moraine::Texture_IVulkan::Texture_IVulkan(GraphicsContext context, ImageColorCha
     });
 
     constructVulkanSampler();
+
+    if (m_context->m_bindlessTable)
+        m_bindlessIndex = m_context->m_bindlessTable->addTexture(m_imageView, m_sampler);
 }
 
 moraine::Texture_IVulkan::~Texture_IVulkan()
 {
-    vkDestroySampler(m_context->m_device, m_sampler, nullptr);
-    vkDestroyImageView(m_context->m_device, m_imageView, nullptr);
-    vmaDestroyImage(m_context->m_allocator, m_image, m_allocation);
+    if (m_bindlessIndex != UINT32_MAX)
+        m_context->m_bindlessTable->removeTexture(m_bindlessIndex);
+
+    // Pending uploads and graphics tasks record commands with the image when the next frames are ticked,
+    // so it is destroyed once every frame was ticked and the uploads have completed
+    GraphicsContext_IVulkan* context = m_context.get(); // The context runs remaining tasks before it is destroyed
+    UploadTicket uploadTicket = m_uploadTicket;
+    VkSampler sampler = m_sampler;
+    VkImageView imageView = m_imageView;
+    VkImage image = m_image;
+    VmaAllocation allocation = m_allocation;
+
+    m_context->addAsyncTask(nullptr, [context, uploadTicket, sampler, imageView, image, allocation]()
+    {
+        std::static_pointer_cast<StagingRing_IVulkan>(context->m_stagingRing)->waitForUpload(uploadTicket);
+
+        vkDestroySampler(context->m_device, sampler, nullptr);
+        vkDestroyImageView(context->m_device, imageView, nullptr);
+        vmaDestroyImage(context->m_allocator, image, allocation);
+    });
 }
 
 void moraine::Texture_IVulkan::resize(uint32_t width, uint32_t height)
@@ -176,7 +244,10 @@ void moraine::Texture_IVulkan::resize(uint32_t width, uint32_t height)
     uint32_t copyWidth = min(m_width, width);
     uint32_t copyHeight = min(m_height, height);
 
-    m_context->dispatchTask(m_context->m_transferQueue, [this, newImage, copyWidth, copyHeight](VkCommandBuffer buffer)
+    VkImage oldImage = m_image;
+
+    // The old image may be sampled by frames in flight, so the copy is ordered with them on the graphics queue
+    std::static_pointer_cast<StagingRing_IVulkan>(m_context->m_stagingRing)->graphicsTask([oldImage, newImage, copyWidth, copyHeight](VkCommandBuffer buffer)
     {
         VkImageMemoryBarrier barrier;
         barrier.sType                               = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
@@ -187,7 +258,7 @@ void moraine::Texture_IVulkan::resize(uint32_t width, uint32_t height)
         barrier.newLayout                           = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
         barrier.srcQueueFamilyIndex                 = VK_QUEUE_FAMILY_IGNORED;
         barrier.dstQueueFamilyIndex                 = VK_QUEUE_FAMILY_IGNORED;
-        barrier.image                               = m_image;
+        barrier.image                               = oldImage;
         barrier.subresourceRange.aspectMask         = VK_IMAGE_ASPECT_COLOR_BIT;
         barrier.subresourceRange.baseMipLevel       = 0;
         barrier.subresourceRange.levelCount         = 1;
@@ -233,11 +304,11 @@ void moraine::Texture_IVulkan::resize(uint32_t width, uint32_t height)
 
         // Copy image
         vkCmdCopyImage(buffer,
-                       m_image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                       oldImage, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
                        newImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
                        1, &copy);
 
-        barrier.image                               = m_image;
+        barrier.image                               = oldImage;
         barrier.srcAccessMask                       = VK_ACCESS_TRANSFER_READ_BIT;
         barrier.dstAccessMask                       = VK_ACCESS_SHADER_READ_BIT;
         barrier.oldLayout                           = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
@@ -279,7 +350,10 @@ void moraine::Texture_IVulkan::resize(uint32_t width, uint32_t height)
         [this](uint32_t frameIndex)
         {
         for (auto& a : m_constantSetBindings)
-            a.first->updateDescriptorSet(std::make_pair(this, a.second), frameIndex);
+            a.first->updateDescriptorSets(frameIndex);
+
+        if (m_bindlessIndex != UINT32_MAX)
+            m_context->m_bindlessTable->updateTexture(m_bindlessIndex, m_imageView, m_sampler, frameIndex);
         },
         [this, newImage, newImageView, newImageAllocation]()
         {
@@ -290,13 +364,26 @@ void moraine::Texture_IVulkan::resize(uint32_t width, uint32_t height)
 
 void moraine::Texture_IVulkan::copyBufferRegionsToTexture(std::vector<CopySubImage>& regions, std::function<void()> operationOnComplete)
 {
-    std::vector<VkBufferImageCopy> vulkanRegions(regions.size());
+    auto stagingRing = std::static_pointer_cast<StagingRing_IVulkan>(m_context->m_stagingRing);
 
-    for(size_t i = 0; i < regions.size(); ++i)
-        vulkanRegions[i] =
+    // Regions may live in different staging blocks, one vkCmdCopyBufferToImage() is recorded per block
+    std::vector<std::pair<VkBuffer, std::vector<VkBufferImageCopy>>> vulkanRegions;
+
+    for (size_t i = 0; i < regions.size(); ++i)
+    {
+        VkBuffer stagingBuffer = stagingRing->getBuffer(regions[i].stagingAllocation);
+
+        auto it = std::find_if(vulkanRegions.begin(), vulkanRegions.end(), [stagingBuffer](const auto& a) { return a.first == stagingBuffer; });
+
+        if (it == vulkanRegions.end())
+        {
+            vulkanRegions.push_back({ stagingBuffer, { } });
+            it = vulkanRegions.end() - 1;
+        }
+
+        it->second.push_back(
         {
-            static_cast<VkDeviceSize>(static_cast<uint8_t*>(regions[i].stagingStackLocation) - 
-                static_cast<uint8_t*>(std::static_pointer_cast<StagingStack_IVulkan>(m_context->m_stagingStack)->getStart())),  // bufferOffset
+            static_cast<VkDeviceSize>(regions[i].stagingAllocation.offset),                                                     // bufferOffset
             0,                                                                                                                  // bufferRowLength
             0,                                                                                                                  // bufferImageHeight
             {                                                                                                                   // imageSubresource
@@ -307,16 +394,19 @@ void moraine::Texture_IVulkan::copyBufferRegionsToTexture(std::vector<CopySubIma
             },
             { static_cast<int32_t>(regions[i].imageLocation.x), static_cast<int32_t>(regions[i].imageLocation.y), 0 },          // imageOffset
             { regions[i].imageLocation.width, regions[i].imageLocation.height, 1 },                                             // imageExtent
-        };
+        });
+    }
+
+    VkImage image = m_image;
 
-    m_context->dispatchTask(m_context->m_transferQueue, [vulkanRegions, this] (VkCommandBuffer buffer)
+    stagingRing->graphicsTask([vulkanRegions, image] (VkCommandBuffer buffer)
     {
         VkImageMemoryBarrier barrier;
         barrier.sType                                        = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
         barrier.pNext                                        = nullptr;
         barrier.srcQueueFamilyIndex                          = VK_QUEUE_FAMILY_IGNORED;
         barrier.dstQueueFamilyIndex                          = VK_QUEUE_FAMILY_IGNORED;
-        barrier.image                                        = m_image;
+        barrier.image                                        = image;
         barrier.subresourceRange.aspectMask                  = VK_IMAGE_ASPECT_COLOR_BIT;
         barrier.subresourceRange.baseMipLevel                = 0;
         barrier.subresourceRange.levelCount                  = 1;
@@ -335,7 +425,8 @@ void moraine::Texture_IVulkan::copyBufferRegionsToTexture(std::vector<CopySubIma
                              0, nullptr,
                              1, &barrier);
 
-        vkCmdCopyBufferToImage(buffer, std::static_pointer_cast<StagingStack_IVulkan>(m_context->m_stagingStack)->getBuffer(), m_image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, static_cast<uint32_t>(vulkanRegions.size()), vulkanRegions.data());
+        for (const auto& a : vulkanRegions)
+            vkCmdCopyBufferToImage(buffer, a.first, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, static_cast<uint32_t>(a.second.size()), a.second.data());
 
         barrier.srcAccessMask                                = VK_ACCESS_TRANSFER_WRITE_BIT;
         barrier.dstAccessMask                                = VK_ACCESS_SHADER_READ_BIT;
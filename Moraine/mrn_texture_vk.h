@@ -18,6 +18,9 @@ namespace moraine
         void resize(uint32_t width, uint32_t height) override;
         void copyBufferRegionsToTexture(std::vector<CopySubImage>& regions, std::function<void()> operationOnComplete) override;
 
+        UploadTicket getUploadTicket() const override { return m_uploadTicket; }
+        uint32_t getBindlessIndex() const override { return m_bindlessIndex; }
+
     protected:
 
         std::shared_ptr<GraphicsContext_IVulkan> m_context;
@@ -30,6 +33,8 @@ namespace moraine
         VkSampler       m_sampler;
         VkFormat        m_format;
         uint32_t        m_textureFlags;
+        UploadTicket    m_uploadTicket;
+        uint32_t        m_bindlessIndex;
 
         std::vector<std::pair<ConstantSet_IVulkan*, uint32_t>> m_constantSetBindings;
     };
@@ -50,14 +50,14 @@ namespace moraine
         float2 operator*(const float2& vec)                 { return _mm_mul_ps(m_sse, vec.m_sse); }
         float2 operator*(float value)                       { return _mm_mul_ps(m_sse, _mm_set_ps1(value)); }
         float2 operator/(const float2& vec)                 { return _mm_div_ps(m_sse, vec.m_sse); }
-        float2 operator/(float value)                       { return _mm_mul_ps(m_sse, _mm_set_ps(1.0f, 1.0f, value, value)); }
+        float2 operator/(float value)                       { return _mm_div_ps(m_sse, _mm_set_ps(1.0f, 1.0f, value, value)); }
               
         float2& operator+=(const float2& vec)               { return *this = _mm_add_ps(m_sse, vec.m_sse); }
         float2& operator-=(const float2& vec)               { return *this = _mm_sub_ps(m_sse, vec.m_sse); }
         float2& operator*=(const float2& vec)               { return *this = _mm_mul_ps(m_sse, vec.m_sse); }
         float2& operator*=(float value)                     { return *this = _mm_mul_ps(m_sse, _mm_set_ps1(value)); }
         float2& operator/=(const float2& vec)               { return *this = _mm_div_ps(m_sse, vec.m_sse); }
-        float2& operator/=(float value)                     { return *this = _mm_mul_ps(m_sse, _mm_set_ps(1.0f, 1.0f, value, value)); }
+        float2& operator/=(float value)                     { return *this = _mm_div_ps(m_sse, _mm_set_ps(1.0f, 1.0f, value, value)); }
     };
 
     inline float2 operator*(float value, const float2& vec) { return _mm_mul_ps(_mm_set_ps1(value), vec.m_sse); }
@@ -86,14 +86,14 @@ namespace moraine
         float3 operator*(const float3& vec)                 { return _mm_mul_ps(m_sse, vec.m_sse); }
         float3 operator*(float value)                       { return _mm_mul_ps(m_sse, _mm_set_ps1(value)); }
         float3 operator/(const float3& vec)                 { return _mm_div_ps(m_sse, vec.m_sse); }
-        float3 operator/(float value)                       { return _mm_mul_ps(m_sse, _mm_set_ps(1.0f, value, value, value)); }
+        float3 operator/(float value)                       { return _mm_div_ps(m_sse, _mm_set_ps(1.0f, value, value, value)); }
               
         float3& operator+=(const float3& vec)               { return *this = _mm_add_ps(m_sse, vec.m_sse); }
         float3& operator-=(const float3& vec)               { return *this = _mm_sub_ps(m_sse, vec.m_sse); }
         float3& operator*=(const float3& vec)               { return *this = _mm_mul_ps(m_sse, vec.m_sse); }
         float3& operator*=(float value)                     { return *this = _mm_mul_ps(m_sse, _mm_set_ps1(value)); }
         float3& operator/=(const float3& vec)               { return *this = _mm_div_ps(m_sse, vec.m_sse); }
-        float3& operator/=(float value)                     { return *this = _mm_mul_ps(m_sse, _mm_set_ps(1.0f, value, value, value)); }
+        float3& operator/=(float value)                     { return *this = _mm_div_ps(m_sse, _mm_set_ps(1.0f, value, value, value)); }
     };
 
     inline float3 operator*(float value, const float3& vec) { return _mm_mul_ps(_mm_set_ps1(value), vec.m_sse); }
@@ -136,14 +136,14 @@ namespace moraine
         float4 operator*(const float4& vec)                 { return _mm_mul_ps(m_sse, vec.m_sse); }
         float4 operator*(float value)                       { return _mm_mul_ps(m_sse, _mm_set_ps1(value)); }
         float4 operator/(const float4& vec)                 { return _mm_div_ps(m_sse, vec.m_sse); }
-        float4 operator/(float value)                       { return _mm_mul_ps(m_sse, _mm_set_ps1(value)); }
+        float4 operator/(float value)                       { return _mm_div_ps(m_sse, _mm_set_ps1(value)); }
               
         float4& operator+=(const float4& vec)               { return *this = _mm_add_ps(m_sse, vec.m_sse); }
         float4& operator-=(const float4& vec)               { return *this = _mm_sub_ps(m_sse, vec.m_sse); }
         float4& operator*=(const float4& vec)               { return *this = _mm_mul_ps(m_sse, vec.m_sse); }
         float4& operator*=(float value)                     { return *this = _mm_mul_ps(m_sse, _mm_set_ps1(value)); }
         float4& operator/=(const float4& vec)               { return *this = _mm_div_ps(m_sse, vec.m_sse); }
-        float4& operator/=(float value)                     { return *this = _mm_mul_ps(m_sse, _mm_set_ps1(value)); }
+        float4& operator/=(float value)                     { return *this = _mm_div_ps(m_sse, _mm_set_ps1(value)); }
     };
 
     inline float4 operator*(float value, const float4& vec) { return _mm_mul_ps(_mm_set_ps1(value), vec.m_sse); }